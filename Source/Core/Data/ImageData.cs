@@ -733,11 +733,15 @@ namespace CodeImp.DoomBuilder.Data
 			if (wantIndexed)
 			{
 				Bitmap indexedBitmap = CreateIndexedBitmap(uncorrectedbitmap, General.Map.Data.Palette);
-				indexedTexture = new Texture(General.Map.Graphics, indexedBitmap);
+				indexedTexture = new Texture(indexedBitmap.Width, indexedBitmap.Height, TextureFormat.Bgra8);
+				General.Map.Graphics.QueuePixels(indexedTexture, indexedBitmap);
 				indexedTexture.UserData = TEXTURE_INDEXED;
 			}
 
-			texture = new Texture(General.Map.Graphics, loadedbitmap);
+			// Uploaded over the next frames, so that loading many images doesn't stall rendering.
+			// Until then the renderer draws a placeholder for it.
+			texture = new Texture(loadedbitmap.Width, loadedbitmap.Height, TextureFormat.Bgra8);
+			General.Map.Graphics.QueuePixels(texture, loadedbitmap);
 
 			loadedbitmap.Dispose();
 			loadedbitmap = null;
@@ -39,6 +39,10 @@ namespace CodeImp.DoomBuilder.Rendering
         private int height;
         private int visiblewidth;
         private int visibleheight;
+        // Area drawn to since the last Clear, and area not yet uploaded to the texture
+        // (right and bottom are exclusive)
+        private int drawnleft, drawntop, drawnright, drawnbottom;
+        private int dirtyleft, dirtytop, dirtyright, dirtybottom;
         // GL
         public Texture Texture { get; private set; }
 
@@ -65,6 +69,13 @@ namespace CodeImp.DoomBuilder.Rendering
             this.height = height;
             this.visiblewidth = width;
             this.visibleheight = height;
+
+            // Nothing drawn yet, but the texture contents are undefined
+            ResetDrawn();
+            dirtyleft = 0;
+            dirtytop = 0;
+            dirtyright = width;
+            dirtybottom = height;
         }
 
         public void Dispose()
@@ -88,16 +99,67 @@ namespace CodeImp.DoomBuilder.Rendering
         // This clears all pixels black
         public void Clear()
         {
+            // Only the area drawn to since the last clear can have pixels that aren't black
+            if (drawnright <= drawnleft || drawnbottom <= drawntop) return;
+            MarkDirty(drawnleft, drawntop, drawnright, drawnbottom);
+
             // Clear memory
             fixed(PixelColor* pixel = pixels)
             {
-                uint* op = (uint*)pixel;
-                for (int i = 0; i < pixels.Length; i++)
+                for (int y = drawntop; y < drawnbottom; y++)
                 {
-                    *op = 0;
-                    op++;
+                    uint* op = (uint*)pixel + y * width + drawnleft;
+                    for (int x = drawnleft; x < drawnright; x++)
+                    {
+                        *op = 0;
+                        op++;
+                    }
                 }
             }
+
+            ResetDrawn();
+        }
+
+        private void ResetDrawn()
+        {
+            drawnleft = width;
+            drawntop = height;
+            drawnright = 0;
+            drawnbottom = 0;
+        }
+
+        // Adds a rectangle (right and bottom exclusive) to the drawn and dirty areas
+        private void MarkDrawn(int left, int top, int right, int bottom)
+        {
+            if (left < 0) left = 0;
+            if (top < 0) top = 0;
+            if (right > width) right = width;
+            if (bottom > height) bottom = height;
+            if (right <= left || bottom <= top) return;
+
+            if (left < drawnleft) drawnleft = left;
+            if (top < drawntop) drawntop = top;
+            if (right > drawnright) drawnright = right;
+            if (bottom > drawnbottom) drawnbottom = bottom;
+            MarkDirty(left, top, right, bottom);
+        }
+
+        private void MarkDirty(int left, int top, int right, int bottom)
+        {
+            if (dirtyright <= dirtyleft || dirtybottom <= dirtytop)
+            {
+                dirtyleft = left;
+                dirtytop = top;
+                dirtyright = right;
+                dirtybottom = bottom;
+            }
+            else
+            {
+                if (left < dirtyleft) dirtyleft = left;
+                if (top < dirtytop) dirtytop = top;
+                if (right > dirtyright) dirtyright = right;
+                if (bottom > dirtybottom) dirtybottom = bottom;
+            }
         }
 
         // This draws a pixel normally
@@ -107,7 +169,10 @@ namespace CodeImp.DoomBuilder.Rendering
 
             // Draw pixel when within range
             if ((x >= 0) && (x < visiblewidth) && (y >= 0) && (y < visibleheight))
+            {
                 pixels[y * width + x] = c;
+                MarkDrawn(x, y, x + 1, y + 1);
+            }
         }
 
         // This draws a pixel normally
@@ -123,6 +188,8 @@ namespace CodeImp.DoomBuilder.Rendering
             // Do unchecked?
             if ((x1 >= 0) && (x2 < visiblewidth) && (y1 >= 0) && (y2 < visibleheight))
             {
+                MarkDrawn(x1, y1, x2 + 1, y2 + 1);
+
                 // Filled square
                 for (int yp = y1; yp <= y2; yp++)
                     for (int xp = x1; xp <= x2; xp++)
@@ -191,6 +258,8 @@ namespace CodeImp.DoomBuilder.Rendering
 
             if ((y >= 0) && (y < height))
             {
+                MarkDrawn(x1 << 1, y, x2 << 1, y + 1);
+
                 // Draw all pixels on this line
                 for (int i = x1; i < x2; i++) pixels[ywidth + ((i << 1) | offset)] = c;
             }
@@ -209,6 +278,8 @@ namespace CodeImp.DoomBuilder.Rendering
 
             if ((x >= 0) && (x < width))
             {
+                MarkDrawn(x, y2 << 1, x + 1, y1 << 1);
+
                 // Draw all pixels on this line
                 for (int i = y2; i < y1; i++) pixels[((i << 1) | offset) * width + x] = c;
             }
@@ -224,6 +295,8 @@ namespace CodeImp.DoomBuilder.Rendering
                 // Draw only when within range
                 if ((x >= 0) && (x < visiblewidth) && (y >= 0) && (y < visibleheight))
                 {
+                    MarkDrawn(x, y, x + 1, y + 1);
+
                     // Get the target pixel
                     PixelColor* p = pixels + (y * width + x);
 
@@ -261,6 +334,8 @@ namespace CodeImp.DoomBuilder.Rendering
                ((y1 < 0) && (y2 < 0)) ||
                ((y1 > visibleheight) && (y2 > visibleheight))) return;
 
+            MarkDrawn(Math.Min(x1, x2), Math.Min(y1, y2), Math.Max(x1, x2) + 1, Math.Max(y1, y2) + 1);
+
             // Distance of the line
             int dx = x2 - x1;
             int dy = y2 - y1;
@@ -413,16 +488,29 @@ namespace CodeImp.DoomBuilder.Rendering
 
         public void DrawContents(RenderDevice graphics)
         {
+            // Only upload what changed since the last time
+            if (dirtyright <= dirtyleft || dirtybottom <= dirtytop) return;
+
             // set pixels of texture
             // convert from pixelcolor to uint
+            int rowsize = (dirtyright - dirtyleft) * sizeof(uint);
             fixed (PixelColor* pixels = this.pixels)
             {
-                uint* uintpixels = (uint*)pixels;
-                uint* targetpixels = (uint*)graphics.MapPBO(Texture);
-                for (int i = 0; i < this.pixels.Length; i++)
-                    *targetpixels++ = *uintpixels++;
-                graphics.UnmapPBO(Texture);
+                uint* uintpixels = (uint*)pixels + dirtytop * width + dirtyleft;
+                uint* targetpixels = (uint*)graphics.MapPBORegion(Texture, dirtyleft, dirtytop, dirtyright - dirtyleft, dirtybottom - dirtytop);
+                for (int y = dirtytop; y < dirtybottom; y++)
+                {
+                    Buffer.MemoryCopy(uintpixels, targetpixels, rowsize, rowsize);
+                    uintpixels += width;
+                    targetpixels += width;
+                }
+                graphics.UnmapPBORegion(Texture);
             }
+
+            dirtyleft = 0;
+            dirtytop = 0;
+            dirtyright = 0;
+            dirtybottom = 0;
         }
 
         #endregion
@@ -0,0 +1,362 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CodeImp.DoomBuilder.Rendering
+{
+    // Records state changes and draws so that RenderDevice.Execute can hand all of them to
+    // BuilderNative in one call instead of one call each. The layout must match RenderCommand
+    // in Backend.h.
+    public class RenderCommandList
+    {
+        public RenderCommandList()
+        {
+            Data = new byte[64 * 1024];
+        }
+
+        public void Clear()
+        {
+            Size = 0;
+        }
+
+        public void SetShader(ShaderName shader)
+        {
+            int pos = Begin(RenderCommand.SetShader, 4);
+            WriteInt(pos, (int)shader);
+        }
+
+        public void SetUniform(UniformName uniform, bool value)
+        {
+            SetUniform(uniform, value ? 1.0f : 0.0f);
+        }
+
+        public unsafe void SetUniform(UniformName uniform, float value)
+        {
+            WriteUniform(uniform, &value, 1, sizeof(float));
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector2f value)
+        {
+            float* data = stackalloc float[] { value.X, value.Y };
+            WriteUniform(uniform, data, 1, sizeof(float) * 2);
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector3f value)
+        {
+            float* data = stackalloc float[] { value.X, value.Y, value.Z };
+            WriteUniform(uniform, data, 1, sizeof(float) * 3);
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector4f value)
+        {
+            float* data = stackalloc float[] { value.X, value.Y, value.Z, value.W };
+            WriteUniform(uniform, data, 1, sizeof(float) * 4);
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Color4 value)
+        {
+            float* data = stackalloc float[] { value.Red, value.Green, value.Blue, value.Alpha };
+            WriteUniform(uniform, data, 1, sizeof(float) * 4);
+        }
+
+        public void SetUniform(UniformName uniform, Matrix matrix)
+        {
+            SetUniform(uniform, ref matrix);
+        }
+
+        public unsafe void SetUniform(UniformName uniform, ref Matrix matrix)
+        {
+            fixed (Matrix* data = &matrix)
+            {
+                WriteUniform(uniform, data, 1, sizeof(float) * 16);
+            }
+        }
+
+        public unsafe void SetUniform(UniformName uniform, int value)
+        {
+            WriteUniform(uniform, &value, 1, sizeof(int));
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector2i value)
+        {
+            int* data = stackalloc int[] { value.X, value.Y };
+            WriteUniform(uniform, data, 1, sizeof(int) * 2);
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector3i value)
+        {
+            int* data = stackalloc int[] { value.X, value.Y, value.Z };
+            WriteUniform(uniform, data, 1, sizeof(int) * 3);
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector4i value)
+        {
+            int* data = stackalloc int[] { value.X, value.Y, value.Z, value.W };
+            WriteUniform(uniform, data, 1, sizeof(int) * 4);
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector2f[] value)
+        {
+            int pos = BeginUniform(uniform, value.Length, sizeof(float) * 2 * value.Length);
+            fixed (byte* dest = Data)
+            {
+                float* d = (float*)(dest + pos);
+                for (int i = 0; i < value.Length; i++)
+                {
+                    *(d++) = value[i].X;
+                    *(d++) = value[i].Y;
+                }
+            }
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector3f[] value)
+        {
+            int pos = BeginUniform(uniform, value.Length, sizeof(float) * 3 * value.Length);
+            fixed (byte* dest = Data)
+            {
+                float* d = (float*)(dest + pos);
+                for (int i = 0; i < value.Length; i++)
+                {
+                    *(d++) = value[i].X;
+                    *(d++) = value[i].Y;
+                    *(d++) = value[i].Z;
+                }
+            }
+        }
+
+        public unsafe void SetUniform(UniformName uniform, Vector4f[] value)
+        {
+            int pos = BeginUniform(uniform, value.Length, sizeof(float) * 4 * value.Length);
+            fixed (byte* dest = Data)
+            {
+                float* d = (float*)(dest + pos);
+                for (int i = 0; i < value.Length; i++)
+                {
+                    *(d++) = value[i].X;
+                    *(d++) = value[i].Y;
+                    *(d++) = value[i].Z;
+                    *(d++) = value[i].W;
+                }
+            }
+        }
+
+        public void SetVertexBuffer(VertexBuffer buffer)
+        {
+            int pos = Begin(RenderCommand.SetVertexBuffer, 8);
+            WriteHandle(pos, buffer != null ? buffer.Handle : IntPtr.Zero);
+        }
+
+        public void SetIndexBuffer(IndexBuffer buffer)
+        {
+            int pos = Begin(RenderCommand.SetIndexBuffer, 8);
+            WriteHandle(pos, buffer != null ? buffer.Handle : IntPtr.Zero);
+        }
+
+        public void SetAlphaBlendEnable(bool value)
+        {
+            WriteValue(RenderCommand.SetAlphaBlendEnable, value ? 1 : 0);
+        }
+
+        public void SetAlphaTestEnable(bool value)
+        {
+            WriteValue(RenderCommand.SetAlphaTestEnable, value ? 1 : 0);
+        }
+
+        public void SetCullMode(Cull mode)
+        {
+            WriteValue(RenderCommand.SetCullMode, (int)mode);
+        }
+
+        public void SetBlendOperation(BlendOperation op)
+        {
+            WriteValue(RenderCommand.SetBlendOperation, (int)op);
+        }
+
+        public void SetSourceBlend(Blend blend)
+        {
+            WriteValue(RenderCommand.SetSourceBlend, (int)blend);
+        }
+
+        public void SetDestinationBlend(Blend blend)
+        {
+            WriteValue(RenderCommand.SetDestinationBlend, (int)blend);
+        }
+
+        public void SetFillMode(FillMode mode)
+        {
+            WriteValue(RenderCommand.SetFillMode, (int)mode);
+        }
+
+        public void SetMultisampleAntialias(bool value)
+        {
+            WriteValue(RenderCommand.SetMultisampleAntialias, value ? 1 : 0);
+        }
+
+        public void SetZEnable(bool value)
+        {
+            WriteValue(RenderCommand.SetZEnable, value ? 1 : 0);
+        }
+
+        public void SetZWriteEnable(bool value)
+        {
+            WriteValue(RenderCommand.SetZWriteEnable, value ? 1 : 0);
+        }
+
+        public void SetTexture(BaseTexture value, int unit = 0)
+        {
+            int pos = Begin(RenderCommand.SetTexture, 16);
+            WriteInt(pos, unit);
+            WriteHandle(pos + 8, value != null ? value.Handle : IntPtr.Zero);
+        }
+
+        public void SetSamplerFilter(TextureFilter filter, int unit = 0)
+        {
+            SetSamplerFilter(filter, filter, MipmapFilter.None, 0.0f, unit);
+        }
+
+        public unsafe void SetSamplerFilter(TextureFilter minfilter, TextureFilter magfilter, MipmapFilter mipfilter, float maxanisotropy, int unit = 0)
+        {
+            int pos = Begin(RenderCommand.SetSamplerFilter, 20);
+            WriteInt(pos, unit);
+            WriteInt(pos + 4, (int)minfilter);
+            WriteInt(pos + 8, (int)magfilter);
+            WriteInt(pos + 12, (int)mipfilter);
+            WriteInt(pos + 16, *(int*)&maxanisotropy);
+        }
+
+        public void SetSamplerState(TextureAddress address, int unit = 0)
+        {
+            int pos = Begin(RenderCommand.SetSamplerState, 8);
+            WriteInt(pos, unit);
+            WriteInt(pos + 4, (int)address);
+        }
+
+        public void DrawIndexed(PrimitiveType type, int startIndex, int primitiveCount)
+        {
+            int pos = Begin(RenderCommand.DrawIndexed, 12);
+            WriteInt(pos, (int)type);
+            WriteInt(pos + 4, startIndex);
+            WriteInt(pos + 8, primitiveCount);
+        }
+
+        public void Draw(PrimitiveType type, int startIndex, int primitiveCount)
+        {
+            int pos = Begin(RenderCommand.Draw, 12);
+            WriteInt(pos, (int)type);
+            WriteInt(pos + 4, startIndex);
+            WriteInt(pos + 8, primitiveCount);
+        }
+
+        public unsafe void Draw(PrimitiveType type, int startIndex, int primitiveCount, FlatVertex[] data)
+        {
+            int vertcount;
+            switch (type)
+            {
+                case PrimitiveType.LineList: vertcount = primitiveCount * 2; break;
+                case PrimitiveType.TriangleList: vertcount = primitiveCount * 3; break;
+                default: vertcount = primitiveCount + 2; break;
+            }
+
+            if (startIndex < 0 || startIndex + vertcount > data.Length)
+                throw new ArgumentOutOfRangeException("primitiveCount");
+
+            int pos = Begin(RenderCommand.DrawData, 8 + vertcount * FlatVertex.Stride);
+            WriteInt(pos, (int)type);
+            WriteInt(pos + 4, primitiveCount);
+            fixed (byte* dest = Data)
+            fixed (FlatVertex* src = data)
+            {
+                Buffer.MemoryCopy(src + startIndex, dest + pos + 8, Data.Length - pos - 8, vertcount * FlatVertex.Stride);
+            }
+        }
+
+        // Reserves room for a command and returns where its payload goes
+        int Begin(RenderCommand command, int payloadsize)
+        {
+            payloadsize = (payloadsize + 7) & ~7;
+
+            int end = Size + 8 + payloadsize;
+            if (end > Data.Length)
+            {
+                byte[] newdata = new byte[Math.Max(end, Data.Length * 2)];
+                Buffer.BlockCopy(Data, 0, newdata, 0, Size);
+                Data = newdata;
+            }
+
+            WriteInt(Size, (int)command);
+            WriteInt(Size + 4, payloadsize);
+
+            int pos = Size + 8;
+            Size = end;
+            return pos;
+        }
+
+        int BeginUniform(UniformName uniform, int count, int bytesize)
+        {
+            int pos = Begin(RenderCommand.SetUniform, 16 + bytesize);
+            WriteInt(pos, (int)uniform);
+            WriteInt(pos + 4, count);
+            WriteInt(pos + 8, bytesize);
+            return pos + 16;
+        }
+
+        unsafe void WriteUniform(UniformName uniform, void* values, int count, int bytesize)
+        {
+            int pos = BeginUniform(uniform, count, bytesize);
+            fixed (byte* dest = Data)
+            {
+                Buffer.MemoryCopy(values, dest + pos, bytesize, bytesize);
+            }
+        }
+
+        void WriteValue(RenderCommand command, int value)
+        {
+            int pos = Begin(command, 4);
+            WriteInt(pos, value);
+        }
+
+        unsafe void WriteInt(int pos, int value)
+        {
+            fixed (byte* dest = Data)
+            {
+                *(int*)(dest + pos) = value;
+            }
+        }
+
+        unsafe void WriteHandle(int pos, IntPtr handle)
+        {
+            fixed (byte* dest = Data)
+            {
+                *(long*)(dest + pos) = handle.ToInt64();
+            }
+        }
+
+        internal byte[] Data { get; private set; }
+        internal int Size { get; private set; }
+
+        enum RenderCommand : int
+        {
+            SetShader,
+            SetUniform,
+            SetVertexBuffer,
+            SetIndexBuffer,
+            SetAlphaBlendEnable,
+            SetAlphaTestEnable,
+            SetCullMode,
+            SetBlendOperation,
+            SetSourceBlend,
+            SetDestinationBlend,
+            SetFillMode,
+            SetMultisampleAntialias,
+            SetZEnable,
+            SetZWriteEnable,
+            SetTexture,
+            SetSamplerFilter,
+            SetSamplerState,
+            Draw,
+            DrawIndexed,
+            DrawData
+        }
+    }
+}
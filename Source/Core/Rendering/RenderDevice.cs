@@ -41,11 +41,21 @@ namespace CodeImp.DoomBuilder.Rendering
 
     public class RenderDevice : IDisposable
     {
-		public RenderDevice(RenderTargetControl rendertarget)
+		public RenderDevice(RenderTargetControl rendertarget) : this(rendertarget, 0, 0)
+		{
+		}
+
+        // Device without a window, for batch and thumbnail rendering. It draws into an offscreen
+        // target of the given size when StartRendering has no target, use ReadPixels to get the image.
+        public RenderDevice(int width, int height) : this(null, width, height)
+        {
+        }
+
+        RenderDevice(RenderTargetControl rendertarget, int width, int height)
 		{
             RenderTarget = rendertarget;
 
-            CreateDevice();
+            CreateDevice(width, height);
 
             DeclareUniform(UniformName.rendersettings, "rendersettings", UniformType.Vec4f);
             DeclareUniform(UniformName.projection, "projection", UniformType.Mat4);
@@ -123,8 +133,20 @@ namespace CodeImp.DoomBuilder.Rendering
             Dispose();
         }
 
-        void CreateDevice()
+        void CreateDevice(int width, int height)
         {
+            if (RenderTarget == null)
+            {
+                Handle = RenderDevice_NewHeadless(width, height, General.DebugRenderDevice);
+                if (Handle == IntPtr.Zero)
+                {
+                    StringBuilder sb = new StringBuilder(4096);
+                    BuilderNative_GetError(sb, sb.Capacity);
+                    throw new RenderDeviceException(string.Format("Could not create headless render device: {0}", sb));
+                }
+                return;
+            }
+
             // Grab the X11 Display handle by abusing reflection to access internal classes in the mono implementation.
             // That's par for the course for everything in Linux, so yeah..
             IntPtr display = IntPtr.Zero;
@@ -218,32 +240,36 @@ namespace CodeImp.DoomBuilder.Rendering
 
         public void SetUniform(UniformName uniform, bool value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new float[] { value ? 1.0f : 0.0f }, 1, sizeof(float));
+            SetUniform(uniform, value ? 1.0f : 0.0f);
         }
 
-        public void SetUniform(UniformName uniform, float value)
+        public unsafe void SetUniform(UniformName uniform, float value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new float[] { value }, 1, sizeof(float));
+            RenderDevice_SetUniform(Handle, uniform, &value, 1, sizeof(float));
         }
 
-        public void SetUniform(UniformName uniform, Vector2f value)
+        public unsafe void SetUniform(UniformName uniform, Vector2f value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new float[] { value.X, value.Y }, 1, sizeof(float) * 2);
+            float* data = stackalloc float[] { value.X, value.Y };
+            RenderDevice_SetUniform(Handle, uniform, data, 1, sizeof(float) * 2);
         }
 
-        public void SetUniform(UniformName uniform, Vector3f value)
+        public unsafe void SetUniform(UniformName uniform, Vector3f value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new float[] { value.X, value.Y, value.Z }, 1, sizeof(float) * 3);
+            float* data = stackalloc float[] { value.X, value.Y, value.Z };
+            RenderDevice_SetUniform(Handle, uniform, data, 1, sizeof(float) * 3);
         }
 
-        public void SetUniform(UniformName uniform, Vector4f value)
+        public unsafe void SetUniform(UniformName uniform, Vector4f value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new float[] { value.X, value.Y, value.Z, value.W }, 1, sizeof(float) * 4);
+            float* data = stackalloc float[] { value.X, value.Y, value.Z, value.W };
+            RenderDevice_SetUniform(Handle, uniform, data, 1, sizeof(float) * 4);
         }
 
-        public void SetUniform(UniformName uniform, Color4 value)
+        public unsafe void SetUniform(UniformName uniform, Color4 value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new float[] { value.Red, value.Green, value.Blue, value.Alpha }, 1, sizeof(float) * 4);
+            float* data = stackalloc float[] { value.Red, value.Green, value.Blue, value.Alpha };
+            RenderDevice_SetUniform(Handle, uniform, data, 1, sizeof(float) * 4);
         }
 
         public void SetUniform(UniformName uniform, Matrix matrix)
@@ -256,24 +282,27 @@ namespace CodeImp.DoomBuilder.Rendering
             RenderDevice_SetUniform(Handle, uniform, ref matrix, 1, sizeof(float) * 16);
         }
 
-        public void SetUniform(UniformName uniform, int value)
+        public unsafe void SetUniform(UniformName uniform, int value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new int[] { value }, 1, sizeof(int));
+            RenderDevice_SetUniform(Handle, uniform, &value, 1, sizeof(int));
         }
 
-        public void SetUniform(UniformName uniform, Vector2i value)
+        public unsafe void SetUniform(UniformName uniform, Vector2i value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new int[] { value.X, value.Y }, 1, sizeof(int) * 2);
+            int* data = stackalloc int[] { value.X, value.Y };
+            RenderDevice_SetUniform(Handle, uniform, data, 1, sizeof(int) * 2);
         }
 
-        public void SetUniform(UniformName uniform, Vector3i value)
+        public unsafe void SetUniform(UniformName uniform, Vector3i value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new int[] { value.X, value.Y, value.Z }, 1, sizeof(int) * 3);
+            int* data = stackalloc int[] { value.X, value.Y, value.Z };
+            RenderDevice_SetUniform(Handle, uniform, data, 1, sizeof(int) * 3);
         }
 
-        public void SetUniform(UniformName uniform, Vector4i value)
+        public unsafe void SetUniform(UniformName uniform, Vector4i value)
         {
-            RenderDevice_SetUniform(Handle, uniform, new int[] { value.X, value.Y, value.Z, value.W }, 1, sizeof(int) * 4);
+            int* data = stackalloc int[] { value.X, value.Y, value.Z, value.W };
+            RenderDevice_SetUniform(Handle, uniform, data, 1, sizeof(int) * 4);
         }
 
         public void SetUniform(UniformName uniform, Vector2f[] value)
@@ -413,6 +442,19 @@ namespace CodeImp.DoomBuilder.Rendering
             ThrowIfFailed(RenderDevice_DrawData(Handle, type, startIndex, primitiveCount, data));
         }
 
+        // Draws several ranges of the current vertex buffer with the same state in one call
+        public void MultiDraw(PrimitiveType type, DrawRange[] ranges, int count)
+        {
+            if (count > 0)
+                ThrowIfFailed(RenderDevice_MultiDraw(Handle, type, ranges, count));
+        }
+
+        public void Execute(RenderCommandList commands)
+        {
+            if (commands.Size > 0)
+                ThrowIfFailed(RenderDevice_ExecuteCommands(Handle, commands.Data, commands.Size));
+        }
+
         public void StartRendering(bool clear, Color4 backcolor)
         {
             ThrowIfFailed(RenderDevice_StartRendering(Handle, clear, backcolor.ToArgb(), IntPtr.Zero, true));
@@ -443,6 +485,32 @@ namespace CodeImp.DoomBuilder.Rendering
             ThrowIfFailed(RenderDevice_CopyTexture(Handle, dst.Handle, face));
         }
 
+        // Copies a rectangle of the render target into a new bitmap. A null source reads the window,
+        // or the offscreen target of a headless device.
+        public System.Drawing.Bitmap ReadPixels(Texture source, int x, int y, int width, int height)
+        {
+            System.Drawing.Bitmap bitmap = new System.Drawing.Bitmap(width, height, System.Drawing.Imaging.PixelFormat.Format32bppArgb);
+            System.Drawing.Imaging.BitmapData bmpdata = bitmap.LockBits(
+                new System.Drawing.Rectangle(0, 0, width, height),
+                System.Drawing.Imaging.ImageLockMode.WriteOnly,
+                System.Drawing.Imaging.PixelFormat.Format32bppArgb);
+
+            bool result;
+            try
+            {
+                result = RenderDevice_ReadPixels(Handle, source != null ? source.Handle : IntPtr.Zero, x, y, width, height, bmpdata.Scan0);
+            }
+            finally
+            {
+                bitmap.UnlockBits(bmpdata);
+            }
+
+            if (!result)
+                bitmap.Dispose();
+            ThrowIfFailed(result);
+            return bitmap;
+        }
+
         public void SetBufferData(IndexBuffer buffer, int[] data)
         {
             ThrowIfFailed(RenderDevice_SetIndexBufferData(Handle, buffer.Handle, data, data.Length * Marshal.SizeOf<int>()));
@@ -514,6 +582,25 @@ namespace CodeImp.DoomBuilder.Rendering
             }
         }
 
+        // Like SetPixels, but the texture is only updated by one of the next Present calls, as
+        // part of a limited number of bytes per frame
+        public void QueuePixels(Texture texture, System.Drawing.Bitmap bitmap)
+        {
+            System.Drawing.Imaging.BitmapData bmpdata = bitmap.LockBits(
+                new System.Drawing.Rectangle(0, 0, bitmap.Size.Width, bitmap.Size.Height),
+                System.Drawing.Imaging.ImageLockMode.ReadOnly,
+                System.Drawing.Imaging.PixelFormat.Format32bppArgb);
+
+            try
+            {
+                ThrowIfFailed(RenderDevice_QueuePixels(Handle, texture.Handle, bmpdata.Scan0));
+            }
+            finally
+            {
+                bitmap.UnlockBits(bmpdata);
+            }
+        }
+
         public unsafe void SetPixels(Texture texture, uint* pixeldata)
         {
             ThrowIfFailed(RenderDevice_SetPixels(Handle, texture.Handle, new IntPtr(pixeldata)));
@@ -531,6 +618,55 @@ namespace CodeImp.DoomBuilder.Rendering
             ThrowIfFailed(RenderDevice_UnmapPBO(Handle, texture.Handle));
         }
 
+        // Maps only the given rectangle of the texture's pixel buffer. Rows are still texture.Width pixels apart.
+        public unsafe void* MapPBORegion(Texture texture, int x, int y, int width, int height)
+        {
+            void* ptr = RenderDevice_MapPBORegion(Handle, texture.Handle, x, y, width, height).ToPointer();
+            ThrowIfFailed(ptr != null);
+            return ptr;
+        }
+
+        public void UnmapPBORegion(Texture texture)
+        {
+            ThrowIfFailed(RenderDevice_UnmapPBORegion(Handle, texture.Handle));
+        }
+
+        public long GetCounter(RenderCounter counter)
+        {
+            return RenderDevice_GetCounter(Handle, counter);
+        }
+
+        // While enabled, every Present ends a frame and its scopes are timed on the CPU and the GPU
+        public void SetProfilerEnabled(bool enable)
+        {
+            RenderDevice_SetProfilerEnabled(Handle, enable);
+        }
+
+        public void BeginScope(string name)
+        {
+            RenderDevice_BeginScope(Handle, name);
+        }
+
+        public void EndScope()
+        {
+            RenderDevice_EndScope(Handle);
+        }
+
+        // Scopes of the latest frame whose GPU times are known, the whole frame first
+        public ProfileResult[] GetProfileResults()
+        {
+            ProfileResult[] results = new ProfileResult[256];
+            int count = RenderDevice_GetProfileResults(Handle, results, results.Length);
+            Array.Resize(ref results, count);
+            return results;
+        }
+
+        // Writes the recorded frames in the Chrome trace event format
+        public void SaveProfileTrace(string filename)
+        {
+            ThrowIfFailed(RenderDevice_SaveProfileTrace(Handle, filename));
+        }
+
         internal void RegisterResource(IRenderResource res)
         {
         }
@@ -573,6 +709,9 @@ namespace CodeImp.DoomBuilder.Rendering
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         static extern IntPtr RenderDevice_New(IntPtr display, IntPtr window, bool debug);
 
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern IntPtr RenderDevice_NewHeadless(int width, int height, bool debug);
+
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         static extern void RenderDevice_Delete(IntPtr handle);
 
@@ -597,6 +736,9 @@ namespace CodeImp.DoomBuilder.Rendering
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         static extern void RenderDevice_SetUniform(IntPtr handle, UniformName name, ref Matrix data, int count, int bytesize);
 
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern unsafe void RenderDevice_SetUniform(IntPtr handle, UniformName name, void* data, int count, int bytesize);
+
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         static extern void RenderDevice_SetVertexBuffer(IntPtr handle, IntPtr buffer);
 
@@ -651,6 +793,12 @@ namespace CodeImp.DoomBuilder.Rendering
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         static extern bool RenderDevice_DrawData(IntPtr handle, PrimitiveType type, int startIndex, int primitiveCount, FlatVertex[] data);
 
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern bool RenderDevice_MultiDraw(IntPtr handle, PrimitiveType type, DrawRange[] ranges, int count);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern bool RenderDevice_ExecuteCommands(IntPtr handle, byte[] commands, long size);
+
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         static extern bool RenderDevice_StartRendering(IntPtr handle, bool clear, int backcolor, IntPtr target, bool usedepthbuffer);
 
@@ -666,6 +814,9 @@ namespace CodeImp.DoomBuilder.Rendering
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         static extern bool RenderDevice_CopyTexture(IntPtr handle, IntPtr dst, CubeMapFace face);
 
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern bool RenderDevice_ReadPixels(IntPtr handle, IntPtr source, int x, int y, int width, int height, IntPtr data);
+
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         static extern bool RenderDevice_SetIndexBufferData(IntPtr handle, IntPtr buffer, int[] data, long size);
 
@@ -693,9 +844,36 @@ namespace CodeImp.DoomBuilder.Rendering
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         protected static extern bool RenderDevice_UnmapPBO(IntPtr handle, IntPtr texture);
 
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        protected static extern IntPtr RenderDevice_MapPBORegion(IntPtr handle, IntPtr texture, int x, int y, int width, int height);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        protected static extern bool RenderDevice_UnmapPBORegion(IntPtr handle, IntPtr texture);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern long RenderDevice_GetCounter(IntPtr handle, RenderCounter counter);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern void RenderDevice_SetProfilerEnabled(IntPtr handle, bool enable);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        static extern void RenderDevice_BeginScope(IntPtr handle, string name);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern void RenderDevice_EndScope(IntPtr handle);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        static extern int RenderDevice_GetProfileResults(IntPtr handle, [In, Out] ProfileResult[] results, int maxcount);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        static extern bool RenderDevice_SaveProfileTrace(IntPtr handle, string filename);
+
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         protected static extern bool RenderDevice_SetCubePixels(IntPtr handle, IntPtr texture, CubeMapFace face, IntPtr data);
 
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        protected static extern bool RenderDevice_QueuePixels(IntPtr handle, IntPtr texture, IntPtr data);
+
         //mxd. Anisotropic filtering steps
         public static readonly List<float> AF_STEPS = new List<float> { 1.0f, 2.0f, 4.0f, 8.0f, 16.0f };
 
@@ -807,6 +985,36 @@ namespace CodeImp.DoomBuilder.Rendering
         doomlightlevels
     }
 
+    [StructLayout(LayoutKind.Sequential)]
+    public struct DrawRange
+    {
+        public int StartIndex;
+        public int PrimitiveCount;
+
+        public DrawRange(int startIndex, int primitiveCount)
+        {
+            StartIndex = startIndex;
+            PrimitiveCount = primitiveCount;
+        }
+    }
+
+    // Times are in microseconds. GpuTime is -1 when the driver has no timer queries. Must match ProfileResult in Backend.h.
+    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi)]
+    public struct ProfileResult
+    {
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string Name;
+        public int Frame;
+        public int Depth;
+        public int DrawCalls;
+        public int StateChanges;
+        public long BytesUploaded;
+        public long CpuStart;
+        public long CpuTime;
+        public long GpuStart;
+        public long GpuTime;
+    }
+
     public enum VertexFormat : int { Flat, World }
     public enum Cull : int { None, Clockwise }
     public enum Blend : int { InverseSourceAlpha, SourceAlpha, One }
@@ -816,4 +1024,5 @@ namespace CodeImp.DoomBuilder.Rendering
     public enum PrimitiveType : int { LineList, TriangleList, TriangleStrip }
     public enum TextureFilter : int { Nearest, Linear }
     public enum MipmapFilter : int { None, Nearest, Linear}
+    public enum RenderCounter : int { VertexBufferSize, VertexBufferFree, VertexBufferFreeRanges, VertexBufferFragmentation, VertexBufferBytesMoved, VertexBufferCompactions, VertexBufferCompactionPending, TextureUploadQueueDepth, TextureUploadQueueBytes, TextureBytesUploaded, TextureBytesUploadedLastFrame, TextureRecycleBytes, TexturesReused, DrawCalls, StateChanges, BytesUploaded }
 }
@@ -300,6 +300,10 @@ namespace CodeImp.DoomBuilder.Rendering
 			graphics.FinishRendering();
 			graphics.Present();
 
+			// Textures uploaded by Present replace their placeholder in the next redraw
+			if (graphics.GetCounter(RenderCounter.TextureBytesUploadedLastFrame) > 0)
+				General.MainWindow.DelayedRedraw();
+
 			// Release binds
 			graphics.SetTexture(null);
 			graphics.SetVertexBuffer(null);
@@ -67,6 +67,9 @@ namespace CodeImp.DoomBuilder.Rendering
 		private VisualVertexHandle vertexhandle;
 		private int[] lightOffsets;
 		
+		// Recorded geometry pass, kept so its buffer is reused
+		private RenderCommandList commands = new RenderCommandList();
+		
 		private Data.ColorMap classicLightingColorMap = null;
 		private Texture classicLightingColorMapTex = null;
 		
@@ -457,20 +460,26 @@ namespace CodeImp.DoomBuilder.Rendering
 			{
 				world = Matrix.Identity;
                 graphics.SetUniform(UniformName.world, ref world);
+				graphics.BeginScope("Sky");
 				RenderSky(skygeo);
+				graphics.EndScope();
 			}
 
 			// SOLID PASS
 			world = Matrix.Identity;
             graphics.SetUniform(UniformName.world, ref world);
+            graphics.BeginScope("Solid");
             RenderSinglePass(solidgeo, solidthings, lightthings);
+            graphics.EndScope();
 
 			//mxd. Render models, without backface culling
 			if(maskedmodelthings.Count > 0)
 			{
 				graphics.SetAlphaTestEnable(true);
 				graphics.SetCullMode(Cull.None);
+				graphics.BeginScope("Models");
 				RenderModels(false, lightthings);
+				graphics.EndScope();
                 graphics.SetCullMode(Cull.Clockwise);
 			}
 
@@ -480,7 +489,9 @@ namespace CodeImp.DoomBuilder.Rendering
 				world = Matrix.Identity;
                 graphics.SetUniform(UniformName.world, ref world);
                 graphics.SetAlphaTestEnable(true);
+				graphics.BeginScope("Masked");
 				RenderSinglePass(maskedgeo, maskedthings, lightthings);
+				graphics.EndScope();
 			}
 
 			// ALPHA AND ADDITIVE PASS
@@ -492,7 +503,9 @@ namespace CodeImp.DoomBuilder.Rendering
 				graphics.SetAlphaTestEnable(false);
 				graphics.SetZWriteEnable(false);
 				graphics.SetSourceBlend(Blend.SourceAlpha);
+				graphics.BeginScope("Translucent");
 				RenderTranslucentPass(translucentgeo, translucentthings, lightthings);
+				graphics.EndScope();
 			}
 
 			//mxd. Render translucent models, with backface culling
@@ -502,7 +515,9 @@ namespace CodeImp.DoomBuilder.Rendering
 				graphics.SetAlphaTestEnable(false);
 				graphics.SetZWriteEnable(false);
 				graphics.SetSourceBlend(Blend.SourceAlpha);
+                graphics.BeginScope("Translucent models");
                 RenderModels(true, lightthings);
+                graphics.EndScope();
             }
 
             // THING CAGES
@@ -510,7 +525,9 @@ namespace CodeImp.DoomBuilder.Rendering
 			{
 				world = Matrix.Identity;
                 graphics.SetUniform(UniformName.world, ref world);
+                graphics.BeginScope("Thing cages");
                 RenderThingCages();
+                graphics.EndScope();
 			}
 
 			//mxd. Visual vertices
@@ -847,15 +864,17 @@ namespace CodeImp.DoomBuilder.Rendering
 	            graphics.SetSamplerState(TextureAddress.Clamp, 1);
             }
 
-            // Render the geometry collected
+            // Render the geometry collected. The state changes and draws are recorded and sent
+            // to the device in one go, as there are a lot of them per sector.
+            commands.Clear();
             foreach (KeyValuePair<ImageData, List<VisualGeometry>> group in geopass)
 			{
 				curtexture = group.Key;
 
         // Apply texture
         Texture texture = UseIndexedTexture ? curtexture.IndexedTexture : curtexture.Texture;
-        graphics.SetTexture(texture);
-        graphics.SetUniform(UniformName.drawPaletted, texture.UserData == ImageData.TEXTURE_INDEXED);
+        commands.SetTexture(texture);
+        commands.SetUniform(UniformName.drawPaletted, texture.UserData == ImageData.TEXTURE_INDEXED);
 
 				//mxd. Sort geometry by sector index
 				group.Value.Sort((g1, g2) => g1.Sector.Sector.FixedIndex - g2.Sector.Sector.FixedIndex);
@@ -902,12 +921,12 @@ namespace CodeImp.DoomBuilder.Rendering
 
                     if (havelights != hadlights || havelights)
                     {
-                        graphics.SetUniform(UniformName.lightColor, lightColor);
+                        commands.SetUniform(UniformName.lightColor, lightColor);
                         if (havelights)
                         {
-                            graphics.SetUniform(UniformName.lightPosAndRadius, lightPosAndRadius);
-                            graphics.SetUniform(UniformName.lightOrientation, lightOrientation);
-                            graphics.SetUniform(UniformName.light2Radius, light2Radius);
+                            commands.SetUniform(UniformName.lightPosAndRadius, lightPosAndRadius);
+                            commands.SetUniform(UniformName.lightOrientation, lightOrientation);
+                            commands.SetUniform(UniformName.light2Radius, light2Radius);
                         }
                     }
 
@@ -927,7 +946,7 @@ namespace CodeImp.DoomBuilder.Rendering
 							sector = g.Sector;
 
 							// Set stream source
-							graphics.SetVertexBuffer(sector.GeometryBuffer);
+							commands.SetVertexBuffer(sector.GeometryBuffer);
 						}
 						else
 						{
@@ -935,7 +954,7 @@ namespace CodeImp.DoomBuilder.Rendering
 						}
 					}
 
-                    graphics.SetUniform(UniformName.desaturation, 0.0f);
+                    commands.SetUniform(UniformName.desaturation, 0.0f);
                     if (sector != null) 
 					{
 						// Determine the shader pass we want to use for this object
@@ -948,38 +967,40 @@ namespace CodeImp.DoomBuilder.Rendering
 						// Switch shader pass?
 						if(currentshaderpass != wantedshaderpass)
 						{
-							graphics.SetShader(wantedshaderpass);
+							commands.SetShader(wantedshaderpass);
 							currentshaderpass = wantedshaderpass;
 
 							//mxd. Set variables for fog rendering?
 							if(wantedshaderpass > ShaderName.world3d_p7)
 							{
-                                graphics.SetUniform(UniformName.modelnormal, Matrix.Identity);
+                                commands.SetUniform(UniformName.modelnormal, Matrix.Identity);
                             }
 						}
 						
 						// volte: set sector light level for classic rendering mode
-						graphics.SetUniform(UniformName.sectorLightLevel, sector.Sector.Brightness);
+						commands.SetUniform(UniformName.sectorLightLevel, sector.Sector.Brightness);
 
 						//mxd. Set variables for fog rendering?
 						if(wantedshaderpass > ShaderName.world3d_p7)
 						{
-							graphics.SetUniform(UniformName.campos, new Vector4f((float)cameraposition.x, (float)cameraposition.y, (float)cameraposition.z, g.FogFactor));
-							graphics.SetUniform(UniformName.sectorfogcolor, sector.Sector.FogColor);
+							commands.SetUniform(UniformName.campos, new Vector4f((float)cameraposition.x, (float)cameraposition.y, (float)cameraposition.z, g.FogFactor));
+							commands.SetUniform(UniformName.sectorfogcolor, sector.Sector.FogColor);
 						}
                         
 						// Set the colors to use
-						graphics.SetUniform(UniformName.highlightcolor, CalculateHighlightColor((g == highlighted) && showhighlight, (g.Selected && showselection)));
+						commands.SetUniform(UniformName.highlightcolor, CalculateHighlightColor((g == highlighted) && showhighlight, (g.Selected && showselection)));
 
                         // [ZZ] include desaturation factor
-                        graphics.SetUniform(UniformName.desaturation, (float)sector.Sector.Desaturation);
+                        commands.SetUniform(UniformName.desaturation, (float)sector.Sector.Desaturation);
 
 						// Render!
-						graphics.Draw(PrimitiveType.TriangleList, g.VertexOffset, g.Triangles);
+						commands.Draw(PrimitiveType.TriangleList, g.VertexOffset, g.Triangles);
 					}
 				}
 			}
 
+            graphics.Execute(commands);
+
             graphics.SetUniform(UniformName.lightsEnabled, false);
 
             // Get things for this pass
@@ -1791,6 +1812,10 @@ namespace CodeImp.DoomBuilder.Rendering
 			graphics.FinishRendering();
 			graphics.Present();
 			highlighted = null;
+
+			// Textures uploaded by Present replace their placeholder in the next redraw
+			if (graphics.GetCounter(RenderCounter.TextureBytesUploadedLastFrame) > 0)
+				General.MainWindow.DelayedRedraw();
 		}
 		
 		#endregion
@@ -87,35 +87,59 @@ namespace CodeImp.DoomBuilder.Rendering.Shaders
             return ss;
         }
 
-        private string GetUniformSource()
+        private string GetUniformDeclaration(ShaderField field, bool inBlock)
         {
+            string output = string.Format("#line {0}\n", field.Line);
 
-            string output = "";
-            foreach (ShaderField field in Group.Uniforms)
+            if (!inBlock)
+                output += "uniform ";
+            output += field.TypeName;
+
+            if (field.ArrayDimensions != null)
             {
+                foreach (List<ZScriptToken> arrayDim in field.ArrayDimensions)
+                    output += "[" + GetTokenListSource(arrayDim) + "]";
+            }
 
-                output += string.Format("#line {0}\n", field.Line);
+            output += " " + field.Name;
 
-                output += "uniform ";
-                output += field.TypeName;
+            if (field.Initializer != null)
+                output += GetTokenListSource(field.Initializer);
 
-                if (field.ArrayDimensions != null)
-                {
-                    foreach (List<ZScriptToken> arrayDim in field.ArrayDimensions)
-                        output += "[" + GetTokenListSource(arrayDim) + "]";
-                }
+            output += ";\n";
+            return output;
+        }
 
-                output += " " + field.Name;
+        // samplers and initialized uniforms can't go in a uniform block
+        private static bool IsUniformBlockField(ShaderField field)
+        {
+            return field.Initializer == null && !field.TypeName.StartsWith("sampler");
+        }
 
-                if (field.Initializer != null)
-                    output += GetTokenListSource(field.Initializer);
+        private string GetUniformSource()
+        {
+            // The native side defines USE_UNIFORM_BLOCK when it can supply the uniforms as a std140 block
+            string blockFields = "";
+            string output = "";
+            foreach (ShaderField field in Group.Uniforms)
+            {
+                if (IsUniformBlockField(field))
+                    blockFields += GetUniformDeclaration(field, true);
+                else
+                    output += GetUniformDeclaration(field, false);
+            }
 
-                output += ";\n";
+            if (blockFields.Length == 0)
+                return output;
 
+            string looseFields = "";
+            foreach (ShaderField field in Group.Uniforms)
+            {
+                if (IsUniformBlockField(field))
+                    looseFields += GetUniformDeclaration(field, false);
             }
 
-            return output;
-
+            return "#ifdef USE_UNIFORM_BLOCK\nlayout(std140) uniform Uniforms\n{\n" + blockFields + "};\n#else\n" + looseFields + "#endif\n" + output;
         }
 
         private string GetDataIOInternalName(string block, string name)
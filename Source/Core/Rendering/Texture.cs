@@ -59,6 +59,9 @@ namespace CodeImp.DoomBuilder.Rendering
 
         [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
         protected static extern void Texture_SetCubeImage(IntPtr handle, int size, TextureFormat format);
+
+        [DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+        protected static extern bool Texture_IsUploadPending(IntPtr handle);
     }
 
     public class Texture : BaseTexture
@@ -96,6 +99,9 @@ namespace CodeImp.DoomBuilder.Rendering
         public int Height { get; private set; }
         public TextureFormat Format { get; private set; }
 
+        // True while the pixels given to RenderDevice.QueuePixels have not reached the texture yet
+        public bool UploadPending { get { return Texture_IsUploadPending(Handle); } }
+
         public object Tag { get; set; }
         public int UserData { get; set; }
     }
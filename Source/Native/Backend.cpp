@@ -71,6 +71,11 @@ extern "C"
 		return Backend::Get()->NewRenderDevice(disp, window, debug);
 	}
 
+	RenderDevice* RenderDevice_NewHeadless(int width, int height, bool debug)
+	{
+		return Backend::Get()->NewHeadlessRenderDevice(width, height, debug);
+	}
+
 	void RenderDevice_Delete(RenderDevice* device)
 	{
 		Backend::Get()->DeleteRenderDevice(device);
@@ -194,6 +199,16 @@ extern "C"
 		return device->DrawData(type, startIndex, primitiveCount, data);
 	}
 
+	bool RenderDevice_MultiDraw(RenderDevice* device, PrimitiveType type, const DrawRange* ranges, int count)
+	{
+		return device->MultiDraw(type, ranges, count);
+	}
+
+	bool RenderDevice_ExecuteCommands(RenderDevice* device, const void* commands, int64_t size)
+	{
+		return device->ExecuteCommands(commands, size);
+	}
+
 	bool RenderDevice_StartRendering(RenderDevice* device, bool clear, int backcolor, Texture* target, bool usedepthbuffer)
 	{
 		return device->StartRendering(clear, backcolor, target, usedepthbuffer);
@@ -219,6 +234,11 @@ extern "C"
 		return device->CopyTexture(dst, face);
 	}
 
+	bool RenderDevice_ReadPixels(RenderDevice* device, Texture* source, int x, int y, int width, int height, void* data)
+	{
+		return device->ReadPixels(source, x, y, width, height, data);
+	}
+
 	bool RenderDevice_SetVertexBufferData(RenderDevice* device, VertexBuffer* buffer, void* data, int64_t size, VertexFormat format)
 	{
 		return device->SetVertexBufferData(buffer, data, size, format);
@@ -244,6 +264,11 @@ extern "C"
 		return device->SetCubePixels(texture, face, data);
 	}
 
+	bool RenderDevice_QueuePixels(RenderDevice* device, Texture* texture, const void* data)
+	{
+		return device->QueuePixels(texture, data);
+	}
+
 	void* RenderDevice_MapPBO(RenderDevice* device, Texture* texture)
 	{
 		return device->MapPBO(texture);
@@ -254,6 +279,46 @@ extern "C"
 		return device->UnmapPBO(texture);
 	}
 
+	void* RenderDevice_MapPBORegion(RenderDevice* device, Texture* texture, int x, int y, int width, int height)
+	{
+		return device->MapPBORegion(texture, x, y, width, height);
+	}
+
+	bool RenderDevice_UnmapPBORegion(RenderDevice* device, Texture* texture)
+	{
+		return device->UnmapPBORegion(texture);
+	}
+
+	int64_t RenderDevice_GetCounter(RenderDevice* device, RenderCounter counter)
+	{
+		return device->GetCounter(counter);
+	}
+
+	void RenderDevice_SetProfilerEnabled(RenderDevice* device, bool enable)
+	{
+		device->SetProfilerEnabled(enable);
+	}
+
+	void RenderDevice_BeginScope(RenderDevice* device, const char* name)
+	{
+		device->BeginScope(name);
+	}
+
+	void RenderDevice_EndScope(RenderDevice* device)
+	{
+		device->EndScope();
+	}
+
+	int RenderDevice_GetProfileResults(RenderDevice* device, ProfileResult* results, int maxcount)
+	{
+		return device->GetProfileResults(results, maxcount);
+	}
+
+	bool RenderDevice_SaveProfileTrace(RenderDevice* device, const char* filename)
+	{
+		return device->SaveProfileTrace(filename);
+	}
+
 	////////////////////////////////////////////////////////////////////////////
 
 	IndexBuffer* IndexBuffer_New()
@@ -299,4 +364,9 @@ extern "C"
 	{
 		tex->SetCubeImage(size, format);
 	}
+
+	bool Texture_IsUploadPending(Texture* tex)
+	{
+		return tex->IsUploadPending();
+	}
 }
@@ -39,6 +39,44 @@ enum class TextureFilter : int { Nearest, Linear };
 enum class MipmapFilter : int { None, Nearest, Linear };
 enum class UniformType : int { Vec4f, Vec3f, Vec2f, Float, Mat4, Vec4i, Vec3i, Vec2i, Int, Vec4fArray, Vec3fArray, Vec2fArray };
 
+// Commands for RenderDevice::ExecuteCommands. Each record is an int32 command and an int32
+// payload size in bytes, followed by the payload padded to a multiple of 8 bytes. The payload
+// holds the arguments of the matching RenderDevice function as int32 values (floats for the
+// anisotropy) and object handles as 64 bit values on an 8 byte boundary:
+//
+// SetShader: name
+// SetUniform: name, count, bytesize, padding, data
+// SetVertexBuffer, SetIndexBuffer: handle
+// SetTexture: unit, padding, handle
+// SetSamplerFilter: unit, minfilter, magfilter, mipfilter, maxanisotropy
+// SetSamplerState: unit, address
+// Draw, DrawIndexed: type, startIndex, primitiveCount
+// DrawData: type, primitiveCount, flat vertices
+// All others: value
+enum class RenderCommand : int32_t
+{
+	SetShader,
+	SetUniform,
+	SetVertexBuffer,
+	SetIndexBuffer,
+	SetAlphaBlendEnable,
+	SetAlphaTestEnable,
+	SetCullMode,
+	SetBlendOperation,
+	SetSourceBlend,
+	SetDestinationBlend,
+	SetFillMode,
+	SetMultisampleAntialias,
+	SetZEnable,
+	SetZWriteEnable,
+	SetTexture,
+	SetSamplerFilter,
+	SetSamplerState,
+	Draw,
+	DrawIndexed,
+	DrawData
+};
+
 enum class PixelFormat : int
 {
 	Rgba8,
@@ -55,6 +93,51 @@ enum class PixelFormat : int
 	A2Rgb10_snorm
 };
 
+// One draw of RenderDevice::MultiDraw, with the same meaning as the arguments of Draw
+struct DrawRange
+{
+	int32_t StartIndex;
+	int32_t PrimitiveCount;
+};
+
+// Statistics for RenderDevice::GetCounter
+enum class RenderCounter : int
+{
+	VertexBufferSize,              // bytes in the shared vertex buffers
+	VertexBufferFree,              // bytes not used by any vertex buffer
+	VertexBufferFreeRanges,        // number of free ranges
+	VertexBufferFragmentation,     // percentage of free bytes outside the largest free range
+	VertexBufferBytesMoved,        // bytes copied by compaction since the device was created
+	VertexBufferCompactions,       // number of times the shared vertex buffers were compacted
+	VertexBufferCompactionPending, // bytes still waiting to be moved by an unfinished compaction
+	TextureUploadQueueDepth,       // textures waiting in the upload queue
+	TextureUploadQueueBytes,       // bytes waiting in the upload queue
+	TextureBytesUploaded,          // bytes uploaded from the queue since the device was created
+	TextureBytesUploadedLastFrame, // bytes uploaded from the queue by the last Present
+	TextureRecycleBytes,           // bytes in texture objects kept for reuse
+	TexturesReused,                // textures created from a recycled texture object
+	DrawCalls,                     // draw calls since the device was created
+	StateChanges,                  // state groups applied by draws since the device was created
+	BytesUploaded                  // bytes of buffer and texture data uploaded since the device was created
+};
+
+// One scope of a frame recorded by the profiler. Times are in microseconds, CpuStart since the
+// profiler was enabled and GpuStart since the start of the frame on the GPU. GpuTime is -1 when
+// the driver has no timer queries. The counters are the difference over the scope.
+struct ProfileResult
+{
+	char Name[32];
+	int32_t Frame;
+	int32_t Depth;
+	int32_t DrawCalls;
+	int32_t StateChanges;
+	int64_t BytesUploaded;
+	int64_t CpuStart;
+	int64_t CpuTime;
+	int64_t GpuStart;
+	int64_t GpuTime;
+};
+
 typedef int UniformName;
 typedef int ShaderName;
 
@@ -89,18 +172,30 @@ public:
 	virtual bool Draw(PrimitiveType type, int startIndex, int primitiveCount) = 0;
 	virtual bool DrawIndexed(PrimitiveType type, int startIndex, int primitiveCount) = 0;
 	virtual bool DrawData(PrimitiveType type, int startIndex, int primitiveCount, const void* data) = 0;
+	virtual bool MultiDraw(PrimitiveType type, const DrawRange* ranges, int count) = 0;
+	virtual bool ExecuteCommands(const void* commands, int64_t size) = 0;
 	virtual bool StartRendering(bool clear, int backcolor, Texture* target, bool usedepthbuffer) = 0;
 	virtual bool FinishRendering() = 0;
 	virtual bool Present() = 0;
 	virtual bool ClearTexture(int backcolor, Texture* texture) = 0;
 	virtual bool CopyTexture(Texture* dst, CubeMapFace face) = 0;
+	virtual bool ReadPixels(Texture* source, int x, int y, int width, int height, void* data) = 0; // BGRA, top row first, null source is the window
 	virtual bool SetVertexBufferData(VertexBuffer* buffer, void* data, int64_t size, VertexFormat format) = 0;
 	virtual bool SetVertexBufferSubdata(VertexBuffer* buffer, int64_t destOffset, void* data, int64_t size) = 0;
 	virtual bool SetIndexBufferData(IndexBuffer* buffer, void* data, int64_t size) = 0;
 	virtual bool SetPixels(Texture* texture, const void* data) = 0;
 	virtual bool SetCubePixels(Texture* texture, CubeMapFace face, const void* data) = 0;
+	virtual bool QueuePixels(Texture* texture, const void* data) = 0;
 	virtual void* MapPBO(Texture* texture) = 0;
 	virtual bool UnmapPBO(Texture* texture) = 0;
+	virtual void* MapPBORegion(Texture* texture, int x, int y, int width, int height) = 0; // rows are still the texture's width apart
+	virtual bool UnmapPBORegion(Texture* texture) = 0;
+	virtual int64_t GetCounter(RenderCounter counter) = 0;
+	virtual void SetProfilerEnabled(bool enable) = 0;
+	virtual void BeginScope(const char* name) = 0;
+	virtual void EndScope() = 0;
+	virtual int GetProfileResults(ProfileResult* results, int maxcount) = 0; // scopes of the latest finished frame
+	virtual bool SaveProfileTrace(const char* filename) = 0;
 };
 
 class VertexBuffer
@@ -124,6 +219,7 @@ public:
 	virtual ~Texture() = default;
 	virtual void Set2DImage(int width, int height, PixelFormat format) = 0;
 	virtual void SetCubeImage(int size, PixelFormat format) = 0;
+	virtual bool IsUploadPending() = 0;
 };
 
 class Backend
@@ -134,6 +230,7 @@ public:
 	static Backend* Get();
 
 	virtual RenderDevice* NewRenderDevice(void* disp, void* window, bool debug) = 0;
+	virtual RenderDevice* NewHeadlessRenderDevice(int width, int height, bool debug) = 0;
 	virtual void DeleteRenderDevice(RenderDevice* device) = 0;
 
 	virtual VertexBuffer* NewVertexBuffer() = 0;
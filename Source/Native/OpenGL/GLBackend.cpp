@@ -40,6 +40,20 @@ RenderDevice* GLBackend::NewRenderDevice(void* disp, void* window, bool debug)
 	}
 }
 
+RenderDevice* GLBackend::NewHeadlessRenderDevice(int width, int height, bool debug)
+{
+	GLRenderDevice* device = new GLRenderDevice(width, height, debug);
+	if (!device->Context)
+	{
+		delete device;
+		return nullptr;
+	}
+	else
+	{
+		return device;
+	}
+}
+
 void GLBackend::DeleteRenderDevice(RenderDevice* device)
 {
 	delete device;
@@ -27,6 +27,7 @@ class GLBackend : public Backend
 {
 public:
 	RenderDevice* NewRenderDevice(void* disp, void* window, bool debug) override;
+	RenderDevice* NewHeadlessRenderDevice(int width, int height, bool debug) override;
 	void DeleteRenderDevice(RenderDevice* device) override;
 
 	VertexBuffer* NewVertexBuffer() override;
@@ -0,0 +1,72 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "Precomp.h"
+#include "GLErrorQueue.h"
+#include <cstdio>
+
+GLErrorQueue::GLErrorQueue() : mEnqueuePos(0), mDropped(0)
+{
+	// An entry can be written when its sequence equals the enqueue position, and read when
+	// it is one past the dequeue position
+	for (uint32_t i = 0; i < Capacity; i++)
+		mEntries[i].Sequence.store(i, std::memory_order_relaxed);
+}
+
+void GLErrorQueue::Push(GLuint id, const char* message)
+{
+	uint32_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+	Entry* entry;
+	while (true)
+	{
+		entry = &mEntries[pos & (Capacity - 1)];
+		int32_t diff = (int32_t)(entry->Sequence.load(std::memory_order_acquire) - pos);
+		if (diff == 0)
+		{
+			if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			pos = mEnqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	snprintf(entry->Message, sizeof(entry->Message), "OpenGL error %u: %s", id, message ? message : "");
+	entry->Sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool GLErrorQueue::Pop(std::string& message)
+{
+	Entry* entry = &mEntries[mDequeuePos & (Capacity - 1)];
+	if (entry->Sequence.load(std::memory_order_acquire) != mDequeuePos + 1)
+		return false;
+
+	message = entry->Message;
+	entry->Sequence.store(mDequeuePos + Capacity, std::memory_order_release);
+	mDequeuePos++;
+	return true;
+}
@@ -0,0 +1,56 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// Holds the errors reported by the KHR_debug callback until Present picks them up.
+//
+// The driver may call the callback from a thread of its own, so this is a bounded lock-free
+// queue (after Dmitry Vyukov's). Errors that arrive while it is full are only counted.
+class GLErrorQueue
+{
+public:
+	GLErrorQueue();
+
+	// Any thread
+	void Push(GLuint id, const char* message);
+
+	// Render thread only
+	bool Pop(std::string& message);
+	int TakeDroppedCount() { return mDropped.exchange(0); }
+
+	static const uint32_t Capacity = 16; // must be a power of two
+
+private:
+	struct Entry
+	{
+		std::atomic<uint32_t> Sequence;
+		char Message[256];
+	};
+
+	Entry mEntries[Capacity];
+	std::atomic<uint32_t> mEnqueuePos;
+	uint32_t mDequeuePos = 0;
+	std::atomic<int> mDropped;
+};
@@ -0,0 +1,261 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "Precomp.h"
+#include "GLFrameProfiler.h"
+#include "GLRenderDevice.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+void GLFrameProfiler::ReleaseResources()
+{
+	for (Frame& frame : mPendingFrames)
+	{
+		for (Scope& scope : frame.Scopes)
+			mFreeQueries.insert(mFreeQueries.end(), scope.Queries, scope.Queries + 2);
+	}
+	for (Scope& scope : mCurrentFrame.Scopes)
+		mFreeQueries.insert(mFreeQueries.end(), scope.Queries, scope.Queries + 2);
+
+	for (GLuint query : mFreeQueries)
+	{
+		if (query) glDeleteQueries(1, &query);
+	}
+
+	mFreeQueries.clear();
+	mPendingFrames.clear();
+	mCurrentFrame.Scopes.clear();
+	mOpenScopes.clear();
+}
+
+void GLFrameProfiler::SetEnabled(GLRenderDevice* device, bool enable)
+{
+	if (mEnabled == enable)
+		return;
+
+	if (enable)
+	{
+		mEnabled = true;
+		mTimerQueries = ogl_IsVersionGEQ(3, 3) && glQueryCounter;
+		mStartTime = std::chrono::steady_clock::now();
+		mFrameNumber = 0;
+		mHistory.clear();
+		BeginFrame(device);
+	}
+	else
+	{
+		// Results still in flight are dropped, the history is kept for SaveTrace
+		ReleaseResources();
+		mEnabled = false;
+	}
+}
+
+void GLFrameProfiler::BeginScope(GLRenderDevice* device, const char* name)
+{
+	if (!mEnabled)
+		return;
+
+	Scope scope;
+	strncpy(scope.Result.Name, name ? name : "", sizeof(scope.Result.Name) - 1);
+	scope.Result.Frame = mFrameNumber;
+	scope.Result.Depth = (int32_t)mOpenScopes.size();
+	scope.Result.DrawCalls = (int32_t)device->mDrawCalls;
+	scope.Result.StateChanges = (int32_t)device->mStateChanges;
+	scope.Result.BytesUploaded = device->mBytesUploaded;
+	scope.Result.CpuStart = GetCpuTime();
+	scope.Result.GpuTime = -1;
+	if (mTimerQueries)
+	{
+		scope.Queries[0] = GetQuery();
+		scope.Queries[1] = GetQuery();
+		glQueryCounter(scope.Queries[0], GL_TIMESTAMP);
+	}
+
+	mOpenScopes.push_back((int)mCurrentFrame.Scopes.size());
+	mCurrentFrame.Scopes.push_back(scope);
+}
+
+void GLFrameProfiler::EndScope(GLRenderDevice* device)
+{
+	// The frame scope is only ended by EndFrame
+	if (!mEnabled || mOpenScopes.size() <= 1)
+		return;
+
+	ProfileResult& result = mCurrentFrame.Scopes[mOpenScopes.back()].Result;
+	result.DrawCalls = (int32_t)device->mDrawCalls - result.DrawCalls;
+	result.StateChanges = (int32_t)device->mStateChanges - result.StateChanges;
+	result.BytesUploaded = device->mBytesUploaded - result.BytesUploaded;
+	result.CpuTime = GetCpuTime() - result.CpuStart;
+	if (mTimerQueries)
+		glQueryCounter(mCurrentFrame.Scopes[mOpenScopes.back()].Queries[1], GL_TIMESTAMP);
+
+	mOpenScopes.pop_back();
+}
+
+void GLFrameProfiler::EndFrame(GLRenderDevice* device)
+{
+	if (!mEnabled)
+		return;
+
+	// Close whatever the caller left open
+	while (mOpenScopes.size() > 1)
+		EndScope(device);
+
+	ProfileResult& result = mCurrentFrame.Scopes.front().Result;
+	result.DrawCalls = (int32_t)device->mDrawCalls - result.DrawCalls;
+	result.StateChanges = (int32_t)device->mStateChanges - result.StateChanges;
+	result.BytesUploaded = device->mBytesUploaded - result.BytesUploaded;
+	result.CpuTime = GetCpuTime() - result.CpuStart;
+	if (mTimerQueries)
+		glQueryCounter(mCurrentFrame.Scopes.front().Queries[1], GL_TIMESTAMP);
+	mOpenScopes.clear();
+
+	if (mTimerQueries)
+		mPendingFrames.push_back(std::move(mCurrentFrame));
+	else
+		FinishFrame(mCurrentFrame);
+	mCurrentFrame = Frame();
+
+	CollectFinishedFrames();
+
+	mFrameNumber++;
+	BeginFrame(device);
+}
+
+void GLFrameProfiler::BeginFrame(GLRenderDevice* device)
+{
+	BeginScope(device, "Frame");
+}
+
+void GLFrameProfiler::CollectFinishedFrames()
+{
+	while (!mPendingFrames.empty())
+	{
+		// Queries finish in order, so the frame is done when the end of the frame scope is
+		Frame& frame = mPendingFrames.front();
+		GLint available = 0;
+		glGetQueryObjectiv(frame.Scopes.front().Queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+
+		GLuint64 frameStart = 0;
+		glGetQueryObjectui64v(frame.Scopes.front().Queries[0], GL_QUERY_RESULT, &frameStart);
+		for (Scope& scope : frame.Scopes)
+		{
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(scope.Queries[0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(scope.Queries[1], GL_QUERY_RESULT, &end);
+			scope.Result.GpuStart = (int64_t)(start - frameStart) / 1000;
+			scope.Result.GpuTime = (int64_t)(end - start) / 1000;
+			mFreeQueries.insert(mFreeQueries.end(), scope.Queries, scope.Queries + 2);
+		}
+
+		FinishFrame(frame);
+		mPendingFrames.pop_front();
+	}
+}
+
+void GLFrameProfiler::FinishFrame(Frame& frame)
+{
+	std::vector<ProfileResult> results;
+	results.reserve(frame.Scopes.size());
+	for (Scope& scope : frame.Scopes)
+		results.push_back(scope.Result);
+
+	mHistory.push_back(std::move(results));
+	if (mHistory.size() > MaxHistoryFrames)
+		mHistory.pop_front();
+}
+
+int GLFrameProfiler::GetResults(ProfileResult* results, int maxcount) const
+{
+	if (mHistory.empty())
+		return 0;
+
+	const std::vector<ProfileResult>& frame = mHistory.back();
+	int count = std::min((int)frame.size(), maxcount);
+	std::copy(frame.begin(), frame.begin() + count, results);
+	return count;
+}
+
+bool GLFrameProfiler::SaveTrace(const char* filename) const
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		SetError("Could not open %s for writing", filename);
+		return false;
+	}
+
+	// Chrome trace event format, as loaded by chrome://tracing and Perfetto
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+	for (const std::vector<ProfileResult>& frame : mHistory)
+	{
+		for (const ProfileResult& result : frame)
+		{
+			std::string name;
+			for (const char* c = result.Name; *c; c++)
+			{
+				if (*c == '"' || *c == '\\') name.push_back('\\');
+				if ((unsigned char)*c >= 32) name.push_back(*c);
+			}
+
+			fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lld,\"dur\":%lld,\"args\":{\"frame\":%d,\"draws\":%d,\"statechanges\":%d,\"bytesuploaded\":%lld}}",
+				name.c_str(), (long long)result.CpuStart, (long long)result.CpuTime, result.Frame, result.DrawCalls, result.StateChanges, (long long)result.BytesUploaded);
+
+			// The GPU clock isn't related to the CPU one, so GPU scopes are placed relative to the start of the frame
+			if (result.GpuTime >= 0)
+			{
+				fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%lld,\"dur\":%lld,\"args\":{\"frame\":%d}}",
+					name.c_str(), (long long)(frame.front().CpuStart + result.GpuStart), (long long)result.GpuTime, result.Frame);
+			}
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	bool result = ferror(file) == 0;
+	fclose(file);
+	if (!result)
+		SetError("Could not write %s", filename);
+	return result;
+}
+
+GLuint GLFrameProfiler::GetQuery()
+{
+	if (mFreeQueries.empty())
+	{
+		mFreeQueries.resize(64);
+		glGenQueries((GLsizei)mFreeQueries.size(), mFreeQueries.data());
+	}
+
+	GLuint query = mFreeQueries.back();
+	mFreeQueries.pop_back();
+	return query;
+}
+
+int64_t GLFrameProfiler::GetCpuTime() const
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mStartTime).count();
+}
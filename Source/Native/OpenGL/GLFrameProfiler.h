@@ -0,0 +1,83 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include "../Backend.h"
+#include <chrono>
+#include <deque>
+#include <vector>
+
+class GLRenderDevice;
+
+// Times named scopes on the CPU and the GPU while enabled. Present ends one frame and
+// starts the next, each frame being the outermost scope.
+//
+// GPU times come from GL_TIMESTAMP queries at both ends of a scope, since
+// GL_TIME_ELAPSED queries can't be nested. Their results are only read once available,
+// usually a few frames later, so the profiler never waits for the GPU.
+class GLFrameProfiler
+{
+public:
+	void ReleaseResources();
+
+	void SetEnabled(GLRenderDevice* device, bool enable);
+	bool IsEnabled() const { return mEnabled; }
+
+	void BeginScope(GLRenderDevice* device, const char* name);
+	void EndScope(GLRenderDevice* device);
+	void EndFrame(GLRenderDevice* device);
+
+	int GetResults(ProfileResult* results, int maxcount) const;
+	bool SaveTrace(const char* filename) const;
+
+	static const int MaxHistoryFrames = 600;
+
+private:
+	struct Scope
+	{
+		// Holds the counters and times at the start of the scope until it ends
+		ProfileResult Result = {};
+		GLuint Queries[2] = {};
+	};
+
+	struct Frame
+	{
+		std::vector<Scope> Scopes;
+	};
+
+	void BeginFrame(GLRenderDevice* device);
+	void CollectFinishedFrames();
+	void FinishFrame(Frame& frame);
+	GLuint GetQuery();
+	int64_t GetCpuTime() const;
+
+	bool mEnabled = false;
+	bool mTimerQueries = false;
+	int mFrameNumber = 0;
+	std::chrono::steady_clock::time_point mStartTime;
+
+	Frame mCurrentFrame;
+	std::vector<int> mOpenScopes;
+	std::deque<Frame> mPendingFrames;
+	std::deque<std::vector<ProfileResult>> mHistory;
+	std::vector<GLuint> mFreeQueries;
+};
@@ -25,6 +25,10 @@
 #include "GLIndexBuffer.h"
 #include "GLTexture.h"
 #include "GLShaderManager.h"
+#include "GLStreamBuffer.h"
+#include "GLTextureUploader.h"
+#include "GLFrameProfiler.h"
+#include "GLErrorQueue.h"
 #include <stdexcept>
 #include <cstdarg>
 #include <algorithm>
@@ -39,14 +43,31 @@ static void APIENTRY GLLogCallback(GLenum source, GLenum type, GLuint id,
 	fclose(f);
 }
 
+static void APIENTRY GLDebugCallback(GLenum source, GLenum type, GLuint id,
+	GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+{
+	const GLRenderDevice* device = static_cast<const GLRenderDevice*>(userParam);
+	if (type == GL_DEBUG_TYPE_ERROR)
+		device->mErrorQueue->Push(id, message);
+	if (device->mDebugLog)
+		GLLogCallback(source, type, id, severity, length, message, nullptr);
+}
+
 static const char* GLLogCheckNull(const GLubyte* str)
 {
 	return str ? (const char*)str : "null";
 }
 
-GLRenderDevice::GLRenderDevice(void* disp, void* window, bool debug)
+GLRenderDevice::GLRenderDevice(void* disp, void* window, bool debug) : GLRenderDevice(IOpenGLContext::Create(disp, window), debug)
+{
+}
+
+GLRenderDevice::GLRenderDevice(int width, int height, bool debug) : GLRenderDevice(IOpenGLContext::CreateHeadless(width, height), debug)
+{
+}
+
+GLRenderDevice::GLRenderDevice(std::unique_ptr<IOpenGLContext> context, bool debug) : Context(std::move(context))
 {
-	Context = IOpenGLContext::Create(disp, window);
 	if (Context)
 	{
 		Context->MakeCurrent();
@@ -63,17 +84,51 @@ GLRenderDevice::GLRenderDevice(void* disp, void* window, bool debug)
 				fprintf(f, "GL_SHADING_LANGUAGE_VERSION = %s\r\n", GLLogCheckNull(glGetString(GL_SHADING_LANGUAGE_VERSION)));
 				fclose(f);
 
-				glEnable(GL_DEBUG_OUTPUT);
-				glDebugMessageCallback(&GLLogCallback, nullptr);
+				mDebugLog = true;
 			}
 		}
 //#endif
 
-		glGenVertexArrays(1, &mStreamVAO);
-		glGenBuffers(1, &mStreamVertexBuffer);
-		glBindVertexArray(mStreamVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, mStreamVertexBuffer);
-		GLSharedVertexBuffer::SetupFlatVAO();
+		// Draws only check for errors in validation mode. Otherwise errors come from the debug
+		// callback and are reported once per frame by Present.
+		mValidate = debug;
+		mErrorQueue.reset(new GLErrorQueue());
+		if ((ogl_IsVersionGEQ(4, 3) || ogl_ext_KHR_debug) && glDebugMessageCallback)
+		{
+			glEnable(GL_DEBUG_OUTPUT);
+			if (!mDebugLog)
+			{
+				glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+				glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+			}
+			glDebugMessageCallback(&GLDebugCallback, this);
+			mDebugCallback = true;
+		}
+
+		mStreamBuffer.reset(new GLStreamBuffer(this, (int64_t)8 * 1024 * 1024));
+		mStreamBuffer->GetVAO();
+
+		mMultiDrawIndirect = ogl_IsVersionGEQ(4, 3) && glMultiDrawArraysIndirect;
+		mMultiBind = ogl_IsVersionGEQ(4, 4) && glBindTextures && glBindSamplers;
+
+		mUniformRing.reset(new GLStreamBuffer(this, (int64_t)16 * 1024 * 1024));
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &mUniformBufferAlignment);
+		mUniformBufferAlignment = std::max(mUniformBufferAlignment, (GLint)16);
+
+		mTextureUploader.reset(new GLTextureUploader());
+
+		uint32_t placeholder = 0xff808080;
+		glGenTextures(1, &mPlaceholderTexture);
+		glBindTexture(GL_TEXTURE_2D, mPlaceholderTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_BGRA, GL_UNSIGNED_BYTE, &placeholder);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		mProfiler.reset(new GLFrameProfiler());
+
+		if (Context->IsHeadless())
+		{
+			mOffscreenTarget.reset(new GLTexture());
+			mOffscreenTarget->Set2DImage(Context->GetWidth(), Context->GetHeight(), PixelFormat::Rgba8);
+		}
 
 		int i = 0;
 		for (auto& sharedbuf : mSharedVertexBuffers)
@@ -98,31 +153,39 @@ GLRenderDevice::~GLRenderDevice()
 	{
 		Context->MakeCurrent();
 
+		if (mDebugCallback)
+			glDebugMessageCallback(nullptr, nullptr);
+
 		ProcessDeleteList();
 		for (GLTexture* tex : mTextures) mDeleteList.Textures.push_back(tex);
 		for (GLIndexBuffer* buffer : mIndexBuffers) mDeleteList.IndexBuffers.push_back(buffer);
-		for (GLVertexBuffer* buffer : mSharedVertexBuffers[0]->VertexBuffers) mDeleteList.VertexBuffers.push_back(buffer);
-		for (GLVertexBuffer* buffer : mSharedVertexBuffers[1]->VertexBuffers) mDeleteList.VertexBuffers.push_back(buffer);
+		for (int i = 0; i < 2; i++)
+		{
+			for (GLVertexBuffer* buffer : mSharedVertexBuffers[i]->VertexBuffers) mDeleteList.VertexBuffers.push_back(buffer);
+			for (auto& sharedbuf : mCompactingVertexBuffers[i])
+				for (GLVertexBuffer* buffer : sharedbuf->VertexBuffers) mDeleteList.VertexBuffers.push_back(buffer);
+		}
 		ProcessDeleteList(true);
 
-		glDeleteBuffers(1, &mStreamVertexBuffer);
-		glDeleteVertexArrays(1, &mStreamVAO);
+		mStreamBuffer->ReleaseResources();
+		mUniformRing->ReleaseResources();
+		mTextureUploader->ReleaseResources();
+		mProfiler->ReleaseResources();
+		glDeleteTextures(1, &mPlaceholderTexture);
+		ReleaseRecycledTextures();
 
-		for (auto& sharedbuf : mSharedVertexBuffers)
+		for (int i = 0; i < 2; i++)
 		{
-			GLuint handle = sharedbuf->GetBuffer();
-			glDeleteBuffers(1, &handle);
-			handle = sharedbuf->GetVAO();
-			glDeleteVertexArrays(1, &handle);
+			mSharedVertexBuffers[i]->ReleaseResources(this);
+			for (auto& sharedbuf : mCompactingVertexBuffers[i])
+				sharedbuf->ReleaseResources(this);
 		}
+		ReleaseRetiredVertexBuffers(true);
 
-		for (auto& it : mTextureUnit)
+		for (GLuint& sampler : mSamplers)
 		{
-		    GLuint &handle = it.SamplerHandle;
-		    if (handle != 0)
-		    {
-		        glDeleteSamplers(1, &handle);
-		    }
+			if (sampler != 0)
+				glDeleteSamplers(1, &sampler);
 		}
 
 		mShaderManager->ReleaseResources();
@@ -142,9 +205,9 @@ void GLRenderDevice::SetVertexBuffer(VertexBuffer* ibuffer)
 	if (buffer != nullptr)
 	{
 		mVertexBufferStartIndex = buffer->BufferStartIndex;
-		if (mVertexBuffer != (int)buffer->Format)
+		if (mVertexBuffer != buffer->SharedBuffer)
 		{
-			mVertexBuffer = (int)buffer->Format;
+			mVertexBuffer = buffer->SharedBuffer;
 			mNeedApply = true;
 			mVertexBufferChanged = true;
 		}
@@ -152,9 +215,9 @@ void GLRenderDevice::SetVertexBuffer(VertexBuffer* ibuffer)
 	else
 	{
 		mVertexBufferStartIndex = 0;
-		if (mVertexBuffer != -1)
+		if (mVertexBuffer != nullptr)
 		{
-			mVertexBuffer = -1;
+			mVertexBuffer = nullptr;
 			mNeedApply = true;
 			mVertexBufferChanged = true;
 		}
@@ -271,6 +334,7 @@ void GLRenderDevice::SetTexture(int unit, Texture* texture)
 	if (mTextureUnit[unit].Tex != texture)
 	{
 		mTextureUnit[unit].Tex = static_cast<GLTexture*>(texture);
+		mDirtyTextureUnits |= 1 << unit;
 		mNeedApply = true;
 		mTexturesChanged = true;
 	}
@@ -306,6 +370,7 @@ void GLRenderDevice::SetSamplerFilter(int unit, TextureFilter minfilter, Texture
     
     if (dirty)
     {
+        mDirtyTextureUnits |= 1 << unit;
         mNeedApply = true;
         mTexturesChanged = true;
     }  
@@ -336,20 +401,12 @@ GLint GLRenderDevice::GetGLMinFilter(TextureFilter filter, MipmapFilter mipfilte
 	}
 }
 
-GLRenderDevice::SamplerFilterKey GLRenderDevice::GetSamplerFilterKey(TextureFilter filter, MipmapFilter mipFilter, float maxAnisotropy)
-{
-    SamplerFilterKey key;
-    key.MinFilter = GetGLMinFilter(filter, mipFilter);
-    key.MagFilter = (filter == TextureFilter::Linear) ? GL_LINEAR : GL_NEAREST;
-    key.MaxAnisotropy = maxAnisotropy;
-    return key;
-}
-
 void GLRenderDevice::SetSamplerState(int unit, TextureAddress address)
 {
 	if (mTextureUnit[unit].WrapMode != address)
 	{
 		mTextureUnit[unit].WrapMode = address;
+		mDirtyTextureUnits |= 1 << unit;
 		mNeedApply = true;
 		mTexturesChanged = true;
 	}
@@ -363,7 +420,8 @@ bool GLRenderDevice::Draw(PrimitiveType type, int startIndex, int primitiveCount
 
 	if (mNeedApply && !ApplyChanges()) return false;
 	glDrawArrays(modes[(int)type], mVertexBufferStartIndex + startIndex, toVertexStart[(int)type] + primitiveCount * toVertexCount[(int)type]);
-	return CheckGLError();
+	mDrawCalls++;
+	return CheckDrawError();
 }
 
 bool GLRenderDevice::DrawIndexed(PrimitiveType type, int startIndex, int primitiveCount)
@@ -374,7 +432,8 @@ bool GLRenderDevice::DrawIndexed(PrimitiveType type, int startIndex, int primiti
 
 	if (mNeedApply && !ApplyChanges()) return false;
 	glDrawElementsBaseVertex(modes[(int)type], toVertexStart[(int)type] + primitiveCount * toVertexCount[(int)type], GL_UNSIGNED_INT, (const void*)(startIndex * sizeof(uint32_t)), mVertexBufferStartIndex);
-	return CheckGLError();
+	mDrawCalls++;
+	return CheckDrawError();
 }
 
 bool GLRenderDevice::DrawData(PrimitiveType type, int startIndex, int primitiveCount, const void* data)
@@ -385,15 +444,342 @@ bool GLRenderDevice::DrawData(PrimitiveType type, int startIndex, int primitiveC
 
 	int vertcount = toVertexStart[(int)type] + primitiveCount * toVertexCount[(int)type];
 
+	// The stream VAO is bound in place of the current vertex buffer, which is only bound
+	// again by the next draw that uses it. That way a run of DrawData calls doesn't keep
+	// switching between the two.
+	mVertexBufferChanged = false;
 	if (mNeedApply && !ApplyChanges()) return false;
+	mVertexBufferChanged = true;
+	mNeedApply = true;
+
+	int64_t offset = mStreamBuffer->Upload(static_cast<const uint8_t*>(data) + startIndex * (size_t)VertexBuffer::FlatStride, vertcount * (int64_t)VertexBuffer::FlatStride, VertexBuffer::FlatStride);
+	if (offset < 0)
+	{
+		SetError("Could not upload vertex data for drawing");
+		return false;
+	}
+
+	BindVertexArray(mStreamBuffer->GetVAO());
+	glDrawArrays(modes[(int)type], (GLint)(offset / VertexBuffer::FlatStride), vertcount);
+	mDrawCalls++;
+	mBytesUploaded += vertcount * (int64_t)VertexBuffer::FlatStride;
+	return CheckDrawError();
+}
+
+bool GLRenderDevice::MultiDraw(PrimitiveType type, const DrawRange* ranges, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (!AddDraw(type, ranges[i].StartIndex, ranges[i].PrimitiveCount)) return false;
+	}
+	return FlushDraws();
+}
+
+bool GLRenderDevice::AddDraw(PrimitiveType type, int startIndex, int primitiveCount)
+{
+	static const int toVertexCount[] = { 2, 3, 1 };
+	static const int toVertexStart[] = { 0, 0, 2 };
+
+	if (!mDrawBatchFirst.empty() && type != mDrawBatchType && !FlushDraws()) return false;
+
+	mDrawBatchType = type;
+	mDrawBatchFirst.push_back((GLint)(mVertexBufferStartIndex + startIndex));
+	mDrawBatchCount.push_back(toVertexStart[(int)type] + primitiveCount * toVertexCount[(int)type]);
+	return true;
+}
+
+bool GLRenderDevice::FlushDraws()
+{
+	static const int modes[] = { GL_LINES, GL_TRIANGLES, GL_TRIANGLE_STRIP };
+
+	if (mDrawBatchFirst.empty())
+		return true;
+
+	GLenum mode = modes[(int)mDrawBatchType];
+	GLsizei count = (GLsizei)mDrawBatchFirst.size();
+
+	bool result = !mNeedApply || ApplyChanges();
+	if (result)
+	{
+		int64_t offset = -1;
+		if (count > 1 && mMultiDrawIndirect)
+		{
+			// DrawArraysIndirectCommand: count, instanceCount, first, baseInstance
+			std::vector<GLuint> indirect(count * 4);
+			for (GLsizei i = 0; i < count; i++)
+			{
+				indirect[i * 4] = mDrawBatchCount[i];
+				indirect[i * 4 + 1] = 1;
+				indirect[i * 4 + 2] = mDrawBatchFirst[i];
+				indirect[i * 4 + 3] = 0;
+			}
+			offset = mStreamBuffer->Upload(indirect.data(), indirect.size() * sizeof(GLuint), sizeof(GLuint));
+		}
+
+		if (offset >= 0)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mStreamBuffer->GetBuffer());
+			glMultiDrawArraysIndirect(mode, (const void*)(intptr_t)offset, count, 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+		else if (count > 1)
+		{
+			glMultiDrawArrays(mode, mDrawBatchFirst.data(), mDrawBatchCount.data(), count);
+		}
+		else
+		{
+			glDrawArrays(mode, mDrawBatchFirst[0], mDrawBatchCount[0]);
+		}
+		mDrawCalls++;
+	}
+
+	mDrawBatchFirst.clear();
+	mDrawBatchCount.clear();
+	return result && CheckDrawError();
+}
+
+bool GLRenderDevice::IsUniformUnchanged(int name, const void* values, int bytesize)
+{
+	const UniformInfo& info = mUniformInfo[name];
+	return (int)info.Data.size() == bytesize && memcmp(info.Data.data(), values, bytesize) == 0;
+}
+
+static int32_t GetCommandInt(const uint8_t* payload, int index)
+{
+	int32_t value;
+	memcpy(&value, payload + index * sizeof(int32_t), sizeof(int32_t));
+	return value;
+}
+
+static float GetCommandFloat(const uint8_t* payload, int index)
+{
+	float value;
+	memcpy(&value, payload + index * sizeof(float), sizeof(float));
+	return value;
+}
+
+static void* GetCommandHandle(const uint8_t* payload, int offset)
+{
+	int64_t value;
+	memcpy(&value, payload + offset, sizeof(int64_t));
+	return (void*)(intptr_t)value;
+}
+
+bool GLRenderDevice::ExecuteCommands(const void* commands, int64_t size)
+{
+	// Smallest payload for each command, see RenderCommand
+	static const int32_t minsizes[] = { 4, 16, 8, 8, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 16, 20, 8, 12, 12, 8 };
+	static const int toVertexCount[] = { 2, 3, 1 };
+	static const int toVertexStart[] = { 0, 0, 2 };
+
+	// Draws left over from a command list which failed part way are dropped
+	mDrawBatchFirst.clear();
+	mDrawBatchCount.clear();
+
+	const uint8_t* start = static_cast<const uint8_t*>(commands);
+	const uint8_t* end = start + size;
+	const uint8_t* pos = start;
+	while (pos < end)
+	{
+		int32_t command, payloadsize;
+		if (end - pos < 8)
+		{
+			SetError("Truncated render command at offset %d", (int)(pos - start));
+			return false;
+		}
+		command = GetCommandInt(pos, 0);
+		payloadsize = GetCommandInt(pos, 1);
+		if (command < 0 || command >= (int32_t)(sizeof(minsizes) / sizeof(minsizes[0])) || payloadsize < minsizes[command] || payloadsize > end - pos - 8)
+		{
+			SetError("Invalid render command %d at offset %d", command, (int)(pos - start));
+			return false;
+		}
+
+		const uint8_t* payload = pos + 8;
+		pos = payload + payloadsize;
 
-	glBindBuffer(GL_ARRAY_BUFFER, mStreamVertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, vertcount * (size_t)VertexBuffer::FlatStride, static_cast<const uint8_t*>(data) + startIndex * (size_t)VertexBuffer::FlatStride, GL_STREAM_DRAW);
-	glBindVertexArray(mStreamVAO);
-	glDrawArrays(modes[(int)type], 0, vertcount);
-	if (!CheckGLError()) return false;
+		// Draws are collected and submitted together until a command changes the state they are drawn with
+		if ((RenderCommand)command != RenderCommand::Draw && (RenderCommand)command != RenderCommand::SetUniform &&
+			(RenderCommand)command != RenderCommand::SetVertexBuffer && !FlushDraws())
+			return false;
 
-	return ApplyVertexBuffer();
+		switch ((RenderCommand)command)
+		{
+		case RenderCommand::SetShader:
+			SetShader(GetCommandInt(payload, 0));
+			break;
+		case RenderCommand::SetUniform:
+		{
+			int name = GetCommandInt(payload, 0);
+			int bytesize = GetCommandInt(payload, 2);
+			if (name < 0 || name >= (int)mUniformInfo.size() || bytesize < 0 || bytesize > payloadsize - 16)
+			{
+				SetError("Invalid uniform in render command at offset %d", (int)(payload - 8 - start));
+				return false;
+			}
+			if (!IsUniformUnchanged(name, payload + 16, bytesize) && !FlushDraws()) return false;
+			SetUniform(name, payload + 16, GetCommandInt(payload, 1), bytesize);
+			break;
+		}
+		case RenderCommand::SetVertexBuffer:
+		{
+			// Vertex buffers in the same shared buffer only differ by start index, which each collected draw already includes
+			GLVertexBuffer* buffer = static_cast<GLVertexBuffer*>(GetCommandHandle(payload, 0));
+			if ((!buffer || buffer->SharedBuffer != mVertexBuffer) && !FlushDraws()) return false;
+			SetVertexBuffer(buffer);
+			break;
+		}
+		case RenderCommand::SetIndexBuffer:
+			SetIndexBuffer(static_cast<IndexBuffer*>(GetCommandHandle(payload, 0)));
+			break;
+		case RenderCommand::SetAlphaBlendEnable:
+			SetAlphaBlendEnable(GetCommandInt(payload, 0) != 0);
+			break;
+		case RenderCommand::SetAlphaTestEnable:
+			SetAlphaTestEnable(GetCommandInt(payload, 0) != 0);
+			break;
+		case RenderCommand::SetCullMode:
+			SetCullMode((Cull)GetCommandInt(payload, 0));
+			break;
+		case RenderCommand::SetBlendOperation:
+			SetBlendOperation((BlendOperation)GetCommandInt(payload, 0));
+			break;
+		case RenderCommand::SetSourceBlend:
+			SetSourceBlend((Blend)GetCommandInt(payload, 0));
+			break;
+		case RenderCommand::SetDestinationBlend:
+			SetDestinationBlend((Blend)GetCommandInt(payload, 0));
+			break;
+		case RenderCommand::SetFillMode:
+			SetFillMode((FillMode)GetCommandInt(payload, 0));
+			break;
+		case RenderCommand::SetMultisampleAntialias:
+			SetMultisampleAntialias(GetCommandInt(payload, 0) != 0);
+			break;
+		case RenderCommand::SetZEnable:
+			SetZEnable(GetCommandInt(payload, 0) != 0);
+			break;
+		case RenderCommand::SetZWriteEnable:
+			SetZWriteEnable(GetCommandInt(payload, 0) != 0);
+			break;
+		case RenderCommand::SetTexture:
+		case RenderCommand::SetSamplerFilter:
+		case RenderCommand::SetSamplerState:
+		{
+			int unit = GetCommandInt(payload, 0);
+			if (unit < 0 || unit >= (int)(sizeof(mTextureUnit) / sizeof(mTextureUnit[0])))
+			{
+				SetError("Invalid texture unit %d in render command at offset %d", unit, (int)(payload - 8 - start));
+				return false;
+			}
+			if ((RenderCommand)command == RenderCommand::SetTexture)
+				SetTexture(unit, static_cast<Texture*>(GetCommandHandle(payload, 8)));
+			else if ((RenderCommand)command == RenderCommand::SetSamplerFilter)
+				SetSamplerFilter(unit, (TextureFilter)GetCommandInt(payload, 1), (TextureFilter)GetCommandInt(payload, 2), (MipmapFilter)GetCommandInt(payload, 3), GetCommandFloat(payload, 4));
+			else
+				SetSamplerState(unit, (TextureAddress)GetCommandInt(payload, 1));
+			break;
+		}
+		case RenderCommand::Draw:
+		{
+			int type = GetCommandInt(payload, 0);
+			if (type < 0 || type > (int)PrimitiveType::TriangleStrip)
+			{
+				SetError("Invalid primitive type in render command at offset %d", (int)(payload - 8 - start));
+				return false;
+			}
+			if (!AddDraw((PrimitiveType)type, GetCommandInt(payload, 1), GetCommandInt(payload, 2))) return false;
+			break;
+		}
+		case RenderCommand::DrawIndexed:
+			if (!DrawIndexed((PrimitiveType)GetCommandInt(payload, 0), GetCommandInt(payload, 1), GetCommandInt(payload, 2))) return false;
+			break;
+		case RenderCommand::DrawData:
+		{
+			int type = GetCommandInt(payload, 0);
+			int primitiveCount = GetCommandInt(payload, 1);
+			if (type < 0 || type > (int)PrimitiveType::TriangleStrip || primitiveCount < 0 ||
+				(toVertexStart[type] + (int64_t)primitiveCount * toVertexCount[type]) * VertexBuffer::FlatStride > payloadsize - 8)
+			{
+				SetError("Invalid vertex data in render command at offset %d", (int)(payload - 8 - start));
+				return false;
+			}
+			if (!DrawData((PrimitiveType)type, 0, primitiveCount, payload + 8)) return false;
+			break;
+		}
+		}
+	}
+	return FlushDraws();
+}
+
+int64_t GLRenderDevice::GetCounter(RenderCounter counter)
+{
+	int64_t value = 0;
+	switch (counter)
+	{
+	case RenderCounter::VertexBufferSize:
+		for (auto& sharedbuf : mSharedVertexBuffers) value += sharedbuf->Size;
+		for (auto& compacting : mCompactingVertexBuffers)
+			for (auto& sharedbuf : compacting) value += sharedbuf->Size;
+		break;
+	case RenderCounter::VertexBufferFree:
+		for (auto& sharedbuf : mSharedVertexBuffers) value += sharedbuf->GetFreeSize();
+		break;
+	case RenderCounter::VertexBufferFreeRanges:
+		for (auto& sharedbuf : mSharedVertexBuffers) value += sharedbuf->GetFreeRangeCount();
+		break;
+	case RenderCounter::VertexBufferFragmentation:
+		// Percentage of free space which is not in the largest free range of its buffer
+		{
+			int64_t freeSize = 0, largest = 0;
+			for (auto& sharedbuf : mSharedVertexBuffers)
+			{
+				freeSize += sharedbuf->GetFreeSize();
+				largest += sharedbuf->GetLargestFree();
+			}
+			value = freeSize != 0 ? (freeSize - largest) * 100 / freeSize : 0;
+		}
+		break;
+	case RenderCounter::VertexBufferBytesMoved:
+		value = mVertexBytesMoved;
+		break;
+	case RenderCounter::VertexBufferCompactions:
+		value = mVertexCompactions;
+		break;
+	case RenderCounter::TextureUploadQueueDepth:
+		value = mTextureUploader->GetQueueDepth();
+		break;
+	case RenderCounter::TextureUploadQueueBytes:
+		value = mTextureUploader->GetQueuedBytes();
+		break;
+	case RenderCounter::TextureBytesUploaded:
+		value = mTextureUploader->GetBytesUploaded();
+		break;
+	case RenderCounter::TextureBytesUploadedLastFrame:
+		value = mTextureUploader->GetLastFrameBytesUploaded();
+		break;
+	case RenderCounter::TextureRecycleBytes:
+		value = mRecycledTextureBytes;
+		break;
+	case RenderCounter::TexturesReused:
+		value = mTexturesReused;
+		break;
+	case RenderCounter::DrawCalls:
+		value = mDrawCalls;
+		break;
+	case RenderCounter::StateChanges:
+		value = mStateChanges;
+		break;
+	case RenderCounter::BytesUploaded:
+		value = mBytesUploaded;
+		break;
+	case RenderCounter::VertexBufferCompactionPending:
+		for (auto& compacting : mCompactingVertexBuffers)
+			for (auto& sharedbuf : compacting)
+				for (GLVertexBuffer* buf : sharedbuf->VertexBuffers) value += buf->Size;
+		break;
+	}
+	return value;
 }
 
 void GLRenderDevice::RequireContext()
@@ -408,11 +794,89 @@ void GLRenderDevice::CheckContext()
 	mContextIsCurrent = true;
 }
 
+void GLRenderDevice::BindVertexArray(GLuint vao)
+{
+	if (mBoundVertexArray != vao)
+	{
+		glBindVertexArray(vao);
+		mBoundVertexArray = vao;
+	}
+}
+
+void GLRenderDevice::DeleteVertexArray(GLuint vao)
+{
+	// Deleting the bound vertex array binds 0 in its place
+	if (mBoundVertexArray == vao)
+		mBoundVertexArray = 0;
+	glDeleteVertexArrays(1, &vao);
+}
+
+void GLRenderDevice::SetActiveTexture(int unit)
+{
+	if (mActiveTextureUnit != unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		mActiveTextureUnit = unit;
+	}
+}
+
+void GLRenderDevice::BindTexture(int unit, GLenum target, GLuint texture)
+{
+	// The active unit is only changed if something has to be bound
+	GLuint& bound = mBoundTextures[unit][target == GL_TEXTURE_CUBE_MAP ? 1 : 0];
+	if (bound != texture)
+	{
+		SetActiveTexture(unit);
+		glBindTexture(target, texture);
+		bound = texture;
+	}
+}
+
+void GLRenderDevice::BindTextureForUpdate(GLenum target, GLuint texture)
+{
+	// Textures are updated through unit 0, which is bound to what the next draw needs by ApplyTextures
+	SetActiveTexture(0);
+	BindTexture(0, target, texture);
+	mDirtyTextureUnits |= 1;
+	mNeedApply = true;
+	mTexturesChanged = true;
+}
+
+void GLRenderDevice::DeleteTextureObject(GLuint texture)
+{
+	// Deleting a bound texture binds 0 in its place
+	for (auto& unit : mBoundTextures)
+	{
+		for (GLuint& bound : unit)
+		{
+			if (bound == texture)
+				bound = 0;
+		}
+	}
+	glDeleteTextures(1, &texture);
+}
+
+void GLRenderDevice::MarkTextureUnitsDirty(GLTexture* texture)
+{
+	for (int index = 0; index < 10; index++)
+	{
+		if (mTextureUnit[index].Tex == texture)
+		{
+			mDirtyTextureUnits |= 1 << index;
+			mNeedApply = true;
+			mTexturesChanged = true;
+		}
+	}
+}
+
 bool GLRenderDevice::StartRendering(bool clear, int backcolor, Texture* itarget, bool usedepthbuffer)
 {
 	RequireContext();
 
 	GLTexture* target = static_cast<GLTexture*>(itarget);
+	if (!target)
+		target = mOffscreenTarget.get(); // headless contexts have no default framebuffer
+
 	if (target)
 	{
 		GLuint framebuffer = 0;
@@ -456,6 +920,7 @@ bool GLRenderDevice::StartRendering(bool clear, int backcolor, Texture* itarget,
 	mShaderChanged = true;
 	mUniformsChanged = true;
 	mTexturesChanged = true;
+	mDirtyTextureUnits = (1 << 10) - 1;
 	mIndexBufferChanged = true;
 	mVertexBufferChanged = true;
 	mDepthStateChanged = true;
@@ -476,7 +941,47 @@ bool GLRenderDevice::Present()
 	Context->MakeCurrent();
 	Context->SwapBuffers();
 	ProcessDeleteList();
-	return CheckGLError();
+	mTextureUploader->Process(this, mTextureUploadBudget);
+	MoveVertexBuffers(VertexFormat::Flat, mVertexCompactionBudget);
+	MoveVertexBuffers(VertexFormat::World, mVertexCompactionBudget);
+	ReleaseRetiredVertexBuffers();
+	mProfiler->EndFrame(this);
+	return CheckFrameErrors();
+}
+
+void GLRenderDevice::SetProfilerEnabled(bool enable)
+{
+	Context->MakeCurrent();
+	mProfiler->SetEnabled(this, enable);
+}
+
+void GLRenderDevice::BeginScope(const char* name)
+{
+	// Draws recorded for a multi-draw belong to the scope they were added in
+	if (mProfiler->IsEnabled())
+	{
+		FlushDraws();
+		mProfiler->BeginScope(this, name);
+	}
+}
+
+void GLRenderDevice::EndScope()
+{
+	if (mProfiler->IsEnabled())
+	{
+		FlushDraws();
+		mProfiler->EndScope(this);
+	}
+}
+
+int GLRenderDevice::GetProfileResults(ProfileResult* results, int maxcount)
+{
+	return mProfiler->GetResults(results, maxcount);
+}
+
+bool GLRenderDevice::SaveProfileTrace(const char* filename)
+{
+	return mProfiler->SaveTrace(filename);
 }
 
 bool GLRenderDevice::ClearTexture(int backcolor, Texture* texture)
@@ -499,86 +1004,195 @@ bool GLRenderDevice::CopyTexture(Texture* idst, CubeMapFace face)
 	};
 
 	CheckContext();
-	GLint oldTexture = 0;
-	glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &oldTexture);
-
-	glBindTexture(GL_TEXTURE_CUBE_MAP, dst->GetTexture(this));
+	BindTextureForUpdate(GL_TEXTURE_CUBE_MAP, dst->GetTexture(this));
 	glCopyTexSubImage2D(facegl[(int)face], 0, 0, 0, 0, 0, dst->GetWidth(), dst->GetHeight());
 	if (face == CubeMapFace::NegativeZ)
 		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, oldTexture);
 	bool result = CheckGLError();
 	return result;
 }
 
+bool GLRenderDevice::ReadPixels(Texture* isource, int x, int y, int width, int height, void* data)
+{
+	GLTexture* source = static_cast<GLTexture*>(isource);
+	if (!source)
+		source = mOffscreenTarget.get();
+
+	int sourceWidth = source ? source->GetWidth() : Context->GetWidth();
+	int sourceHeight = source ? source->GetHeight() : Context->GetHeight();
+	if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > sourceWidth || y + height > sourceHeight)
+	{
+		SetError("ReadPixels: rectangle is outside the render target");
+		return false;
+	}
+
+	CheckContext();
+
+	// Creating the framebuffer binds it, and CopyTexture reads from the read framebuffer
+	GLint oldDrawFramebuffer = 0, oldReadFramebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oldDrawFramebuffer);
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &oldReadFramebuffer);
+
+	GLuint framebuffer = 0;
+	if (source)
+	{
+		try
+		{
+			framebuffer = source->GetFramebuffer(this, false);
+		}
+		catch (std::runtime_error& e)
+		{
+			SetError("Error reading render target: %s", e.what());
+			return false;
+		}
+	}
+
+	// OpenGL has the bottom row first
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(x, sourceHeight - y - height, width, height, GL_BGRA, GL_UNSIGNED_BYTE, data);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oldDrawFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, oldReadFramebuffer);
+
+	uint8_t* pixels = static_cast<uint8_t*>(data);
+	size_t pitch = (size_t)width * 4;
+	std::vector<uint8_t> row(pitch);
+	for (int i = 0; i < height / 2; i++)
+	{
+		uint8_t* top = pixels + i * pitch;
+		uint8_t* bottom = pixels + (height - 1 - i) * pitch;
+		memcpy(row.data(), top, pitch);
+		memcpy(top, bottom, pitch);
+		memcpy(bottom, row.data(), pitch);
+	}
+
+	return CheckGLError();
+}
+
 void GLRenderDevice::GarbageCollectBuffer(int size, VertexFormat format)
 {
 	auto& sharedbuf = mSharedVertexBuffers[(int)format];
-	if (sharedbuf->NextPos + size <= sharedbuf->Size)
-		return;
+	auto& compacting = mCompactingVertexBuffers[(int)format];
 
 	int totalSize = size;
 	for (GLVertexBuffer* buf : sharedbuf->VertexBuffers)
 		totalSize += buf->Size;
+	for (auto& oldbuf : compacting)
+		for (GLVertexBuffer* buf : oldbuf->VertexBuffers)
+			totalSize += buf->Size;
 
 	// If buffer is only half full we only need to GC. Otherwise we also need to expand the buffer size.
 	int newSize = std::max(totalSize, sharedbuf->Size);
 	if (newSize < totalSize * 2) newSize *= 2;
 
-	std::unique_ptr<GLSharedVertexBuffer> old = std::move(sharedbuf);
+	// The old buffer stays in use until Present has moved everything out of it
+	compacting.push_back(std::move(sharedbuf));
 	sharedbuf.reset(new GLSharedVertexBuffer(format, newSize));
 
-	GLint oldarray = 0, oldvao = 0;
-	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldarray);
-	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &oldvao);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, sharedbuf->GetBuffer());
+	glBufferData(GL_COPY_WRITE_BUFFER, sharedbuf->Size, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	// Move in offset order so that neighbouring vertex buffers can be copied together
+	compacting.back()->VertexBuffers.sort([](GLVertexBuffer* a, GLVertexBuffer* b) { return a->BufferOffset < b->BufferOffset; });
 
-	glBindBuffer(GL_ARRAY_BUFFER, sharedbuf->GetBuffer());
-	glBufferData(GL_ARRAY_BUFFER, sharedbuf->Size, nullptr, GL_STATIC_DRAW);
+	mVertexCompactions++;
+}
 
-	glBindBuffer(GL_COPY_READ_BUFFER, old->GetBuffer());
+void GLRenderDevice::MoveVertexBuffers(VertexFormat format, int64_t maxBytes)
+{
+	auto& sharedbuf = mSharedVertexBuffers[(int)format];
+	auto& compacting = mCompactingVertexBuffers[(int)format];
+	if (compacting.empty())
+		return;
 
-	// Copy all ranges still in use to the new buffer
 	int stride = (format == VertexFormat::Flat ? VertexBuffer::FlatStride : VertexBuffer::WorldStride);
-	int readPos = 0;
-	int writePos = 0;
-	int copySize = 0;
-	for (GLVertexBuffer* buf : old->VertexBuffers)
+	int64_t moved = 0;
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, sharedbuf->GetBuffer());
+
+	while (!compacting.empty() && moved < maxBytes)
 	{
-		if (buf->BufferOffset != readPos + copySize)
+		GLSharedVertexBuffer* oldbuf = compacting.front().get();
+		glBindBuffer(GL_COPY_READ_BUFFER, oldbuf->GetBuffer());
+
+		int readPos = 0;
+		int writePos = 0;
+		int copySize = 0;
+		while (!oldbuf->VertexBuffers.empty() && moved < maxBytes)
 		{
-			if (copySize != 0)
-				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, readPos, writePos, copySize);
-			readPos = buf->BufferOffset;
-			writePos += copySize;
-			copySize = 0;
-		}
+			GLVertexBuffer* buf = oldbuf->VertexBuffers.front();
+			int newOffset = sharedbuf->Alloc(buf->Size);
+			if (newOffset < 0)
+			{
+				// The new buffer filled up. The next SetVertexBufferData to run out of room starts a bigger one.
+				maxBytes = 0;
+				break;
+			}
 
-		buf->BufferOffset = sharedbuf->NextPos;
-		buf->BufferStartIndex = buf->BufferOffset / stride;
-		sharedbuf->NextPos += buf->Size;
-		copySize += buf->Size;
-	}
-	if (copySize != 0)
-		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, readPos, writePos, copySize);
-	sharedbuf->VertexBuffers.swap(old->VertexBuffers);
-	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			if (buf->BufferOffset != readPos + copySize || newOffset != writePos + copySize)
+			{
+				if (copySize != 0)
+					glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, readPos, writePos, copySize);
+				readPos = buf->BufferOffset;
+				writePos = newOffset;
+				copySize = 0;
+			}
+			copySize += (buf->Size + stride - 1) / stride * stride;
+
+			oldbuf->Free(buf->BufferOffset, buf->Size);
+			sharedbuf->VertexBuffers.splice(sharedbuf->VertexBuffers.end(), oldbuf->VertexBuffers, buf->ListIt);
+			buf->SharedBuffer = sharedbuf.get();
+			buf->BufferOffset = newOffset;
+			buf->BufferStartIndex = buf->BufferOffset / stride;
 
-	GLuint handle = old->GetVAO();
-	glDeleteVertexArrays(1, &handle);
-	if (handle == oldvao) oldvao = sharedbuf->GetVAO();
+			moved += buf->Size;
+		}
+		if (copySize != 0)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, readPos, writePos, copySize);
+
+		if (!oldbuf->VertexBuffers.empty())
+			break;
+
+		// Draws already queued may still read from the old buffer
+		RetiredVertexBuffer retired;
+		retired.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		retired.Buffer = std::move(compacting.front());
+		mRetiredVertexBuffers.push_back(std::move(retired));
+		compacting.erase(compacting.begin());
+	}
 
-	handle = old->GetBuffer();
-	glDeleteBuffers(1, &handle);
-	if (handle == oldarray) oldarray = sharedbuf->GetBuffer();
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
-	glBindBuffer(GL_ARRAY_BUFFER, oldarray);
-	glBindVertexArray(oldvao);
+	mVertexBytesMoved += moved;
 
+	// Start indexes may have changed. Everything has to be bound again for the next frame.
+	mVertexBuffer = nullptr;
+	mVertexBufferStartIndex = 0;
 	mVertexBufferChanged = true;
 	mNeedApply = true;
 }
 
+void GLRenderDevice::ReleaseRetiredVertexBuffers(bool finalize)
+{
+	auto it = mRetiredVertexBuffers.begin();
+	while (it != mRetiredVertexBuffers.end())
+	{
+		if (finalize || glClientWaitSync(it->Fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+		{
+			glDeleteSync(it->Fence);
+			it->Buffer->ReleaseResources(this);
+			it = mRetiredVertexBuffers.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
 bool GLRenderDevice::SetVertexBufferData(VertexBuffer* ibuffer, void* data, int64_t size, VertexFormat format)
 {
 	CheckContext();
@@ -587,32 +1201,39 @@ bool GLRenderDevice::SetVertexBufferData(VertexBuffer* ibuffer, void* data, int6
 
 	if (buffer->Device)
 	{
-		buffer->Device->mSharedVertexBuffers[(int)buffer->Format]->VertexBuffers.erase(buffer->ListIt);
+		buffer->SharedBuffer->Free(buffer->BufferOffset, buffer->Size);
+		buffer->SharedBuffer->VertexBuffers.erase(buffer->ListIt);
+		buffer->SharedBuffer = nullptr;
 		buffer->Device = nullptr;
 	}
 
-	GarbageCollectBuffer(size, format);
+	// Freed ranges are reused, so the buffer is only compacted when none is large enough
+	int offset = mSharedVertexBuffers[(int)format]->Alloc((int)size);
+	if (offset < 0)
+	{
+		GarbageCollectBuffer((int)size, format);
+		offset = mSharedVertexBuffers[(int)format]->Alloc((int)size);
+	}
 
 	auto& sharedbuf = mSharedVertexBuffers[(int)format];
 
-	GLint oldbinding = 0;
-	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldbinding);
-	glBindBuffer(GL_ARRAY_BUFFER, sharedbuf->GetBuffer());
-
 	buffer->ListIt = sharedbuf->VertexBuffers.insert(sharedbuf->VertexBuffers.end(), buffer);
 	buffer->Device = this;
-	buffer->Size = size;
+	buffer->SharedBuffer = sharedbuf.get();
+	buffer->Size = (int)size;
 	buffer->Format = format;
-	buffer->BufferOffset = sharedbuf->NextPos;
+	buffer->BufferOffset = offset;
 	buffer->BufferStartIndex = buffer->BufferOffset / (format == VertexFormat::Flat ? VertexBuffer::FlatStride : VertexBuffer::WorldStride);
-	sharedbuf->NextPos += size;
 
+	// Buffers are written through GL_COPY_WRITE_BUFFER, which no draw depends on, so there is no binding to restore
 	if (data)
 	{
-		glBufferSubData(GL_ARRAY_BUFFER, buffer->BufferOffset, size, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, sharedbuf->GetBuffer());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, buffer->BufferOffset, size, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		mBytesUploaded += size;
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, oldbinding);
 	bool result = CheckGLError();
 	return result;
 }
@@ -621,11 +1242,10 @@ bool GLRenderDevice::SetVertexBufferSubdata(VertexBuffer* ibuffer, int64_t destO
 {
 	CheckContext();
 	GLVertexBuffer* buffer = static_cast<GLVertexBuffer*>(ibuffer);
-	GLint oldbinding = 0;
-	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldbinding);
-	glBindBuffer(GL_ARRAY_BUFFER, mSharedVertexBuffers[(int)buffer->Format]->GetBuffer());
-	glBufferSubData(GL_ARRAY_BUFFER, buffer->BufferOffset + destOffset, size, data);
-	glBindBuffer(GL_ARRAY_BUFFER, oldbinding);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->SharedBuffer->GetBuffer());
+	glBufferSubData(GL_COPY_WRITE_BUFFER, buffer->BufferOffset + destOffset, size, data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	mBytesUploaded += size;
 	bool result = CheckGLError();
 	return result;
 }
@@ -639,11 +1259,11 @@ bool GLRenderDevice::SetIndexBufferData(IndexBuffer* ibuffer, void* data, int64_
 		buffer->ItBuffer = mIndexBuffers.insert(mIndexBuffers.end(), buffer);
 		buffer->Device = this;
 	}
-	GLint oldbinding = 0;
-	glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &oldbinding);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer->GetBuffer());
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, oldbinding);
+	// The element array binding belongs to the bound vertex array, GL_COPY_WRITE_BUFFER leaves it alone
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->GetBuffer());
+	glBufferData(GL_COPY_WRITE_BUFFER, size, data, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (data) mBytesUploaded += size;
 	bool result = CheckGLError();
 	return result;
 }
@@ -653,6 +1273,26 @@ bool GLRenderDevice::SetPixels(Texture* itexture, const void* data)
 	CheckContext();
 	GLTexture* texture = static_cast<GLTexture*>(itexture);
 	texture->SetPixels(this, data);
+	if (data) mBytesUploaded += texture->GetDataSize();
+	return CheckGLError();
+}
+
+bool GLRenderDevice::QueuePixels(Texture* itexture, const void* data)
+{
+	CheckContext();
+	GLTexture* texture = static_cast<GLTexture*>(itexture);
+	if (texture->IsCubeTexture())
+		return SetPixels(texture, data);
+
+	if (!mTextureUploader->Queue(this, texture, data))
+	{
+		CheckGLError();
+		SetError("Could not queue texture upload");
+		return false;
+	}
+
+	// Units using the texture draw the placeholder until Present has uploaded it
+	MarkTextureUnitsDirty(texture);
 	return CheckGLError();
 }
 
@@ -660,38 +1300,71 @@ bool GLRenderDevice::SetCubePixels(Texture* itexture, CubeMapFace face, const vo
 {
 	GLTexture* texture = static_cast<GLTexture*>(itexture);
 	texture->SetCubePixels(this, face, data);
+	if (data) mBytesUploaded += texture->GetDataSize();
 	return CheckGLError();
 }
 
 void* GLRenderDevice::MapPBO(Texture* itexture)
+{
+	GLTexture* texture = static_cast<GLTexture*>(itexture);
+	return MapPBORegion(texture, 0, 0, texture->GetWidth(), texture->GetHeight());
+}
+
+bool GLRenderDevice::UnmapPBO(Texture* itexture)
+{
+	return UnmapPBORegion(itexture);
+}
+
+void* GLRenderDevice::MapPBORegion(Texture* itexture, int x, int y, int width, int height)
 {
 	CheckContext();
 	GLTexture* texture = static_cast<GLTexture*>(itexture);
-	GLint pbo = texture->GetPBO(this);
+	if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > texture->GetWidth() || y + height > texture->GetHeight())
+	{
+		SetError("MapPBORegion: rectangle is outside the texture");
+		return nullptr;
+	}
+
+	// Only the bytes from the first to the last pixel of the rectangle are mapped. The pixels
+	// in between that are outside the rectangle become undefined, but are never uploaded.
+	GLint pbo = texture->GetNextPBO(this);
+	GLintptr pitch = (GLintptr)texture->GetWidth() * 4;
+	GLintptr offset = y * pitch + x * 4;
+	GLsizeiptr size = (height - 1) * pitch + width * 4;
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
-	void* buf = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	void* buf = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
 	bool result = CheckGLError();
 	if (!result && buf)
 	{
 		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 		buf = nullptr;
 	}
+
+	texture->PBORegionX = x;
+	texture->PBORegionY = y;
+	texture->PBORegionWidth = width;
+	texture->PBORegionHeight = height;
 	return buf;
 }
 
-bool GLRenderDevice::UnmapPBO(Texture* itexture)
+bool GLRenderDevice::UnmapPBORegion(Texture* itexture)
 {
 	CheckContext();
 	GLTexture* texture = static_cast<GLTexture*>(itexture);
+	GLuint handle = texture->GetTexture(this, false); // before binding the PBO, creating the texture unbinds it
 	GLint pbo = texture->GetPBO(this);
+	mTextureUploader->Cancel(texture);
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
 	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-	glBindTexture(GL_TEXTURE_2D, texture->GetTexture(this));
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture->GetWidth(), texture->GetHeight(), 0, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
-	bool result = CheckGLError();
-	mNeedApply = true;
-	mTexturesChanged = true;
-	return result;
+	BindTextureForUpdate(GL_TEXTURE_2D, handle);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, texture->GetWidth());
+	GLintptr offset = ((GLintptr)texture->PBORegionY * texture->GetWidth() + texture->PBORegionX) * 4;
+	glTexSubImage2D(GL_TEXTURE_2D, 0, texture->PBORegionX, texture->PBORegionY, texture->PBORegionWidth, texture->PBORegionHeight, GL_BGRA, GL_UNSIGNED_BYTE, (const void*)offset);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	texture->FencePBO();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	mBytesUploaded += (int64_t)texture->PBORegionWidth * texture->PBORegionHeight * 4;
+	return CheckGLError();
 }
 
 bool GLRenderDevice::InvalidateTexture(GLTexture* texture)
@@ -701,8 +1374,7 @@ bool GLRenderDevice::InvalidateTexture(GLTexture* texture)
 		CheckContext();
 		texture->Invalidate();
 		bool result = CheckGLError();
-		mNeedApply = true;
-		mTexturesChanged = true;
+		MarkTextureUnitsDirty(texture);
 		return result;
 	}
 	else
@@ -711,6 +1383,58 @@ bool GLRenderDevice::InvalidateTexture(GLTexture* texture)
 	}
 }
 
+GLuint GLRenderDevice::GetRecycledTexture(int width, int height, PixelFormat format, bool cube, int levels)
+{
+	for (auto it = mRecycledTextures.rbegin(); it != mRecycledTextures.rend(); ++it)
+	{
+		if (it->Width == width && it->Height == height && it->Format == format && it->Cube == cube && it->Levels == levels)
+		{
+			GLuint texture = it->Texture;
+			mRecycledTextureBytes -= it->Size;
+			mRecycledTextures.erase(std::next(it).base());
+			mTexturesReused++;
+			return texture;
+		}
+	}
+	return 0;
+}
+
+bool GLRenderDevice::RecycleTexture(GLuint texture, int width, int height, PixelFormat format, bool cube, int levels)
+{
+	// Mipmap levels add up to a third of the base level
+	int64_t size = (int64_t)width * height * GLTexture::ToBytesPerPixel(format) * (cube ? 6 : 1);
+	if (levels > 1) size += size / 3;
+	if (size > mTextureRecycleLimit)
+		return false;
+
+	RecycledTexture recycled;
+	recycled.Texture = texture;
+	recycled.Width = width;
+	recycled.Height = height;
+	recycled.Format = format;
+	recycled.Cube = cube;
+	recycled.Levels = levels;
+	recycled.Size = size;
+	mRecycledTextures.push_back(recycled);
+	mRecycledTextureBytes += size;
+
+	while (mRecycledTextureBytes > mTextureRecycleLimit)
+	{
+		DeleteTextureObject(mRecycledTextures.front().Texture);
+		mRecycledTextureBytes -= mRecycledTextures.front().Size;
+		mRecycledTextures.pop_front();
+	}
+	return true;
+}
+
+void GLRenderDevice::ReleaseRecycledTextures()
+{
+	for (RecycledTexture& recycled : mRecycledTextures)
+		DeleteTextureObject(recycled.Texture);
+	mRecycledTextures.clear();
+	mRecycledTextureBytes = 0;
+}
+
 bool GLRenderDevice::CheckGLError()
 {
 	if (!Context->IsCurrent())
@@ -722,10 +1446,39 @@ bool GLRenderDevice::CheckGLError()
 	if (error == GL_NO_ERROR)
 		return true;
 
-	SetError("OpenGL error: %d", error);
+	if (!ReportQueuedErrors())
+		SetError("OpenGL error: %d", error);
 	return false;
 }
 
+bool GLRenderDevice::CheckFrameErrors()
+{
+	if (ReportQueuedErrors())
+	{
+		glGetError();
+		return false;
+	}
+	return CheckGLError();
+}
+
+bool GLRenderDevice::ReportQueuedErrors()
+{
+	// The first error is reported, as that is usually what caused the rest
+	std::string message;
+	if (!mErrorQueue->Pop(message))
+		return false;
+
+	int more = mErrorQueue->TakeDroppedCount();
+	std::string next;
+	while (mErrorQueue->Pop(next)) more++;
+
+	if (more > 0)
+		SetError("%s (and %d more)", message.c_str(), more);
+	else
+		SetError("%s", message.c_str());
+	return true;
+}
+
 GLShader* GLRenderDevice::GetActiveShader()
 {
 	if (mAlphaTest)
@@ -763,6 +1516,9 @@ void GLRenderDevice::SetUniform(UniformName name, const void* values, int count,
 
 bool GLRenderDevice::ApplyChanges()
 {
+	mStateChanges += (int)mShaderChanged + (int)mVertexBufferChanged + (int)mIndexBufferChanged + (int)mUniformsChanged +
+		(int)mTexturesChanged + (int)mRasterizerStateChanged + (int)mBlendStateChanged + (int)mDepthStateChanged;
+
 	if (mShaderChanged && !ApplyShader()) return false;
 	if (mVertexBufferChanged && !ApplyVertexBuffer()) return false;
 	if (mIndexBufferChanged && !ApplyIndexBuffer()) return false;
@@ -779,7 +1535,7 @@ bool GLRenderDevice::ApplyChanges()
 bool GLRenderDevice::ApplyViewport()
 {
 	glViewport(0, 0, mViewportWidth, mViewportHeight);
-	return CheckGLError();
+	return CheckDrawError();
 }
 
 bool GLRenderDevice::ApplyShader()
@@ -794,7 +1550,7 @@ bool GLRenderDevice::ApplyShader()
 	curShader->Bind();
 	mShaderChanged = false;
 
-	return CheckGLError();
+	return CheckDrawError();
 }
 
 bool GLRenderDevice::ApplyRasterizerState()
@@ -814,7 +1570,7 @@ bool GLRenderDevice::ApplyRasterizerState()
 
 	mRasterizerStateChanged = false;
 
-	return CheckGLError();
+	return CheckDrawError();
 }
 
 bool GLRenderDevice::ApplyBlendState()
@@ -835,7 +1591,7 @@ bool GLRenderDevice::ApplyBlendState()
 
 	mBlendStateChanged = false;
 
-	return CheckGLError();
+	return CheckDrawError();
 }
 
 bool GLRenderDevice::ApplyDepthState()
@@ -853,7 +1609,7 @@ bool GLRenderDevice::ApplyDepthState()
 
 	mDepthStateChanged = false;
 
-	return CheckGLError();
+	return CheckDrawError();
 }
 
 bool GLRenderDevice::ApplyIndexBuffer()
@@ -869,17 +1625,17 @@ bool GLRenderDevice::ApplyIndexBuffer()
 
 	mIndexBufferChanged = false;
 
-	return CheckGLError();
+	return CheckDrawError();
 }
 
 bool GLRenderDevice::ApplyVertexBuffer()
 {
-	if (mVertexBuffer != -1)
-		glBindVertexArray(mSharedVertexBuffers[mVertexBuffer]->GetVAO());
+	if (mVertexBuffer)
+		BindVertexArray(mVertexBuffer->GetVAO(this));
 
 	mVertexBufferChanged = false;
 
-	return CheckGLError();
+	return CheckDrawError();
 }
 
 void GLRenderDevice::DeclareUniform(UniformName name, const char* glslname, UniformType type)
@@ -893,11 +1649,34 @@ void GLRenderDevice::DeclareUniform(UniformName name, const char* glslname, Unif
 	info.Type = type;
 }
 
+// Copies a uniform into the shader's std140 block, with each array element at the block's stride
+static void CopyToUniformBlock(const GLRenderDevice::UniformInfo& info, const GLShader::UniformBlockMember& member, uint8_t* block)
+{
+	static const int elementSizes[] = { 16, 12, 8, 4, 64, 16, 12, 8, 4, 16, 12, 8 };
+
+	int elementSize = std::min(elementSizes[(int)info.Type], member.ElementSize);
+	int count = 1;
+	if (info.Type == UniformType::Vec4fArray || info.Type == UniformType::Vec3fArray || info.Type == UniformType::Vec2fArray)
+		count = std::min(info.Count, member.ArraySize);
+	count = std::min(count, (int)(info.Data.size() / std::max(elementSizes[(int)info.Type], 1)));
+
+	const uint8_t* src = info.Data.data();
+	uint8_t* dest = block + member.Offset;
+	for (int i = 0; i < count; i++)
+	{
+		memcpy(dest, src, elementSize);
+		src += elementSizes[(int)info.Type];
+		dest += member.ArrayStride;
+	}
+}
+
 bool GLRenderDevice::ApplyUniforms()
 {
 	GLShader* shader = GetActiveShader();
 	GLuint* locations = shader->UniformLocations.data();
 	int* lastupdates = shader->UniformLastUpdates.data();
+	const GLShader::UniformBlockMember* members = shader->UniformBlockMembers.empty() ? nullptr : shader->UniformBlockMembers.data();
+	bool blockChanged = false;
 
 	int count = (int)mUniformInfo.size();
 	for (int i = 0; i < count; i++)
@@ -905,6 +1684,14 @@ bool GLRenderDevice::ApplyUniforms()
 		UniformInfo& info = mUniformInfo.data()[i];
 		if (lastupdates[i] != info.LastUpdate)
 		{
+			if (members && members[i].Offset >= 0)
+			{
+				CopyToUniformBlock(info, members[i], shader->UniformBlockData.data());
+				blockChanged = true;
+				lastupdates[i] = info.LastUpdate;
+				continue;
+			}
+
 			float* data = (float*)info.Data.data();
 			int* idata = (int*)info.Data.data();
 			GLuint location = locations[i];
@@ -928,54 +1715,158 @@ bool GLRenderDevice::ApplyUniforms()
 		}
 	}
 
+	if (members && (blockChanged || mUniformBlockShader != shader))
+	{
+		if (!ApplyUniformBlock(shader))
+			return false;
+	}
+
 	mUniformsChanged = false;
 
-	return CheckGLError();
+	return CheckDrawError();
+}
+
+bool GLRenderDevice::ApplyUniformBlock(GLShader* shader)
+{
+	// Every change gets a new range in the ring, so draws already issued keep the values they were given
+	int64_t size = (int64_t)shader->UniformBlockData.size();
+	int64_t offset = mUniformRing->Upload(shader->UniformBlockData.data(), size, mUniformBufferAlignment);
+	if (offset < 0)
+	{
+		SetError("Could not upload uniform block");
+		return false;
+	}
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, mUniformRing->GetBuffer(), (GLintptr)offset, (GLsizeiptr)size);
+	mUniformBlockShader = shader;
+	return true;
+}
+
+GLuint GLRenderDevice::GetTextureToDraw(GLTexture* texture)
+{
+	// Queued uploads are left to the per frame budget of Present, so drawing never waits for them
+	return texture->UploadPending ? mPlaceholderTexture : texture->GetTexture(this);
 }
 
 bool GLRenderDevice::ApplyTextures()
 {
-    bool hasError = false;
+    uint32_t dirty = mDirtyTextureUnits;
+
+    // Multi-bind replaces every binding in the range, so the units in between are rebound too
+    int first = 0, count = 0;
+    if (mMultiBind && dirty != 0)
+    {
+        while (!(dirty & (1 << first))) first++;
+        int last = 9;
+        while (!(dirty & (1 << last))) last--;
+        count = last - first + 1;
+        dirty = ((1 << count) - 1) << first;
+    }
+
+    // Creating a texture binds it to unit 0, so that is all done before anything is bound
+    // for the draw
+    for (int index = 0; index < 10; index++)
+    {
+        TextureUnit &unit = mTextureUnit[index];
+        if ((dirty & (1 << index)) && unit.Tex)
+            unit.Tex->GetTexture(this);
+    }
+
+    // Unit 0 was changed if anything was created above
+    dirty |= mDirtyTextureUnits & 1;
+    if (count > 0 && first > 0 && (dirty & 1))
+    {
+        count += first;
+        first = 0;
+        dirty = (1 << count) - 1;
+    }
+
+    if (count > 0)
+    {
+        GLuint textures[10], samplers[10];
+        for (int index = first; index < first + count; index++)
+        {
+            TextureUnit &unit = mTextureUnit[index];
+            GLuint texture = unit.Tex ? GetTextureToDraw(unit.Tex) : 0;
+            bool cube = unit.Tex && unit.Tex->IsCubeTexture();
+            textures[index - first] = texture;
+            samplers[index - first] = unit.Tex ? GetSampler(unit) : 0;
+
+            // A texture only replaces the binding of its own target, zero unbinds every target of the unit
+            if (texture != 0)
+            {
+                mBoundTextures[index][cube ? 1 : 0] = texture;
+            }
+            else
+            {
+                mBoundTextures[index][0] = 0;
+                mBoundTextures[index][1] = 0;
+            }
+            unit.SamplerHandle = samplers[index - first];
+        }
+        glBindTextures(first, count, textures);
+        glBindSamplers(first, count, samplers);
+    }
+
     for (int index = 0; index < 10; index++)
     {
         TextureUnit &unit = mTextureUnit[index];
-        if (unit.Tex)
+        if ((dirty & (1 << index)) && unit.Tex)
         {
-            glActiveTexture(GL_TEXTURE0 + index);
             GLenum target = unit.Tex->IsCubeTexture() ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
-    
-            glBindTexture(target, unit.Tex->GetTexture(this));
+            if (count == 0)
+                BindTexture(index, target, GetTextureToDraw(unit.Tex));
 
-            SamplerFilterKey key = GetSamplerFilterKey(unit.MagFilter, unit.MipFilter, unit.MaxAnisotropy);
-            SamplerFilter &filter = mSamplers[key];
-            GLuint &samplerHandle = filter.WrapModes[(int)unit.WrapMode];
-
-            if (samplerHandle == 0)
+            // Mipmaps of textures from the upload queue are only made once they are needed
+            if (!unit.Tex->UploadPending && unit.Tex->HasDirtyMipmaps() && unit.MipFilter != MipmapFilter::None)
             {
-                static const int wrapMode[] = { GL_REPEAT, GL_CLAMP_TO_EDGE };
-
-                glGenSamplers(1, &samplerHandle);
-                glSamplerParameteri(samplerHandle, GL_TEXTURE_MIN_FILTER, key.MinFilter);
-                glSamplerParameteri(samplerHandle, GL_TEXTURE_MAG_FILTER, key.MagFilter);
-                glSamplerParameteri(samplerHandle, GL_TEXTURE_WRAP_S, wrapMode[(int)unit.WrapMode]);
-                glSamplerParameteri(samplerHandle, GL_TEXTURE_WRAP_T, wrapMode[(int)unit.WrapMode]);
-                glSamplerParameteri(samplerHandle, GL_TEXTURE_WRAP_R, wrapMode[(int)unit.WrapMode]);
-                if (key.MaxAnisotropy > 0.0f)
-                    glSamplerParameterf(samplerHandle, GL_TEXTURE_MAX_ANISOTROPY_EXT, key.MaxAnisotropy);
+                SetActiveTexture(index);
+                glGenerateMipmap(target);
+                unit.Tex->SetMipmapsDirty(false);
             }
-        
-            if (unit.SamplerHandle != samplerHandle)
+
+            if (count == 0)
             {
-                unit.SamplerHandle = samplerHandle;
-                glBindSampler(index, samplerHandle);
+                GLuint sampler = GetSampler(unit);
+                if (unit.SamplerHandle != sampler)
+                {
+                    unit.SamplerHandle = sampler;
+                    glBindSampler(index, sampler);
+                }
             }
         }
-        
-        hasError |= CheckGLError();
     }
-    
+
+    mDirtyTextureUnits = 0;
     mTexturesChanged = false;
-    return hasError;
+    return CheckDrawError();
+}
+
+int GLRenderDevice::GetSamplerIndex(const TextureUnit& unit)
+{
+    // The min filter is derived from the mag filter and the mipmap filter, so it is not part of the key
+    int anisotropy = std::max(std::min((int)unit.MaxAnisotropy, (int)MaxSamplerAnisotropy), 0);
+    return ((anisotropy * 3 + (int)unit.MipFilter) * 2 + (int)unit.MagFilter) * 2 + (int)unit.WrapMode;
+}
+
+GLuint GLRenderDevice::GetSampler(const TextureUnit& unit)
+{
+    GLuint &sampler = mSamplers[GetSamplerIndex(unit)];
+    if (sampler == 0)
+    {
+        static const int wrapMode[] = { GL_REPEAT, GL_CLAMP_TO_EDGE };
+        GLint wrap = wrapMode[(int)unit.WrapMode];
+
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GetGLMinFilter(unit.MagFilter, unit.MipFilter));
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, unit.MagFilter == TextureFilter::Linear ? GL_LINEAR : GL_NEAREST);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_R, wrap);
+        if (unit.MaxAnisotropy >= 1.0f)
+            glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, (float)std::min((int)unit.MaxAnisotropy, (int)MaxSamplerAnisotropy));
+    }
+    return sampler;
 }
 
 std::mutex& GLRenderDevice::GetMutex()
@@ -26,6 +26,10 @@
 #include <list>
 
 class GLSharedVertexBuffer;
+class GLStreamBuffer;
+class GLTextureUploader;
+class GLFrameProfiler;
+class GLErrorQueue;
 class GLShader;
 class GLShaderManager;
 class GLVertexBuffer;
@@ -36,6 +40,8 @@ class GLRenderDevice : public RenderDevice
 {
 public:
 	GLRenderDevice(void* disp, void* window, bool debug);
+	GLRenderDevice(int width, int height, bool debug);
+	GLRenderDevice(std::unique_ptr<IOpenGLContext> context, bool debug);
 	~GLRenderDevice();
 
 	void DeclareUniform(UniformName name, const char* glslname, UniformType type) override;
@@ -60,11 +66,14 @@ public:
 	bool Draw(PrimitiveType type, int startIndex, int primitiveCount) override;
 	bool DrawIndexed(PrimitiveType type, int startIndex, int primitiveCount) override;
 	bool DrawData(PrimitiveType type, int startIndex, int primitiveCount, const void* data) override;
+	bool MultiDraw(PrimitiveType type, const DrawRange* ranges, int count) override;
+	bool ExecuteCommands(const void* commands, int64_t size) override;
 	bool StartRendering(bool clear, int backcolor, Texture* target, bool usedepthbuffer) override;
 	bool FinishRendering() override;
 	bool Present() override;
 	bool ClearTexture(int backcolor, Texture* texture) override;
 	bool CopyTexture(Texture* dst, CubeMapFace face) override;
+	bool ReadPixels(Texture* source, int x, int y, int width, int height, void* data) override;
 
 	bool SetVertexBufferData(VertexBuffer* buffer, void* data, int64_t size, VertexFormat format) override;
 	bool SetVertexBufferSubdata(VertexBuffer* buffer, int64_t destOffset, void* data, int64_t size) override;
@@ -72,12 +81,32 @@ public:
 
 	bool SetPixels(Texture* texture, const void* data) override;
 	bool SetCubePixels(Texture* texture, CubeMapFace face, const void* data) override;
+	bool QueuePixels(Texture* texture, const void* data) override;
 	void* MapPBO(Texture* texture) override;
 	bool UnmapPBO(Texture* texture) override;
+	void* MapPBORegion(Texture* texture, int x, int y, int width, int height) override;
+	bool UnmapPBORegion(Texture* texture) override;
+
+	int64_t GetCounter(RenderCounter counter) override;
+	void SetProfilerEnabled(bool enable) override;
+	void BeginScope(const char* name) override;
+	void EndScope() override;
+	int GetProfileResults(ProfileResult* results, int maxcount) override;
+	bool SaveProfileTrace(const char* filename) override;
 
 	bool InvalidateTexture(GLTexture* texture);
 
+	GLuint GetRecycledTexture(int width, int height, PixelFormat format, bool cube, int levels);
+	bool RecycleTexture(GLuint texture, int width, int height, PixelFormat format, bool cube, int levels);
+	void ReleaseRecycledTextures();
+
 	void GarbageCollectBuffer(int size, VertexFormat format);
+	void MoveVertexBuffers(VertexFormat format, int64_t maxBytes);
+	void ReleaseRetiredVertexBuffers(bool finalize = false);
+
+	bool AddDraw(PrimitiveType type, int startIndex, int primitiveCount);
+	bool FlushDraws();
+	bool IsUniformUnchanged(int name, const void* values, int bytesize);
 
 	bool ApplyViewport();
 	bool ApplyChanges();
@@ -85,7 +114,9 @@ public:
 	bool ApplyIndexBuffer();
 	bool ApplyShader();
 	bool ApplyUniforms();
+	bool ApplyUniformBlock(GLShader* shader);
 	bool ApplyTextures();
+	GLuint GetTextureToDraw(GLTexture* texture);
 	bool ApplyRasterizerState();
 	bool ApplyBlendState();
 	bool ApplyDepthState();
@@ -93,7 +124,18 @@ public:
 	void CheckContext();
 	void RequireContext();
 
+	void BindVertexArray(GLuint vao);
+	void DeleteVertexArray(GLuint vao);
+	void SetActiveTexture(int unit);
+	void BindTexture(int unit, GLenum target, GLuint texture);
+	void BindTextureForUpdate(GLenum target, GLuint texture);
+	void DeleteTextureObject(GLuint texture);
+	void MarkTextureUnitsDirty(GLTexture* texture);
+
 	bool CheckGLError();
+	bool CheckDrawError() { return !mValidate || CheckGLError(); }
+	bool CheckFrameErrors();
+	bool ReportQueuedErrors();
 
 	GLShader* GetActiveShader();
 
@@ -108,6 +150,9 @@ public:
 
 	std::unique_ptr<IOpenGLContext> Context;
 
+	// Stands in for the window when the context is headless
+	std::unique_ptr<GLTexture> mOffscreenTarget;
+
 	struct DeleteList
 	{
 		std::vector<GLVertexBuffer*> VertexBuffers;
@@ -126,36 +171,79 @@ public:
 		float MaxAnisotropy = 1;
 	} mTextureUnit[10];
 
-	struct SamplerFilterKey
-	{
-		GLuint MinFilter = 0;
-		GLuint MagFilter = 0;
-		float MaxAnisotropy = 0.0f;
+	// What is bound in the context, so that bindings never have to be queried and binding what
+	// is already bound can be skipped. Anything binding a vertex array or texture has to go
+	// through BindVertexArray and BindTexture for this to stay true.
+	GLuint mBoundVertexArray = 0;
+	int mActiveTextureUnit = 0;
+	GLuint mBoundTextures[10][2] = {}; // GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP of each unit
 
-		bool operator<(const SamplerFilterKey& b) const { return memcmp(this, &b, sizeof(SamplerFilterKey)) < 0; }
-		bool operator==(const SamplerFilterKey& b) const { return memcmp(this, &b, sizeof(SamplerFilterKey)) == 0; }
-		bool operator!=(const SamplerFilterKey& b) const { return memcmp(this, &b, sizeof(SamplerFilterKey)) != 0; }
-	};
-	
-	struct SamplerFilter
-    {
-        GLuint WrapModes[2] = { 0, 0 };
-    };
+	// Units whose texture or sampler state changed since ApplyTextures last ran, one bit each
+	uint32_t mDirtyTextureUnits = 0;
+	bool mMultiBind = false;
 
-  std::map<SamplerFilterKey, SamplerFilter> mSamplers;
+	// Sampler objects are shared by all units with the same filter, mipmap filter, anisotropy
+	// and wrap mode. The cache is indexed by GetSamplerIndex and filled as samplers are needed.
+	enum { MaxSamplerAnisotropy = 16, SamplerCacheSize = (MaxSamplerAnisotropy + 1) * 3 * 2 * 2 };
+	GLuint mSamplers[SamplerCacheSize] = {};
 
-  SamplerFilterKey GetSamplerFilterKey(TextureFilter filter, MipmapFilter mipFilter, float maxAnisotropy);
+	int GetSamplerIndex(const TextureUnit& unit);
+	GLuint GetSampler(const TextureUnit& unit);
 
-	int mVertexBuffer = -1;
+	GLSharedVertexBuffer* mVertexBuffer = nullptr;
 	int64_t mVertexBufferStartIndex = 0;
 
 	GLIndexBuffer* mIndexBuffer = nullptr;
 
 	std::unique_ptr<GLSharedVertexBuffer> mSharedVertexBuffers[2];
 
+	// Buffers replaced by GarbageCollectBuffer. Their vertex buffers are moved into
+	// mSharedVertexBuffers a few at a time by Present, after which they are kept until
+	// the GPU is done with them.
+	std::vector<std::unique_ptr<GLSharedVertexBuffer>> mCompactingVertexBuffers[2];
+	struct RetiredVertexBuffer
+	{
+		GLsync Fence = 0;
+		std::unique_ptr<GLSharedVertexBuffer> Buffer;
+	};
+	std::vector<RetiredVertexBuffer> mRetiredVertexBuffers;
+	int64_t mVertexCompactionBudget = 4 * 1024 * 1024; // bytes moved per Present
+	int64_t mVertexBytesMoved = 0;
+	int64_t mVertexCompactions = 0;
+
 	std::list<GLTexture*> mTextures;
+	std::unique_ptr<GLTextureUploader> mTextureUploader;
+	int64_t mTextureUploadBudget = 16 * 1024 * 1024; // bytes uploaded per Present
+	GLuint mPlaceholderTexture = 0; // drawn in place of textures whose queued upload isn't done yet
+
+	// Texture objects of destroyed textures, kept for a new texture of the same size and
+	// format. Most recently released last.
+	struct RecycledTexture
+	{
+		GLuint Texture = 0;
+		int Width = 0;
+		int Height = 0;
+		PixelFormat Format = {};
+		bool Cube = false;
+		int Levels = 0;
+		int64_t Size = 0;
+	};
+	std::list<RecycledTexture> mRecycledTextures;
+	int64_t mRecycledTextureBytes = 0;
+	int64_t mTextureRecycleLimit = 64 * 1024 * 1024; // bytes kept for reuse
+	int64_t mTexturesReused = 0;
 	std::list<GLIndexBuffer*> mIndexBuffers;
 
+	std::unique_ptr<GLFrameProfiler> mProfiler;
+	int64_t mDrawCalls = 0;
+	int64_t mStateChanges = 0;
+	int64_t mBytesUploaded = 0;
+
+	std::unique_ptr<GLErrorQueue> mErrorQueue;
+	bool mValidate = false;
+	bool mDebugLog = false;
+	bool mDebugCallback = false;
+
 	std::unique_ptr<GLShaderManager> mShaderManager;
 	ShaderName mShaderName = {};
 
@@ -170,8 +258,16 @@ public:
 
 	std::vector<UniformInfo> mUniformInfo;
 
-	GLuint mStreamVertexBuffer = 0;
-	GLuint mStreamVAO = 0;
+	// Draws collected by AddDraw, as absolute vertex ranges in the current vertex array
+	PrimitiveType mDrawBatchType = PrimitiveType::TriangleList;
+	std::vector<GLint> mDrawBatchFirst;
+	std::vector<GLsizei> mDrawBatchCount;
+	bool mMultiDrawIndirect = false;
+
+	std::unique_ptr<GLStreamBuffer> mStreamBuffer;
+	std::unique_ptr<GLStreamBuffer> mUniformRing;
+	GLint mUniformBufferAlignment = 256;
+	GLShader* mUniformBlockShader = nullptr;
 
 	Cull mCullMode = Cull::None;
 	FillMode mFillMode = FillMode::Solid;
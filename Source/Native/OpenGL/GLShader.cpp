@@ -80,11 +80,13 @@ void GLShader::CreateProgram(GLRenderDevice* device)
 {
 	const char* prefixNAT = R"(
 		#version 330
+		#define USE_UNIFORM_BLOCK
 		#line 1
 	)";
 	const char* prefixAT = R"(
 		#version 330
 		#define ALPHA_TEST
+		#define USE_UNIFORM_BLOCK
 		#line 1
 	)";
 
@@ -136,6 +138,71 @@ void GLShader::CreateProgram(GLRenderDevice* device)
 		if (!name.empty())
 			UniformLocations[i] = glGetUniformLocation(mProgram, name.c_str());
 	}
+
+	FindUniformBlock(device);
+}
+
+static int GetUniformElementSize(GLenum type)
+{
+	switch (type)
+	{
+	default: return 0;
+	case GL_FLOAT: case GL_INT: case GL_BOOL: return 4;
+	case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: return 8;
+	case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: return 12;
+	case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: return 16;
+	case GL_FLOAT_MAT4: return 64;
+	}
+}
+
+void GLShader::FindUniformBlock(GLRenderDevice* device)
+{
+	UniformBlockMembers.clear();
+	UniformBlockData.clear();
+
+	GLuint blockIndex = glGetUniformBlockIndex(mProgram, "Uniforms");
+	if (blockIndex == GL_INVALID_INDEX)
+		return;
+
+	glUniformBlockBinding(mProgram, blockIndex, 0);
+
+	GLint blockSize = 0;
+	glGetActiveUniformBlockiv(mProgram, blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &blockSize);
+	UniformBlockData.resize(blockSize);
+	UniformBlockMembers.resize(device->mUniformInfo.size());
+
+	int count = (int)UniformBlockMembers.size();
+	for (int i = 0; i < count; i++)
+	{
+		const auto& name = device->mUniformInfo[i].Name;
+		if (name.empty())
+			continue;
+
+		// Arrays are listed by the name of their first element
+		std::string arrayName = name + "[0]";
+		const GLchar* names[] = { name.c_str(), arrayName.c_str() };
+		GLuint index = GL_INVALID_INDEX;
+		glGetUniformIndices(mProgram, 1, names, &index);
+		if (index == GL_INVALID_INDEX)
+			glGetUniformIndices(mProgram, 1, names + 1, &index);
+		if (index == GL_INVALID_INDEX)
+			continue;
+
+		GLint block = -1, offset = 0, arrayStride = 0, arraySize = 0, type = 0;
+		glGetActiveUniformsiv(mProgram, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block);
+		glGetActiveUniformsiv(mProgram, 1, &index, GL_UNIFORM_OFFSET, &offset);
+		glGetActiveUniformsiv(mProgram, 1, &index, GL_UNIFORM_ARRAY_STRIDE, &arrayStride);
+		glGetActiveUniformsiv(mProgram, 1, &index, GL_UNIFORM_SIZE, &arraySize);
+		glGetActiveUniformsiv(mProgram, 1, &index, GL_UNIFORM_TYPE, &type);
+		if (block != (GLint)blockIndex)
+			continue;
+
+		UniformBlockMember& member = UniformBlockMembers[i];
+		member.Offset = offset;
+		member.ElementSize = GetUniformElementSize(type);
+		member.ArrayStride = arrayStride;
+		member.ArraySize = arraySize;
+	}
 }
 
 GLuint GLShader::CompileShader(const std::string& code, GLenum type)
@@ -38,9 +38,22 @@ public:
 	std::vector<int> UniformLastUpdates;
 	std::vector<GLuint> UniformLocations;
 
+	// Where each uniform is in the std140 "Uniforms" block. Empty if the shader has no such
+	// block, in which case all uniforms are set with glUniform* instead.
+	struct UniformBlockMember
+	{
+		int Offset = -1;
+		int ElementSize = 0;
+		int ArrayStride = 0;
+		int ArraySize = 0;
+	};
+	std::vector<UniformBlockMember> UniformBlockMembers;
+	std::vector<uint8_t> UniformBlockData;
+
 private:
 	void CreateProgram(GLRenderDevice* device);
 	GLuint CompileShader(const std::string& code, GLenum type);
+	void FindUniformBlock(GLRenderDevice* device);
 
 	std::string mIdentifier;
 	std::string mVertexText;
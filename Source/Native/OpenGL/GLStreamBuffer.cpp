@@ -0,0 +1,230 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "Precomp.h"
+#include "GLStreamBuffer.h"
+#include "GLVertexBuffer.h"
+#include "GLRenderDevice.h"
+
+void GLStreamBuffer::ReleaseResources()
+{
+	for (GLsync& fence : mFences)
+	{
+		if (fence)
+		{
+			glDeleteSync(fence);
+			fence = 0;
+		}
+	}
+
+	if (mBuffer)
+	{
+		if (mMapped)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			mMapped = nullptr;
+		}
+		glDeleteBuffers(1, &mBuffer);
+		mBuffer = 0;
+	}
+
+	if (mVAO)
+	{
+		mDevice->DeleteVertexArray(mVAO);
+		mVAO = 0;
+	}
+
+	mPos = 0;
+	mSegment = 0;
+	mUnfencedSegments = 0;
+}
+
+void GLStreamBuffer::Create()
+{
+	mPersistent = ogl_IsVersionGEQ(4, 4) || ogl_ext_ARB_buffer_storage;
+
+	glGenBuffers(1, &mBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+	if (mPersistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, mSize, nullptr, flags);
+		mMapped = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, mSize, flags));
+		if (!mMapped)
+			mPersistent = false;
+	}
+	if (!mPersistent)
+	{
+		// Buffer storage is immutable, so a failed persistent map needs a fresh buffer
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &mBuffer);
+		glGenBuffers(1, &mBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, mSize, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	// The VAO remembers the buffer, so it must be set up again for a new one
+	if (mVAO)
+		SetupVAO();
+
+	mPos = 0;
+	mSegment = 0;
+	for (int i = 0; i < SegmentCount; i++)
+	{
+		mLastUpload[i] = -1;
+		mFencedUploads[i] = 0;
+	}
+}
+
+void GLStreamBuffer::Grow(int64_t minsize)
+{
+	GLuint vao = mVAO;
+	mVAO = 0;
+	ReleaseResources();
+	mVAO = vao;
+
+	while (mSize < minsize)
+		mSize *= 2;
+	Create();
+}
+
+void GLStreamBuffer::SetupVAO()
+{
+	// This can happen in the middle of a draw, so the vertex array of the draw is bound again
+	GLuint oldvao = mDevice->mBoundVertexArray;
+	if (!mVAO)
+		glGenVertexArrays(1, &mVAO);
+	mDevice->BindVertexArray(mVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+	GLSharedVertexBuffer::SetupFlatVAO();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	mDevice->BindVertexArray(oldvao);
+}
+
+GLuint GLStreamBuffer::GetBuffer()
+{
+	if (!mBuffer)
+		Create();
+	return mBuffer;
+}
+
+GLuint GLStreamBuffer::GetVAO()
+{
+	if (!mBuffer)
+		Create();
+	if (!mVAO)
+		SetupVAO();
+	return mVAO;
+}
+
+void GLStreamBuffer::FenceSegment(int segment)
+{
+	if (mFences[segment])
+		glDeleteSync(mFences[segment]);
+	mFences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	mFencedUploads[segment] = mUploadCount;
+	mUnfencedSegments &= ~(1u << segment);
+}
+
+void GLStreamBuffer::EnterSegment(int segment, bool fenceNow)
+{
+	// A segment holding part of the upload being made is still going to be read by its draws
+	if (fenceNow)
+		FenceSegment(mSegment);
+	else
+		mUnfencedSegments |= 1u << mSegment;
+
+	mSegment = segment;
+
+	// The fence waited for must come after the draws of the last upload placed in the segment
+	assert(mLastUpload[segment] < mFencedUploads[segment]);
+
+	GLsync fence = mFences[segment];
+	if (fence)
+	{
+		GLenum result;
+		do
+		{
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000 * 1000 * 1000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		mFences[segment] = 0;
+	}
+}
+
+int64_t GLStreamBuffer::Upload(const void* data, int64_t size, int64_t align)
+{
+	if (!mBuffer)
+		Create();
+
+	if (size > mSize)
+		Grow(size);
+
+	int64_t segmentSize = mSize / SegmentCount;
+
+	// The draws of the previous upload have been issued now
+	for (int i = 0; i < SegmentCount; i++)
+	{
+		if (mUnfencedSegments & (1u << i))
+			FenceSegment(i);
+	}
+
+	int64_t pos = (mPos + align - 1) / align * align;
+	if (pos + size > mSize)
+	{
+		// Wrap around, the tail of the buffer is left unused this time
+		EnterSegment(0, true);
+		pos = 0;
+	}
+
+	int firstSegment = (int)(pos / segmentSize);
+	int lastSegment = (int)((pos + std::max(size, (int64_t)1) - 1) / segmentSize);
+	while (mSegment < lastSegment)
+		EnterSegment(mSegment + 1, false);
+
+	if (mPersistent)
+	{
+		memcpy(mMapped + pos, data, size);
+	}
+	else
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+		void* dest = glMapBufferRange(GL_COPY_WRITE_BUFFER, pos, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		if (dest)
+		{
+			memcpy(dest, data, size);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		if (!dest)
+			return -1;
+	}
+
+	for (int i = firstSegment; i <= lastSegment; i++)
+		mLastUpload[i] = mUploadCount;
+	mUploadCount++;
+
+	mPos = pos + size;
+	return pos;
+}
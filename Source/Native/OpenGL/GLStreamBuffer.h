@@ -0,0 +1,83 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include "../Backend.h"
+
+class GLRenderDevice;
+
+// Ring buffer for data which is only used once, such as the vertices of
+// RenderDevice::DrawData or the uniform block of a draw.
+//
+// The buffer is split into segments. A fence is inserted when writing moves
+// on from a segment, and writing only enters a segment again once the fence
+// from its previous use has signalled, so the GPU is never still reading the
+// range being overwritten. With ARB_buffer_storage the whole buffer stays
+// mapped, otherwise each upload maps its range unsynchronized.
+//
+// The draws reading an upload are issued after Upload returns, so when an
+// upload spans several segments, the fences of the segments it leaves are
+// only inserted by the next Upload. Callers must issue every draw reading an
+// upload before making the next one.
+class GLStreamBuffer
+{
+public:
+	GLStreamBuffer(GLRenderDevice* device, int64_t size) : mDevice(device), mSize(size) { }
+
+	void ReleaseResources();
+
+	// Copies data into the buffer and returns the offset it was placed at, a
+	// multiple of align. Returns -1 if the data could not be uploaded.
+	int64_t Upload(const void* data, int64_t size, int64_t align);
+
+	GLuint GetBuffer();
+
+	// Vertex array for drawing flat vertices from the buffer
+	GLuint GetVAO();
+
+	static const int SegmentCount = 4;
+
+private:
+	void Create();
+	void SetupVAO();
+	void Grow(int64_t minsize);
+	void EnterSegment(int segment, bool fenceNow);
+	void FenceSegment(int segment);
+
+	GLRenderDevice* mDevice = nullptr;
+	int64_t mSize = 0;
+	int64_t mPos = 0;
+	int mSegment = 0;
+
+	GLuint mBuffer = 0;
+	GLuint mVAO = 0;
+	uint8_t* mMapped = nullptr;
+	bool mPersistent = false;
+
+	GLsync mFences[SegmentCount] = {};
+	unsigned int mUnfencedSegments = 0; // bit mask of segments left by the last upload
+
+	// For checking the fences: uploads are numbered, and a fence covers every upload before mFencedUploads
+	int64_t mUploadCount = 0;
+	int64_t mLastUpload[SegmentCount];
+	int64_t mFencedUploads[SegmentCount];
+};
@@ -22,6 +22,7 @@
 #include "Precomp.h"
 #include "GLTexture.h"
 #include "GLRenderDevice.h"
+#include "GLTextureUploader.h"
 #include <stdexcept>
 
 GLTexture::GLTexture()
@@ -63,28 +64,31 @@ bool GLTexture::SetPixels(GLRenderDevice* device, const void* data)
 	GLint texture = GetTexture(device);
 	if (!texture) return false;
 
-	GLint oldActiveTex = GL_TEXTURE0;
-	glGetIntegerv(GL_ACTIVE_TEXTURE, &oldActiveTex);
-	glActiveTexture(GL_TEXTURE0);
-	GLint oldBinding = 0;
-	glGetIntegerv(GL_TEXTURE_BINDING_2D, &oldBinding);
+	// Anything still queued for the texture is older than this
+	device->mTextureUploader->Cancel(this);
 
-	//
-	
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-	glBindTexture(GL_TEXTURE_2D, mTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), data);
-	if (data != nullptr) 
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-	//
+	// The storage is immutable, so without data there is nothing to do
+	if (data == nullptr)
+		return true;
 
-	glBindTexture(GL_TEXTURE_2D, oldBinding);
-	glActiveTexture(oldActiveTex);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	device->BindTextureForUpdate(GL_TEXTURE_2D, mTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mWidth, mHeight, ToDataFormat(mFormat), ToDataType(mFormat), data);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	mMipmapsDirty = false;
 
 	return true;
 }
 
+void GLTexture::SetPixelsFromBuffer(GLRenderDevice* device)
+{
+	// The pixels come from the buffer bound to GL_PIXEL_UNPACK_BUFFER. Any unit may be active,
+	// as BindTextureForUpdate selects unit 0.
+	device->BindTextureForUpdate(GL_TEXTURE_2D, GetTexture(device));
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mWidth, mHeight, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
+	mMipmapsDirty = true;
+}
+
 bool GLTexture::SetCubePixels(GLRenderDevice* device, CubeMapFace face, const void* data)
 {
 	static GLint cubeMapFaceToGL[] =
@@ -95,44 +99,48 @@ bool GLTexture::SetCubePixels(GLRenderDevice* device, CubeMapFace face, const vo
 
 	GLint texture = GetTexture(device);
 	if (!texture) return false;
-
-	GLint oldActiveTex = GL_TEXTURE0;
-	glGetIntegerv(GL_ACTIVE_TEXTURE, &oldActiveTex);
-	glActiveTexture(GL_TEXTURE0);
-	GLint oldBinding = 0;
-	glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &oldBinding);
-
-	//
+	if (data == nullptr) return true;
 
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, mTexture);
-	glTexImage2D(cubeMapFaceToGL[(int)face], 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), data);
-	if (data != nullptr && face == CubeMapFace::NegativeZ)
+	device->BindTextureForUpdate(GL_TEXTURE_CUBE_MAP, mTexture);
+	glTexSubImage2D(cubeMapFaceToGL[(int)face], 0, 0, 0, mWidth, mHeight, ToDataFormat(mFormat), ToDataType(mFormat), data);
+	if (face == CubeMapFace::NegativeZ)
 		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-	//
-
-	glBindTexture(GL_TEXTURE_CUBE_MAP, oldBinding);
-	glActiveTexture(oldActiveTex);
-
 	return true;
 }
 
 void GLTexture::Invalidate()
 {
+	if (Device) Device->mTextureUploader->Cancel(this);
 	if (mDepthRenderbuffer) glDeleteRenderbuffers(1, &mDepthRenderbuffer);
 	if (mFramebuffer) glDeleteFramebuffers(1, &mFramebuffer);
-	if (mTexture) glDeleteTextures(1, &mTexture);
-	if (mPBO) glDeleteBuffers(1, &mPBO);
+	if (mTexture)
+	{
+		// Keep the texture object around for the next texture of the same size and format
+		if (!Device)
+			glDeleteTextures(1, &mTexture);
+		else if (!Device->RecycleTexture(mTexture, mWidth, mHeight, mFormat, mCubeTexture, mLevels))
+			Device->DeleteTextureObject(mTexture);
+	}
+	for (int i = 0; i < PBOCount; i++)
+	{
+		if (mPBOFences[i]) glDeleteSync(mPBOFences[i]);
+		if (mPBOs[i]) glDeleteBuffers(1, &mPBOs[i]);
+		mPBOFences[i] = 0;
+		mPBOs[i] = 0;
+	}
 	mDepthRenderbuffer = 0;
 	mFramebuffer = 0;
 	mTexture = 0;
-	mPBO = 0;
+	mPBOIndex = 0;
+	mLevels = 0;
+	mMipmapsDirty = false;
 	if (Device) Device->mTextures.erase(ItTexture);
 	Device = nullptr;
 }
 
-GLuint GLTexture::GetTexture(GLRenderDevice* device)
+GLuint GLTexture::GetTexture(GLRenderDevice* device, bool mipmaps)
 {
 	if (mTexture == 0)
 	{
@@ -142,41 +150,46 @@ GLuint GLTexture::GetTexture(GLRenderDevice* device)
 			ItTexture = Device->mTextures.insert(Device->mTextures.end(), this);
 		}
 
-		GLint oldActiveTex = GL_TEXTURE0;
-		glGetIntegerv(GL_ACTIVE_TEXTURE, &oldActiveTex);
-		glActiveTexture(GL_TEXTURE0);
+		mLevels = mipmaps ? GetMipLevels(mWidth, mHeight) : 1;
+		mTexture = Device->GetRecycledTexture(mWidth, mHeight, mFormat, mCubeTexture, mLevels);
+		if (mTexture != 0)
+			return mTexture;
+
+		GLenum target = IsCubeTexture() ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
 
 		glGenTextures(1, &mTexture);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		Device->BindTextureForUpdate(target, mTexture);
 
-		if (!IsCubeTexture())
+		if (ogl_IsVersionGEQ(4, 2) && glTexStorage2D)
 		{
-			GLint oldBinding = 0;
-			glGetIntegerv(GL_TEXTURE_BINDING_2D, &oldBinding);
-
-			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-			glBindTexture(GL_TEXTURE_2D, mTexture);
-			glTexImage2D(GL_TEXTURE_2D, 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
-
-			glBindTexture(GL_TEXTURE_2D, oldBinding);
+			glTexStorage2D(target, mLevels, ToInternalFormat(mFormat), mWidth, mHeight);
 		}
 		else
 		{
-			GLint oldBinding = 0;
-			glGetIntegerv(GL_TEXTURE_BINDING_CUBE_MAP, &oldBinding);
-
-			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, mTexture);
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, ToInternalFormat(mFormat), mWidth, mHeight, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
-
-			glBindTexture(GL_TEXTURE_CUBE_MAP, oldBinding);
+			// Specify every level once, the same layout glTexStorage2D gives. After this the
+			// texture is only ever updated with glTexSubImage2D.
+			static const GLenum faces[] =
+			{
+				GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
+				GL_TEXTURE_CUBE_MAP_NEGATIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
+			};
+			for (int level = 0; level < mLevels; level++)
+			{
+				int width = std::max(mWidth >> level, 1);
+				int height = std::max(mHeight >> level, 1);
+				if (!IsCubeTexture())
+				{
+					glTexImage2D(GL_TEXTURE_2D, level, ToInternalFormat(mFormat), width, height, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
+				}
+				else
+				{
+					for (GLenum face : faces)
+						glTexImage2D(face, level, ToInternalFormat(mFormat), width, height, 0, ToDataFormat(mFormat), ToDataType(mFormat), nullptr);
+				}
+			}
+			glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, mLevels - 1);
 		}
-
-		glActiveTexture(oldActiveTex);
 	}
 	return mTexture;
 }
@@ -187,7 +200,7 @@ GLuint GLTexture::GetFramebuffer(GLRenderDevice* device, bool usedepthbuffer)
 	{
 		if (mFramebuffer == 0)
 		{
-			GLuint texture = GetTexture(device);
+			GLuint texture = GetTexture(device, false);
 			glGenFramebuffers(1, &mFramebuffer);
 			glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
 			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
@@ -214,7 +227,7 @@ GLuint GLTexture::GetFramebuffer(GLRenderDevice* device, bool usedepthbuffer)
 
 		if (mFramebuffer == 0)
 		{
-			GLuint texture = GetTexture(device);
+			GLuint texture = GetTexture(device, false);
 			glGenFramebuffers(1, &mFramebuffer);
 			glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
 			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
@@ -229,7 +242,8 @@ GLuint GLTexture::GetFramebuffer(GLRenderDevice* device, bool usedepthbuffer)
 
 GLuint GLTexture::GetPBO(GLRenderDevice* device)
 {
-	if (mPBO == 0)
+	GLuint& pbo = mPBOs[mPBOIndex];
+	if (pbo == 0)
 	{
 		if (Device == nullptr)
 		{
@@ -237,12 +251,47 @@ GLuint GLTexture::GetPBO(GLRenderDevice* device)
 			ItTexture = Device->mTextures.insert(Device->mTextures.end(), this);
 		}
 
-		glGenBuffers(1, &mPBO);
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mPBO);
+		glGenBuffers(1, &pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
 		glBufferData(GL_PIXEL_UNPACK_BUFFER, mWidth*mHeight * 4, NULL, GL_STREAM_DRAW);
 	}
 
-	return mPBO;
+	return pbo;
+}
+
+GLuint GLTexture::GetNextPBO(GLRenderDevice* device)
+{
+	mPBOIndex = (mPBOIndex + 1) % PBOCount;
+
+	// Only waits if the upload from this buffer, PBOCount frames ago, still hasn't finished
+	GLsync& fence = mPBOFences[mPBOIndex];
+	if (fence)
+	{
+		GLenum result;
+		do
+		{
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000 * 1000 * 1000);
+		} while (result == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	return GetPBO(device);
+}
+
+void GLTexture::FencePBO()
+{
+	GLsync& fence = mPBOFences[mPBOIndex];
+	if (fence) glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+int GLTexture::GetMipLevels(int width, int height)
+{
+	int levels = 1;
+	for (int size = std::max(width, height); size > 1; size >>= 1)
+		levels++;
+	return levels;
 }
 
 GLint GLTexture::ToInternalFormat(PixelFormat format)
@@ -298,3 +347,21 @@ GLenum GLTexture::ToDataType(PixelFormat format)
 	};
 	return cvt[(int)format];
 }
+
+int GLTexture::ToBytesPerPixel(PixelFormat format)
+{
+	static int cvt[] =
+	{
+		4,
+		4,
+		8,
+		16,
+		4,
+		8,
+		12,
+		16,
+		8,
+		4
+	};
+	return cvt[(int)format];
+}
@@ -36,36 +36,64 @@ public:
 
 	void Set2DImage(int width, int height, PixelFormat format) override;
 	void SetCubeImage(int size, PixelFormat format) override;
+	bool IsUploadPending() override { return UploadPending; }
 
 	bool SetPixels(GLRenderDevice* device, const void* data);
 	bool SetCubePixels(GLRenderDevice* device, CubeMapFace face, const void* data);
+	void SetPixelsFromBuffer(GLRenderDevice* device);
 
 	bool IsCubeTexture() const { return mCubeTexture; }
 	int GetWidth() const { return mWidth; }
 	int GetHeight() const { return mHeight; }
+	int64_t GetDataSize() const { return (int64_t)mWidth * mHeight * ToBytesPerPixel(mFormat); }
+	PixelFormat GetFormat() const { return mFormat; }
+
+	bool HasDirtyMipmaps() const { return mMipmapsDirty; }
+	void SetMipmapsDirty(bool value) { mMipmapsDirty = value; }
 
 	bool IsTextureCreated() const { return mTexture; }
 	void Invalidate();
 
-	GLuint GetTexture(GLRenderDevice* device);
+	// Render targets and plotter textures pass false for mipmaps to get a single level
+	GLuint GetTexture(GLRenderDevice* device, bool mipmaps = true);
 	GLuint GetFramebuffer(GLRenderDevice* device, bool usedepthbuffer);
 	GLuint GetPBO(GLRenderDevice* device);
+	GLuint GetNextPBO(GLRenderDevice* device);
+	void FencePBO();
+
+	// The rectangle mapped by GLRenderDevice::MapPBORegion
+	int PBORegionX = 0;
+	int PBORegionY = 0;
+	int PBORegionWidth = 0;
+	int PBORegionHeight = 0;
 
 	GLRenderDevice* Device = nullptr;
 	std::list<GLTexture*>::iterator ItTexture;
+	bool UploadPending = false;
+
+	static int ToBytesPerPixel(PixelFormat format);
 
 private:
 	static GLint ToInternalFormat(PixelFormat format);
 	static GLenum ToDataFormat(PixelFormat format);
 	static GLenum ToDataType(PixelFormat format);
+	static int GetMipLevels(int width, int height);
 
 	int mWidth = 0;
 	int mHeight = 0;
 	PixelFormat mFormat = {};
+	int mLevels = 0;
 	bool mCubeTexture = false;
 	bool mPBOTexture = false;
+	bool mMipmapsDirty = false;
 	GLuint mTexture = 0;
 	GLuint mFramebuffer = 0;
 	GLuint mDepthRenderbuffer = 0;
-	GLuint mPBO = 0;
+
+	// MapPBO and UnmapPBO use these in turn. Each is fenced after its upload, so mapping the
+	// next one does not have to wait for the GPU to finish reading the previous one.
+	enum { PBOCount = 3 };
+	GLuint mPBOs[PBOCount] = {};
+	GLsync mPBOFences[PBOCount] = {};
+	int mPBOIndex = 0;
 };
@@ -0,0 +1,195 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "Precomp.h"
+#include "GLTextureUploader.h"
+#include "GLTexture.h"
+#include "GLRenderDevice.h"
+
+void GLTextureUploader::ReleaseResources()
+{
+	for (Upload& upload : mQueue)
+	{
+		upload.Texture->UploadPending = false;
+		DeleteBuffer(upload.Buffer);
+	}
+	mQueue.clear();
+	mQueuedBytes = 0;
+
+	for (PixelBuffer& buffer : mBusyBuffers) DeleteBuffer(buffer);
+	for (PixelBuffer& buffer : mFreeBuffers) DeleteBuffer(buffer);
+	mBusyBuffers.clear();
+	mFreeBuffers.clear();
+}
+
+bool GLTextureUploader::Queue(GLRenderDevice* device, GLTexture* texture, const void* data)
+{
+	// A newer image replaces the one still waiting
+	Cancel(texture);
+
+	if (!texture->GetTexture(device))
+		return false;
+
+	Upload upload;
+	upload.Texture = texture;
+	upload.Size = texture->GetDataSize();
+	upload.Buffer = GetFreeBuffer(upload.Size);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.Buffer.Buffer);
+	void* dest = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, upload.Size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (dest)
+	{
+		memcpy(dest, data, upload.Size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (!dest)
+	{
+		mFreeBuffers.push_back(upload.Buffer);
+		return false;
+	}
+
+	mQueue.push_back(upload);
+	mQueuedBytes += upload.Size;
+	texture->UploadPending = true;
+	return true;
+}
+
+void GLTextureUploader::Cancel(GLTexture* texture)
+{
+	if (!texture->UploadPending)
+		return;
+
+	for (auto it = mQueue.begin(); it != mQueue.end(); ++it)
+	{
+		if (it->Texture == texture)
+		{
+			mQueuedBytes -= it->Size;
+			mFreeBuffers.push_back(it->Buffer);
+			mQueue.erase(it);
+			break;
+		}
+	}
+	texture->UploadPending = false;
+}
+
+void GLTextureUploader::Process(GLRenderDevice* device, int64_t maxBytes)
+{
+	ReleaseFinishedBuffers();
+
+	mLastFrameBytesUploaded = 0;
+	if (mQueue.empty())
+		return;
+
+	// At least one texture is uploaded per frame, even if it is larger than the budget
+	int64_t uploaded = 0;
+	while (!mQueue.empty() && (uploaded == 0 || uploaded + mQueue.front().Size <= maxBytes))
+	{
+		uploaded += mQueue.front().Size;
+		Transfer(device, mQueue.front());
+		mQueue.pop_front();
+	}
+
+	mLastFrameBytesUploaded = uploaded;
+	mBytesUploaded += uploaded;
+}
+
+void GLTextureUploader::Transfer(GLRenderDevice* device, Upload& upload)
+{
+	mQueuedBytes -= upload.Size;
+	upload.Texture->UploadPending = false;
+	device->mBytesUploaded += upload.Size;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.Buffer.Buffer);
+	upload.Texture->SetPixelsFromBuffer(device);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	// Units still showing the placeholder get the texture at the next draw
+	device->MarkTextureUnitsDirty(upload.Texture);
+
+	upload.Buffer.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	mBusyBuffers.push_back(upload.Buffer);
+}
+
+GLTextureUploader::PixelBuffer GLTextureUploader::GetFreeBuffer(int64_t size)
+{
+	ReleaseFinishedBuffers();
+
+	// Use the smallest free buffer the pixels fit in, unless it is much too large
+	auto best = mFreeBuffers.end();
+	for (auto it = mFreeBuffers.begin(); it != mFreeBuffers.end(); ++it)
+	{
+		if (it->Size >= size && it->Size <= size * 4 && (best == mFreeBuffers.end() || it->Size < best->Size))
+			best = it;
+	}
+
+	if (best != mFreeBuffers.end())
+	{
+		PixelBuffer buffer = *best;
+		mFreeBuffers.erase(best);
+		return buffer;
+	}
+
+	PixelBuffer buffer;
+	buffer.Size = size;
+	glGenBuffers(1, &buffer.Buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.Buffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return buffer;
+}
+
+void GLTextureUploader::ReleaseFinishedBuffers()
+{
+	auto it = mBusyBuffers.begin();
+	while (it != mBusyBuffers.end())
+	{
+		if (glClientWaitSync(it->Fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+		{
+			glDeleteSync(it->Fence);
+			it->Fence = 0;
+			mFreeBuffers.push_back(*it);
+			it = mBusyBuffers.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	// Keep the most recently used buffers only
+	while (mFreeBuffers.size() > MaxFreeBuffers)
+	{
+		DeleteBuffer(mFreeBuffers.front());
+		mFreeBuffers.erase(mFreeBuffers.begin());
+	}
+}
+
+void GLTextureUploader::DeleteBuffer(PixelBuffer& buffer)
+{
+	if (buffer.Fence)
+		glDeleteSync(buffer.Fence);
+	if (buffer.Buffer)
+		glDeleteBuffers(1, &buffer.Buffer);
+	buffer.Fence = 0;
+	buffer.Buffer = 0;
+}
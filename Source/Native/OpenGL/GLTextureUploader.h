@@ -0,0 +1,82 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include "../Backend.h"
+#include <list>
+#include <vector>
+
+class GLRenderDevice;
+class GLTexture;
+
+// Queue for texture uploads which don't have to be visible right away, such
+// as the images DataManager loads. The pixels are copied into a pixel buffer
+// when queued, and Process transfers a limited number of bytes per frame into
+// the textures. Until then draws use a placeholder in place of the texture.
+// Mipmaps are left for the first draw that uses the texture.
+//
+// Pixel buffers are reused once the fence placed after their upload has
+// signalled.
+class GLTextureUploader
+{
+public:
+	void ReleaseResources();
+
+	bool Queue(GLRenderDevice* device, GLTexture* texture, const void* data);
+	void Cancel(GLTexture* texture);
+	void Process(GLRenderDevice* device, int64_t maxBytes);
+
+	int GetQueueDepth() const { return (int)mQueue.size(); }
+	int64_t GetQueuedBytes() const { return mQueuedBytes; }
+	int64_t GetBytesUploaded() const { return mBytesUploaded; }
+	int64_t GetLastFrameBytesUploaded() const { return mLastFrameBytesUploaded; }
+
+	static const int MaxFreeBuffers = 16;
+
+private:
+	struct PixelBuffer
+	{
+		GLuint Buffer = 0;
+		int64_t Size = 0;
+		GLsync Fence = 0;
+	};
+
+	struct Upload
+	{
+		GLTexture* Texture = nullptr;
+		PixelBuffer Buffer;
+		int64_t Size = 0;
+	};
+
+	void Transfer(GLRenderDevice* device, Upload& upload);
+	PixelBuffer GetFreeBuffer(int64_t size);
+	void ReleaseFinishedBuffers();
+	static void DeleteBuffer(PixelBuffer& buffer);
+
+	std::list<Upload> mQueue;
+	std::vector<PixelBuffer> mBusyBuffers;
+	std::vector<PixelBuffer> mFreeBuffers;
+
+	int64_t mQueuedBytes = 0;
+	int64_t mBytesUploaded = 0;
+	int64_t mLastFrameBytesUploaded = 0;
+};
@@ -24,6 +24,11 @@
 #include "GLShader.h"
 #include "GLRenderDevice.h"
 
+GLSharedVertexBuffer::GLSharedVertexBuffer(VertexFormat format, int size) : Format(format), Size(size)
+{
+	AddFreeRange(0, size);
+}
+
 GLuint GLSharedVertexBuffer::GetBuffer()
 {
 	if (mBuffer == 0)
@@ -31,12 +36,12 @@ GLuint GLSharedVertexBuffer::GetBuffer()
 	return mBuffer;
 }
 
-GLuint GLSharedVertexBuffer::GetVAO()
+GLuint GLSharedVertexBuffer::GetVAO(GLRenderDevice* device)
 {
 	if (!mVAO)
 	{
 		glGenVertexArrays(1, &mVAO);
-		glBindVertexArray(mVAO);
+		device->BindVertexArray(mVAO);
 		glBindBuffer(GL_ARRAY_BUFFER, GetBuffer());
 		if (Format == VertexFormat::Flat)
 			SetupFlatVAO();
@@ -47,6 +52,21 @@ GLuint GLSharedVertexBuffer::GetVAO()
 	return mVAO;
 }
 
+void GLSharedVertexBuffer::ReleaseResources(GLRenderDevice* device)
+{
+	if (mVAO)
+	{
+		device->DeleteVertexArray(mVAO);
+		mVAO = 0;
+	}
+
+	if (mBuffer)
+	{
+		glDeleteBuffers(1, &mBuffer);
+		mBuffer = 0;
+	}
+}
+
 void GLSharedVertexBuffer::SetupFlatVAO()
 {
 	glEnableVertexAttribArray((int)DeclarationUsage::Position);
@@ -69,6 +89,82 @@ void GLSharedVertexBuffer::SetupWorldVAO()
 	glVertexAttribPointer((int)DeclarationUsage::Normal, 3, GL_FLOAT, GL_FALSE, VertexBuffer::WorldStride, (const void*)24);
 }
 
+int GLSharedVertexBuffer::GetAllocSize(int size) const
+{
+	// Ranges are kept whole vertices apart so that every offset is a valid start index
+	int stride = (Format == VertexFormat::Flat ? VertexBuffer::FlatStride : VertexBuffer::WorldStride);
+	return (size + stride - 1) / stride * stride;
+}
+
+int GLSharedVertexBuffer::Alloc(int size)
+{
+	size = GetAllocSize(size);
+	if (size == 0)
+		return 0;
+
+	auto it = mFreeBySize.lower_bound(size);
+	if (it == mFreeBySize.end())
+		return -1;
+
+	int offset = it->second;
+	int freeSize = it->first;
+	RemoveFreeRange(mFreeRanges.find(offset));
+	if (freeSize > size)
+		AddFreeRange(offset + size, freeSize - size);
+	return offset;
+}
+
+void GLSharedVertexBuffer::Free(int offset, int size)
+{
+	size = GetAllocSize(size);
+	if (size == 0)
+		return;
+
+	// Merge with the free ranges on either side
+	auto next = mFreeRanges.lower_bound(offset);
+	if (next != mFreeRanges.end() && next->first == offset + size)
+	{
+		size += next->second;
+		RemoveFreeRange(next);
+	}
+
+	next = mFreeRanges.lower_bound(offset);
+	if (next != mFreeRanges.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset)
+		{
+			offset = prev->first;
+			size += prev->second;
+			RemoveFreeRange(prev);
+		}
+	}
+
+	AddFreeRange(offset, size);
+}
+
+void GLSharedVertexBuffer::AddFreeRange(int offset, int size)
+{
+	mFreeRanges[offset] = size;
+	mFreeBySize.insert({ size, offset });
+	mFreeSize += size;
+}
+
+void GLSharedVertexBuffer::RemoveFreeRange(std::map<int, int>::iterator it)
+{
+	auto range = mFreeBySize.equal_range(it->second);
+	for (auto sizeIt = range.first; sizeIt != range.second; ++sizeIt)
+	{
+		if (sizeIt->second == it->first)
+		{
+			mFreeBySize.erase(sizeIt);
+			break;
+		}
+	}
+	mFreeSize -= it->second;
+	mFreeRanges.erase(it);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 GLVertexBuffer::~GLVertexBuffer()
@@ -80,7 +176,9 @@ void GLVertexBuffer::Finalize()
 {
 	if (Device)
 	{
-		Device->mSharedVertexBuffers[(int)Format]->VertexBuffers.erase(ListIt);
+		SharedBuffer->Free(BufferOffset, Size);
+		SharedBuffer->VertexBuffers.erase(ListIt);
+		SharedBuffer = nullptr;
 		Device = nullptr;
 	}
 }
@@ -22,6 +22,7 @@
 #pragma once
 
 #include <list>
+#include <map>
 
 #include "../Backend.h"
 
@@ -31,14 +32,23 @@ class GLVertexBuffer;
 class GLSharedVertexBuffer
 {
 public:
-	GLSharedVertexBuffer(VertexFormat format, int size) : Format(format), Size(size) { }
+	GLSharedVertexBuffer(VertexFormat format, int size);
 
 	GLuint GetBuffer();
-	GLuint GetVAO();
+	GLuint GetVAO(GLRenderDevice* device);
+	void ReleaseResources(GLRenderDevice* device);
+
+	// Finds room for a vertex buffer, using the smallest free range it fits in.
+	// Returns -1 if no free range is large enough.
+	int Alloc(int size);
+	void Free(int offset, int size);
+
+	int GetFreeSize() const { return mFreeSize; }
+	int GetLargestFree() const { return mFreeBySize.empty() ? 0 : mFreeBySize.rbegin()->first; }
+	int GetFreeRangeCount() const { return (int)mFreeRanges.size(); }
 
 	VertexFormat Format = VertexFormat::Flat;
 
-	int NextPos = 0;
 	int Size = 0;
 
 	std::list<GLVertexBuffer*> VertexBuffers;
@@ -47,8 +57,16 @@ public:
 	static void SetupWorldVAO();
 	
 private:
+	int GetAllocSize(int size) const;
+	void AddFreeRange(int offset, int size);
+	void RemoveFreeRange(std::map<int, int>::iterator it);
+
 	GLuint mBuffer = 0;
 	GLuint mVAO = 0;
+
+	std::map<int, int> mFreeRanges; // offset -> size
+	std::multimap<int, int> mFreeBySize; // size -> offset
+	int mFreeSize = 0;
 };
 
 class GLVertexBuffer : public VertexBuffer
@@ -61,6 +79,7 @@ public:
 	VertexFormat Format = VertexFormat::Flat;
 
 	GLRenderDevice* Device = nullptr;
+	GLSharedVertexBuffer* SharedBuffer = nullptr;
 	std::list<GLVertexBuffer*>::iterator ListIt;
 
 	int BufferOffset = 0;
@@ -351,6 +351,12 @@ std::unique_ptr<IOpenGLContext> IOpenGLContext::Create(void* disp, void* window)
 	return ctx;
 }
 
+std::unique_ptr<IOpenGLContext> IOpenGLContext::CreateHeadless(int width, int height)
+{
+	SetError("Headless OpenGL contexts are not supported on this platform");
+	return nullptr;
+}
+
 #elif defined(__APPLE__)
 
 class OpenGLContext : public IOpenGLContext
@@ -379,11 +385,19 @@ std::unique_ptr<IOpenGLContext> IOpenGLContext::Create(void* disp, void* window)
 	return ctx;
 }
 
+std::unique_ptr<IOpenGLContext> IOpenGLContext::CreateHeadless(int width, int height)
+{
+	SetError("Headless OpenGL contexts are not supported on this platform");
+	return nullptr;
+}
+
 #else
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <GL/glx.h>
+#include <dlfcn.h>
+#include <cstring>
 
 #define GLFUNC
 
@@ -927,6 +941,283 @@ GLXContext OpenGLContext::create_context_glx_1_3(GLXContext shared_context)
 	return context;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+
+// libEGL is loaded with dlopen, so the few EGL types and values used here are declared
+// locally rather than making the EGL headers a build dependency
+typedef void* EGLDisplay;
+typedef void* EGLConfig;
+typedef void* EGLContext;
+typedef void* EGLSurface;
+typedef void* EGLNativeDisplayType;
+typedef int32_t EGLint;
+typedef unsigned int EGLBoolean;
+typedef unsigned int EGLenum;
+
+#define EGL_NO_DISPLAY                          ((EGLDisplay)0)
+#define EGL_NO_CONTEXT                          ((EGLContext)0)
+#define EGL_NO_SURFACE                          ((EGLSurface)0)
+#define EGL_DEFAULT_DISPLAY                     ((EGLNativeDisplayType)0)
+#define EGL_DONT_CARE                           ((EGLint)-1)
+#define EGL_PBUFFER_BIT                         0x0001
+#define EGL_OPENGL_BIT                          0x0008
+#define EGL_ALPHA_SIZE                          0x3021
+#define EGL_BLUE_SIZE                           0x3022
+#define EGL_GREEN_SIZE                          0x3023
+#define EGL_RED_SIZE                            0x3024
+#define EGL_SURFACE_TYPE                        0x3033
+#define EGL_NONE                                0x3038
+#define EGL_RENDERABLE_TYPE                     0x3040
+#define EGL_EXTENSIONS                          0x3055
+#define EGL_HEIGHT                              0x3056
+#define EGL_WIDTH                               0x3057
+#define EGL_OPENGL_API                          0x30A2
+#define EGL_CONTEXT_MAJOR_VERSION_KHR           0x3098
+#define EGL_CONTEXT_MINOR_VERSION_KHR           0x30FB
+#define EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR     0x30FD
+#define EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR 0x0001
+#define EGL_PLATFORM_SURFACELESS_MESA           0x31DD
+
+#define GL_EGL_LIBRARY "libEGL.so.1"
+
+class GL_EGLFunctions
+{
+public:
+	typedef EGLDisplay(GLFUNC* ptr_eglGetDisplay)(EGLNativeDisplayType display_id);
+	typedef EGLDisplay(GLFUNC* ptr_eglGetPlatformDisplayEXT)(EGLenum platform, void* native_display, const EGLint* attrib_list);
+	typedef EGLBoolean(GLFUNC* ptr_eglInitialize)(EGLDisplay dpy, EGLint* major, EGLint* minor);
+	typedef EGLBoolean(GLFUNC* ptr_eglTerminate)(EGLDisplay dpy);
+	typedef const char* (GLFUNC* ptr_eglQueryString)(EGLDisplay dpy, EGLint name);
+	typedef EGLBoolean(GLFUNC* ptr_eglBindAPI)(EGLenum api);
+	typedef EGLBoolean(GLFUNC* ptr_eglChooseConfig)(EGLDisplay dpy, const EGLint* attrib_list, EGLConfig* configs, EGLint config_size, EGLint* num_config);
+	typedef EGLContext(GLFUNC* ptr_eglCreateContext)(EGLDisplay dpy, EGLConfig config, EGLContext share_context, const EGLint* attrib_list);
+	typedef EGLBoolean(GLFUNC* ptr_eglDestroyContext)(EGLDisplay dpy, EGLContext ctx);
+	typedef EGLSurface(GLFUNC* ptr_eglCreatePbufferSurface)(EGLDisplay dpy, EGLConfig config, const EGLint* attrib_list);
+	typedef EGLBoolean(GLFUNC* ptr_eglDestroySurface)(EGLDisplay dpy, EGLSurface surface);
+	typedef EGLBoolean(GLFUNC* ptr_eglMakeCurrent)(EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx);
+	typedef EGLContext(GLFUNC* ptr_eglGetCurrentContext)(void);
+	typedef void (*(GLFUNC* ptr_eglGetProcAddress)(const char* procname))(void);
+
+public:
+	ptr_eglGetDisplay eglGetDisplay = nullptr;
+	ptr_eglGetPlatformDisplayEXT eglGetPlatformDisplayEXT = nullptr;
+	ptr_eglInitialize eglInitialize = nullptr;
+	ptr_eglTerminate eglTerminate = nullptr;
+	ptr_eglQueryString eglQueryString = nullptr;
+	ptr_eglBindAPI eglBindAPI = nullptr;
+	ptr_eglChooseConfig eglChooseConfig = nullptr;
+	ptr_eglCreateContext eglCreateContext = nullptr;
+	ptr_eglDestroyContext eglDestroyContext = nullptr;
+	ptr_eglCreatePbufferSurface eglCreatePbufferSurface = nullptr;
+	ptr_eglDestroySurface eglDestroySurface = nullptr;
+	ptr_eglMakeCurrent eglMakeCurrent = nullptr;
+	ptr_eglGetCurrentContext eglGetCurrentContext = nullptr;
+	ptr_eglGetProcAddress eglGetProcAddress = nullptr;
+};
+
+GL_EGLFunctions egl_global;
+
+// Context without a window, for running the renderer on machines without a display. It uses
+// Mesa's surfaceless platform when available, so no X server is needed. There is no default
+// framebuffer: GLRenderDevice renders to an offscreen texture of GetWidth() x GetHeight() instead.
+class HeadlessOpenGLContext : public IOpenGLContext
+{
+public:
+	HeadlessOpenGLContext(int width, int height);
+	~HeadlessOpenGLContext();
+
+	void MakeCurrent() override;
+	void ClearCurrent() override;
+	void SwapBuffers() override;
+	bool IsCurrent() override;
+	bool IsHeadless() const override { return true; }
+
+	int GetWidth() const override { return width; }
+	int GetHeight() const override { return height; }
+
+	bool IsValid() const { return context != EGL_NO_CONTEXT; }
+
+private:
+	void CreateContext();
+	static bool HasExtension(const char* extensions, const char* name);
+
+	GL_EGLFunctions egl;
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	EGLSurface surface = EGL_NO_SURFACE;
+
+	int width = 0;
+	int height = 0;
+
+	void* egl_lib_handle = nullptr;
+};
+
+HeadlessOpenGLContext::HeadlessOpenGLContext(int width, int height) : width(width), height(height)
+{
+	try
+	{
+		CreateContext();
+		egl_global = egl;
+	}
+	catch (const std::exception& e)
+	{
+		SetError("Could not create headless OpenGL context: %s", e.what());
+	}
+
+	if (context != EGL_NO_CONTEXT)
+	{
+		MakeCurrent();
+		static OpenGLLoadFunctions loadFunctions;
+		ClearCurrent();
+	}
+}
+
+HeadlessOpenGLContext::~HeadlessOpenGLContext()
+{
+	if (display != EGL_NO_DISPLAY)
+	{
+		if (context != EGL_NO_CONTEXT)
+		{
+			if (egl.eglGetCurrentContext() == context)
+				ClearCurrent();
+			egl.eglDestroyContext(display, context);
+		}
+		if (surface != EGL_NO_SURFACE)
+			egl.eglDestroySurface(display, surface);
+		egl.eglTerminate(display);
+	}
+
+	if (egl_lib_handle)
+		dlclose(egl_lib_handle);
+}
+
+void HeadlessOpenGLContext::MakeCurrent()
+{
+	egl.eglMakeCurrent(display, surface, surface, context);
+}
+
+void HeadlessOpenGLContext::ClearCurrent()
+{
+	egl.eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void HeadlessOpenGLContext::SwapBuffers()
+{
+	// Nothing to show, but the frame should still be submitted
+	glFlush();
+}
+
+bool HeadlessOpenGLContext::IsCurrent()
+{
+	return egl.eglGetCurrentContext() == context;
+}
+
+bool HeadlessOpenGLContext::HasExtension(const char* extensions, const char* name)
+{
+	size_t len = strlen(name);
+	for (const char* ext = extensions ? strstr(extensions, name) : nullptr; ext; ext = strstr(ext + len, name))
+	{
+		if ((ext == extensions || ext[-1] == ' ') && (ext[len] == ' ' || ext[len] == 0))
+			return true;
+	}
+	return false;
+}
+
+void HeadlessOpenGLContext::CreateContext()
+{
+	// RTLD_NODELETE keeps the library loaded after dlclose, as the OpenGL functions are only
+	// looked up once and later contexts keep using them
+	egl_lib_handle = dlopen(GL_EGL_LIBRARY, RTLD_NOW | RTLD_GLOBAL | RTLD_NODELETE);
+	if (!egl_lib_handle)
+		throw std::runtime_error(std::string("Cannot open EGL library: ") + GL_EGL_LIBRARY);
+
+	egl.eglGetDisplay = (GL_EGLFunctions::ptr_eglGetDisplay) dlsym(egl_lib_handle, "eglGetDisplay");
+	egl.eglInitialize = (GL_EGLFunctions::ptr_eglInitialize) dlsym(egl_lib_handle, "eglInitialize");
+	egl.eglTerminate = (GL_EGLFunctions::ptr_eglTerminate) dlsym(egl_lib_handle, "eglTerminate");
+	egl.eglQueryString = (GL_EGLFunctions::ptr_eglQueryString) dlsym(egl_lib_handle, "eglQueryString");
+	egl.eglBindAPI = (GL_EGLFunctions::ptr_eglBindAPI) dlsym(egl_lib_handle, "eglBindAPI");
+	egl.eglChooseConfig = (GL_EGLFunctions::ptr_eglChooseConfig) dlsym(egl_lib_handle, "eglChooseConfig");
+	egl.eglCreateContext = (GL_EGLFunctions::ptr_eglCreateContext) dlsym(egl_lib_handle, "eglCreateContext");
+	egl.eglDestroyContext = (GL_EGLFunctions::ptr_eglDestroyContext) dlsym(egl_lib_handle, "eglDestroyContext");
+	egl.eglCreatePbufferSurface = (GL_EGLFunctions::ptr_eglCreatePbufferSurface) dlsym(egl_lib_handle, "eglCreatePbufferSurface");
+	egl.eglDestroySurface = (GL_EGLFunctions::ptr_eglDestroySurface) dlsym(egl_lib_handle, "eglDestroySurface");
+	egl.eglMakeCurrent = (GL_EGLFunctions::ptr_eglMakeCurrent) dlsym(egl_lib_handle, "eglMakeCurrent");
+	egl.eglGetCurrentContext = (GL_EGLFunctions::ptr_eglGetCurrentContext) dlsym(egl_lib_handle, "eglGetCurrentContext");
+	egl.eglGetProcAddress = (GL_EGLFunctions::ptr_eglGetProcAddress) dlsym(egl_lib_handle, "eglGetProcAddress");
+
+	if (!egl.eglGetDisplay || !egl.eglInitialize || !egl.eglTerminate || !egl.eglQueryString || !egl.eglBindAPI ||
+		!egl.eglChooseConfig || !egl.eglCreateContext || !egl.eglDestroyContext || !egl.eglCreatePbufferSurface ||
+		!egl.eglDestroySurface || !egl.eglMakeCurrent || !egl.eglGetCurrentContext || !egl.eglGetProcAddress)
+	{
+		throw std::runtime_error("Cannot obtain required EGL functions");
+	}
+
+	const char* client_extensions = egl.eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (HasExtension(client_extensions, "EGL_MESA_platform_surfaceless"))
+	{
+		egl.eglGetPlatformDisplayEXT = (GL_EGLFunctions::ptr_eglGetPlatformDisplayEXT) egl.eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (egl.eglGetPlatformDisplayEXT)
+			display = egl.eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+	if (display == EGL_NO_DISPLAY)
+		display = egl.eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY)
+		throw std::runtime_error("eglGetDisplay failed");
+
+	EGLint egl_major = 0, egl_minor = 0;
+	if (!egl.eglInitialize(display, &egl_major, &egl_minor))
+	{
+		display = EGL_NO_DISPLAY;
+		throw std::runtime_error("eglInitialize failed");
+	}
+
+	const char* extensions = egl.eglQueryString(display, EGL_EXTENSIONS);
+	if ((egl_major == 1 && egl_minor < 5) && !HasExtension(extensions, "EGL_KHR_create_context"))
+		throw std::runtime_error("EGL 1.5 or EGL_KHR_create_context is required");
+
+	// A pbuffer is only needed to have something to make current if the driver can't do without
+	bool surfaceless = HasExtension(extensions, "EGL_KHR_surfaceless_context");
+
+	if (!egl.eglBindAPI(EGL_OPENGL_API))
+		throw std::runtime_error("eglBindAPI(EGL_OPENGL_API) failed");
+
+	EGLint config_attributes[] =
+	{
+		EGL_SURFACE_TYPE, surfaceless ? EGL_DONT_CARE : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig config = nullptr;
+	EGLint num_configs = 0;
+	if (!egl.eglChooseConfig(display, config_attributes, &config, 1, &num_configs) || num_configs < 1)
+		throw std::runtime_error("eglChooseConfig found no usable config");
+
+	EGLint context_attributes[] =
+	{
+		EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+		EGL_CONTEXT_MINOR_VERSION_KHR, 2,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		EGL_NONE
+	};
+	context = egl.eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+	if (context == EGL_NO_CONTEXT)
+		throw std::runtime_error("No OpenGL 3.2 support found");
+
+	if (!surfaceless)
+	{
+		EGLint pbuffer_attributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = egl.eglCreatePbufferSurface(display, config, pbuffer_attributes);
+		if (surface == EGL_NO_SURFACE)
+			throw std::runtime_error("eglCreatePbufferSurface failed");
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 std::unique_ptr<IOpenGLContext> IOpenGLContext::Create(void* disp, void* window)
 {
 	auto ctx = std::make_unique<OpenGLContext>(disp, window);
@@ -934,12 +1225,27 @@ std::unique_ptr<IOpenGLContext> IOpenGLContext::Create(void* disp, void* window)
 	return ctx;
 }
 
+std::unique_ptr<IOpenGLContext> IOpenGLContext::CreateHeadless(int width, int height)
+{
+	if (width <= 0 || height <= 0)
+	{
+		SetError("Invalid headless render target size %dx%d", width, height);
+		return nullptr;
+	}
+
+	auto ctx = std::make_unique<HeadlessOpenGLContext>(width, height);
+	if (!ctx->IsValid()) return nullptr;
+	return ctx;
+}
+
 void* GL_GetProcAddress(const char* function_name)
 {
 	if (glx_global.glXGetProcAddressARB)
 		return (void*)glx_global.glXGetProcAddressARB((GLubyte*)function_name);
 	else if (glx_global.glXGetProcAddress)
 		return (void*)glx_global.glXGetProcAddress((GLubyte*)function_name);
+	else if (egl_global.eglGetProcAddress)
+		return (void*)egl_global.eglGetProcAddress(function_name);
 	else
 		return nullptr;
 }
@@ -32,9 +32,13 @@ public:
 	virtual void ClearCurrent() = 0;
 	virtual void SwapBuffers() = 0;
 	virtual bool IsCurrent() = 0;
+	virtual bool IsHeadless() const { return false; }
 	
 	virtual int GetWidth() const = 0;
 	virtual int GetHeight() const = 0;
 	
 	static std::unique_ptr<IOpenGLContext> Create(void* disp, void* window);
+
+	// Context without a window, which GLRenderDevice renders to through an offscreen texture of this size
+	static std::unique_ptr<IOpenGLContext> CreateHeadless(int width, int height);
 };
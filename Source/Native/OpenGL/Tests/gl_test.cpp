@@ -0,0 +1,215 @@
+/*
+**  BuilderNative Renderer
+**  Copyright (c) 2019 Magnus Norddahl
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+*/
+
+// Renderer tests on a headless device, built and run by "make gltest". Exits with 1 when a
+// check fails, and skips everything when no headless context can be created (no libEGL).
+
+#include "Precomp.h"
+#include "../../Backend.h"
+#include <cstdio>
+#include <cstring>
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { printf("FAILED: " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+static const char* VertexShader = "in vec4 AttrPosition; in vec4 AttrColor; out vec4 Color; void main() { gl_Position = AttrPosition; Color = AttrColor; }";
+static const char* FragmentShader = "in vec4 Color; out vec4 FragColor; void main() { FragColor = Color; }";
+
+struct FlatVertex
+{
+	float x, y, z;
+	uint32_t c;
+	float u, v;
+};
+
+static void AddRect(std::vector<FlatVertex>& vertices, float x1, float y1, float x2, float y2, uint32_t color)
+{
+	FlatVertex v[6] =
+	{
+		{ x1, y1, 0.0f, color, 0.0f, 0.0f }, { x2, y1, 0.0f, color, 1.0f, 0.0f }, { x2, y2, 0.0f, color, 1.0f, 1.0f },
+		{ x1, y1, 0.0f, color, 0.0f, 0.0f }, { x2, y2, 0.0f, color, 1.0f, 1.0f }, { x1, y2, 0.0f, color, 0.0f, 1.0f }
+	};
+	vertices.insert(vertices.end(), v, v + 6);
+}
+
+static const char* TexturedVertexShader = "in vec4 AttrPosition; in vec2 AttrUV; out vec2 UV; void main() { gl_Position = AttrPosition; UV = AttrUV; }";
+static const char* TexturedFragmentShader = "uniform sampler2D texture1; in vec2 UV; out vec4 FragColor; void main() { FragColor = texture(texture1, UV); }";
+
+static void SetupFlatShader(RenderDevice* device)
+{
+	device->DeclareShader(0, "test", VertexShader, FragmentShader);
+	device->SetShader(0);
+	device->SetCullMode(Cull::None);
+	device->SetZEnable(false);
+	device->SetAlphaBlendEnable(false);
+}
+
+// Clears the offscreen target and reads the colour back, then checks that the top row comes first
+static void TestHeadlessReadback(RenderDevice* device)
+{
+	const int width = 64, height = 32;
+	std::vector<uint32_t> pixels(width * height);
+
+	CHECK(device->StartRendering(true, (int)0xff102030, nullptr, false), "StartRendering: %s", GetError());
+	CHECK(device->ReadPixels(nullptr, 0, 0, width, height, pixels.data()), "ReadPixels: %s", GetError());
+	device->FinishRendering();
+
+	int wrong = 0;
+	for (uint32_t p : pixels)
+		if (p != 0xff102030) wrong++;
+	CHECK(wrong == 0, "cleared target has %d pixels which are not 0xff102030 (first is %08x)", wrong, pixels[0]);
+
+	SetupFlatShader(device);
+	std::vector<FlatVertex> vertices;
+	AddRect(vertices, -1.0f, 0.0f, 1.0f, 1.0f, 0xffff0000); // upper half
+	CHECK(device->StartRendering(true, (int)0xff0000ff, nullptr, false), "StartRendering: %s", GetError());
+	CHECK(device->DrawData(PrimitiveType::TriangleList, 0, 2, vertices.data()), "DrawData: %s", GetError());
+	CHECK(device->ReadPixels(nullptr, 8, 4, 16, 24, pixels.data()), "ReadPixels: %s", GetError());
+	device->FinishRendering();
+
+	CHECK(pixels[0] == 0xffff0000, "top row of the rectangle is %08x instead of ffff0000", pixels[0]);
+	CHECK(pixels[16 * 23] == 0xff0000ff, "bottom row of the rectangle is %08x instead of ff0000ff", pixels[16 * 23]);
+
+	CHECK(!device->ReadPixels(nullptr, 60, 0, 8, 8, pixels.data()), "ReadPixels outside the target did not fail");
+}
+
+// Draws with vertex counts that make uploads span segments of the DrawData ring and wrap around it
+// several times. The ring asserts that every segment it reuses was fenced after its last draw.
+static void TestStreamBufferWrap(RenderDevice* device)
+{
+	SetupFlatShader(device);
+	CHECK(device->StartRendering(true, (int)0xff000000, nullptr, false), "StartRendering: %s", GetError());
+
+	unsigned int randState = 1;
+	std::vector<FlatVertex> vertices;
+	uint32_t color = 0;
+	for (int i = 0; i < 200; i++)
+	{
+		randState = randState * 1103515245u + 12345u;
+		int triangles = 1 + (int)((randState >> 8) % 30000);
+
+		// Degenerate triangles to fill the ring, then one covering the target
+		color = 0xff000000 | (i * 0x010203);
+		vertices.assign(triangles * 3 - 3, { 0.0f, 0.0f, 0.0f, color, 0.0f, 0.0f });
+		FlatVertex cover[3] = { { -1.0f, -1.0f, 0.0f, color, 0.0f, 0.0f }, { 3.0f, -1.0f, 0.0f, color, 0.0f, 0.0f }, { -1.0f, 3.0f, 0.0f, color, 0.0f, 0.0f } };
+		vertices.insert(vertices.end(), cover, cover + 3);
+
+		if (!device->DrawData(PrimitiveType::TriangleList, 0, triangles, vertices.data()))
+		{
+			CHECK(false, "DrawData: %s", GetError());
+			break;
+		}
+	}
+
+	uint32_t pixel = 0;
+	CHECK(device->ReadPixels(nullptr, 32, 16, 1, 1, &pixel), "ReadPixels: %s", GetError());
+	device->FinishRendering();
+	CHECK(pixel == color, "last DrawData left %08x instead of %08x", pixel, color);
+}
+
+static uint32_t DrawTexturedPixel(RenderDevice* device, Texture* texture)
+{
+	std::vector<FlatVertex> vertices;
+	AddRect(vertices, -1.0f, -1.0f, 1.0f, 1.0f, 0xffffffff);
+
+	uint32_t pixel = 0;
+	device->SetTexture(0, texture);
+	CHECK(device->StartRendering(true, (int)0xff000000, nullptr, false), "StartRendering: %s", GetError());
+	CHECK(device->DrawData(PrimitiveType::TriangleList, 0, 2, vertices.data()), "DrawData: %s", GetError());
+	CHECK(device->ReadPixels(nullptr, 32, 16, 1, 1, &pixel), "ReadPixels: %s", GetError());
+	device->FinishRendering();
+	device->SetTexture(0, nullptr);
+	return pixel;
+}
+
+// Queues more texture data than one frame may upload. Drawing a queued texture must not upload
+// it, and every Present must stay within the budget until the queue is empty.
+static void TestTextureUploadBudget(RenderDevice* device)
+{
+	const int64_t budget = 16 * 1024 * 1024; // GLRenderDevice::mTextureUploadBudget
+	const int size = 512, count = 40;
+
+	device->DeclareShader(1, "textured", TexturedVertexShader, TexturedFragmentShader);
+	device->SetShader(1);
+	device->SetCullMode(Cull::None);
+	device->SetZEnable(false);
+	device->SetAlphaBlendEnable(false);
+	device->SetSamplerFilter(0, TextureFilter::Nearest, TextureFilter::Nearest, MipmapFilter::None, 0.0f);
+
+	std::vector<uint32_t> pixels(size * size, 0xff00ff00);
+	std::vector<Texture*> textures;
+	for (int i = 0; i < count; i++)
+	{
+		Texture* texture = Backend::Get()->NewTexture();
+		texture->Set2DImage(size, size, PixelFormat::Rgba8);
+		CHECK(device->QueuePixels(texture, pixels.data()), "QueuePixels: %s", GetError());
+		textures.push_back(texture);
+	}
+	CHECK(device->GetCounter(RenderCounter::TextureUploadQueueDepth) == count, "%d textures queued instead of %d", (int)device->GetCounter(RenderCounter::TextureUploadQueueDepth), count);
+
+	uint32_t pixel = DrawTexturedPixel(device, textures.back());
+	CHECK(pixel == 0xff808080, "queued texture drew %08x instead of the placeholder", pixel);
+	CHECK(textures.back()->IsUploadPending(), "drawing a queued texture uploaded it");
+	CHECK(device->GetCounter(RenderCounter::TextureUploadQueueDepth) == count, "drawing a queued texture changed the queue");
+
+	int frames = 0;
+	while (device->GetCounter(RenderCounter::TextureUploadQueueDepth) > 0 && frames < 100)
+	{
+		device->Present();
+		int64_t uploaded = device->GetCounter(RenderCounter::TextureBytesUploadedLastFrame);
+		CHECK(uploaded > 0 && uploaded <= budget, "Present uploaded %lld bytes, the budget is %lld", (long long)uploaded, (long long)budget);
+		frames++;
+	}
+	CHECK(frames == (int)((count * (int64_t)size * size * 4 + budget - 1) / budget), "the queue took %d frames to upload", frames);
+
+	pixel = DrawTexturedPixel(device, textures.back());
+	CHECK(pixel == 0xff00ff00, "uploaded texture drew %08x instead of ff00ff00", pixel);
+
+	for (Texture* texture : textures)
+		Backend::Get()->DeleteTexture(texture);
+}
+
+int main(int argc, char** argv)
+{
+	RenderDevice* device = Backend::Get()->NewHeadlessRenderDevice(64, 32, false);
+	if (!device)
+	{
+		printf("skipped, no headless device: %s\n", GetError());
+		return 0;
+	}
+
+	TestHeadlessReadback(device);
+	TestStreamBufferWrap(device);
+	TestTextureUploadBudget(device);
+
+	Backend::Get()->DeleteRenderDevice(device);
+
+	if (failures > 0)
+	{
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	printf("all tests passed\n");
+	return 0;
+}
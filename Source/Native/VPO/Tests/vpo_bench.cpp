@@ -0,0 +1,258 @@
+//------------------------------------------------------------------------
+//  Visplane Overflow Library : benchmarks
+//------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  "make vpobench" builds this twice, once as the library is shipped
+//  and once with the vanilla code paths (PLANEHASH_SIZE 0), and runs
+//  both so the numbers can be compared on the same machine.
+//
+//------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "../vpo_local.h"
+#include "vpo_testmap.h"
+
+#include <chrono>
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double SecondsSince(bench_clock::time_point start)
+{
+	return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+
+//
+// BenchFindPlane
+// Times R_FindPlane for views which have 'numplanes' different
+// visplanes, each one being looked up eight times (about what a
+// dense view does, one floor and one ceiling lookup per seg).
+//
+static void BenchFindPlane(int numplanes)
+{
+	std::unique_ptr<vpo::RenderState> rs(new vpo::RenderState());
+
+	std::vector<int> keys;
+	unsigned int rand_state = 1;
+
+	for (int i = 0 ; i < numplanes * 8 ; i++)
+		keys.push_back(i % numplanes);
+
+	for (int i = (int)keys.size() - 1 ; i > 0 ; i--)
+	{
+		rand_state = rand_state * 1103515245u + 12345u;
+		std::swap(keys[i], keys[(rand_state >> 16) % (unsigned int)(i + 1)]);
+	}
+
+	int views = 0;
+	int64_t checksum = 0;
+
+	auto start = bench_clock::now();
+
+	do
+	{
+		for (int n = 0 ; n < 100 ; n++)
+		{
+			rs->R_ClearPlanes();
+
+			for (int k : keys)
+			{
+				// keys differing in height, flat and light, like real ones
+				vpo::visplane_t *pl = rs->R_FindPlane((k >> 2) << FRACBITS, 3 + (k & 1), 128 + (k & 2));
+				checksum += pl - rs->visplanes;
+			}
+
+			if (rs->total_visplanes != numplanes)
+			{
+				fprintf(stderr, "R_FindPlane: %d visplanes instead of %d\n", rs->total_visplanes, numplanes);
+				exit(1);
+			}
+		}
+
+		views += 100;
+	}
+	while (SecondsSince(start) < 0.5);
+
+	double seconds = SecondsSince(start);
+
+	printf("R_FindPlane  %3d planes : %7.1f ns/lookup  %8.0f ns/view  (check %lld)\n",
+		numplanes, seconds * 1e9 / ((double)views * keys.size()),
+		seconds * 1e9 / views, (long long)(checksum / views));
+}
+
+
+//
+// BenchViews
+// Times whole views from the middle of every cell of a synthetic map,
+// looking in eight directions, the same as the plugin's default sweep.
+//
+static void BenchViews(int size)
+{
+	static const int angles[8] = { 0, 45, 90, 135, 180, 225, 270, 315 };
+
+	TestMap map(size, 7);
+	VPOContext ctx = VPO_NewContext();
+
+	if (map.Open(ctx) != 0)
+	{
+		fprintf(stderr, "opening the test map: %s\n", VPO_GetError(ctx));
+		exit(1);
+	}
+
+	std::vector<int> spots;
+
+	for (int x = 0 ; x < size ; x++)
+	for (int y = 0 ; y < size ; y++)
+	{
+		if (map.Present(x, y))
+		{
+			spots.push_back(map.CellMiddle(x));
+			spots.push_back(map.CellMiddle(y));
+			spots.push_back(41);
+		}
+	}
+
+	int num_spots = (int)spots.size() / 3;
+	std::vector<int> results(num_spots * VPO_SPOT_RESULT_SIZE);
+
+	// best of three, the first run also warms up the caches
+	double best = 0;
+	int64_t checksum = 0;
+
+	for (int run = 0 ; run < 3 ; run++)
+	{
+		auto start = bench_clock::now();
+
+		VPO_TestSpotMulti(ctx, num_spots, spots.data(), 8, angles, results.data());
+
+		double seconds = SecondsSince(start);
+
+		if (run == 0 || seconds < best)
+			best = seconds;
+	}
+
+	for (int r : results)
+		checksum += r;
+
+	printf("views  %3dx%-3d map     : %7.0f ns/view  (%d views, check %lld)\n",
+		size, size, best * 1e9 / (num_spots * 8.0), num_spots * 8, (long long)checksum);
+
+	VPO_DeleteContext(ctx);
+}
+
+
+//
+// BenchNodes
+// Times the same views as BenchViews, walking the compact node array
+// and the original nodes alternately, so both see the same caches.
+//
+static void BenchNodes(int size)
+{
+	static const int angles[8] = { 0, 45, 90, 135, 180, 225, 270, 315 };
+
+	TestMap map(size, 7);
+	VPOContext ctx = VPO_NewContext();
+
+	if (map.Open(ctx) != 0)
+	{
+		fprintf(stderr, "opening the test map: %s\n", VPO_GetError(ctx));
+		exit(1);
+	}
+
+	vpo::RenderState& rs = ((vpo::Context *)ctx)->render;
+
+	std::vector<vpo::fixed_t> views;
+
+	for (int x = 0 ; x < size ; x++)
+	for (int y = 0 ; y < size ; y++)
+	{
+		vpo::fixed_t rx, ry, rz;
+
+		if (map.Present(x, y) &&
+			rs.X_SetupSpot(map.CellMiddle(x), map.CellMiddle(y), 41, &rx, &ry, &rz) == RESULT_OK)
+		{
+			views.push_back(rx);
+			views.push_back(ry);
+			views.push_back(rz);
+		}
+	}
+
+	int num_views = (int)views.size() / 3 * 8;
+
+	// best of three for each walk, the first run also warms up the caches
+	double best[2] = { 0, 0 };
+	int64_t checksum[2] = { 0, 0 };
+
+	for (int run = 0 ; run < 3 ; run++)
+	{
+		for (int compact = 0 ; compact < 2 ; compact++)
+		{
+			auto start = bench_clock::now();
+
+			checksum[compact] = 0;
+
+			for (size_t i = 0 ; i < views.size() ; i += 3)
+			for (int a = 0 ; a < 8 ; a++)
+			{
+				vpo::angle_t angle = (vpo::angle_t)(((uint64_t)angles[a] << 32) / 360);
+
+				try
+				{
+					rs.R_RenderView(views[i], views[i+1], views[i+2], angle, compact != 0);
+				}
+				catch (vpo::overflow_exception&)
+				{
+				}
+
+				checksum[compact] += rs.total_visplanes + rs.total_drawsegs;
+			}
+
+			double seconds = SecondsSince(start);
+
+			if (run == 0 || seconds < best[compact])
+				best[compact] = seconds;
+		}
+	}
+
+	printf("nodes  %3dx%-3d map     : %7.0f ns/view recursive, %7.0f ns/view compact  (%d views, check %lld/%lld)\n",
+		size, size, best[0] * 1e9 / num_views, best[1] * 1e9 / num_views, num_views,
+		(long long)checksum[0], (long long)checksum[1]);
+
+	VPO_DeleteContext(ctx);
+}
+
+
+int main(int argc, char **argv)
+{
+	printf("PLANEHASH_SIZE %d\n", PLANEHASH_SIZE);
+
+	BenchFindPlane(16);
+	BenchFindPlane(64);
+	BenchFindPlane(256);
+	BenchFindPlane(500);
+
+	BenchViews(32);
+	BenchViews(64);
+	BenchViews(90);
+
+	BenchNodes(32);
+	BenchNodes(64);
+	BenchNodes(90);
+
+	return 0;
+}
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
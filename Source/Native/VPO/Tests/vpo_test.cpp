@@ -0,0 +1,781 @@
+//------------------------------------------------------------------------
+//  Visplane Overflow Library : regression tests
+//------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  Built and run by "make vpotest", exits with 1 when a check fails.
+//  The compressed node formats are written with zlib, the same as the
+//  node builders do, to check the library's own decoder against it.
+//
+//------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "../vpo_local.h"
+#include "vpo_testmap.h"
+
+#include <chrono>
+#include <thread>
+
+#include <zlib.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond, ...)  \
+	do { if (! (cond)) { printf("FAILED: " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+
+static void TestOpenMap()
+{
+	TestMap map(16, 1);
+	VPOContext ctx = VPO_NewContext();
+
+	CHECK(map.Open(ctx) == 0, "opening the test map: %s", VPO_GetError(ctx));
+
+	// the first cell which has a sector, and the first one which has not
+	int inside = -1, outside = -1;
+
+	for (int n = 0 ; n < map.size * map.size ; n++)
+	{
+		if (map.Present(n % map.size, n / map.size))
+			inside = (inside < 0) ? n : inside;
+		else
+			outside = (outside < 0) ? n : outside;
+	}
+
+	CHECK(inside >= 0 && outside >= 0, "the test map has no empty cell or no sector");
+
+	int visplanes = 0, drawsegs = 0, openings = 0, solidsegs = 0;
+	int result = VPO_TestSpot(ctx, map.CellMiddle(inside % map.size), map.CellMiddle(inside / map.size), 41, 0,
+	                          &visplanes, &drawsegs, &openings, &solidsegs);
+
+	CHECK(result == RESULT_OK, "testing a spot in a sector gave %d", result);
+	CHECK(visplanes > 0 && drawsegs > 0 && solidsegs > 0,
+		"a view from inside a sector used %d visplanes, %d drawsegs, %d solidsegs",
+		visplanes, drawsegs, solidsegs);
+
+	result = VPO_TestSpot(ctx, map.CellMiddle(inside % map.size), map.CellMiddle(inside / map.size), 5000, 0,
+	                      &visplanes, &drawsegs, &openings, &solidsegs);
+
+	CHECK(result == RESULT_BAD_Z, "testing a spot above the ceiling gave %d", result);
+
+	result = VPO_TestSpot(ctx, map.CellMiddle(outside % map.size), map.CellMiddle(outside / map.size), 41, 0,
+	                      &visplanes, &drawsegs, &openings, &solidsegs);
+
+	CHECK(result == RESULT_IN_VOID, "testing a spot in an empty cell gave %d", result);
+
+	VPO_DeleteContext(ctx);
+}
+
+
+static bool WriteFile(const char *filename, const std::vector<unsigned char>& data)
+{
+	FILE *fp = fopen(filename, "wb");
+
+	if (! fp)
+		return false;
+
+	fwrite(data.data(), 1, data.size(), fp);
+	fclose(fp);
+
+	return true;
+}
+
+
+#ifdef __linux__
+// true when the process has the file open or mapped
+static bool FileInUse(const char *filename)
+{
+	char path[4096];
+
+	if (! realpath(filename, path))
+		return false;
+
+	FILE *fp = fopen("/proc/self/maps", "r");
+	char line[4096 + 128];
+	bool found = false;
+
+	while (fp && fgets(line, sizeof(line), fp))
+		if (strstr(line, path))
+			found = true;
+
+	if (fp)
+		fclose(fp);
+
+	for (int fd = 0 ; fd < 1024 ; fd++)
+	{
+		char link[64];
+		char target[4096];
+
+		snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+
+		ssize_t len = readlink(link, target, sizeof(target) - 1);
+
+		if (len > 0)
+		{
+			target[len] = 0;
+
+			if (strcmp(target, path) == 0)
+				found = true;
+		}
+	}
+
+	return found;
+}
+#endif
+
+
+//
+// A wad which is rewritten in place (same size, only a map name
+// differs) or replaced while a context has it loaded.  The file must
+// not be held open once the map is loaded, new loads must see the new
+// contents, and the old directory must not be used to read from it.
+//
+static void TestWadFileChanges()
+{
+	static const char *filename = "vpo_test_change.wad";
+	static const char *tempname = "vpo_test_change.tmp";
+
+	TestMap map(8, 2);
+	std::vector<unsigned char> wad = map.Wad("MAP01");
+
+	CHECK(WriteFile(filename, wad), "cannot create %s", filename);
+
+	VPOContext ctx = VPO_NewContext();
+
+	CHECK(VPO_LoadWAD(ctx, filename) == 0, "loading the wad: %s", VPO_GetError(ctx));
+	CHECK(VPO_OpenMap(ctx, "MAP01") == 0, "opening the map: %s", VPO_GetError(ctx));
+
+#ifdef __linux__
+	CHECK(! FileInUse(filename), "the wad is still open after loading its map");
+#endif
+
+	static const char *names[2] = { "MAP02", "MAP03" };
+
+	for (int replace = 0 ; replace < 2 ; replace++)
+	{
+		// past the timestamp granularity of coarse file systems
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		if (replace)
+		{
+			CHECK(WriteFile(tempname, map.Wad(names[replace])), "cannot create %s", tempname);
+			remove(filename);
+			rename(tempname, filename);
+		}
+		else
+		{
+			CHECK(WriteFile(filename, map.Wad(names[replace])), "cannot rewrite %s", filename);
+		}
+
+		VPOContext ctx2 = VPO_NewContext();
+
+		CHECK(VPO_LoadWAD(ctx2, filename) == 0, "loading the changed wad: %s", VPO_GetError(ctx2));
+
+		const char *name = VPO_GetMapName(ctx2, 0);
+
+		CHECK(name && strcmp(name, names[replace]) == 0, "the %s wad has map %s instead of %s",
+			replace ? "replaced" : "rewritten", name ? name : "(none)", names[replace]);
+
+		VPO_DeleteContext(ctx2);
+
+		CHECK(VPO_OpenMap(ctx, "MAP01") != 0, "a map was read from the %s wad with its old directory",
+			replace ? "replaced" : "rewritten");
+	}
+
+	VPO_DeleteContext(ctx);
+
+	remove(filename);
+}
+
+
+//
+// Opens the same map from a wad file, from a wad in memory and from its
+// lumps (the way the plugin does), and checks that every cell gives the
+// same results from all three.
+//
+static void TestLoadFromMemory()
+{
+	static const int angles[8] = { 0, 45, 90, 135, 180, 225, 270, 315 };
+	static const char *filename = "vpo_test_map.wad";
+
+	TestMap map(32, 3);
+	std::vector<unsigned char> wad = map.Wad("MAP01");
+
+	FILE *fp = fopen(filename, "wb");
+
+	CHECK(fp != NULL, "cannot create %s", filename);
+
+	if (! fp)
+		return;
+
+	fwrite(wad.data(), 1, wad.size(), fp);
+	fclose(fp);
+
+	std::vector<int> spots;
+
+	for (int x = 0 ; x < map.size ; x++)
+	for (int y = 0 ; y < map.size ; y++)
+	{
+		spots.push_back(map.CellMiddle(x));
+		spots.push_back(map.CellMiddle(y));
+		spots.push_back(41);
+	}
+
+	int num_spots = (int)spots.size() / 3;
+
+	static const char *how[3] = { "from a file", "from memory", "from lumps" };
+
+	std::vector<int> results[3];
+
+	for (int k = 0 ; k < 3 ; k++)
+	{
+		VPOContext ctx = VPO_NewContext();
+
+		int err;
+
+		if (k == 0)
+			err = VPO_LoadWAD(ctx, filename);
+		else if (k == 1)
+			err = VPO_LoadWADFromMemory(ctx, wad.data(), wad.size());
+		else
+			err = 0;
+
+		if (err == 0 && k < 2)
+		{
+			const char *name = VPO_GetMapName(ctx, 0);
+
+			CHECK(name && strcmp(name, "MAP01") == 0, "the first map %s is %s", how[k], name ? name : "missing");
+
+			err = VPO_OpenMap(ctx, "MAP01");
+		}
+		else if (err == 0)
+		{
+			err = map.Open(ctx);
+		}
+
+		CHECK(err == 0, "opening the map %s: %s", how[k], VPO_GetError(ctx));
+
+		results[k].resize(num_spots * VPO_SPOT_RESULT_SIZE);
+
+		if (err == 0)
+		{
+			CHECK(VPO_TestSpotMulti(ctx, num_spots, spots.data(), 8, angles, results[k].data()) == num_spots,
+				"testing the map %s: %s", how[k], VPO_GetError(ctx));
+		}
+
+		VPO_DeleteContext(ctx);
+	}
+
+	remove(filename);
+
+	CHECK(results[0] == results[1], "the map gives different results from a file and from memory");
+	CHECK(results[0] == results[2], "the map gives different results from a file and from lumps");
+}
+
+
+//
+// Compresses data into a zlib stream.  Level 0 gives stored blocks,
+// Z_FIXED the fixed Huffman codes, otherwise zlib mostly picks
+// dynamic ones.
+//
+static std::vector<unsigned char> Deflate(const std::vector<unsigned char>& data, int level, int strategy)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+
+	deflateInit2(&zs, level, Z_DEFLATED, 15, 8, strategy);
+
+	std::vector<unsigned char> out(deflateBound(&zs, (uLong)data.size()));
+
+	zs.next_in   = (Bytef *)data.data();
+	zs.avail_in  = (uInt)data.size();
+	zs.next_out  = out.data();
+	zs.avail_out = (uInt)out.size();
+
+	deflate(&zs, Z_FINISH);
+
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+
+	return out;
+}
+
+static const int compress_levels[4]     = { -1, 0, 9, 9 };
+static const int compress_strategies[4] = { 0, Z_DEFAULT_STRATEGY, Z_FIXED, Z_DEFAULT_STRATEGY };
+static const char *compress_names[4]    = { "uncompressed", "stored", "fixed", "dynamic" };
+
+
+//
+// Converts a vanilla map into each of the ZDoom extended formats (XNOD
+// in NODES, the GL ones in SSECTORS with NODES and SEGS left empty),
+// uncompressed and compressed, and checks that every cell gives the
+// same results as the vanilla nodes.  The map has more than 32767 segs,
+// so the vanilla subsectors need their seg numbers read unsigned.
+//
+static void TestExtendedNodes()
+{
+	static const int angles[4] = { 0, 135, 180, 315 };
+	static const char *formats[4] = { "NOD", "GLN", "GL2", "GL3" };
+
+	TestMap map(98, 11);
+
+	CHECK(map.segs.size() / 12 > 32767, "the test map has only %d segs", (int)map.segs.size() / 12);
+
+	// every third cell, which still reaches every part of the map
+	std::vector<int> spots;
+
+	for (int x = 0 ; x < map.size ; x++)
+	for (int y = (x % 3) ; y < map.size ; y += 3)
+	{
+		spots.push_back(map.CellMiddle(x));
+		spots.push_back(map.CellMiddle(y));
+		spots.push_back(41);
+	}
+
+	int num_spots = (int)spots.size() / 3;
+
+	std::vector<int> vanilla(num_spots * VPO_SPOT_RESULT_SIZE);
+	std::vector<int> results(num_spots * VPO_SPOT_RESULT_SIZE);
+
+	VPOContext ctx = VPO_NewContext();
+
+	CHECK(map.Open(ctx) == 0, "opening the test map: %s", VPO_GetError(ctx));
+	CHECK(VPO_TestSpotMulti(ctx, num_spots, spots.data(), 4, angles, vanilla.data()) == num_spots,
+		"testing the vanilla nodes: %s", VPO_GetError(ctx));
+
+	for (int gl_version = 0 ; gl_version < 4 ; gl_version++)
+	{
+		std::vector<unsigned char> data = map.ExtendedNodes(gl_version);
+
+		for (int c = 0 ; c < 4 ; c++)
+		{
+			char signature[5];
+			snprintf(signature, sizeof(signature), "%c%s", c ? 'Z' : 'X', formats[gl_version]);
+
+			std::vector<unsigned char> lump(signature, signature + 4);
+			std::vector<unsigned char> body = c ? Deflate(data, compress_levels[c], compress_strategies[c]) : data;
+
+			lump.insert(lump.end(), body.begin(), body.end());
+
+			const std::vector<unsigned char> empty;
+			const std::vector<unsigned char>& segs     = empty;
+			const std::vector<unsigned char>& ssectors = gl_version ? lump : empty;
+			const std::vector<unsigned char>& nodes    = gl_version ? empty : lump;
+
+			int err = VPO_OpenMapFromLumps(ctx, false,
+				map.linedefs.data(), (int)map.linedefs.size(),
+				map.sidedefs.data(), (int)map.sidedefs.size(),
+				map.vertexes.data(), (int)map.vertexes.size(),
+				segs.data(),         (int)segs.size(),
+				ssectors.data(),     (int)ssectors.size(),
+				nodes.data(),        (int)nodes.size(),
+				map.sectors.data(),  (int)map.sectors.size());
+
+			CHECK(err == 0, "opening %s (%s): %s", signature, compress_names[c], VPO_GetError(ctx));
+
+			if (err != 0)
+				continue;
+
+			std::fill(results.begin(), results.end(), -1);
+
+			VPO_TestSpotMulti(ctx, num_spots, spots.data(), 4, angles, results.data());
+
+			int mismatches = 0;
+
+			for (int i = 0 ; i < num_spots ; i++)
+				if (memcmp(&results[i * VPO_SPOT_RESULT_SIZE], &vanilla[i * VPO_SPOT_RESULT_SIZE],
+				           VPO_SPOT_RESULT_SIZE * sizeof(int)) != 0)
+					mismatches++;
+
+			CHECK(mismatches == 0, "%d of %d spots differ with %s (%s) nodes", mismatches, num_spots,
+				signature, compress_names[c]);
+
+			// cut short anywhere, the map must be rejected
+			for (size_t cut = 0 ; cut < lump.size() - 4 ; cut += 1 + lump.size() / 40)
+			{
+				err = VPO_OpenMapFromLumps(ctx, false,
+					map.linedefs.data(), (int)map.linedefs.size(),
+					map.sidedefs.data(), (int)map.sidedefs.size(),
+					map.vertexes.data(), (int)map.vertexes.size(),
+					segs.data(),         (int)segs.size(),
+					ssectors.data(),     gl_version ? (int)cut : 0,
+					nodes.data(),        gl_version ? 0 : (int)cut,
+					map.sectors.data(),  (int)map.sectors.size());
+
+				CHECK(err == -1, "%s (%s) nodes cut to %d bytes gave %d", signature, compress_names[c], (int)cut, err);
+			}
+		}
+	}
+
+	VPO_DeleteContext(ctx);
+}
+
+
+//
+// Decodes all of a stream, returns true when the decoder failed
+//
+static bool InflateFails(const std::vector<unsigned char>& stream, std::vector<unsigned char>& out, size_t max_out)
+{
+	std::unique_ptr<vpo::Inflater> inf(new vpo::Inflater(stream.data(), stream.size()));
+
+	out.resize(max_out);
+	out.resize(inf->Read(out.data(), max_out));
+
+	return inf->Failed();
+}
+
+
+//
+// The decoder on streams which are complete, cut short, damaged, or
+// built by hand to break one rule each.
+//
+static void TestInflater()
+{
+	TestMap map(12, 4);
+	std::vector<unsigned char> data = map.ExtendedNodes(0);
+	std::vector<unsigned char> out;
+
+	for (int c = 1 ; c < 4 ; c++)
+	{
+		std::vector<unsigned char> stream = Deflate(data, compress_levels[c], compress_strategies[c]);
+
+		// asking for more than there is reaches the end of the stream
+		CHECK(! InflateFails(stream, out, data.size() + 1) && out == data,
+			"%s stream decoded to %d of %d bytes", compress_names[c], (int)out.size(), (int)data.size());
+
+		// the adler32 checksum (last four bytes) is not checked, but
+		// anything shorter has to fail, after correct output
+		for (size_t cut = 0 ; cut + 4 < stream.size() ; cut++)
+		{
+			std::vector<unsigned char> part(stream.begin(), stream.begin() + cut);
+
+			bool failed = InflateFails(part, out, data.size() + 1);
+
+			if (! failed || out.size() > data.size() || memcmp(out.data(), data.data(), out.size()) != 0)
+			{
+				CHECK(false, "%s stream cut to %d bytes: failed %d, %d bytes out", compress_names[c],
+					(int)cut, (int)failed, (int)out.size());
+				break;
+			}
+		}
+
+		// damaged streams may decode to anything, but must not run past
+		// the buffer or the input
+		for (size_t pos = 0 ; pos < stream.size() ; pos++)
+		{
+			std::vector<unsigned char> bad = stream;
+			bad[pos] ^= (unsigned char)(1 << (pos % 8));
+
+			InflateFails(bad, out, data.size() + 1);
+
+			CHECK(out.size() <= data.size() + 1, "damaged stream gave %d bytes", (int)out.size());
+		}
+	}
+
+	static const struct
+	{
+		const char *what;
+		std::vector<unsigned char> stream;
+		bool fails;
+	}
+	cases[] =
+	{
+		{ "an empty stored block",          { 0x78, 0x01, 0x01, 0x00, 0x00, 0xFF, 0xFF }, false },
+		{ "no header",                      { }, true },
+		{ "a method other than deflate",    { 0x77, 0x01, 0x01, 0x00, 0x00, 0xFF, 0xFF }, true },
+		{ "a preset dictionary",            { 0x78, 0xBB, 0x01, 0x00, 0x00, 0xFF, 0xFF }, true },
+		{ "bad header check bits",          { 0x78, 0x02, 0x01, 0x00, 0x00, 0xFF, 0xFF }, true },
+		{ "a stored length mismatch",       { 0x78, 0x01, 0x01, 0x05, 0x00, 0x00, 0x00, 1, 2, 3, 4, 5 }, true },
+		{ "a stored block cut short",       { 0x78, 0x01, 0x01, 0x05, 0x00, 0xFA, 0xFF, 1, 2 }, true },
+		{ "the reserved block type",        { 0x78, 0x01, 0x07, 0x00 }, true },
+		{ "a distance before the start",    { 0x78, 0x01, 0x03, 0x02, 0x00 }, true },
+	};
+
+	for (auto& t : cases)
+	{
+		bool failed = InflateFails(t.stream, out, 16);
+
+		CHECK(failed == t.fails, "a stream with %s %s", t.what, failed ? "failed" : "did not fail");
+	}
+}
+
+
+//
+// Each lump given as (NULL, 0) or as an empty buffer.  The map is
+// unusable, but it has to be rejected or loaded, not crash.
+//
+static void TestEmptyLumps()
+{
+	static const char *names[7] =
+	{
+		"LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS", "NODES", "SECTORS"
+	};
+
+	TestMap map(4, 1);
+
+	for (int empty = 0 ; empty < 7 ; empty++)
+	{
+		for (int with_pointer = 0 ; with_pointer < 2 ; with_pointer++)
+		{
+			const std::vector<unsigned char> *lumps[7] =
+			{
+				&map.linedefs, &map.sidedefs, &map.vertexes, &map.segs,
+				&map.ssectors, &map.nodes, &map.sectors
+			};
+
+			const void *data[7];
+			int length[7];
+
+			for (int i = 0 ; i < 7 ; i++)
+			{
+				data[i]   = lumps[i]->data();
+				length[i] = (int)lumps[i]->size();
+			}
+
+			data[empty]   = with_pointer ? lumps[empty]->data() : NULL;
+			length[empty] = 0;
+
+			VPOContext ctx = VPO_NewContext();
+
+			int result = VPO_OpenMapFromLumps(ctx, false,
+				data[0], length[0], data[1], length[1], data[2], length[2],
+				data[3], length[3], data[4], length[4], data[5], length[5],
+				data[6], length[6]);
+
+			CHECK(result == 0 || result == -1, "empty %s lump gave %d", names[empty], result);
+
+			VPO_DeleteContext(ctx);
+		}
+	}
+}
+
+
+//
+// Renders every cell of a map in eight directions, once walking the
+// compact node array and once with the recursive R_RenderBSPNode, and
+// checks that both give the same counts.
+//
+static void TestCompactNodes()
+{
+	static const int angles[8] = { 0, 45, 90, 135, 180, 225, 270, 315 };
+
+	TestMap map(48, 5);
+	VPOContext ctx = VPO_NewContext();
+
+	CHECK(map.Open(ctx) == 0, "opening the test map: %s", VPO_GetError(ctx));
+
+	vpo::RenderState& rs = ((vpo::Context *)ctx)->render;
+
+	int views = 0, mismatches = 0;
+
+	for (int x = 0 ; x < map.size ; x++)
+	for (int y = 0 ; y < map.size ; y++)
+	{
+		vpo::fixed_t rx, ry, rz;
+
+		if (! map.Present(x, y) ||
+			rs.X_SetupSpot(map.CellMiddle(x), map.CellMiddle(y), 41, &rx, &ry, &rz) != RESULT_OK)
+			continue;
+
+		for (int a = 0 ; a < 8 ; a++)
+		{
+			vpo::angle_t angle = (vpo::angle_t)(((uint64_t)angles[a] << 32) / 360);
+
+			int counts[2][5];
+
+			for (int compact = 0 ; compact < 2 ; compact++)
+			{
+				int overflow = 0;
+
+				try
+				{
+					rs.R_RenderView(rx, ry, rz, angle, compact != 0);
+				}
+				catch (vpo::overflow_exception&)
+				{
+					overflow = 1;
+				}
+
+				counts[compact][0] = overflow;
+				counts[compact][1] = rs.total_visplanes;
+				counts[compact][2] = rs.total_drawsegs;
+				counts[compact][3] = rs.total_openings;
+				counts[compact][4] = rs.max_solidsegs;
+			}
+
+			if (memcmp(counts[0], counts[1], sizeof(counts[0])) != 0 && mismatches++ < 5)
+			{
+				printf("cell %d,%d angle %d: recursive %d/%d/%d/%d/%d, compact %d/%d/%d/%d/%d\n",
+					x, y, angles[a],
+					counts[0][0], counts[0][1], counts[0][2], counts[0][3], counts[0][4],
+					counts[1][0], counts[1][1], counts[1][2], counts[1][3], counts[1][4]);
+			}
+
+			views++;
+		}
+	}
+
+	CHECK(views > 0, "no spot of the test map could be rendered");
+	CHECK(mismatches == 0, "%d of %d views differ between the node walks", mismatches, views);
+
+	VPO_DeleteContext(ctx);
+}
+
+
+//
+// Tests every cell of a map (some of them in the void, some with a bad
+// z) on the sweep engine, and checks that each spot comes back once
+// with the same result as VPO_TestSpotMulti gives.
+//
+static void TestSweep()
+{
+	static const int angles[8] = { 0, 45, 90, 135, 180, 225, 270, 315 };
+
+	TestMap map(48, 5);
+	VPOContext ctx = VPO_NewContext();
+
+	CHECK(map.Open(ctx) == 0, "opening the test map: %s", VPO_GetError(ctx));
+
+	std::vector<int> spots;
+
+	for (int x = 0 ; x < map.size ; x++)
+	for (int y = 0 ; y < map.size ; y++)
+	{
+		int index = (int)spots.size() / VPO_SWEEP_SPOT_SIZE;
+
+		spots.push_back(map.CellMiddle(x));
+		spots.push_back(map.CellMiddle(y));
+		spots.push_back((index % 7 == 0) ? 5000 : 41);
+		spots.push_back(index);
+	}
+
+	int num_spots = (int)spots.size() / VPO_SWEEP_SPOT_SIZE;
+
+	// VPO_TestSpotMulti reads (x, y, dz) triples
+	std::vector<int> triples;
+	std::vector<int> serial(num_spots * VPO_SPOT_RESULT_SIZE);
+
+	for (int i = 0 ; i < num_spots ; i++)
+		triples.insert(triples.end(), &spots[i * VPO_SWEEP_SPOT_SIZE], &spots[i * VPO_SWEEP_SPOT_SIZE + 3]);
+
+	CHECK(VPO_TestSpotMulti(ctx, num_spots, triples.data(), 8, angles, serial.data()) == num_spots,
+		"VPO_TestSpotMulti: %s", VPO_GetError(ctx));
+
+	int num_ok = 0, num_void = 0, num_bad_z = 0;
+
+	for (int i = 0 ; i < num_spots ; i++)
+	{
+		int result = serial[i * VPO_SPOT_RESULT_SIZE];
+
+		num_ok    += (result == RESULT_OK);
+		num_void  += (result == RESULT_IN_VOID);
+		num_bad_z += (result == RESULT_BAD_Z);
+	}
+
+	CHECK(num_ok > 0 && num_void > 0 && num_bad_z > 0,
+		"spots are %d OK, %d in the void, %d bad z", num_ok, num_void, num_bad_z);
+
+	VPOSweep sweep = VPO_NewSweep(ctx, 4, 8, angles);
+
+	CHECK(sweep != NULL, "VPO_NewSweep: %s", VPO_GetError(ctx));
+
+	if (sweep)
+	{
+		// queued in two batches, the second one while the first is running
+		int half = num_spots / 2;
+
+		VPO_SweepAddSpots(sweep, half, spots.data());
+		VPO_SweepAddSpots(sweep, num_spots - half, &spots[half * VPO_SWEEP_SPOT_SIZE]);
+
+		std::vector<int> seen(num_spots, 0);
+		std::vector<int> results(64 * VPO_SWEEP_RESULT_SIZE);
+
+		int received = 0, mismatches = 0;
+
+		for (;;)
+		{
+			bool done = (VPO_SweepPending(sweep) == 0);
+
+			int count = VPO_SweepGetResults(sweep, 64, results.data());
+
+			for (int k = 0 ; k < count ; k++)
+			{
+				const int *rec = &results[k * VPO_SWEEP_RESULT_SIZE];
+				int index = rec[3];
+
+				if (index < 0 || index >= num_spots || seen[index]++)
+				{
+					CHECK(false, "sweep returned spot %d twice or out of range", index);
+					continue;
+				}
+
+				const int *spot = &spots[index * VPO_SWEEP_SPOT_SIZE];
+				const int *want = &serial[index * VPO_SPOT_RESULT_SIZE];
+
+				if (memcmp(rec, spot, VPO_SWEEP_SPOT_SIZE * sizeof(int)) != 0 ||
+					memcmp(rec + VPO_SWEEP_SPOT_SIZE, want, VPO_SPOT_RESULT_SIZE * sizeof(int)) != 0)
+				{
+					if (mismatches++ < 5)
+						printf("spot %d: sweep %d/%d/%d/%d/%d, serial %d/%d/%d/%d/%d\n", index,
+							rec[4], rec[5], rec[6], rec[7], rec[8],
+							want[0], want[1], want[2], want[3], want[4]);
+				}
+
+				received++;
+			}
+
+			if (done && count == 0)
+				break;
+
+			if (count == 0)
+				std::this_thread::yield();
+		}
+
+		CHECK(received == num_spots, "sweep returned %d of %d spots", received, num_spots);
+		CHECK(mismatches == 0, "%d spots differ between the sweep and VPO_TestSpotMulti", mismatches);
+
+		VPO_DeleteSweep(sweep);
+	}
+
+	VPO_DeleteContext(ctx);
+}
+
+
+int main(int argc, char **argv)
+{
+	TestOpenMap();
+	TestLoadFromMemory();
+	TestWadFileChanges();
+	TestEmptyLumps();
+	TestExtendedNodes();
+	TestInflater();
+	TestCompactNodes();
+	TestSweep();
+
+	if (failures > 0)
+	{
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	printf("all tests passed\n");
+	return 0;
+}
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
@@ -0,0 +1,463 @@
+//------------------------------------------------------------------------
+//  Visplane Overflow Library : synthetic test map
+//------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#ifndef __VPO_TESTMAP_H__
+#define __VPO_TESTMAP_H__
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "../vpo_api.h"
+
+//
+// A square grid of 128 unit cells with random heights, flats and
+// lights, a few cells missing (void) and a few closed doors.  Every
+// cell is a sector and a subsector of its own, and the nodes split the
+// grid in halves, so no node builder is needed.  The same size and
+// seed always give the same map.
+//
+class TestMap
+{
+public:
+	enum { CELL = 128 };
+
+	std::vector<unsigned char> linedefs;
+	std::vector<unsigned char> sidedefs;
+	std::vector<unsigned char> vertexes;
+	std::vector<unsigned char> segs;
+	std::vector<unsigned char> ssectors;
+	std::vector<unsigned char> nodes;
+	std::vector<unsigned char> sectors;
+
+	int size;
+
+	TestMap(int size, unsigned int seed) : size(size), rand_state(seed)
+	{
+		present.resize(size * size);
+
+		for (int i = 0 ; i < size * size ; i++)
+			present[i] = Random(100) >= 12;
+
+		static const int floors[]   = { 0, 0, 8, 16, 24, 32, -16, 64 };
+		static const int heights[]  = { 72, 96, 128, 128, 200, 256 };
+		static const int lights[]   = { 128, 160, 192, 255 };
+		static const char *fflats[] = { "FLOOR4_8", "NUKAGE1", "F_SKY1" };
+		static const char *cflats[] = { "CEIL3_5", "F_SKY1", "FLAT1" };
+
+		sector_of.assign(size * size, -1);
+
+		int numsectors = 0;
+
+		for (int x = 0 ; x < size ; x++)
+		for (int y = 0 ; y < size ; y++)
+		{
+			if (! Present(x, y))
+				continue;
+
+			int f = floors[Random(8)];
+			int c = f + heights[Random(6)];
+			int tag = 0;
+
+			if (Random(100) < 5)
+			{
+				c = f;
+				tag = 1;
+			}
+
+			Put16(sectors, f);
+			Put16(sectors, c);
+			PutName(sectors, fflats[Random(3)]);
+			PutName(sectors, cflats[Random(3)]);
+			Put16(sectors, lights[Random(4)]);
+			Put16(sectors, 0);
+			Put16(sectors, tag);
+
+			sector_of[x * size + y] = numsectors++;
+		}
+
+		// one linedef per cell edge, made by the first cell to reach it
+		std::map<std::pair<int, int>, int> line_of;
+
+		int numlines = 0;
+		int numsides = 0;
+
+		for (int x = 0 ; x < size ; x++)
+		for (int y = 0 ; y < size ; y++)
+		{
+			if (! Present(x, y))
+				continue;
+
+			for (int e = 0 ; e < 4 ; e++)
+			{
+				Edge edge = CellEdge(x, y, e);
+
+				int v1 = Vertex(edge.x1, edge.y1);
+				int v2 = Vertex(edge.x2, edge.y2);
+
+				if (line_of.count(std::make_pair(v2, v1)))
+					continue;
+
+				bool two_sided = Present(edge.nx, edge.ny);
+
+				AddSide(two_sided ? "-" : "STARTAN3", sector_of[x * size + y]);
+
+				int back = -1;
+
+				if (two_sided)
+				{
+					AddSide("-", sector_of[edge.nx * size + edge.ny]);
+					back = numsides + 1;
+				}
+
+				Put16(linedefs, v1);
+				Put16(linedefs, v2);
+				Put16(linedefs, two_sided ? 4 : 1);
+				Put16(linedefs, 0);
+				Put16(linedefs, 0);
+				Put16(linedefs, numsides);
+				Put16(linedefs, back);
+
+				numsides += two_sided ? 2 : 1;
+
+				line_of[std::make_pair(v1, v2)] = numlines++;
+			}
+		}
+
+		// one subsector per cell, with a seg on each edge
+		static const int angles[4] = { 0, -0x4000, -0x8000, 0x4000 };
+
+		int numsegs = 0;
+
+		subsector_of.assign(size * size, -1);
+
+		for (int x = 0 ; x < size ; x++)
+		for (int y = 0 ; y < size ; y++)
+		{
+			if (! Present(x, y))
+				continue;
+
+			for (int e = 0 ; e < 4 ; e++)
+			{
+				Edge edge = CellEdge(x, y, e);
+
+				int v1 = Vertex(edge.x1, edge.y1);
+				int v2 = Vertex(edge.x2, edge.y2);
+
+				int side = 0;
+				auto it = line_of.find(std::make_pair(v1, v2));
+
+				if (it == line_of.end())
+				{
+					it = line_of.find(std::make_pair(v2, v1));
+					side = 1;
+				}
+
+				Put16(segs, v1);
+				Put16(segs, v2);
+				Put16(segs, angles[e]);
+				Put16(segs, it->second);
+				Put16(segs, side);
+				Put16(segs, 0);
+			}
+
+			Put16(ssectors, 4);
+			Put16(ssectors, numsegs);
+			numsegs += 4;
+
+			subsector_of[x * size + y] = (int)(ssectors.size() / 4) - 1;
+		}
+
+		for (auto& v : vertex_list)
+		{
+			Put16(vertexes, v.first);
+			Put16(vertexes, v.second);
+		}
+
+		numnodes = 0;
+		BuildNode(0, 0, size, size);
+	}
+
+	bool Present(int x, int y) const
+	{
+		return x >= 0 && x < size && y >= 0 && y < size && present[x * size + y];
+	}
+
+	// the middle of a cell in map units
+	int CellMiddle(int n) const { return n * CELL + CELL / 2; }
+
+	// opens this map from its lumps, returns the VPO_OpenMapFromLumps result
+	int Open(VPOContext ctx) const
+	{
+		return VPO_OpenMapFromLumps(ctx, false,
+			linedefs.data(), (int)linedefs.size(),
+			sidedefs.data(), (int)sidedefs.size(),
+			vertexes.data(), (int)vertexes.size(),
+			segs.data(),     (int)segs.size(),
+			ssectors.data(), (int)ssectors.size(),
+			nodes.data(),    (int)nodes.size(),
+			sectors.data(),  (int)sectors.size());
+	}
+
+	// this map's nodes converted to one of the ZDoom extended formats,
+	// 0 = XNOD, 1 = XGLN, 2 = XGL2, 3 = XGL3.  Only the data after the
+	// four byte signature is returned, uncompressed.  The GL formats
+	// leave out v2 of each seg, it is the v1 of the next seg around the
+	// subsector (the segs of a cell always form such a loop).
+	std::vector<unsigned char> ExtendedNodes(int gl_version) const
+	{
+		std::vector<unsigned char> lump;
+
+		int num_ssectors = (int)ssectors.size() / 4;
+		int num_segs     = (int)segs.size() / 12;
+		int num_nodes    = (int)nodes.size() / 28;
+
+		Put32(lump, (int)vertexes.size() / 4);
+		Put32(lump, 0);  // no new vertices
+
+		Put32(lump, num_ssectors);
+
+		for (int i = 0 ; i < num_ssectors ; i++)
+			Put32(lump, Get16(ssectors, i * 2));
+
+		Put32(lump, num_segs);
+
+		for (int i = 0 ; i < num_segs ; i++)
+		{
+			Put32(lump, Get16(segs, i * 6));
+
+			if (gl_version == 0)
+				Put32(lump, Get16(segs, i * 6 + 1));
+			else
+				Put32(lump, -1);  // no partner seg
+
+			if (gl_version >= 2)
+				Put32(lump, Get16(segs, i * 6 + 3));
+			else
+				Put16(lump, Get16(segs, i * 6 + 3));
+
+			lump.push_back((unsigned char)Get16(segs, i * 6 + 4));
+		}
+
+		Put32(lump, num_nodes);
+
+		for (int i = 0 ; i < num_nodes ; i++)
+		{
+			for (int k = 0 ; k < 4 ; k++)
+			{
+				if (gl_version >= 3)
+					Put32(lump, Get16(nodes, i * 14 + k) * 65536);
+				else
+					Put16(lump, Get16(nodes, i * 14 + k));
+			}
+
+			for (int k = 4 ; k < 12 ; k++)
+				Put16(lump, Get16(nodes, i * 14 + k));
+
+			for (int k = 12 ; k < 14 ; k++)
+			{
+				int child = Get16(nodes, i * 14 + k) & 0xFFFF;
+
+				if (child & 0x8000)
+					child = (int)(0x80000000u | (unsigned int)(child & 0x7FFF));
+
+				Put32(lump, child);
+			}
+		}
+
+		return lump;
+	}
+
+	// a PWAD holding just this map (with empty THINGS, REJECT and
+	// BLOCKMAP lumps), laid out like one written by a map editor
+	std::vector<unsigned char> Wad(const char *mapname) const
+	{
+		const char *names[11] =
+		{
+			mapname, "THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS",
+			"SSECTORS", "NODES", "SECTORS", "REJECT", "BLOCKMAP"
+		};
+
+		const std::vector<unsigned char> empty;
+		const std::vector<unsigned char> *lumps[11] =
+		{
+			&empty, &empty, &linedefs, &sidedefs, &vertexes, &segs,
+			&ssectors, &nodes, &sectors, &empty, &empty
+		};
+
+		std::vector<unsigned char> wad;
+		std::vector<unsigned char> dir;
+
+		PutName(wad, "PWAD");
+		wad.resize(4);
+		Put32(wad, 11);
+		Put32(wad, 0);  // directory offset, patched below
+
+		for (int i = 0 ; i < 11 ; i++)
+		{
+			Put32(dir, (int)wad.size());
+			Put32(dir, (int)lumps[i]->size());
+			PutName(dir, names[i]);
+
+			wad.insert(wad.end(), lumps[i]->begin(), lumps[i]->end());
+		}
+
+		int dir_pos = (int)wad.size();
+
+		for (int b = 0 ; b < 4 ; b++)
+			wad[8 + b] = (unsigned char)((dir_pos >> (b * 8)) & 0xFF);
+
+		wad.insert(wad.end(), dir.begin(), dir.end());
+		return wad;
+	}
+
+private:
+	struct Edge
+	{
+		int x1, y1, x2, y2;  // clockwise around the cell
+		int nx, ny;          // the cell on the other side
+	};
+
+	std::vector<bool> present;
+	std::vector<int> sector_of;
+	std::vector<int> subsector_of;
+	std::map<std::pair<int, int>, int> vertex_of;
+	std::vector<std::pair<int, int>> vertex_list;
+	int numnodes;
+	unsigned int rand_state;
+
+	int Random(int range)
+	{
+		rand_state = rand_state * 1103515245u + 12345u;
+		return (int)((rand_state >> 16) % (unsigned int)range);
+	}
+
+	static void Put16(std::vector<unsigned char>& lump, int value)
+	{
+		lump.push_back((unsigned char)(value & 0xFF));
+		lump.push_back((unsigned char)((value >> 8) & 0xFF));
+	}
+
+	// the n-th 16-bit value in a lump, sign extended
+	static int Get16(const std::vector<unsigned char>& lump, int n)
+	{
+		return (short)(lump[n * 2] | (lump[n * 2 + 1] << 8));
+	}
+
+	static void Put32(std::vector<unsigned char>& lump, int value)
+	{
+		Put16(lump, value & 0xFFFF);
+		Put16(lump, (value >> 16) & 0xFFFF);
+	}
+
+	static void PutName(std::vector<unsigned char>& lump, const char *name)
+	{
+		for (int i = 0 ; i < 8 ; i++)
+			lump.push_back(*name ? (unsigned char)*name++ : 0);
+	}
+
+	void AddSide(const char *middle, int sector)
+	{
+		Put16(sidedefs, 0);
+		Put16(sidedefs, 0);
+		PutName(sidedefs, "STARTAN3");
+		PutName(sidedefs, "STARTAN3");
+		PutName(sidedefs, middle);
+		Put16(sidedefs, sector);
+	}
+
+	int Vertex(int x, int y)
+	{
+		auto key = std::make_pair(x, y);
+		auto it = vertex_of.find(key);
+
+		if (it != vertex_of.end())
+			return it->second;
+
+		vertex_list.push_back(key);
+		return vertex_of[key] = (int)vertex_list.size() - 1;
+	}
+
+	Edge CellEdge(int x, int y, int e) const
+	{
+		int x0 = x * CELL, x1 = x0 + CELL;
+		int y0 = y * CELL, y1 = y0 + CELL;
+
+		switch (e)
+		{
+			case 0:  return { x0, y1, x1, y1, x, y + 1 };  // north
+			case 1:  return { x1, y1, x1, y0, x + 1, y };  // east
+			case 2:  return { x1, y0, x0, y0, x, y - 1 };  // south
+			default: return { x0, y0, x0, y1, x - 1, y };  // west
+		}
+	}
+
+	// Builds the node (or subsector) for the cells from (x1 y1) up to
+	// but not including (x2 y2), returns its child number, or -1 when
+	// none of the cells are present.
+	int BuildNode(int x1, int y1, int x2, int y2)
+	{
+		if (x2 - x1 == 1 && y2 - y1 == 1)
+			return Present(x1, y1) ? (0x8000 | subsector_of[x1 * size + y1]) : -1;
+
+		int front, back;
+		int part[4];
+		int fbox[4] = { y2, y1, x1, x2 };  // top, bottom, left, right
+		int bbox[4] = { y2, y1, x1, x2 };
+
+		if (x2 - x1 >= y2 - y1)
+		{
+			// partition pointing north, its right side is the east half
+			int mx = (x1 + x2) / 2;
+
+			front = BuildNode(mx, y1, x2, y2);
+			back  = BuildNode(x1, y1, mx, y2);
+
+			part[0] = mx * CELL; part[1] = 0; part[2] = 0; part[3] = CELL;
+			fbox[2] = mx;
+			bbox[3] = mx;
+		}
+		else
+		{
+			// partition pointing east, its right side is the south half
+			int my = (y1 + y2) / 2;
+
+			front = BuildNode(x1, y1, x2, my);
+			back  = BuildNode(x1, my, x2, y2);
+
+			part[0] = 0; part[1] = my * CELL; part[2] = CELL; part[3] = 0;
+			fbox[0] = my;
+			bbox[1] = my;
+		}
+
+		if (front < 0 || back < 0)
+			return front < 0 ? back : front;
+
+		for (int i = 0 ; i < 4 ; i++)
+			Put16(nodes, part[i]);
+		for (int i = 0 ; i < 4 ; i++)
+			Put16(nodes, fbox[i] * CELL);
+		for (int i = 0 ; i < 4 ; i++)
+			Put16(nodes, bbox[i] * CELL);
+
+		Put16(nodes, front);
+		Put16(nodes, back);
+
+		return numnodes++;
+	}
+};
+
+#endif  /* __VPO_TESTMAP_H__ */
@@ -194,7 +194,10 @@ typedef struct
 // BSP node structure.
 
 // Indicate a leaf.
-#define	NF_SUBSECTOR	0x8000
+#define	NF_SUBSECTOR_VANILLA	0x8000
+
+// Indicate a leaf in the ZDoom extended node formats, and in node_t.
+#define	NF_SUBSECTOR	0x80000000
 
 typedef struct
 {
@@ -208,7 +211,7 @@ typedef struct
   // clip against view frustum.
   short		bbox[2][4];
 
-  // If NF_SUBSECTOR its a subsector,
+  // If NF_SUBSECTOR_VANILLA its a subsector,
   // else it's a node of another subtree.
   unsigned short	children[2];
 
@@ -34,14 +34,14 @@ namespace vpo
 {
 
 
-void Context::M_ClearBox (fixed_t *box)
+void LevelData::M_ClearBox (fixed_t *box)
 {
     box[BOXTOP] = box[BOXRIGHT] = INT_MIN;
     box[BOXBOTTOM] = box[BOXLEFT] = INT_MAX;
 }
 
 void
-Context::M_AddToBox
+LevelData::M_AddToBox
 ( fixed_t*	box,
   fixed_t	x,
   fixed_t	y )
@@ -0,0 +1,466 @@
+//------------------------------------------------------------------------
+//  Visplane Overflow Library : zlib stream decoder
+//------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  The decoding follows the "puff" reference inflater by Mark Adler,
+//  rearranged so that output is produced on demand.  The adler32
+//  checksum at the end of the stream is not checked.
+//
+//------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "vpo_local.h"
+
+namespace vpo
+{
+
+// base lengths and extra bits for length codes 257..285
+static const short length_base[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const short length_extra[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+// offset bases and extra bits for distance codes 0..29
+static const short dist_base[30] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+static const short dist_extra[30] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// order of the code length code lengths in a dynamic block
+static const short codelen_order[19] =
+{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+
+Inflater::Inflater(const byte *data, size_t length) :
+	src(data), src_end(data + length),
+	bitbuf(0), bitcnt(0),
+	failed(false), last_block(false),
+	mode(BLOCK_NONE), stored_left(0),
+	copy_len(0), copy_dist(0),
+	out_pos(0)
+{
+	// check the zlib header : deflate method, window no larger
+	// than 32K, no preset dictionary, valid check bits.
+	if (length < 2)
+	{
+		Fail();
+		return;
+	}
+
+	int cmf = data[0];
+	int flg = data[1];
+
+	if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7 ||
+	    (flg & 0x20) != 0 || ((cmf << 8) | flg) % 31 != 0)
+	{
+		Fail();
+		return;
+	}
+
+	src += 2;
+}
+
+
+void Inflater::Fail()
+{
+	failed   = true;
+	mode     = BLOCK_DONE;
+	copy_len = 0;
+}
+
+
+//
+// GetBits
+// Returns the next 'need' bits of the input, least significant first.
+// Running out of input marks the stream as failed.
+//
+int Inflater::GetBits(int need)
+{
+	unsigned int val = bitbuf;
+
+	while (bitcnt < need)
+	{
+		if (src >= src_end)
+		{
+			Fail();
+			return 0;
+		}
+
+		val |= (unsigned int)(*src++) << bitcnt;
+		bitcnt += 8;
+	}
+
+	bitbuf = val >> need;
+	bitcnt -= need;
+
+	return (int)(val & ((1U << need) - 1));
+}
+
+
+//
+// Decode
+// Reads one symbol using a canonical Huffman code.
+// Returns -1 for a code which is not in the table.
+//
+int Inflater::Decode(const huffman_t *h)
+{
+	int code  = 0;  // bits read so far
+	int first = 0;  // first code of this length
+	int index = 0;  // index of the first code of this length in symbol[]
+
+	for (int len = 1 ; len <= MAXBITS ; len++)
+	{
+		code |= GetBits(1);
+
+		// out of input, the bits read so far are not a whole code
+		if (failed)
+			break;
+
+		int count = h->count[len];
+
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+
+		index += count;
+		first += count;
+		first <<= 1;
+		code  <<= 1;
+	}
+
+	return -1;
+}
+
+
+//
+// Construct
+// Builds a decoding table from the code lengths of n symbols.
+// Returns false for an over-subscribed set of lengths, incomplete
+// codes are allowed (decoding simply fails on an unused code).
+//
+bool Inflater::Construct(huffman_t *h, const short *length, int n)
+{
+	short offs[MAXBITS+1];
+	int len;
+	int sym;
+
+	for (len = 0 ; len <= MAXBITS ; len++)
+		h->count[len] = 0;
+
+	for (sym = 0 ; sym < n ; sym++)
+		h->count[length[sym]]++;
+
+	if (h->count[0] == n)
+		return true;
+
+	int left = 1;
+
+	for (len = 1 ; len <= MAXBITS ; len++)
+	{
+		left <<= 1;
+		left -= h->count[len];
+
+		if (left < 0)
+			return false;
+	}
+
+	offs[1] = 0;
+
+	for (len = 1 ; len < MAXBITS ; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+
+	for (sym = 0 ; sym < n ; sym++)
+		if (length[sym] != 0)
+			h->symbol[offs[length[sym]]++] = sym;
+
+	return true;
+}
+
+
+void Inflater::FixedTables()
+{
+	short lengths[MAXLCODES];
+	int sym;
+
+	for (sym = 0 ; sym < 144 ; sym++)
+		lengths[sym] = 8;
+	for (; sym < 256 ; sym++)
+		lengths[sym] = 9;
+	for (; sym < 280 ; sym++)
+		lengths[sym] = 7;
+	for (; sym < MAXLCODES ; sym++)
+		lengths[sym] = 8;
+
+	Construct(&lencode, lengths, MAXLCODES);
+
+	for (sym = 0 ; sym < MAXDCODES ; sym++)
+		lengths[sym] = 5;
+
+	Construct(&distcode, lengths, MAXDCODES);
+}
+
+
+bool Inflater::DynamicTables()
+{
+	short lengths[MAXLCODES + MAXDCODES];
+
+	int nlen  = GetBits(5) + 257;
+	int ndist = GetBits(5) + 1;
+	int ncode = GetBits(4) + 4;
+
+	if (failed || nlen > 286 || ndist > MAXDCODES)
+		return false;
+
+	int index;
+
+	// the code length code, reusing lencode for it
+	for (index = 0 ; index < 19 ; index++)
+		lengths[codelen_order[index]] = (index < ncode) ? GetBits(3) : 0;
+
+	if (failed || ! Construct(&lencode, lengths, 19))
+		return false;
+
+	index = 0;
+
+	while (index < nlen + ndist)
+	{
+		int sym = Decode(&lencode);
+
+		if (sym < 0)
+			return false;
+
+		if (sym < 16)
+		{
+			lengths[index++] = sym;
+			continue;
+		}
+
+		short len = 0;
+		int repeat;
+
+		if (sym == 16)
+		{
+			if (index == 0)
+				return false;
+
+			len = lengths[index - 1];
+			repeat = 3 + GetBits(2);
+		}
+		else if (sym == 17)
+			repeat = 3 + GetBits(3);
+		else
+			repeat = 11 + GetBits(7);
+
+		if (failed || index + repeat > nlen + ndist)
+			return false;
+
+		while (repeat-- > 0)
+			lengths[index++] = len;
+	}
+
+	// an end-of-block code is required
+	if (lengths[256] == 0)
+		return false;
+
+	return Construct(&lencode, lengths, nlen) &&
+	       Construct(&distcode, lengths + nlen, ndist);
+}
+
+
+bool Inflater::StartBlock()
+{
+	last_block = GetBits(1) != 0;
+
+	int type = GetBits(2);
+
+	if (failed)
+		return false;
+
+	switch (type)
+	{
+		case 0:
+		{
+			// stored block : skip to a byte boundary, then a length
+			// and its complement
+			bitbuf = 0;
+			bitcnt = 0;
+
+			if (src_end - src < 4)
+				return false;
+
+			unsigned int len  = src[0] | (src[1] << 8);
+			unsigned int nlen = src[2] | (src[3] << 8);
+
+			if (len != (~nlen & 0xFFFF))
+				return false;
+
+			src += 4;
+
+			stored_left = len;
+			mode = BLOCK_STORED;
+			return true;
+		}
+
+		case 1:
+			FixedTables();
+			mode = BLOCK_HUFFMAN;
+			return true;
+
+		case 2:
+			if (! DynamicTables())
+				return false;
+
+			mode = BLOCK_HUFFMAN;
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+
+size_t Inflater::Read(byte *buffer, size_t length)
+{
+	size_t done = 0;
+
+	while (done < length)
+	{
+		if (copy_len > 0)
+		{
+			byte b = window[(out_pos - copy_dist) & (WINDOWSIZE - 1)];
+
+			window[out_pos++ & (WINDOWSIZE - 1)] = b;
+			buffer[done++] = b;
+
+			copy_len--;
+			continue;
+		}
+
+		if (mode == BLOCK_DONE)
+			break;
+
+		if (mode == BLOCK_NONE)
+		{
+			if (last_block)
+			{
+				mode = BLOCK_DONE;
+				break;
+			}
+
+			if (! StartBlock())
+				Fail();
+
+			continue;
+		}
+
+		if (mode == BLOCK_STORED)
+		{
+			if (stored_left == 0)
+			{
+				mode = BLOCK_NONE;
+				continue;
+			}
+
+			if (src >= src_end)
+			{
+				Fail();
+				break;
+			}
+
+			byte b = *src++;
+			stored_left--;
+
+			window[out_pos++ & (WINDOWSIZE - 1)] = b;
+			buffer[done++] = b;
+			continue;
+		}
+
+		// BLOCK_HUFFMAN
+
+		int sym = Decode(&lencode);
+
+		if (sym < 0)
+		{
+			Fail();
+			break;
+		}
+
+		if (sym < 256)
+		{
+			window[out_pos++ & (WINDOWSIZE - 1)] = (byte)sym;
+			buffer[done++] = (byte)sym;
+			continue;
+		}
+
+		if (sym == 256)
+		{
+			mode = BLOCK_NONE;
+			continue;
+		}
+
+		sym -= 257;
+
+		if (sym >= 29)
+		{
+			Fail();
+			break;
+		}
+
+		int len = length_base[sym] + GetBits(length_extra[sym]);
+
+		int dsym = Decode(&distcode);
+
+		if (dsym < 0 || dsym >= MAXDCODES)
+		{
+			Fail();
+			break;
+		}
+
+		int dist = dist_base[dsym] + GetBits(dist_extra[dsym]);
+
+		if (failed || (size_t)dist > out_pos)
+		{
+			Fail();
+			break;
+		}
+
+		copy_len  = len;
+		copy_dist = dist;
+	}
+
+	return done;
+}
+
+
+} // namespace vpo
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
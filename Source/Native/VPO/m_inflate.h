@@ -0,0 +1,97 @@
+//------------------------------------------------------------------------
+//  Visplane Overflow Library : zlib stream decoder
+//------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#ifndef __M_INFLATE_H__
+#define __M_INFLATE_H__
+
+//
+// Decodes a zlib stream (RFC 1950/1951) which is wholly in memory,
+// producing the output on demand, so the caller can parse it as it
+// goes without holding the whole of the uncompressed data.
+//
+// Used for the compressed ZDoom node formats (ZNOD, ZGLN etc).
+//
+class Inflater
+{
+public:
+	Inflater(const byte *data, size_t length);
+
+	// decode up to 'length' bytes into buffer, returns the number
+	// of bytes produced.  This is less than asked for only when the
+	// stream has ended or is corrupt (see Failed).
+	size_t Read(byte *buffer, size_t length);
+
+	bool Failed() const { return failed; }
+
+private:
+	enum
+	{
+		MAXBITS    = 15,
+		MAXLCODES  = 288,
+		MAXDCODES  = 30,
+		WINDOWSIZE = 32768
+	};
+
+	// canonical Huffman code: number of codes of each length, and
+	// the symbols ordered by code
+	struct huffman_t
+	{
+		short count[MAXBITS+1];
+		short symbol[MAXLCODES];
+	};
+
+	enum block_mode_e
+	{
+		BLOCK_NONE,      // need the next block header
+		BLOCK_STORED,
+		BLOCK_HUFFMAN,
+		BLOCK_DONE       // end of stream (or an error)
+	};
+
+	const byte *src;
+	const byte *src_end;
+
+	unsigned int bitbuf;
+	int bitcnt;
+
+	bool failed;
+	bool last_block;
+
+	block_mode_e mode;
+
+	size_t stored_left;
+
+	huffman_t lencode;
+	huffman_t distcode;
+
+	// pending back reference
+	int copy_len;
+	int copy_dist;
+
+	// history for back references (total output in 'out_pos')
+	byte window[WINDOWSIZE];
+	size_t out_pos;
+
+	int  GetBits(int need);
+	int  Decode(const huffman_t *h);
+	bool Construct(huffman_t *h, const short *length, int n);
+	bool StartBlock();
+	bool DynamicTables();
+	void FixedTables();
+	void Fail();
+};
+
+#endif  /* __M_INFLATE_H__ */
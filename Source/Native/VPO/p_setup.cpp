@@ -62,7 +62,7 @@ static int R_FlatNumForName (const char * name)
 }
 
 
-void Context::LevelError(const char *msg, ...)
+void LevelData::LevelError(const char *msg, ...)
 {
 	va_list argptr;
 
@@ -78,24 +78,24 @@ void Context::LevelError(const char *msg, ...)
 //
 // P_LoadVertexes
 //
-void Context::P_LoadVertexes (int lump)
+void LevelData::P_LoadVertexes (int lump)
 {
-	byte*		data;
+	const byte*		data;
 	int			i;
-	mapvertex_t*	ml;
+	const mapvertex_t*	ml;
 	vertex_t*		li;
 
 	// Determine number of lumps:
 	//  total lump length / vertex record length.
-	numvertexes = W_LumpLength (lump) / sizeof(mapvertex_t);
+	numvertexes = wad->W_LumpLength (lump) / sizeof(mapvertex_t);
 
 	// Allocate zone memory for buffer.
 	vertexes = new vertex_t[numvertexes];
 
 	// Load data into cache.
-	data = W_LoadLump (lump);
+	data = wad->W_LoadLump (lump);
 
-	ml = (mapvertex_t *)data;
+	ml = (const mapvertex_t *)data;
 	li = vertexes;
 
 	// Copy and convert vertex coordinates,
@@ -107,14 +107,14 @@ void Context::P_LoadVertexes (int lump)
 	}
 
 	// Free buffer memory.
-	W_FreeLump(data);
+	wad->W_FreeLump(data);
 }
 
 
 //
 // GetSectorAtNullAddress
 //
-sector_t * Context::GetSectorAtNullAddress(void)
+sector_t * LevelData::GetSectorAtNullAddress(void)
 {
 	return sectors + 0;
 }
@@ -123,30 +123,27 @@ sector_t * Context::GetSectorAtNullAddress(void)
 //
 // P_LoadSegs
 //
-void Context::P_LoadSegs (int lump)
+void LevelData::P_LoadSegs (int lump)
 {
-	byte*		data;
+	const byte*		data;
 	int		i;
-	mapseg_t*	ml;
+	const mapseg_t*	ml;
 	seg_t*		li;
-	line_t*		ldef;
-	int		side;
-	int             sidenum;
 
-	numsegs = W_LumpLength (lump) / sizeof(mapseg_t);
+	numsegs = wad->W_LumpLength (lump) / sizeof(mapseg_t);
 	segs = new seg_t[numsegs];
 
 	memset (segs, 0, numsegs*sizeof(seg_t));
 
-	data = W_LoadLump (lump);
+	data = wad->W_LoadLump (lump);
 
-	ml = (mapseg_t *)data;
+	ml = (const mapseg_t *)data;
 	li = segs;
 
 	for (i=0 ; i < numsegs ; i++, li++, ml++)
 	{
-		int v1_idx = SHORT(ml->v1);
-		int v2_idx = SHORT(ml->v2);
+		int v1_idx = USHORT(ml->v1);
+		int v2_idx = USHORT(ml->v2);
 
 		if (v1_idx < 0 || v1_idx >= numvertexes ||
 		    v2_idx < 0 || v2_idx >= numvertexes)
@@ -157,7 +154,7 @@ void Context::P_LoadSegs (int lump)
 		li->v1 = &vertexes[v1_idx];
 		li->v2 = &vertexes[v2_idx];
 
-		int line_idx = SHORT(ml->linedef);
+		int line_idx = USHORT(ml->linedef);
 
 		if (line_idx < 0 || line_idx >= numlines)
 		{
@@ -167,73 +164,83 @@ void Context::P_LoadSegs (int lump)
 		li->angle = (SHORT(ml->angle))<<16;
 		li->offset = (SHORT(ml->offset))<<16;
 
-		ldef = &lines[line_idx];
-		li->linedef = ldef;
+		Seg_CommonSetup(li, &lines[line_idx], SHORT(ml->side));
+	}
 
-		side = SHORT(ml->side);
-		li->sidedef = &sides[ldef->sidenum[side]];
-		li->frontsector = sides[ldef->sidenum[side]].sector;
+	wad->W_FreeLump(data);
+}
 
-		if (ldef-> flags & ML_TWOSIDED)
-		{
-			sidenum = ldef->sidenum[side ^ 1];
 
-			// If the sidenum is out of range, this may be a "glass hack"
-			// impassible window.  Point at side #0 (this may not be
-			// the correct Vanilla behavior; however, it seems to work for
-			// OTTAWAU.WAD, which is the one place I've seen this trick
-			// used).
+//
+// Seg_CommonSetup
+// Sets the sides and sectors of a seg along the given linedef.
+//
+void LevelData::Seg_CommonSetup(seg_t *li, line_t *ldef, int side)
+{
+	int             sidenum;
 
-			if (sidenum < 0 || sidenum >= numsides)
-			{
-				li->backsector = GetSectorAtNullAddress();
-			}
-			else
-			{
-				li->backsector = sides[sidenum].sector;
-			}
+	li->linedef = ldef;
+
+	li->sidedef = &sides[ldef->sidenum[side]];
+	li->frontsector = sides[ldef->sidenum[side]].sector;
+
+	if (ldef-> flags & ML_TWOSIDED)
+	{
+		sidenum = ldef->sidenum[side ^ 1];
+
+		// If the sidenum is out of range, this may be a "glass hack"
+		// impassible window.  Point at side #0 (this may not be
+		// the correct Vanilla behavior; however, it seems to work for
+		// OTTAWAU.WAD, which is the one place I've seen this trick
+		// used).
+
+		if (sidenum < 0 || sidenum >= numsides)
+		{
+			li->backsector = GetSectorAtNullAddress();
 		}
 		else
 		{
-			li->backsector = NULL;
+			li->backsector = sides[sidenum].sector;
 		}
 	}
-
-	W_FreeLump(data);
+	else
+	{
+		li->backsector = NULL;
+	}
 }
 
 
 //
 // P_LoadSubsectors
 //
-void Context::P_LoadSubsectors (int lump)
+void LevelData::P_LoadSubsectors (int lump)
 {
-	byte*		data;
+	const byte*		data;
 	int			i;
-	mapsubsector_t*	ms;
+	const mapsubsector_t*	ms;
 	subsector_t*	ss;
 
-	numsubsectors = W_LumpLength (lump) / sizeof(mapsubsector_t);
+	numsubsectors = wad->W_LumpLength (lump) / sizeof(mapsubsector_t);
 	subsectors = new subsector_t[numsubsectors];
 
-	data = W_LoadLump (lump);
+	data = wad->W_LoadLump (lump);
 
-	ms = (mapsubsector_t *)data;
+	ms = (const mapsubsector_t *)data;
 	memset (subsectors,0, numsubsectors*sizeof(subsector_t));
 	ss = subsectors;
 
 	for (i=0 ; i < numsubsectors ; i++, ss++, ms++)
 	{
-		ss->numlines = SHORT(ms->numsegs);
-		ss->firstline = SHORT(ms->firstseg);
+		ss->numlines = USHORT(ms->numsegs);
+		ss->firstline = USHORT(ms->firstseg);
 	}
 
-	W_FreeLump(data);
+	wad->W_FreeLump(data);
 }
 
 
 // andrewj: added this
-void Context::ValidateSubsectors ()
+void LevelData::ValidateSubsectors ()
 {
 	int i;
 	subsector_t * ss = subsectors;
@@ -252,20 +259,20 @@ void Context::ValidateSubsectors ()
 //
 // P_LoadSectors
 //
-void Context::P_LoadSectors (int lump)
+void LevelData::P_LoadSectors (int lump)
 {
-	byte*		data;
+	const byte*		data;
 	int			i;
-	mapsector_t*	ms;
+	const mapsector_t*	ms;
 	sector_t*		ss;
 
-	numsectors = W_LumpLength (lump) / sizeof(mapsector_t);
+	numsectors = wad->W_LumpLength (lump) / sizeof(mapsector_t);
 	sectors = new sector_t[numsectors];
 
 	memset (sectors, 0, numsectors*sizeof(sector_t));
-	data = W_LoadLump (lump);
+	data = wad->W_LoadLump (lump);
 
-	ms = (mapsector_t *)data;
+	ms = (const mapsector_t *)data;
 	ss = sectors;
 
 	for (i=0 ; i < numsectors ; i++, ss++, ms++)
@@ -280,37 +287,37 @@ void Context::P_LoadSectors (int lump)
 		///	ss->thinglist = NULL;
 	}
 
-	W_FreeLump(data);
+	wad->W_FreeLump(data);
 }
 
 
-bool Context::isChildValid(unsigned short child)
+bool LevelData::isChildValid(unsigned int child)
 {
 	if (child & NF_SUBSECTOR)
-		return ((child & ~NF_SUBSECTOR) < numsubsectors);
+		return ((child & ~NF_SUBSECTOR) < (unsigned int)numsubsectors);
 	else
-		return (child < numnodes);
+		return (child < (unsigned int)numnodes);
 }
 
 
 //
 // P_LoadNodes
 //
-void Context::P_LoadNodes (int lump)
+void LevelData::P_LoadNodes (int lump)
 {
-	byte*	data;
+	const byte*	data;
 	int		i;
 	int		j;
 	int		k;
-	mapnode_t*	mn;
+	const mapnode_t*	mn;
 	node_t*	no;
 
-	numnodes = W_LumpLength (lump) / sizeof(mapnode_t);
+	numnodes = wad->W_LumpLength (lump) / sizeof(mapnode_t);
 	nodes = new node_t[numnodes];
 
-	data = W_LoadLump (lump);
+	data = wad->W_LoadLump (lump);
 
-	mn = (mapnode_t *)data;
+	mn = (const mapnode_t *)data;
 	no = nodes;
 
 	for (i=0 ; i < numnodes ; i++, no++, mn++)
@@ -322,7 +329,10 @@ void Context::P_LoadNodes (int lump)
 
 		for (j=0 ; j < 2 ; j++)
 		{
-			unsigned short child = SHORT(mn->children[j]);
+			unsigned int child = (unsigned short)SHORT(mn->children[j]);
+
+			if (child & NF_SUBSECTOR_VANILLA)
+				child = (child & ~NF_SUBSECTOR_VANILLA) | NF_SUBSECTOR;
 
 			if (! isChildValid(child))
 				LevelError("Bad map data : invalid child in node #%d", i);
@@ -334,14 +344,425 @@ void Context::P_LoadNodes (int lump)
 		}
 	}
 
-	W_FreeLump(data);
+	wad->W_FreeLump(data);
+}
+
+
+//
+// The ZDoom extended nodes, read either straight from the lump or
+// through the zlib decoder (for the "Z" signatures).  Reading past the
+// end of the data gives zeros and sets 'truncated', which the loader
+// checks as it goes.
+//
+class ExtNodesReader
+{
+public:
+	ExtNodesReader(const byte *data, size_t length, bool compressed) :
+		truncated(false), pos(data), end(data + length)
+	{
+		if (compressed)
+			zstream.reset(new Inflater(data, length));
+	}
+
+	bool truncated;
+
+	void Read(byte *buffer, size_t length)
+	{
+		size_t got;
+
+		if (zstream)
+		{
+			got = zstream->Read(buffer, length);
+		}
+		else
+		{
+			got = MIN(length, (size_t)(end - pos));
+
+			memcpy(buffer, pos, got);
+			pos += got;
+		}
+
+		if (got < length)
+		{
+			memset(buffer + got, 0, length - got);
+			truncated = true;
+		}
+	}
+
+	unsigned int U8()
+	{
+		byte b;
+		Read(&b, 1);
+		return b;
+	}
+
+	unsigned int U16()
+	{
+		byte b[2];
+		Read(b, 2);
+		return b[0] | (b[1] << 8);
+	}
+
+	unsigned int U32()
+	{
+		byte b[4];
+		Read(b, 4);
+		return b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+	}
+
+	short S16() { return (short)U16(); }
+	int   S32() { return (int)U32(); }
+
+private:
+	const byte *pos;
+	const byte *end;
+
+	std::unique_ptr<Inflater> zstream;
+};
+
+
+// seg as stored in the extended formats, 'partner' is only in the
+// GL formats (where v2 is the v1 of the next seg in the subsector)
+typedef struct
+{
+	unsigned int v1, v2;
+	unsigned int partner;
+	unsigned int line;
+	int side;
+
+} extseg_t;
+
+#define EXT_NO_INDEX	0xFFFFFFFF
+
+// more of anything than this is a corrupt lump
+#define EXT_MAX_COUNT	0x4000000
+
+
+static angle_t SegAngle(const vertex_t *v1, const vertex_t *v2)
+{
+	double a = atan2((double)v2->y - (double)v1->y, (double)v2->x - (double)v1->x);
+
+	return (angle_t)(int64_t)(a * ANG180 / M_PI);
+}
+
+
+//
+// P_LoadExtendedNodes
+// Loads the nodes, subsectors and segs (plus the vertices added by the
+// node builder) from a lump in one of the ZDoom extended formats, which
+// use 32-bit indices.  Returns false when the lump is in some other
+// format.
+//
+bool LevelData::P_LoadExtendedNodes (int lump)
+{
+	if (wad->W_LumpLength (lump) < 4)
+		return false;
+
+	const byte* data = wad->W_LoadLump (lump);
+
+	static const char *const formats[4] = { "NOD", "GLN", "GL2", "GL3" };
+
+	int gl_version;
+
+	for (gl_version = 3 ; gl_version >= 0 ; gl_version--)
+		if (memcmp (data + 1, formats[gl_version], 3) == 0)
+			break;
+
+	if ((data[0] != 'X' && data[0] != 'Z') || gl_version < 0)
+	{
+		wad->W_FreeLump(data);
+		return false;
+	}
+
+	ExtNodesReader reader(data + 4, wad->W_LumpLength (lump) - 4, data[0] == 'Z');
+
+	try
+	{
+		P_ReadExtendedNodes (reader, gl_version);
+	}
+	catch (invalid_data_exception)
+	{
+		wad->W_FreeLump(data);
+		throw;
+	}
+
+	wad->W_FreeLump(data);
+	return true;
+}
+
+
+void LevelData::P_ReadExtendedNodes (ExtNodesReader& reader, int gl_version)
+{
+	unsigned int	count;
+	unsigned int	i;
+	unsigned int	k;
+
+	// vertices : the ones in VERTEXES are followed by the new ones
+
+	unsigned int orgverts = reader.U32();
+	unsigned int newverts = reader.U32();
+
+	if (orgverts > (unsigned int)numvertexes || newverts > EXT_MAX_COUNT)
+		LevelError("Bad map data : vertex count mismatch in extended nodes");
+
+	vertex_t *newvertexes = new vertex_t[orgverts + newverts];
+
+	memcpy (newvertexes, vertexes, orgverts * sizeof(vertex_t));
+
+	for (i = 0 ; i < newverts && ! reader.truncated ; i++)
+	{
+		newvertexes[orgverts + i].x = reader.S32();
+		newvertexes[orgverts + i].y = reader.S32();
+	}
+
+	for (i = 0 ; i < (unsigned int)numlines ; i++)
+	{
+		line_t *ld = &lines[i];
+
+		if ((unsigned int)(ld->v1 - vertexes) >= orgverts ||
+		    (unsigned int)(ld->v2 - vertexes) >= orgverts)
+		{
+			delete[] newvertexes;
+			LevelError("Bad map data : vertex out of range (linedef #%d)", i);
+		}
+
+		ld->v1 = newvertexes + (ld->v1 - vertexes);
+		ld->v2 = newvertexes + (ld->v2 - vertexes);
+	}
+
+	delete[] vertexes;
+
+	vertexes = newvertexes;
+	numvertexes = orgverts + newverts;
+
+	// subsectors : only the seg counts are stored
+
+	count = reader.U32();
+
+	if (count > EXT_MAX_COUNT)
+		LevelError("Bad map data : too many subsectors");
+
+	numsubsectors = count;
+	subsectors = new subsector_t[numsubsectors];
+
+	memset (subsectors, 0, numsubsectors*sizeof(subsector_t));
+
+	unsigned int total = 0;
+
+	for (i = 0 ; i < count && ! reader.truncated ; i++)
+	{
+		unsigned int n = reader.U32();
+
+		if (n > EXT_MAX_COUNT - total)
+			LevelError("Bad map data : invalid seg range in subsector #%d", i);
+
+		subsectors[i].firstline = total;
+		subsectors[i].numlines  = n;
+
+		total += n;
+	}
+
+	// segs
+
+	count = reader.U32();
+
+	if (count != total && ! reader.truncated)
+		LevelError("Bad map data : seg count mismatch in extended nodes");
+
+	std::vector<extseg_t> rawsegs;
+
+	for (i = 0 ; i < count && ! reader.truncated ; i++)
+	{
+		extseg_t seg;
+
+		seg.v1 = reader.U32();
+
+		if (gl_version == 0)
+		{
+			seg.v2 = reader.U32();
+			seg.partner = EXT_NO_INDEX;
+		}
+		else
+		{
+			seg.v2 = EXT_NO_INDEX;
+			seg.partner = reader.U32();
+		}
+
+		seg.line = (gl_version >= 2) ? reader.U32() : reader.U16();
+		seg.side = reader.U8();
+
+		if (gl_version == 1 && seg.line == 0xFFFF)
+			seg.line = EXT_NO_INDEX;
+
+		rawsegs.push_back(seg);
+	}
+
+	// nodes
+
+	count = reader.U32();
+
+	if (count > EXT_MAX_COUNT)
+		LevelError("Bad map data : too many nodes");
+
+	numnodes = count;
+	nodes = new node_t[numnodes];
+
+	for (i = 0 ; i < count && ! reader.truncated ; i++)
+	{
+		node_t *no = &nodes[i];
+
+		if (gl_version >= 3)
+		{
+			no->x  = reader.S32();
+			no->y  = reader.S32();
+			no->dx = reader.S32();
+			no->dy = reader.S32();
+		}
+		else
+		{
+			no->x  = reader.S16() << FRACBITS;
+			no->y  = reader.S16() << FRACBITS;
+			no->dx = reader.S16() << FRACBITS;
+			no->dy = reader.S16() << FRACBITS;
+		}
+
+		for (k = 0 ; k < 8 ; k++)
+			no->bbox[k / 4][k % 4] = reader.S16() << FRACBITS;
+
+		for (k = 0 ; k < 2 ; k++)
+		{
+			unsigned int child = reader.U32();
+
+			if (! isChildValid(child) && ! reader.truncated)
+				LevelError("Bad map data : invalid child in node #%d", i);
+
+			no->children[k] = child;
+		}
+	}
+
+	if (reader.truncated)
+		LevelError("Bad map data : extended nodes are truncated");
+
+	// in the GL formats the segs of each subsector form a closed loop,
+	// and minisegs (which lie along no linedef) are dropped as they can
+	// never be drawn.
+
+	std::vector<int> seg_subsector(rawsegs.size());
+
+	numsegs = 0;
+
+	for (i = 0 ; i < (unsigned int)numsubsectors ; i++)
+	{
+		subsector_t *ss = &subsectors[i];
+
+		for (k = 0 ; k < (unsigned int)ss->numlines ; k++)
+		{
+			extseg_t *seg = &rawsegs[ss->firstline + k];
+
+			if (gl_version > 0)
+				seg->v2 = rawsegs[ss->firstline + (k + 1) % ss->numlines].v1;
+
+			if (seg->v1 >= (unsigned int)numvertexes ||
+			    seg->v2 >= (unsigned int)numvertexes)
+			{
+				LevelError("Bad map data : vertex out of range (seg #%d)", ss->firstline + k);
+			}
+
+			if (seg->line == EXT_NO_INDEX && gl_version > 0)
+				continue;
+
+			if (seg->line >= (unsigned int)numlines || seg->side > 1 ||
+			    lines[seg->line].sidenum[seg->side] < 0 ||
+			    lines[seg->line].sidenum[seg->side] >= numsides)
+			{
+				LevelError("Bad map data : linedef out of range (seg #%d)", ss->firstline + k);
+			}
+
+			numsegs++;
+		}
+
+		for (k = 0 ; k < (unsigned int)ss->numlines ; k++)
+			seg_subsector[ss->firstline + k] = i;
+	}
+
+	segs = new seg_t[numsegs];
+
+	memset (segs, 0, numsegs*sizeof(seg_t));
+
+	seg_t *li = segs;
+
+	for (i = 0 ; i < (unsigned int)numsubsectors ; i++)
+	{
+		subsector_t *ss = &subsectors[i];
+
+		int first = ss->firstline;
+		int n = ss->numlines;
+
+		ss->firstline = li - segs;
+		ss->numlines  = 0;
+
+		for (k = 0 ; k < (unsigned int)n ; k++)
+		{
+			const extseg_t *seg = &rawsegs[first + k];
+
+			if (seg->line == EXT_NO_INDEX)
+				continue;
+
+			line_t *ldef = &lines[seg->line];
+
+			li->v1 = &vertexes[seg->v1];
+			li->v2 = &vertexes[seg->v2];
+
+			// the angle and offset are not stored, work them out
+			const vertex_t *start = seg->side ? ldef->v2 : ldef->v1;
+
+			li->angle  = SegAngle(li->v1, li->v2);
+			li->offset = (fixed_t)hypot((double)li->v1->x - (double)start->x,
+			                            (double)li->v1->y - (double)start->y);
+
+			Seg_CommonSetup(li, ldef, seg->side);
+
+			if (! ss->sector)
+				ss->sector = li->sidedef->sector;
+
+			li++;
+			ss->numlines++;
+		}
+	}
+
+	// subsectors made only of minisegs get their sector from a
+	// neighbour across one of them (minisegs never cross a linedef)
+	bool changed = true;
+
+	while (changed)
+	{
+		changed = false;
+
+		for (k = 0 ; k < rawsegs.size() ; k++)
+		{
+			subsector_t *ss = &subsectors[seg_subsector[k]];
+			unsigned int partner = rawsegs[k].partner;
+
+			if (ss->sector || partner >= rawsegs.size())
+				continue;
+
+			ss->sector = subsectors[seg_subsector[partner]].sector;
+
+			if (ss->sector)
+				changed = true;
+		}
+	}
+
+	for (i = 0 ; i < (unsigned int)numsubsectors ; i++)
+		if (! subsectors[i].sector)
+			LevelError("Bad map data : no sector for subsector #%d", i);
 }
 
 
 /* andrewj : removed P_LoadThings(), not needed for Visplane Explorer */
 
 
-void Context::LineDef_CommonSetup(line_t *ld)
+void LevelData::LineDef_CommonSetup(line_t *ld)
 {
 	vertex_t *v1 = ld->v1;
 	vertex_t *v2 = ld->v2;
@@ -408,30 +829,41 @@ void Context::LineDef_CommonSetup(line_t *ld)
 }
 
 
+// A sidedef number from a linedef.  Like the other indices in the
+// map lumps it is unsigned, so that maps with more than 32767 sidedefs
+// work, only 0xFFFF means no sidedef.
+static int SideNum(short raw)
+{
+	int num = USHORT(raw);
+
+	return (num == 0xFFFF) ? -1 : num;
+}
+
+
 //
 // P_LoadLineDefs
 // Also counts secret lines for intermissions.
 //
-void Context::P_LoadLineDefs (int lump)
+void LevelData::P_LoadLineDefs (int lump)
 {
-	byte*		data;
+	const byte*		data;
 	int		i;
-	maplinedef_t*	mld;
+	const maplinedef_t*	mld;
 	line_t*		ld;
 
-	numlines = W_LumpLength (lump) / sizeof(maplinedef_t);
+	numlines = wad->W_LumpLength (lump) / sizeof(maplinedef_t);
 	lines = new line_t[numlines];
 
 	memset (lines, 0, numlines*sizeof(line_t));
-	data = W_LoadLump (lump);
+	data = wad->W_LoadLump (lump);
 
-	mld = (maplinedef_t *)data;
+	mld = (const maplinedef_t *)data;
 	ld = lines;
 
 	for (i=0 ; i < numlines ; i++, mld++, ld++)
 	{
-		int v1_idx = SHORT(mld->v1);
-		int v2_idx = SHORT(mld->v2);
+		int v1_idx = USHORT(mld->v1);
+		int v2_idx = USHORT(mld->v2);
 
 		if (v1_idx < 0 || v1_idx >= numvertexes ||
 		    v2_idx < 0 || v2_idx >= numvertexes)
@@ -445,37 +877,37 @@ void Context::P_LoadLineDefs (int lump)
 		ld->flags = SHORT(mld->flags);
 		ld->special = SHORT(mld->special);
 		ld->tag = SHORT(mld->tag);
-		ld->sidenum[0] = SHORT(mld->sidenum[0]);
-		ld->sidenum[1] = SHORT(mld->sidenum[1]);
+		ld->sidenum[0] = SideNum(mld->sidenum[0]);
+		ld->sidenum[1] = SideNum(mld->sidenum[1]);
 
 		LineDef_CommonSetup(ld);
 	}
 
-	W_FreeLump(data);
+	wad->W_FreeLump(data);
 }
 
 
 // andrewj: added this for Hexen support
-void Context::P_LoadLineDefs_Hexen (int lump)
+void LevelData::P_LoadLineDefs_Hexen (int lump)
 {
-	byte*			data;
+	const byte*			data;
 	int			i, k;
-	maplinedef_hexen_t*	mld;
+	const maplinedef_hexen_t*	mld;
 	line_t*			ld;
 
-	numlines = W_LumpLength (lump) / sizeof(maplinedef_hexen_t);
+	numlines = wad->W_LumpLength (lump) / sizeof(maplinedef_hexen_t);
 	lines = new line_t[numlines];
 
 	memset (lines, 0, numlines*sizeof(line_t));
-	data = W_LoadLump (lump);
+	data = wad->W_LoadLump (lump);
 
-	mld = (maplinedef_hexen_t *)data;
+	mld = (const maplinedef_hexen_t *)data;
 	ld = lines;
 
 	for (i=0 ; i < numlines ; i++, mld++, ld++)
 	{
-		int v1_idx = SHORT(mld->v1);
-		int v2_idx = SHORT(mld->v2);
+		int v1_idx = USHORT(mld->v1);
+		int v2_idx = USHORT(mld->v2);
 
 		if (v1_idx < 0 || v1_idx >= numvertexes ||
 		    v2_idx < 0 || v2_idx >= numvertexes)
@@ -489,8 +921,8 @@ void Context::P_LoadLineDefs_Hexen (int lump)
 		ld->flags = SHORT(mld->flags);
 		ld->special = mld->special;
 		ld->tag = 0;
-		ld->sidenum[0] = SHORT(mld->sidenum[0]);
-		ld->sidenum[1] = SHORT(mld->sidenum[1]);
+		ld->sidenum[0] = SideNum(mld->sidenum[0]);
+		ld->sidenum[1] = SideNum(mld->sidenum[1]);
 
 		for (k = 0 ; k < 5 ; k++)
 			ld->args[k] = mld->args[k];
@@ -498,27 +930,27 @@ void Context::P_LoadLineDefs_Hexen (int lump)
 		LineDef_CommonSetup(ld);
 	}
 
-	W_FreeLump(data);
+	wad->W_FreeLump(data);
 }
 
 
 //
 // P_LoadSideDefs
 //
-void Context::P_LoadSideDefs (int lump)
+void LevelData::P_LoadSideDefs (int lump)
 {
-	byte*		data;
+	const byte*		data;
 	int			i;
-	mapsidedef_t*	msd;
+	const mapsidedef_t*	msd;
 	side_t*		sd;
 
-	numsides = W_LumpLength (lump) / sizeof(mapsidedef_t);
+	numsides = wad->W_LumpLength (lump) / sizeof(mapsidedef_t);
 	sides = new side_t[numsides];
 
 	memset (sides, 0, numsides*sizeof(side_t));
-	data = W_LoadLump (lump);
+	data = wad->W_LoadLump (lump);
 
-	msd = (mapsidedef_t *)data;
+	msd = (const mapsidedef_t *)data;
 	sd = sides;
 
 	for (i=0 ; i < numsides ; i++, msd++, sd++)
@@ -542,7 +974,7 @@ void Context::P_LoadSideDefs (int lump)
 		sd->sector = &sectors[sec_idx];
 	}
 
-	W_FreeLump(data);
+	wad->W_FreeLump(data);
 }
 
 
@@ -552,9 +984,9 @@ void Context::P_LoadSideDefs (int lump)
 // Builds sector line lists and subsector sector numbers.
 // Finds block bounding boxes for sectors.
 //
-void Context::P_GroupLines (void)
+void LevelData::P_GroupLines (void)
 {
-	line_t**		linebuffer;
+	line_t**		linebuffer_p;
 	int			i;
 	int			j;
 	line_t*		li;
@@ -568,6 +1000,11 @@ void Context::P_GroupLines (void)
 	ss = subsectors;
 	for (i=0 ; i < numsubsectors ; i++, ss++)
 	{
+		// (already done for the extended nodes, which may
+		//  have subsectors made only of minisegs)
+		if (ss->sector)
+			continue;
+
 		seg = &segs[ss->firstline];
 		ss->sector = seg->sidedef->sector;
 	}
@@ -589,13 +1026,14 @@ void Context::P_GroupLines (void)
 
 	// build line tables for each sector	
 	linebuffer = new line_t* [totallines];
+	linebuffer_p = linebuffer;
 
 	for (i=0; i < numsectors; ++i)
 	{
 		// Assign the line buffer for this sector
 
-		sectors[i].lines = linebuffer;
-		linebuffer += sectors[i].linecount;
+		sectors[i].lines = linebuffer_p;
+		linebuffer_p += sectors[i].linecount;
 
 		// Reset linecount to zero so in the next stage we can count
 		// lines into the list.
@@ -653,6 +1091,200 @@ void Context::P_GroupLines (void)
 		M_AddToBox (Map_bbox, li->v1->x, li->v1->y);
 		M_AddToBox (Map_bbox, li->v2->x, li->v2->y);
 	}
+
+	P_CreateBlockMap ();
+}
+
+
+//
+// P_CreateBlockMap
+// Builds the line index used by X_SectorForPoint (the BLOCKMAP lump
+// is not used, it is often missing or broken in the maps we get).
+//
+// Each line is put in every block of each row it crosses, plus one
+// block either side, so that a lookup only needs to search the row of
+// the spot outwards until no closer line can exist.
+//
+void LevelData::P_CreateBlockMap (void)
+{
+	int		i;
+	int		pass;
+	int		row;
+	int		col;
+
+	if (numlines == 0)
+	{
+		bmapwidth = bmapheight = 0;
+		blockoffsets.assign (1, 0);
+		return;
+	}
+
+	// (M_AddToBox can miss a maximum, so Map_bbox is not used here)
+	fixed_t *box = bmapbox;
+
+	M_ClearBox (box);
+
+	for (i = 0 ; i < numlines ; i++)
+	{
+		const vertex_t *v[2] = { lines[i].v1, lines[i].v2 };
+
+		for (int k = 0 ; k < 2 ; k++)
+		{
+			box[BOXLEFT]   = MIN(box[BOXLEFT],   v[k]->x);
+			box[BOXRIGHT]  = MAX(box[BOXRIGHT],  v[k]->x);
+			box[BOXBOTTOM] = MIN(box[BOXBOTTOM], v[k]->y);
+			box[BOXTOP]    = MAX(box[BOXTOP],    v[k]->y);
+		}
+	}
+
+	fixed_t bmaporgx = box[BOXLEFT];
+	fixed_t bmaporgy = box[BOXBOTTOM];
+
+	bmapwidth  = (int)(((int64_t)box[BOXRIGHT] - bmaporgx) >> MAPBLOCKSHIFT) + 1;
+	bmapheight = (int)(((int64_t)box[BOXTOP]   - bmaporgy) >> MAPBLOCKSHIFT) + 1;
+
+	blockoffsets.assign (bmapwidth * bmapheight + 1, 0);
+
+	// first pass counts the lines in each block, the second one fills
+	// them in (in ascending order, as the lines are visited in order)
+	for (pass = 0 ; pass < 2 ; pass++)
+	{
+		if (pass == 1)
+		{
+			for (i = 0 ; i < bmapwidth * bmapheight ; i++)
+				blockoffsets[i+1] += blockoffsets[i];
+
+			blocklines.resize (blockoffsets[bmapwidth * bmapheight]);
+		}
+
+		for (i = 0 ; i < numlines ; i++)
+		{
+			const line_t *li = &lines[i];
+
+			double x1 = li->v1->x - (double)bmaporgx;
+			double y1 = li->v1->y - (double)bmaporgy;
+			double x2 = li->v2->x - (double)bmaporgx;
+			double y2 = li->v2->y - (double)bmaporgy;
+
+			// horizontal lines are never found by the horizontal ray
+			if (y1 == y2)
+				continue;
+
+			if (y1 > y2)
+			{
+				std::swap (x1, x2);
+				std::swap (y1, y2);
+			}
+
+			int row1 = (int)((int64_t)y1 >> MAPBLOCKSHIFT);
+			int row2 = (int)((int64_t)y2 >> MAPBLOCKSHIFT);
+
+			for (row = row1 ; row <= row2 ; row++)
+			{
+				// part of the line within this row
+				double ylo = MAX(y1, (double)((int64_t)row << MAPBLOCKSHIFT));
+				double yhi = MIN(y2, (double)((int64_t)(row + 1) << MAPBLOCKSHIFT));
+
+				double xlo = x1 + (x2 - x1) * (ylo - y1) / (y2 - y1);
+				double xhi = x1 + (x2 - x1) * (yhi - y1) / (y2 - y1);
+
+				if (xlo > xhi)
+					std::swap (xlo, xhi);
+
+				int col1 = MAX(0, (int)((int64_t)xlo >> MAPBLOCKSHIFT) - 1);
+				int col2 = MIN(bmapwidth - 1, (int)((int64_t)xhi >> MAPBLOCKSHIFT) + 1);
+
+				for (col = col1 ; col <= col2 ; col++)
+				{
+					int block = row * bmapwidth + col;
+
+					if (pass == 0)
+						blockoffsets[block + 1]++;
+					else
+						blocklines[blockoffsets[block]++] = i;
+				}
+			}
+		}
+	}
+
+	// the fill pass moved each offset to the start of the next block
+	for (i = bmapwidth * bmapheight ; i > 0 ; i--)
+		blockoffsets[i] = blockoffsets[i-1];
+
+	blockoffsets[0] = 0;
+}
+
+
+//
+// P_CompactNodes
+// Builds the compact copy of the nodes used by R_RenderBSP.
+// A node reached twice (which no node builder makes) would let
+// the walk go on forever, hence it is treated as bad data.
+//
+void LevelData::P_CompactNodes (void)
+{
+	bspnodes.clear ();
+	bspbboxes.clear ();
+	bspdepth = 0;
+
+	if (numnodes == 0)
+		return;
+
+	std::vector<int> newnum (numnodes, -1);
+
+	// pending nodes as (number, depth) pairs
+	std::vector<int> pending;
+
+	pending.push_back (numnodes - 1);
+	pending.push_back (1);
+
+	while (! pending.empty ())
+	{
+		int depth = pending.back (); pending.pop_back ();
+		int num   = pending.back (); pending.pop_back ();
+
+		if (newnum[num] >= 0)
+			LevelError ("Bad map data : node #%d is used twice", num);
+
+		newnum[num] = (int)bspnodes.size ();
+		bspdepth = MAX(bspdepth, depth);
+
+		const node_t *no = &nodes[num];
+
+		bspnode_t bsp;
+
+		bsp.x  = no->x;
+		bsp.y  = no->y;
+		bsp.dx = no->dx;
+		bsp.dy = no->dy;
+
+		bsp.children[0] = no->children[0];
+		bsp.children[1] = no->children[1];
+
+		bspnodes.push_back (bsp);
+		bspbboxes.insert (bspbboxes.end (), &no->bbox[0][0], &no->bbox[0][0] + 8);
+
+		// the front child is visited next, so it directly follows
+		for (int side = 1 ; side >= 0 ; side--)
+		{
+			if (! (no->children[side] & NF_SUBSECTOR))
+			{
+				pending.push_back (no->children[side]);
+				pending.push_back (depth + 1);
+			}
+		}
+	}
+
+	for (size_t i = 0 ; i < bspnodes.size () ; i++)
+	{
+		for (int side = 0 ; side < 2 ; side++)
+		{
+			int child = bspnodes[i].children[side];
+
+			if (! (child & NF_SUBSECTOR))
+				bspnodes[i].children[side] = newnum[child];
+		}
+	}
 }
 
 
@@ -663,7 +1295,7 @@ void Context::P_GroupLines (void)
 // Main criterion is that sector is closed, and either has a tag
 // or one of the linedefs has a manual door type.
 //
-int Context::HasManualDoor(const sector_t *sec)
+int LevelData::HasManualDoor(const sector_t *sec)
 {
 	int k;
 
@@ -701,7 +1333,7 @@ int Context::HasManualDoor(const sector_t *sec)
 	return 0;
 }
 
-void Context::CalcDoorAltHeight(sector_t *sec)
+void LevelData::CalcDoorAltHeight(sector_t *sec)
 {
 	fixed_t door_h = sec->floorheight;  // == sec->ceilingheight
 
@@ -747,7 +1379,7 @@ void Context::CalcDoorAltHeight(sector_t *sec)
 	}
 }
 
-void Context::P_DetectDoorSectors()
+void LevelData::P_DetectDoorSectors()
 {
 	int i;
 
@@ -768,6 +1400,44 @@ void Context::P_DetectDoorSectors()
 }
 
 
+//
+// P_OpenDoorSectors
+//
+// Open or close all door sectors, for this render state only.
+// dir must be > 0 to open them, or -1 to close them.
+//
+void RenderState::P_OpenDoorSectors(int dir)
+{
+	int i;
+
+	if (! level)
+		return;
+
+	for (i = 0 ; i < level->numsectors ; i++)
+	{
+		const sector_t *sec = &level->sectors[i];
+
+		if (sec->is_door == 0)
+			continue;
+
+		if (dir > 0)  // open them
+		{
+			if (sec->is_door > 0)
+				ceilingheights[i] = sec->alt_height;
+			else
+				floorheights[i] = sec->alt_height;
+		}
+		else if (dir < 0)  // close them
+		{
+			if (sec->is_door > 0)
+				ceilingheights[i] = floorheights[i];
+			else
+				floorheights[i] = ceilingheights[i];
+		}
+	}
+}
+
+
 //
 // P_SetupLevel
 //
@@ -784,53 +1454,86 @@ const char * Context::P_SetupLevel ( const char *lumpname, bool *is_hexen )
 		return level_error_msg;
 	}
 
-	level_is_hexen = lumpinfo[base].is_hexen;
+	return P_LoadLevel(wad_dir.get(), base, lumpname, is_hexen);
+}
+
+
+//
+// P_LoadLevel
+//
+// Load the map whose header lump is 'base' in the given directory.
+// Returns an error message if something went wrong
+// or NULL on success.
+//
+const char * Context::P_LoadLevel ( wad_directory_t *dir, int base, const char *mapname, bool *is_hexen )
+{
+	const lumpinfo_t *map_lumps = &dir->lumps[base];
+
+	std::shared_ptr<LevelData> data(new LevelData());
+
+	data->level_is_hexen = map_lumps[0].is_hexen;
 
 	if (is_hexen)
-		*is_hexen = level_is_hexen;
+		*is_hexen = data->level_is_hexen;
 
-	// check that we have some nodes
-	if (lumpinfo[base + ML_SEGS].size == 0)
+	if (! W_BeginRead(dir))
 	{
-		sprintf(level_error_msg, "Missing nodes for: %s", lumpname);
+		snprintf(level_error_msg, sizeof(level_error_msg),
+			"Wad file was changed or removed since it was loaded: %s", dir->filename.c_str());
 		return level_error_msg;
 	}
 
-	W_BeginRead();
+	data->wad = this;
 
 	try
 	{
 		// note: most of this ordering is important	
 		///    P_LoadBlockMap (base + ML_BLOCKMAP);
-		P_LoadVertexes (base + ML_VERTEXES);
-		P_LoadSectors (base + ML_SECTORS);
-		P_LoadSideDefs (base + ML_SIDEDEFS);
+		data->P_LoadVertexes (base + ML_VERTEXES);
+		data->P_LoadSectors (base + ML_SECTORS);
+		data->P_LoadSideDefs (base + ML_SIDEDEFS);
 
-		if (level_is_hexen)
-			P_LoadLineDefs_Hexen (base + ML_LINEDEFS);
+		if (data->level_is_hexen)
+			data->P_LoadLineDefs_Hexen (base + ML_LINEDEFS);
 		else
-			P_LoadLineDefs (base + ML_LINEDEFS);
+			data->P_LoadLineDefs (base + ML_LINEDEFS);
+
+		// the ZDoom formats are in the NODES lump, or for the
+		// compressed GL nodes in SSECTORS, there is no SEGS lump
+		if (! data->P_LoadExtendedNodes (base + ML_NODES) &&
+		    ! data->P_LoadExtendedNodes (base + ML_SSECTORS))
+		{
+			// check that we have some nodes
+			if (map_lumps[ML_SEGS].size == 0)
+				data->LevelError("Missing nodes for: %s", mapname);
 
-		P_LoadSubsectors (base + ML_SSECTORS);
-		P_LoadNodes (base + ML_NODES);
-		P_LoadSegs (base + ML_SEGS);
+			data->P_LoadSubsectors (base + ML_SSECTORS);
+			data->P_LoadNodes (base + ML_NODES);
+			data->P_LoadSegs (base + ML_SEGS);
+		}
 
-		ValidateSubsectors();
+		data->ValidateSubsectors();
+		data->P_CompactNodes();
 	}
 	catch (invalid_data_exception)
 	{
 		W_EndRead();
-		P_FreeLevelData();
 
+		strcpy(level_error_msg, data->level_error_msg);
 		return level_error_msg;
 	}
 
 	W_EndRead();
 
-	P_GroupLines ();
+	data->wad = NULL;
+
+	data->P_GroupLines ();
 
 	// andrewj: added this
-	P_DetectDoorSectors();
+	data->P_DetectDoorSectors();
+
+	level = data;
+	render.R_SetLevel(level.get());
 
 	return NULL;
 }
@@ -838,54 +1541,22 @@ const char * Context::P_SetupLevel ( const char *lumpname, bool *is_hexen )
 
 void Context::P_FreeLevelData ()
 {
-	if (vertexes)
-	{
-		delete[] vertexes;
-		vertexes = NULL;
-		numvertexes = 0;
-	}
-
-	if (sectors)
-	{
-		delete[] sectors;
-		sectors = NULL;
-		numsectors = 0;
-	}
-
-	if (sides)
-	{
-		delete[] sides;
-		sides = NULL;
-		numsides = 0;
-	}
+	render.R_SetLevel(NULL);
 
-	if (lines)
-	{
-		delete[] lines;
-		lines = NULL;
-		numlines = 0;
-	}
+	level.reset();
+}
 
-	if (segs)
-	{
-		delete[] segs;
-		segs = NULL;
-		numsegs = 0;
-	}
 
-	if (subsectors)
-	{
-		delete[] subsectors;
-		subsectors = NULL;
-		numsubsectors = 0;
-	}
-
-	if (nodes)
-	{
-		delete[] nodes;
-		nodes = NULL;
-		numnodes = 0;
-	}
+LevelData::~LevelData ()
+{
+	delete[] vertexes;
+	delete[] sectors;
+	delete[] sides;
+	delete[] lines;
+	delete[] segs;
+	delete[] subsectors;
+	delete[] nodes;
+	delete[] linebuffer;
 }
 
 
@@ -893,4 +1564,3 @@ void Context::P_FreeLevelData ()
 
 //--- editor settings ---
 // vi:ts=4:sw=4:noexpandtab
-// Emacs style mode select   -*- C++ -*- 
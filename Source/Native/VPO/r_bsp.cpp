@@ -36,7 +36,7 @@ namespace vpo
 //
 // R_ClearDrawSegs
 //
-void Context::R_ClearDrawSegs (void)
+void RenderState::R_ClearDrawSegs (void)
 {
     total_drawsegs = 0;
 
@@ -53,7 +53,7 @@ void Context::R_ClearDrawSegs (void)
 //  that entirely block the view.
 // 
 void
-Context::R_ClipSolidWallSegment ( int   first, int   last )
+RenderState::R_ClipSolidWallSegment ( int   first, int   last )
 {
     cliprange_t*	next;
     cliprange_t*	start;
@@ -153,7 +153,7 @@ Context::R_ClipSolidWallSegment ( int   first, int   last )
 // Does handle windows,
 //  e.g. LineDefs with upper and lower texture.
 //
-void Context::R_ClipPassWallSegment ( int first, int last )
+void RenderState::R_ClipPassWallSegment ( int first, int last )
 {
     cliprange_t*	start;
 
@@ -199,7 +199,7 @@ void Context::R_ClipPassWallSegment ( int first, int last )
 //
 // R_ClearClipSegs
 //
-void Context::R_ClearClipSegs (void)
+void RenderState::R_ClearClipSegs (void)
 {
     solidsegs[0].first = -0x7fffffff;
     solidsegs[0].last = -1;
@@ -215,7 +215,7 @@ void Context::R_ClearClipSegs (void)
 // Clips the given segment
 // and adds any visible pieces to the line list.
 //
-void Context::R_AddLine (seg_t*	line)
+void RenderState::R_AddLine (seg_t*	line)
 {
     int			x1;
     int			x2;
@@ -283,13 +283,13 @@ void Context::R_AddLine (seg_t*	line)
 	goto clipsolid;		
 
     // Closed door.
-    if (backsector->ceilingheight <= frontsector->floorheight
-	|| backsector->floorheight >= frontsector->ceilingheight)
+    if (R_CeilingHeight(backsector) <= R_FloorHeight(frontsector)
+	|| R_FloorHeight(backsector) >= R_CeilingHeight(frontsector))
 	goto clipsolid;		
 
     // Window.
-    if (backsector->ceilingheight != frontsector->ceilingheight
-	|| backsector->floorheight != frontsector->floorheight)
+    if (R_CeilingHeight(backsector) != R_CeilingHeight(frontsector)
+	|| R_FloorHeight(backsector) != R_FloorHeight(frontsector))
 	goto clippass;	
 		
     // Reject empty lines used for triggers
@@ -337,7 +337,7 @@ static const int checkcoord[12][4] =
 };
 
 
-boolean Context::R_CheckBBox (fixed_t*	bspcoord)
+boolean RenderState::R_CheckBBox (const fixed_t*	bspcoord)
 {
     int			boxx;
     int			boxy;
@@ -453,38 +453,38 @@ boolean Context::R_CheckBBox (fixed_t*	bspcoord)
 // Add sprites of things in sector.
 // Draw one or more line segments.
 //
-void Context::R_Subsector (int num)
+void RenderState::R_Subsector (int num)
 {
     int			count;
     seg_t*		line;
     subsector_t*	sub;
 	
 #ifdef RANGECHECK
-    if (num>=numsubsectors)
+    if (num>=level->numsubsectors)
 	I_Error ("R_Subsector: ss %i with numss = %i",
 		 num,
-		 numsubsectors);
+		 level->numsubsectors);
 #endif
 
     sscount++;
-    sub = &subsectors[num];
+    sub = &level->subsectors[num];
     frontsector = sub->sector;
     count = sub->numlines;
-    line = &segs[sub->firstline];
+    line = &level->segs[sub->firstline];
 
-    if (frontsector->floorheight < viewz)
+    if (R_FloorHeight(frontsector) < viewz)
     {
-	floorplane = R_FindPlane (frontsector->floorheight,
+	floorplane = R_FindPlane (R_FloorHeight(frontsector),
 				  frontsector->floorpic,
 				  frontsector->lightlevel);
     }
     else
 	floorplane = NULL;
     
-    if (frontsector->ceilingheight > viewz 
+    if (R_CeilingHeight(frontsector) > viewz 
 	|| frontsector->ceilingpic == skyflatnum)
     {
-	ceilingplane = R_FindPlane (frontsector->ceilingheight,
+	ceilingplane = R_FindPlane (R_CeilingHeight(frontsector),
 				    frontsector->ceilingpic,
 				    frontsector->lightlevel);
     }
@@ -508,7 +508,7 @@ void Context::R_Subsector (int num)
 // Renders all subsectors below a given node,
 //  traversing subtree recursively.
 // Just call with BSP root.
-void Context::R_RenderBSPNode (int bspnum)
+void RenderState::R_RenderBSPNode (int bspnum)
 {
     node_t*	bsp;
     int		side;
@@ -523,7 +523,7 @@ void Context::R_RenderBSPNode (int bspnum)
 	return;
     }
 		
-    bsp = &nodes[bspnum];
+    bsp = &level->nodes[bspnum];
     
     // Decide which side the view point is on.
     side = R_PointOnSide (viewx, viewy, bsp);
@@ -537,5 +537,117 @@ void Context::R_RenderBSPNode (int bspnum)
 }
 
 
+//
+// R_RenderBSP
+// Renders the whole BSP tree like R_RenderBSPNode, but walks
+//  the compact nodes with an explicit stack of back sides.
+//
+void RenderState::R_RenderBSP (void)
+{
+    const bspnode_t*	nodes = level->bspnodes.data();
+    const fixed_t*	bboxes = level->bspbboxes.data();
+    int*		stack;
+    int			sp = 0;
+    int			bspnum;
+    int			side;
+
+    if ((int)bspstack.size() < level->bspdepth)
+	bspstack.resize (level->bspdepth);
+
+    stack = bspstack.data();
+
+    // the root is node 0, or a lone subsector
+    bspnum = level->bspnodes.empty() ? -1 : 0;
+
+    for (;;)
+    {
+	// Go down the front sides, remembering each back side.
+	while (! (bspnum & NF_SUBSECTOR))
+	{
+	    const bspnode_t *bsp = &nodes[bspnum];
+
+	    side = R_PointOnSide (viewx, viewy, bsp);
+
+	    stack[sp++] = (bspnum << 1) | (side ^ 1);
+	    bspnum = bsp->children[side];
+	}
+
+	if (bspnum == -1)
+	    R_Subsector (0);
+	else
+	    R_Subsector (bspnum&(~NF_SUBSECTOR));
+
+	// Continue with the innermost back side which may be seen.
+	for (;;)
+	{
+	    if (sp == 0)
+		return;
+
+	    int back = stack[--sp];
+
+	    if (R_CheckBBox (&bboxes[back * 4]))
+	    {
+		bspnum = nodes[back >> 1].children[back & 1];
+		break;
+	    }
+	}
+    }
+}
+
+
+//
+// R_RegionBSPNode
+// Walks the BSP like R_RenderBSPNode, but only keeps the solid clip
+// ranges up to date (no planes, no drawsegs), and returns true as
+// soon as a subsector which overlaps region_bbox might be visible.
+// The bbox is the one of the given subtree, from its parent node.
+//
+boolean RenderState::R_RegionBSPNode (int bspnum, const fixed_t *bbox)
+{
+    node_t*	bsp;
+    int		side;
+    int		i;
+
+    // Found a subsector?
+    if (bspnum & NF_SUBSECTOR)
+    {
+	if (bbox[BOXLEFT]   <= region_bbox[BOXRIGHT] &&
+	    bbox[BOXRIGHT]  >= region_bbox[BOXLEFT]  &&
+	    bbox[BOXBOTTOM] <= region_bbox[BOXTOP]   &&
+	    bbox[BOXTOP]    >= region_bbox[BOXBOTTOM])
+	{
+	    return true;
+	}
+
+	subsector_t *sub = &level->subsectors[bspnum == -1 ? 0 : bspnum & (~NF_SUBSECTOR)];
+	seg_t *line = &level->segs[sub->firstline];
+
+	frontsector = sub->sector;
+
+	for (i = 0 ; i < sub->numlines ; i++, line++)
+	    R_AddLine (line);
+
+	return false;
+    }
+
+    bsp = &level->nodes[bspnum];
+
+    // Decide which side the view point is on.
+    side = R_PointOnSide (viewx, viewy, bsp);
+
+    // unlike R_RenderBSPNode, the front space is checked too
+    for (i = 0 ; i < 2 ; i++, side ^= 1)
+    {
+	if (R_CheckBBox (bsp->bbox[side]) &&
+	    R_RegionBSPNode (bsp->children[side], bsp->bbox[side]))
+	{
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+
 } // namespace vpo
 
@@ -27,6 +27,14 @@
 #ifndef __R_BSP__
 #define __R_BSP__
 
+// Default for R_RenderView: non-zero walks the compact node array
+// iteratively with R_RenderBSP, zero uses the vanilla recursive
+// R_RenderBSPNode on the original nodes (Tests/vpo_bench.cpp times
+// both on the same map).
+#ifndef BSP_COMPACT_NODES
+#define BSP_COMPACT_NODES	1
+#endif
+
 #if 0
 extern seg_t*		curline;
 extern side_t*		sidedef;
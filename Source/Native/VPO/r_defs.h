@@ -156,7 +156,7 @@ typedef struct line_s
 
 	// Visual appearance: SideDefs.
 	//  sidenum[1] will be -1 if one sided
-	short	sidenum[2];			
+	int	sidenum[2];			
 
 	// Neat. Another bounding box, for the extent
 	//  of the LineDef.
@@ -192,8 +192,8 @@ typedef struct subsector_s
 {
 	sector_t*	sector;
 
-	short	numlines;
-	short	firstline;
+	int	numlines;
+	int	firstline;
 
 } subsector_t;
 
@@ -237,11 +237,28 @@ typedef struct
 	fixed_t	bbox[2][4];
 
 	// If NF_SUBSECTOR its a subsector.
-	unsigned short children[2];
+	int children[2];
 
 } node_t;
 
 
+//
+// BSP node, compact form used by R_RenderBSP.
+// Only the partition and children are kept here, the bounding
+// boxes are in a separate array as just the back side needs them.
+//
+typedef struct
+{
+	fixed_t	x;
+	fixed_t	y;
+	fixed_t	dx;
+	fixed_t	dy;
+
+	int children[2];
+
+} bspnode_t;
+
+
 //
 // OTHER TYPES
 //
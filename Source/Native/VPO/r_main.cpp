@@ -45,7 +45,7 @@ namespace vpo
 // Expand a given bbox
 // so that it encloses a given point.
 //
-void Context::R_AddPointToBox ( int  x, int  y, fixed_t* box )
+void RenderState::R_AddPointToBox ( int  x, int  y, fixed_t* box )
 {
     if (x< box[BOXLEFT])
 	box[BOXLEFT] = x;
@@ -63,8 +63,10 @@ void Context::R_AddPointToBox ( int  x, int  y, fixed_t* box )
 // Traverse BSP (sub) tree,
 //  check point against partition plane.
 // Returns side 0 (front) or 1 (back).
+// (shared by both forms of the nodes, see below)
 //
-int Context::R_PointOnSide ( fixed_t	x, fixed_t	y, node_t*	node )
+template <typename NODE>
+static inline int PointOnSide ( fixed_t	x, fixed_t	y, const NODE*	node )
 {
     fixed_t	dx;
     fixed_t	dy;
@@ -112,8 +114,18 @@ int Context::R_PointOnSide ( fixed_t	x, fixed_t	y, node_t*	node )
     return 1;			
 }
 
+int R_PointOnSide ( fixed_t	x, fixed_t	y, const node_t*	node )
+{
+    return PointOnSide (x, y, node);
+}
+
+int R_PointOnSide ( fixed_t	x, fixed_t	y, const bspnode_t*	node )
+{
+    return PointOnSide (x, y, node);
+}
+
 
-int Context::R_PointOnSegSide ( fixed_t	x, fixed_t	y, seg_t*	line )
+int RenderState::R_PointOnSegSide ( fixed_t	x, fixed_t	y, seg_t*	line )
 {
     fixed_t	lx;
     fixed_t	ly;
@@ -181,7 +193,7 @@ int Context::R_PointOnSegSide ( fixed_t	x, fixed_t	y, seg_t*	line )
 //  tangent (slope) value which is looked up in the
 //  tantoangle[] table.
 
-angle_t Context::R_PointToAngle ( fixed_t	x, fixed_t	y )
+angle_t RenderState::R_PointToAngle ( fixed_t	x, fixed_t	y )
 {	
     x -= viewx;
     y -= viewy;
@@ -264,7 +276,7 @@ angle_t Context::R_PointToAngle ( fixed_t	x, fixed_t	y )
 }
 
 
-angle_t Context::R_PointToAngle2 ( fixed_t	x1, fixed_t	y1, fixed_t	x2, fixed_t	y2 )
+angle_t RenderState::R_PointToAngle2 ( fixed_t	x1, fixed_t	y1, fixed_t	x2, fixed_t	y2 )
 {	
     viewx = x1;
     viewy = y1;
@@ -273,7 +285,7 @@ angle_t Context::R_PointToAngle2 ( fixed_t	x1, fixed_t	y1, fixed_t	x2, fixed_t	y
 }
 
 
-fixed_t Context::R_PointToDist ( fixed_t	x, fixed_t	y )
+fixed_t RenderState::R_PointToDist ( fixed_t	x, fixed_t	y )
 {
     int		angle;
     fixed_t	dx;
@@ -319,7 +331,7 @@ fixed_t Context::R_PointToDist ( fixed_t	x, fixed_t	y )
 //  at the given angle.
 // rw_distance must be calculated first.
 //
-fixed_t Context::R_ScaleFromGlobalAngle (angle_t visangle)
+fixed_t RenderState::R_ScaleFromGlobalAngle (angle_t visangle)
 {
     fixed_t		scale;
     angle_t		anglea;
@@ -371,7 +383,7 @@ fixed_t Context::R_ScaleFromGlobalAngle (angle_t visangle)
 }
 
 
-void Context::R_InitBuffer ( int		width, int		height ) 
+void RenderState::R_InitBuffer ( int		width, int		height ) 
 { 
     int		i;
 	
@@ -408,7 +420,7 @@ void Context::R_InitBuffer ( int		width, int		height )
 //
 // R_InitTextureMapping
 //
-void Context::R_InitTextureMapping (void)
+void RenderState::R_InitTextureMapping (void)
 {
     int			i;
     int			x;
@@ -474,7 +486,7 @@ void Context::R_InitTextureMapping (void)
 //
 // R_SetViewSize
 //
-void Context::R_SetViewSize ( int  blocks, int  detail )
+void RenderState::R_SetViewSize ( int  blocks, int  detail )
 {
     fixed_t	cosadj;
     fixed_t	dy;
@@ -532,7 +544,7 @@ void Context::R_SetViewSize ( int  blocks, int  detail )
 //
 // R_Init
 //
-void Context::R_Init (void)
+void RenderState::R_Init (void)
 {
     R_SetViewSize (11, 0);
 	
@@ -540,12 +552,56 @@ void Context::R_Init (void)
 }
 
 
+RenderState::RenderState ()
+{
+    R_Init ();
+}
+
+
+//
+// R_SetLevel
+// Selects the level to render (or none when NULL).
+// The sector heights are taken from the level,
+//  or from another state when given.
+//
+void RenderState::R_SetLevel (const LevelData* newlevel, const RenderState* heights_from)
+{
+    level = newlevel;
+
+    floorheights.clear();
+    ceilingheights.clear();
+
+    last_x = -77777;
+    last_y = -77777;
+    last_sector = NULL;
+
+    if (!level)
+	return;
+
+    if (heights_from)
+    {
+	floorheights = heights_from->floorheights;
+	ceilingheights = heights_from->ceilingheights;
+	return;
+    }
+
+    floorheights.resize (level->numsectors);
+    ceilingheights.resize (level->numsectors);
+
+    for (int i=0 ; i<level->numsectors ; i++)
+    {
+	floorheights[i] = level->sectors[i].floorheight;
+	ceilingheights[i] = level->sectors[i].ceilingheight;
+    }
+}
+
+
 //
 // R_PointInSubsector
 //
-subsector_t* Context::R_PointInSubsector ( fixed_t	x, fixed_t	y )
+subsector_t* LevelData::R_PointInSubsector ( fixed_t	x, fixed_t	y ) const
 {
-    node_t*	node;
+    const node_t*	node;
     int		side;
     int		nodenum;
 
@@ -569,7 +625,7 @@ subsector_t* Context::R_PointInSubsector ( fixed_t	x, fixed_t	y )
 //
 // R_SetupFrame
 //
-void Context::R_SetupFrame (fixed_t x, fixed_t y, fixed_t z, angle_t angle)
+void RenderState::R_SetupFrame (fixed_t x, fixed_t y, fixed_t z, angle_t angle)
 {		
     viewx = x;
     viewy = y;
@@ -590,7 +646,7 @@ void Context::R_SetupFrame (fixed_t x, fixed_t y, fixed_t z, angle_t angle)
 //
 // R_RenderView
 //
-void Context::R_RenderView (fixed_t x, fixed_t y, fixed_t z, angle_t angle)
+void RenderState::R_RenderView (fixed_t x, fixed_t y, fixed_t z, angle_t angle, bool compact_nodes)
 {	
     R_SetupFrame (x, y, z, angle);
 
@@ -600,8 +656,15 @@ void Context::R_RenderView (fixed_t x, fixed_t y, fixed_t z, angle_t angle)
     R_ClearPlanes ();
 ///  R_ClearSprites ();
     
-    // The head node is the last node output.
-    R_RenderBSPNode (numnodes - 1);
+    if (compact_nodes)
+    {
+	R_RenderBSP ();
+    }
+    else
+    {
+	// The head node is the last node output.
+	R_RenderBSPNode (level->numnodes - 1);
+    }
 }
 
 
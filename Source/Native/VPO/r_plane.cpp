@@ -109,7 +109,7 @@ void R_MapPlane ( int  y, int  x1, int  x2 )
 // R_ClearPlanes
 // At begining of frame.
 //
-void Context::R_ClearPlanes (void)
+void RenderState::R_ClearPlanes (void)
 {
     int		i;
     angle_t	angle;
@@ -127,6 +127,15 @@ void Context::R_ClearPlanes (void)
     lastvisplane = visplanes;
     lastopening = openings;
 
+#if PLANEHASH_SIZE > 0
+    // invalidate the visplane index (only wipe it when the counter wraps)
+    if (++planehash_gen == 0)
+    {
+	memset (planehash_slotgen, 0, sizeof(planehash_slotgen));
+	planehash_gen = 1;
+    }
+#endif
+
     // texture calculation
     memset (cachedheight, 0, sizeof(cachedheight));
 
@@ -144,7 +153,7 @@ void Context::R_ClearPlanes (void)
 //
 // R_FindPlane
 //
-visplane_t* Context::R_FindPlane ( fixed_t height, int  picnum, int  lightlevel )
+visplane_t* RenderState::R_FindPlane ( fixed_t height, int  picnum, int  lightlevel )
 {
     visplane_t*	check;
 	
@@ -154,6 +163,33 @@ visplane_t* Context::R_FindPlane ( fixed_t height, int  picnum, int  lightlevel
 	lightlevel = 0;
     }
 	
+#if PLANEHASH_SIZE > 0
+    // Only the first visplane with a given key is indexed, planes split
+    // off by R_CheckPlane are never returned here (same as the scan).
+    unsigned int hash;
+
+    hash  = (unsigned int)height * 0x9E3779B1u;
+    hash ^= (unsigned int)picnum * 0x85EBCA6Bu;
+    hash ^= (unsigned int)lightlevel * 0xC2B2AE35u;
+    hash ^= hash >> 15;
+    hash &= PLANEHASH_SIZE - 1;
+
+    while (planehash_slotgen[hash] == planehash_gen)
+    {
+	check = visplanes + planehash_slot[hash];
+
+	if (height == check->height
+	    && picnum == check->picnum
+	    && lightlevel == check->lightlevel)
+	{
+	    return check;
+	}
+
+	hash = (hash + 1) & (PLANEHASH_SIZE - 1);
+    }
+
+    check = lastvisplane;
+#else
     for (check=visplanes; check<lastvisplane; check++)
     {
 	if (height == check->height
@@ -167,9 +203,15 @@ visplane_t* Context::R_FindPlane ( fixed_t height, int  picnum, int  lightlevel
 			
     if (check < lastvisplane)
 	return check;
+#endif
 		
     if (total_visplanes >= MAXVISPLANES)
       throw overflow_exception(); // I_Error ("R_FindPlane: no more visplanes");
+
+#if PLANEHASH_SIZE > 0
+    planehash_slotgen[hash] = planehash_gen;
+    planehash_slot[hash] = (short)(check - visplanes);
+#endif
 		
     total_visplanes++;
     lastvisplane++;
@@ -189,7 +231,7 @@ visplane_t* Context::R_FindPlane ( fixed_t height, int  picnum, int  lightlevel
 //
 // R_CheckPlane
 //
-visplane_t* Context::R_CheckPlane ( visplane_t* pl, int  start, int  stop )
+visplane_t* RenderState::R_CheckPlane ( visplane_t* pl, int  start, int  stop )
 {
     int		intrl;
     int		intrh;
@@ -56,6 +56,14 @@ visplane_t* R_CheckPlane ( visplane_t* pl, int start, int stop );
 // #define MAXOPENINGS	SCREENWIDTH*64
 #define MAXOPENINGS	SCREENWIDTH*256  // andrewj: increased for Visplane Explorer
 
+// Size of the open-addressing index used by R_FindPlane, must be a
+// power of two comfortably above MAXVISPLANES.  Zero disables the index
+// and falls back to the vanilla linear scan (Tests/vpo_bench.cpp is
+// built both ways to compare them).
+#ifndef PLANEHASH_SIZE
+#define PLANEHASH_SIZE	2048
+#endif
+
 /*
 extern int total_visplanes;
 extern int total_drawsegs;
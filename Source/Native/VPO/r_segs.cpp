@@ -41,7 +41,7 @@ namespace vpo
 #define HEIGHTBITS		12
 #define HEIGHTUNIT		(1<<HEIGHTBITS)
 
-void Context::R_RenderSegLoop (void)
+void RenderState::R_RenderSegLoop (void)
 {
   angle_t		angle;
   int			yl;
@@ -205,13 +205,17 @@ void Context::R_RenderSegLoop (void)
 // A wall segment will be drawn
 //  between start and stop pixels (inclusive).
 //
-void Context::R_StoreWallRange ( int	start, int	stop )
+void RenderState::R_StoreWallRange ( int	start, int	stop )
 {
   fixed_t		hyp;
   fixed_t		sineval;
   angle_t		distangle, offsetangle;
   fixed_t		vtop;
 
+  // only the clip ranges matter for R_RegionBSPNode
+  if (region_query)
+    return;
+
   // don't overflow and crash
   total_drawsegs++;
 
@@ -226,9 +230,6 @@ void Context::R_StoreWallRange ( int	start, int	stop )
   sidedef = curline->sidedef;
   linedef = curline->linedef;
 
-  // mark the segment as visible for auto map
-  linedef->flags |= ML_MAPPED;
-
   // calculate rw_distance for scale calculation
   rw_normalangle = curline->angle + ANG90;
   offsetangle = abs((int)rw_normalangle-rw_angle1);
@@ -264,8 +265,8 @@ void Context::R_StoreWallRange ( int	start, int	stop )
 
   // calculate texture boundaries
   //  and decide if floor / ceiling marks are needed
-  worldtop = frontsector->ceilingheight - viewz;
-  worldbottom = frontsector->floorheight - viewz;
+  worldtop = R_CeilingHeight(frontsector) - viewz;
+  worldbottom = R_FloorHeight(frontsector) - viewz;
 
   midtexture = toptexture = bottomtexture = maskedtexture = 0;
   ds_p->maskedtexturecol = NULL;
@@ -278,7 +279,7 @@ void Context::R_StoreWallRange ( int	start, int	stop )
     markfloor = markceiling = true;
     if (linedef->flags & ML_DONTPEGBOTTOM)
     {
-      vtop = frontsector->floorheight
+      vtop = R_FloorHeight(frontsector)
              + 128; ///??? textureheight[sidedef->midtexture];
       // bottom of texture at bottom
       rw_midtexturemid = vtop - viewz;	
@@ -302,46 +303,46 @@ void Context::R_StoreWallRange ( int	start, int	stop )
     ds_p->sprtopclip = ds_p->sprbottomclip = NULL;
     ds_p->silhouette = 0;
 
-    if (frontsector->floorheight > backsector->floorheight)
+    if (R_FloorHeight(frontsector) > R_FloorHeight(backsector))
     {
       ds_p->silhouette = SIL_BOTTOM;
-      ds_p->bsilheight = frontsector->floorheight;
+      ds_p->bsilheight = R_FloorHeight(frontsector);
     }
-    else if (backsector->floorheight > viewz)
+    else if (R_FloorHeight(backsector) > viewz)
     {
       ds_p->silhouette = SIL_BOTTOM;
       ds_p->bsilheight = INT_MAX;
       // ds_p->sprbottomclip = negonearray;
     }
 
-    if (frontsector->ceilingheight < backsector->ceilingheight)
+    if (R_CeilingHeight(frontsector) < R_CeilingHeight(backsector))
     {
       ds_p->silhouette |= SIL_TOP;
-      ds_p->tsilheight = frontsector->ceilingheight;
+      ds_p->tsilheight = R_CeilingHeight(frontsector);
     }
-    else if (backsector->ceilingheight < viewz)
+    else if (R_CeilingHeight(backsector) < viewz)
     {
       ds_p->silhouette |= SIL_TOP;
       ds_p->tsilheight = INT_MIN;
       // ds_p->sprtopclip = screenheightarray;
     }
 
-    if (backsector->ceilingheight <= frontsector->floorheight)
+    if (R_CeilingHeight(backsector) <= R_FloorHeight(frontsector))
     {
       ds_p->sprbottomclip = negonearray;
       ds_p->bsilheight = INT_MAX;
       ds_p->silhouette |= SIL_BOTTOM;
     }
 
-    if (backsector->floorheight >= frontsector->ceilingheight)
+    if (R_FloorHeight(backsector) >= R_CeilingHeight(frontsector))
     {
       ds_p->sprtopclip = screenheightarray;
       ds_p->tsilheight = INT_MIN;
       ds_p->silhouette |= SIL_TOP;
     }
 
-    worldhigh = backsector->ceilingheight - viewz;
-    worldlow = backsector->floorheight - viewz;
+    worldhigh = R_CeilingHeight(backsector) - viewz;
+    worldlow = R_FloorHeight(backsector) - viewz;
 
     // hack to allow height changes in outdoor areas
     if (frontsector->ceilingpic == skyflatnum 
@@ -376,8 +377,8 @@ void Context::R_StoreWallRange ( int	start, int	stop )
       markceiling = false;
     }
 
-    if (backsector->ceilingheight <= frontsector->floorheight
-        || backsector->floorheight >= frontsector->ceilingheight)
+    if (R_CeilingHeight(backsector) <= R_FloorHeight(frontsector)
+        || R_FloorHeight(backsector) >= R_CeilingHeight(frontsector))
     {
       // closed door
       markceiling = markfloor = true;
@@ -395,7 +396,7 @@ void Context::R_StoreWallRange ( int	start, int	stop )
       }
       else
       {
-        vtop = backsector->ceilingheight
+        vtop = R_CeilingHeight(backsector)
                + 128; ///???  textureheight[sidedef->toptexture];
 
         // bottom of texture
@@ -462,13 +463,13 @@ void Context::R_StoreWallRange ( int	start, int	stop )
   //  and doesn't need to be marked.
 
 
-  if (frontsector->floorheight >= viewz)
+  if (R_FloorHeight(frontsector) >= viewz)
   {
     // above view plane
     markfloor = false;
   }
 
-  if (frontsector->ceilingheight <= viewz 
+  if (R_CeilingHeight(frontsector) <= viewz 
       && frontsector->ceilingpic != skyflatnum)
   {
     // below view plane
@@ -21,6 +21,8 @@
 #ifndef __VPO_API_H__
 #define __VPO_API_H__
 
+#include <stddef.h>
+
 typedef void* VPOContext;
 
 VPOContext VPO_NewContext();
@@ -32,9 +34,18 @@ void VPO_DeleteContext(VPOContext ctx);
 const char *VPO_GetError(VPOContext ctx);
 
 // try to load a wad file
+// only the directory is kept, the file is opened again while
+// VPO_OpenMap() reads a map from it, which fails if the file has
+// changed since.  Load it again to pick up the changes.
 // returns 0 on success, negative value on error
 int VPO_LoadWAD(VPOContext ctx, const char *wad_filename);
 
+// load a wad file which is already in memory, e.g. one built by the
+// caller without writing it to disk.  The data is used in place, so it
+// must remain valid until VPO_FreeWAD() (or the next load) is called.
+// returns 0 on success, negative value on error
+int VPO_LoadWADFromMemory(VPOContext ctx, const void *data, size_t size);
+
 // free all data associated with the wad file
 // can be safely called without any loaded wad file
 void VPO_FreeWAD(VPOContext ctx);
@@ -50,6 +61,20 @@ const char * VPO_GetMapName(VPOContext ctx, unsigned int index, bool *is_hexen =
 // returns 0 on success, negative value on error
 int VPO_OpenMap(VPOContext ctx, const char *map_name, bool *is_hexen = NULL);
 
+// open a map directly from its lumps, without any wad file.  Each lump
+// is given as a pointer to its raw contents plus its length in bytes,
+// the LINEDEFS lump must be in HEXEN format when is_hexen is true.
+// The lumps only need to remain valid for the duration of this call.
+// returns 0 on success, negative value on error
+int VPO_OpenMapFromLumps(VPOContext ctx, bool is_hexen,
+                         const void *linedefs, int linedefs_len,
+                         const void *sidedefs, int sidedefs_len,
+                         const void *vertexes, int vertexes_len,
+                         const void *segs,     int segs_len,
+                         const void *ssectors, int ssectors_len,
+                         const void *nodes,    int nodes_len,
+                         const void *sectors,  int sectors_len);
+
 // free all data associated with a map
 // can be safely called without any opened map
 void VPO_CloseMap(VPOContext ctx);
@@ -98,5 +123,85 @@ int VPO_TestSpot(VPOContext ctx,
                  int *num_openings,
                  int *num_solidsegs);
 
+// test a whole batch of spots, each one against every angle in a set.
+// spots points to num_spots (x, y, dz) triples, angles points to
+// num_angles values in degrees (same meaning as for VPO_TestSpot).
+//
+// results must have room for VPO_SPOT_RESULT_SIZE ints per spot, which
+// receive the result code followed by the maximum number of visplanes,
+// drawsegs, openings and solidsegs over all the angles.  The result code
+// is RESULT_BAD_Z or RESULT_IN_VOID when the spot itself is unusable,
+// RESULT_OVERFLOW when any of the angles overflowed, otherwise RESULT_OK.
+//
+// the sector lookup for a spot is only done once for all of its angles.
+// returns the number of spots processed, or -1 on a usage error.
+
+#define VPO_SPOT_RESULT_SIZE  5
+
+int VPO_TestSpotMulti(VPOContext ctx,
+                      int num_spots, const int *spots,
+                      int num_angles, const int *angles,
+                      int *results);
+
+// find which previously tested spots may be affected by a change to
+// part of the map, so that only those need to be tested again.
+// (x1 y1) and (x2 y2) are the corners of a box which must contain every
+// changed linedef and the whole of every changed sector.  spots and
+// angles are the same as for VPO_TestSpotMulti, and should be checked
+// against the map which the old results were computed from.
+//
+// a spot is flagged when it is in the box, when the box is on the same
+// row as the spot close enough to alter the sector lookup, or when the
+// renderer reaches a part of the BSP tree inside the box (without being
+// blocked by solid walls) from any of the angles.
+//
+// flags receives 1 for each spot which needs testing again, else 0.
+// returns the number of flagged spots, or -1 on a usage error.
+
+int VPO_SpotsSeeingRegion(VPOContext ctx,
+                          int x1, int y1, int x2, int y2,
+                          int num_spots, const int *spots,
+                          int num_angles, const int *angles,
+                          int *flags);
+
+
+// the sweep engine tests spots on a pool of worker threads which all
+// render the map opened in a single context, without loading their own
+// copy of it.  Spots are queued in tiles, idle workers steal tiles from
+// busy ones, and finished results are collected in a buffer which the
+// caller drains with VPO_SweepGetResults().
+//
+// the sweep keeps using the map (with the doors opened or closed) as it
+// was when the sweep was started, even if the context closes it.
+
+typedef void* VPOSweep;
+
+// input record for each spot: x, y, dz, and a user value which is
+// passed back unchanged in the result record
+#define VPO_SWEEP_SPOT_SIZE    4
+
+// output record for each spot: the input record, followed by the
+// VPO_SPOT_RESULT_SIZE values described at VPO_TestSpotMulti()
+#define VPO_SWEEP_RESULT_SIZE  (VPO_SWEEP_SPOT_SIZE + VPO_SPOT_RESULT_SIZE)
+
+// start a sweep on the current map of ctx
+// num_threads <= 0 uses all the available hardware threads
+// returns NULL on error (see VPO_GetError)
+VPOSweep VPO_NewSweep(VPOContext ctx, int num_threads, int num_angles, const int *angles);
+
+// stop the worker threads and free the sweep
+// (spots which are still queued are discarded)
+void VPO_DeleteSweep(VPOSweep sweep);
+
+// queue spots for testing (num_spots input records)
+void VPO_SweepAddSpots(VPOSweep sweep, int num_spots, const int *spots);
+
+// fetch up to max_spots finished result records
+// returns the number of records written to results
+int VPO_SweepGetResults(VPOSweep sweep, int max_spots, int *results);
+
+// returns the number of queued spots which are not finished yet
+int VPO_SweepPending(VPOSweep sweep);
+
 #endif  /* __VPO_API_H__ */
 
@@ -36,6 +36,11 @@
 #include <string.h>
 #include <math.h>
 
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "sys_type.h"
 #include "sys_macro.h"
 #include "sys_endian.h"
@@ -49,6 +54,7 @@ namespace vpo
 
 #include "m_bbox.h"
 #include "m_fixed.h"
+#include "m_inflate.h"
 
 #include "w_file.h"
 #include "w_wad.h"
@@ -64,15 +70,18 @@ namespace vpo
 
 //------------------------------------------------------------
 
-#define SHORT(x)  LE_S16(x)
-#define LONG(x)   LE_S32(x)
+#define SHORT(x)   LE_S16(x)
+#define USHORT(x)  LE_U16(x)
+#define LONG(x)    LE_S32(x)
 
-const char * P_SetupLevel (const char *lumpname, bool *is_hexen );
-void P_FreeLevelData (void);
+// size of the blocks in the line index used by X_SectorForPoint
+#define MAPBLOCKUNITS	128
+#define MAPBLOCKSHIFT	(FRACBITS+7)
 
 void I_Error (const char *error, ...);
 
-sector_t * X_SectorForPoint(fixed_t x, fixed_t y);
+int R_PointOnSide (fixed_t x, fixed_t y, const node_t *node);
+int R_PointOnSide (fixed_t x, fixed_t y, const bspnode_t *node);
 
 // exceptions thrown on overflows
 class overflow_exception { };
@@ -111,8 +120,19 @@ typedef struct
 
 } PACKEDATTR filelump_t;
 
-struct Context
+struct Context;
+class ExtNodesReader;
+
+//
+// LevelData
+// The geometry of a loaded map.  Nothing modifies it once it has been
+// loaded, hence any number of RenderStates (possibly on different
+// threads) can share a single copy of it.
+//
+struct LevelData
 {
+	~LevelData();
+
 	void M_ClearBox(fixed_t* box);
 	void M_AddToBox(fixed_t* box, fixed_t x, fixed_t y);
 
@@ -120,33 +140,108 @@ struct Context
 	void P_LoadVertexes(int lump);
 	sector_t* GetSectorAtNullAddress();
 	void P_LoadSegs(int lump);
+	void Seg_CommonSetup(seg_t* li, line_t* ldef, int side);
 	void P_LoadSubsectors(int lump);
 	void ValidateSubsectors();
 	void P_LoadSectors(int lump);
-	bool isChildValid(unsigned short child);
+	bool isChildValid(unsigned int child);
 	void P_LoadNodes(int lump);
+	bool P_LoadExtendedNodes(int lump);
+	void P_ReadExtendedNodes(ExtNodesReader& reader, int gl_version);
 	void LineDef_CommonSetup(line_t* ld);
 	void P_LoadLineDefs(int lump);
 	void P_LoadLineDefs_Hexen(int lump);
 	void P_LoadSideDefs(int lump);
 	void P_GroupLines();
+	void P_CompactNodes();
+	void P_CreateBlockMap();
 	int HasManualDoor(const sector_t* sec);
 	void CalcDoorAltHeight(sector_t* sec);
 	void P_DetectDoorSectors();
-	const char* P_SetupLevel(const char* lumpname, bool* is_hexen);
-	void P_FreeLevelData();
+
+	subsector_t* R_PointInSubsector(fixed_t x, fixed_t y) const;
+	int ClosestLine_FullScan(fixed_t x, fixed_t y, int* side, fixed_t* dist) const;
+	int ClosestLine_CastingHoriz(fixed_t x, fixed_t y, int* side, fixed_t* dist = NULL) const;
+	sector_t* X_SectorForPoint(fixed_t x, fixed_t y) const;
+
+	// the context whose wad file the lumps are read from
+	// (only valid while Context::P_SetupLevel is loading the level)
+	Context* wad = {};
+
+	// the error message of a failed load
+	char level_error_msg[1024] = {};
+	bool level_is_hexen = {};
+
+	vertex_t* vertexes = {};
+	int numvertexes = {};
+	seg_t* segs = {};
+	int numsegs = {};
+	sector_t* sectors = {};
+	int numsectors = {};
+	subsector_t* subsectors = {};
+	int numsubsectors = {};
+	node_t* nodes = {};
+	int numnodes = {};
+
+	// The nodes reached from the root, numbered depth first (front
+	// child before back) so a descent stays in nearby memory.  The
+	// box of child 'side' of node n is the four values at
+	// bspbboxes[(n*2 + side)*4], and bspdepth is the most nodes on
+	// any path from the root.
+	std::vector<bspnode_t> bspnodes;
+	std::vector<fixed_t> bspbboxes;
+	int bspdepth = {};
+	line_t* lines = {};
+	int numlines = {};
+	side_t* sides = {};
+	int numsides = {};
+
+	// storage for the line lists of all sectors
+	line_t** linebuffer = {};
+
+	fixed_t  Map_bbox[4] = {};
+
+	// Index of the non-horizontal lines, for ClosestLine_CastingHoriz.
+	// The box around all lines is split into MAPBLOCKUNITS square blocks,
+	// and the lines passing through block (x, y) are blocklines[] from
+	// blockoffsets[i] up to blockoffsets[i+1], in ascending order, with
+	// i being y * bmapwidth + x.
+	fixed_t bmapbox[4] = {};
+	int bmapwidth = {};
+	int bmapheight = {};
+	std::vector<int> blockoffsets;
+	std::vector<int> blocklines;
+};
+
+//
+// RenderState
+// Everything needed to render views of a level: the view setup and all
+// the scratch buffers (drawsegs, solidsegs, visplanes, openings...).
+// Door sectors are opened or closed by overriding their heights here,
+// so the shared LevelData is never modified.
+//
+struct RenderState
+{
+	RenderState();
+
+	void R_SetLevel(const LevelData* level, const RenderState* heights_from = NULL);
+	void P_OpenDoorSectors(int dir);
+
+	fixed_t R_FloorHeight(const sector_t* sec) const { return floorheights[sec - level->sectors]; }
+	fixed_t R_CeilingHeight(const sector_t* sec) const { return ceilingheights[sec - level->sectors]; }
 
 	void R_ClearDrawSegs();
 	void R_ClipSolidWallSegment(int first, int last);
 	void R_ClipPassWallSegment(int first, int last);
 	void R_ClearClipSegs();
 	void R_AddLine(seg_t* line);
-	boolean R_CheckBBox(fixed_t* bspcoord);
+	boolean R_CheckBBox(const fixed_t* bspcoord);
 	void R_Subsector(int num);
 	void R_RenderBSPNode(int bspnum);
+	void R_RenderBSP();
+	boolean R_RegionBSPNode(int bspnum, const fixed_t* bbox);
 
 	void R_AddPointToBox(int x, int y, fixed_t* box);
-	int R_PointOnSide(fixed_t x, fixed_t y, node_t* node);
 	int R_PointOnSegSide(fixed_t x, fixed_t y, seg_t* line);
 	angle_t R_PointToAngle(fixed_t x, fixed_t y);
 	angle_t R_PointToAngle2(fixed_t	x1, fixed_t	y1, fixed_t	x2, fixed_t	y2);
@@ -156,9 +251,8 @@ struct Context
 	void R_InitTextureMapping();
 	void R_SetViewSize(int blocks, int detail);
 	void R_Init();
-	subsector_t* R_PointInSubsector(fixed_t x, fixed_t y);
 	void R_SetupFrame(fixed_t x, fixed_t y, fixed_t z, angle_t angle);
-	void R_RenderView(fixed_t x, fixed_t y, fixed_t z, angle_t angle);
+	void R_RenderView(fixed_t x, fixed_t y, fixed_t z, angle_t angle, bool compact_nodes = BSP_COMPACT_NODES != 0);
 
 	void R_ClearPlanes();
 	visplane_t* R_FindPlane(fixed_t height, int picnum, int lightlevel);
@@ -167,49 +261,22 @@ struct Context
 	void R_RenderSegLoop();
 	void R_StoreWallRange(int start, int stop);
 
-	void ClearError();
-	void SetError(const char* msg, ...);
+	int X_SetupSpot(int x, int y, int dz, fixed_t* rx, fixed_t* ry, fixed_t* rz);
+	int X_RenderSpot(fixed_t rx, fixed_t ry, fixed_t rz, int angle,
+	                 int* num_visplanes, int* num_drawsegs,
+	                 int* num_openings, int* num_solidsegs);
+	void X_TestSpots(int num_spots, const int* spots, int spot_size,
+	                 int num_angles, const int* angles, int* results);
+	int X_SpotsSeeingRegion(const fixed_t* bbox,
+	                        int num_spots, const int* spots, int spot_size,
+	                        int num_angles, const int* angles, int* flags);
 
-	void I_Error(const char* error, ...);
-	int ClosestLine_CastingHoriz(fixed_t x, fixed_t y, int* side);
-	sector_t* X_SectorForPoint(fixed_t x, fixed_t y);
+	// the level being rendered
+	const LevelData* level = {};
 
-	wad_file_t* W_OpenFile(const char* path);
-	void W_CloseFile(wad_file_t* wad);
-	size_t W_Read(wad_file_t* wad, unsigned int offset, void* buffer, size_t buffer_len);
-
-	int CheckMapHeader(filelump_t* lumps, int num_after);
-	bool W_AddFile(const char* filename);
-	void W_RemoveFile();
-	int W_NumLumps();
-	int W_CheckNumForName(const char* name);
-	int W_LumpLength(int lumpnum);
-	void W_ReadLump(int lump, void* dest);
-	byte* W_LoadLump(int lumpnum);
-	void W_FreeLump(byte* data);
-	void W_BeginRead();
-	void W_EndRead();
-
-	// the error message returned from P_SetupLevel()
-	char level_error_msg[1024] = {};
-	bool level_is_hexen = {};
-
-	vertex_t* vertexes = {};
-	int numvertexes = {};
-	seg_t* segs = {};
-	int numsegs = {};
-	sector_t* sectors = {};
-	int numsectors = {};
-	subsector_t* subsectors = {};
-	int numsubsectors = {};
-	node_t* nodes = {};
-	int numnodes = {};
-	line_t* lines = {};
-	int numlines = {};
-	side_t* sides = {};
-	int numsides = {};
-
-	fixed_t  Map_bbox[4] = {};
+	// sector heights for this state, indexed by sector number
+	std::vector<fixed_t> floorheights;
+	std::vector<fixed_t> ceilingheights;
 
 	seg_t* curline = {};
 	side_t* sidedef = {};
@@ -228,6 +295,9 @@ struct Context
 
 	int max_solidsegs = {};
 
+	// back sides waiting to be checked by R_RenderBSP
+	std::vector<int> bspstack;
+
 
 	int			viewangleoffset = {};
 
@@ -317,6 +387,15 @@ struct Context
 
 	int total_visplanes = {};
 
+#if PLANEHASH_SIZE > 0
+	// Index from (height, picnum, lightlevel) to the first visplane
+	// with that key.  Slots are only valid when their generation
+	// matches planehash_gen, so R_ClearPlanes needn't wipe the table.
+	unsigned int planehash_slotgen[PLANEHASH_SIZE] = {};
+	short planehash_slot[PLANEHASH_SIZE] = {};
+	unsigned int planehash_gen = {};
+#endif
+
 	short openings[MAXOPENINGS + 400] = {};
 	short* lastopening = {};
 
@@ -411,18 +490,59 @@ struct Context
 	fixed_t          dc_iscale = {};
 	fixed_t          dc_texturemid = {};
 
-	char error_buffer[1024] = {};
-	char mapname_buffer[16] = {};
+	// the changed area looked for by R_RegionBSPNode, which also makes
+	// R_StoreWallRange do nothing while it is set
+	fixed_t region_bbox[4] = {};
+	bool region_query = {};
 
 	// cache for the sector lookup
 	int last_x = {};
 	int last_y = {};
 	sector_t* last_sector = {};
+};
+
+struct Context
+{
+	void ClearError();
+	void SetError(const char* msg, ...);
+
+	const char* P_SetupLevel(const char* lumpname, bool* is_hexen);
+	const char* P_LoadLevel(wad_directory_t* dir, int base, const char* mapname, bool* is_hexen);
+	void P_FreeLevelData();
+
+	bool W_AddFile(const char* filename);
+	bool W_AddMemory(const void* data, size_t size);
+	void W_RemoveFile();
+	int W_NumLumps();
+	int W_CheckNumForName(const char* name);
+	int W_LumpLength(int lumpnum);
+	void W_ReadLump(int lump, void* dest);
+	const byte* W_LoadLump(int lumpnum);
+	void W_FreeLump(const byte* data);
+	bool W_BeginRead(wad_directory_t* dir);
+	void W_EndRead();
+
+	// the error message returned from P_SetupLevel()
+	char level_error_msg[1024] = {};
+
+	// the currently opened map (NULL when none)
+	std::shared_ptr<LevelData> level;
+
+	RenderState render;
+
+	char error_buffer[1024] = {};
+	char mapname_buffer[16] = {};
+
+	// the loaded wad (possibly shared with other contexts)
+	std::shared_ptr<wad_directory_t> wad_dir;
 
 	// Location of each lump on disk.
-	lumpinfo_t* lumpinfo = {};
+	const lumpinfo_t* lumpinfo = {};
 	int numlumps = 0;
-	char* wad_filename = {};
+
+	// the directory and file being read from (between W_BeginRead
+	// and W_EndRead only)
+	wad_directory_t* current_dir = {};
 	wad_file_t* current_file = {};
 };
 
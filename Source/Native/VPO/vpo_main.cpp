@@ -67,8 +67,6 @@ int VPO_LoadWAD(VPOContext ctx, const char *wad_filename)
 	// free any previously loaded wad
 	VPO_FreeWAD(ctx);
 
-	context->R_Init();
-
 	if (! context->W_AddFile(wad_filename))
 	{
 		context->SetError("Missing or invalid wad file: %s", wad_filename);
@@ -79,6 +77,25 @@ int VPO_LoadWAD(VPOContext ctx, const char *wad_filename)
 }
 
 
+int VPO_LoadWADFromMemory(VPOContext ctx, const void *data, size_t size)
+{
+	vpo::Context* context = (vpo::Context*)ctx;
+
+	context->ClearError();
+
+	// free any previously loaded wad
+	VPO_FreeWAD(ctx);
+
+	if (! data || ! context->W_AddMemory(data, size))
+	{
+		context->SetError("Invalid wad data in memory");
+		return -1;
+	}
+
+	return 0;  // OK !
+}
+
+
 int VPO_OpenMap(VPOContext ctx, const char *map_name, bool *is_hexen)
 {
 	vpo::Context* context = (vpo::Context*)ctx;
@@ -107,6 +124,65 @@ int VPO_OpenMap(VPOContext ctx, const char *map_name, bool *is_hexen)
 }
 
 
+int VPO_OpenMapFromLumps(VPOContext ctx, bool is_hexen,
+                         const void *linedefs, int linedefs_len,
+                         const void *sidedefs, int sidedefs_len,
+                         const void *vertexes, int vertexes_len,
+                         const void *segs,     int segs_len,
+                         const void *ssectors, int ssectors_len,
+                         const void *nodes,    int nodes_len,
+                         const void *sectors,  int sectors_len)
+{
+	vpo::Context* context = (vpo::Context*)ctx;
+
+	context->ClearError();
+
+	// close any previously loaded map
+	VPO_CloseMap(ctx);
+
+	// build a directory with just this map's lumps, in the usual order
+	vpo::wad_directory_t dir;
+
+	dir.lumps.resize(vpo::ML_BLOCKMAP + 1);
+
+	dir.lumps[0].is_map_header = true;
+	dir.lumps[0].is_hexen = is_hexen;
+
+	struct { int index; const void *data; int length; } lumps[] =
+	{
+		{ vpo::ML_LINEDEFS, linedefs, linedefs_len },
+		{ vpo::ML_SIDEDEFS, sidedefs, sidedefs_len },
+		{ vpo::ML_VERTEXES, vertexes, vertexes_len },
+		{ vpo::ML_SEGS,     segs,     segs_len     },
+		{ vpo::ML_SSECTORS, ssectors, ssectors_len },
+		{ vpo::ML_NODES,    nodes,    nodes_len    },
+		{ vpo::ML_SECTORS,  sectors,  sectors_len  }
+	};
+
+	for (auto& lump : lumps)
+	{
+		if (lump.length < 0 || (lump.length > 0 && ! lump.data))
+		{
+			context->SetError("VPO_OpenMapFromLumps: bad lump data");
+			return -1;
+		}
+
+		dir.lumps[lump.index].data = (const vpo::byte *)lump.data;
+		dir.lumps[lump.index].size = lump.length;
+	}
+
+	const char *err_msg = context->P_LoadLevel(&dir, 0, "(lumps)", NULL);
+
+	if (err_msg)
+	{
+		context->SetError("%s", err_msg);
+		return -1;
+	}
+
+	return 0;  // OK !
+}
+
+
 void VPO_FreeWAD(VPOContext ctx)
 {
 	vpo::Context* context = (vpo::Context*)ctx;
@@ -123,10 +199,6 @@ void VPO_CloseMap(VPOContext ctx)
 
 	context->ClearError();
 
-	context->last_x = -77777;
-	context->last_y = -77777;
-	context->last_sector = NULL;
-
 	context->P_FreeLevelData();
 }
 
@@ -165,11 +237,12 @@ const char * VPO_GetMapName(VPOContext ctx, unsigned int index, bool *is_hexen)
 int VPO_GetLinedef(VPOContext ctx, unsigned int index, int *x1, int *y1, int *x2, int *y2)
 {
 	vpo::Context* context = (vpo::Context*)ctx;
+	const vpo::LevelData* level = context->level.get();
 
-	if (index >= (unsigned int)context->numlines)
+	if (! level || index >= (unsigned int)level->numlines)
 		return -1;
 
-	const vpo::line_t *L = &context->lines[index];
+	const vpo::line_t *L = &level->lines[index];
 
 	*x1 = L->v1->x >> FRACBITS;
 	*y1 = L->v1->y >> FRACBITS;
@@ -185,11 +258,12 @@ int VPO_GetSeg(VPOContext ctx, unsigned int index, int *linedef, int *side,
                int *x1, int *y1, int *x2, int *y2)
 {
 	vpo::Context* context = (vpo::Context*)ctx;
+	const vpo::LevelData* level = context->level.get();
 
-	if (index >= (unsigned int)context->numsegs)
+	if (! level || index >= (unsigned int)level->numsegs)
 		return -1;
 	
-	const vpo::seg_t *seg = &context->segs[index];
+	const vpo::seg_t *seg = &level->segs[index];
 	const vpo::line_t *L  = seg->linedef;
 
 	*x1 = seg->v1->x >> FRACBITS;
@@ -198,10 +272,10 @@ int VPO_GetSeg(VPOContext ctx, unsigned int index, int *linedef, int *side,
 	*x2 = seg->v2->x >> FRACBITS;
 	*y2 = seg->v2->y >> FRACBITS;
 
-	*linedef = (L - context->lines);
+	*linedef = (L - level->lines);
 	*side = 0;
 
-	if (L->sidenum[1] >= 0 && seg->sidedef == &context->sides[L->sidenum[1]])
+	if (L->sidenum[1] >= 0 && seg->sidedef == &level->sides[L->sidenum[1]])
 		*side = 1;
 
 	return 0;
@@ -212,10 +286,18 @@ void VPO_GetBBox(VPOContext ctx, int *x1, int *y1, int *x2, int *y2)
 {
 	vpo::Context* context = (vpo::Context*)ctx;
 
-	*x1 = (context->Map_bbox[vpo::BOXLEFT]   >> FRACBITS);
-	*y1 = (context->Map_bbox[vpo::BOXBOTTOM] >> FRACBITS);
-	*x2 = (context->Map_bbox[vpo::BOXRIGHT]  >> FRACBITS);
-	*y2 = (context->Map_bbox[vpo::BOXTOP]    >> FRACBITS);
+	if (! context->level)
+	{
+		*x1 = *y1 = *x2 = *y2 = 0;
+		return;
+	}
+
+	const vpo::fixed_t *bbox = context->level->Map_bbox;
+
+	*x1 = (bbox[vpo::BOXLEFT]   >> FRACBITS);
+	*y1 = (bbox[vpo::BOXBOTTOM] >> FRACBITS);
+	*x2 = (bbox[vpo::BOXRIGHT]  >> FRACBITS);
+	*y2 = (bbox[vpo::BOXTOP]    >> FRACBITS);
 }
 
 
@@ -223,28 +305,7 @@ void VPO_OpenDoorSectors(VPOContext ctx, int dir)
 {
 	vpo::Context* context = (vpo::Context*)ctx;
 
-	for (int i = 0 ; i < context->numsectors ; i++)
-	{
-		vpo::sector_t *sec = &context->sectors[i];
-
-		if (sec->is_door == 0)
-			continue;
-
-		if (dir > 0)  // open them
-		{
-			if (sec->is_door > 0)
-				sec->ceilingheight = sec->alt_height;
-			else
-				sec->floorheight = sec->alt_height;
-		}
-		else if (dir < 0)  // close them
-		{
-			if (sec->is_door > 0)
-				sec->ceilingheight = sec->floorheight;
-			else
-				sec->floorheight = sec->ceilingheight;
-		}
-	}
+	context->render.P_OpenDoorSectors(dir);
 }
 
 
@@ -256,74 +317,59 @@ int VPO_TestSpot(VPOContext ctx, int x, int y, int dz, int angle,
 {
 	vpo::Context* context = (vpo::Context*)ctx;
 
-	// the actual spot we will use
-	// (this prevents issues with X_SectorForPoint getting the wrong
-	//  value when the casted ray hits a vertex)
-	vpo::fixed_t rx = (x << FRACBITS) + (FRACUNIT / 2);
-	vpo::fixed_t ry = (y << FRACBITS) + (FRACUNIT / 2);
-
-	// check if spot is outside the map
-	if (rx < context->Map_bbox[vpo::BOXLEFT]   ||
-	    rx > context->Map_bbox[vpo::BOXRIGHT]  ||
-	    ry < context->Map_bbox[vpo::BOXBOTTOM] ||
-		ry > context->Map_bbox[vpo::BOXTOP])
-	{
-		return RESULT_IN_VOID;
-	}
+	vpo::fixed_t rx, ry, rz;
 
-	// optimization: we cache the last sector lookup
-	vpo::sector_t *sec;
+	int result = context->render.X_SetupSpot(x, y, dz, &rx, &ry, &rz);
 
-	if (x == context->last_x && y == context->last_y)
-		sec = context->last_sector;
-	else
-	{
-		sec = context->X_SectorForPoint(rx, ry);
+	if (result != RESULT_OK)
+		return result;
 
-		context->last_x = x;
-		context->last_y = y;
-		context->last_sector = sec;
-	}
+	return context->render.X_RenderSpot(rx, ry, rz, angle,
+	                                    num_visplanes, num_drawsegs, num_openings, num_solidsegs);
+}
 
-	if (! sec)
-		return RESULT_IN_VOID;
-	
-	vpo::fixed_t rz;
-	
-	if (dz < 0)
-		rz = sec->ceilingheight + (dz << FRACBITS);
-	else
-		rz = sec->floorheight + (dz << FRACBITS);
 
-	if (rz <= sec->floorheight || rz >= sec->ceilingheight)
-		return RESULT_BAD_Z;
+int VPO_TestSpotMulti(VPOContext ctx,
+                      int num_spots, const int *spots,
+                      int num_angles, const int *angles,
+                      int *results)
+{
+	vpo::Context* context = (vpo::Context*)ctx;
+
+	if (num_spots < 0 || num_angles <= 0 || (num_spots > 0 && ! (spots && angles && results)))
+	{
+		context->SetError("VPO_TestSpotMulti called with invalid arguments");
+		return -1;
+	}
 
-	// convert angle to the 32-bit BAM representation
-	if (angle == 360)
-		angle = 0;
+	context->render.X_TestSpots(num_spots, spots, 3, num_angles, angles, results);
 
-	vpo::fixed_t ang2 = vpo::FixedDiv(angle << FRACBITS, 360 << FRACBITS);
+	return num_spots;
+}
 
-	vpo::angle_t r_ang = (vpo::angle_t) (ang2 << 16);
 
-	int result = RESULT_OK;
+int VPO_SpotsSeeingRegion(VPOContext ctx,
+                          int x1, int y1, int x2, int y2,
+                          int num_spots, const int *spots,
+                          int num_angles, const int *angles,
+                          int *flags)
+{
+	vpo::Context* context = (vpo::Context*)ctx;
 
-	// perform a no-draw render and see how many visplanes were needed
-	try
-	{
-		context->R_RenderView(rx, ry, rz, r_ang);
-	}
-	catch (vpo::overflow_exception&)
+	if (num_spots < 0 || num_angles <= 0 || (num_spots > 0 && ! (spots && angles && flags)))
 	{
-		result = RESULT_OVERFLOW;
+		context->SetError("VPO_SpotsSeeingRegion called with invalid arguments");
+		return -1;
 	}
 
-	*num_visplanes = MAX(*num_visplanes, context->total_visplanes);
-	*num_drawsegs  = MAX(*num_drawsegs, context->total_drawsegs);
-	*num_openings  = MAX(*num_openings, context->total_openings);
-	*num_solidsegs = MAX(*num_solidsegs, context->max_solidsegs);
+	vpo::fixed_t bbox[4];
+
+	bbox[vpo::BOXLEFT]   = MIN(x1, x2) << FRACBITS;
+	bbox[vpo::BOXRIGHT]  = MAX(x1, x2) << FRACBITS;
+	bbox[vpo::BOXBOTTOM] = MIN(y1, y2) << FRACBITS;
+	bbox[vpo::BOXTOP]    = MAX(y1, y2) << FRACBITS;
 
-	return result;
+	return context->render.X_SpotsSeeingRegion(bbox, num_spots, spots, 3, num_angles, angles, flags);
 }
 
 
@@ -20,12 +20,13 @@
 
 #include "Precomp.h"
 #include "vpo_local.h"
+#include "vpo_api.h"
 
 namespace vpo
 {
 
 
-void Context::I_Error (const char *error, ...)
+void I_Error (const char *error, ...)
 {
 	va_list	argptr;
 
@@ -40,7 +41,12 @@ void Context::I_Error (const char *error, ...)
 }
 
 
-int Context::ClosestLine_CastingHoriz(fixed_t x, fixed_t y, int *side)
+//
+// ClosestLine_FullScan
+//
+// Checks every line, see ClosestLine_CastingHoriz.
+//
+int LevelData::ClosestLine_FullScan(fixed_t x, fixed_t y, int *side, fixed_t *dist) const
 {
 	int     best_match = -1;
 	fixed_t best_dist  = 32000 << FRACBITS;
@@ -62,18 +68,18 @@ int Context::ClosestLine_CastingHoriz(fixed_t x, fixed_t y, int *side)
 		fixed_t lx2 = lines[n].v2->x;
 
 		fixed_t quot = FixedDiv(y - ly1, ly2 - ly1);
-		fixed_t dist = lx1 - x + FixedMul(lx2 - lx1, quot);
+		fixed_t d = lx1 - x + FixedMul(lx2 - lx1, quot);
 
-		if (abs(dist) < best_dist)
+		if (abs(d) < best_dist)
 		{
 			best_match = n;
-			best_dist  = abs(dist);
+			best_dist  = abs(d);
 
 			if (side)
 			{
 				if (best_dist < FRACUNIT / 8)
 					*side = 0;  // on the line
-				else if ( (ly1 > ly2) == (dist > 0))
+				else if ( (ly1 > ly2) == (d > 0))
 					*side = 1;  // right side
 				else
 					*side = -1; // left side
@@ -81,11 +87,110 @@ int Context::ClosestLine_CastingHoriz(fixed_t x, fixed_t y, int *side)
 		}
 	}
 
+	if (dist)
+		*dist = best_dist;
+
+	return best_match;
+}
+
+
+//
+// ClosestLine_CastingHoriz
+//
+// Finds the closest line crossed by a horizontal line through the spot,
+// the lowest numbered one when several are equally close.  The blocks
+// of the spot's row are searched outwards, see P_CreateBlockMap.
+//
+int LevelData::ClosestLine_CastingHoriz(fixed_t x, fixed_t y, int *side, fixed_t *dist) const
+{
+	int     best_match = -1;
+	fixed_t best_dist  = 32000 << FRACBITS;
+	fixed_t best_side_dist = 0;
+
+	// the distances overflow for lines 32768 units or more away, or
+	// lines as wide or tall as that.  Only the full scan gives the same results
+	// then, so use it.
+	const int64_t limit = (int64_t)32768 << FRACBITS;
+
+	if ((int64_t)bmapbox[BOXTOP] - bmapbox[BOXBOTTOM] >= limit ||
+	    (int64_t)bmapbox[BOXRIGHT] - bmapbox[BOXLEFT] >= limit ||
+	    (int64_t)x - bmapbox[BOXLEFT] >= limit ||
+	    (int64_t)bmapbox[BOXRIGHT] - x >= limit)
+	{
+		return ClosestLine_FullScan(x, y, side, dist);
+	}
+
+	int64_t row = ((int64_t)y - bmapbox[BOXBOTTOM]) >> MAPBLOCKSHIFT;
+	int64_t col = ((int64_t)x - bmapbox[BOXLEFT])   >> MAPBLOCKSHIFT;
+
+	// no lines can cross rows outside of the map
+	for (int64_t k = 0 ; row >= 0 && row < bmapheight ; k++)
+	{
+		// lines not seen yet are at least (k - 1) blocks away, as each
+		// line is also in the blocks beside the ones it crosses (keep
+		// another block in hand for rounding, and for ties).
+		if (best_match >= 0 && ((int64_t)best_dist >> MAPBLOCKSHIFT) + 2 < k)
+			break;
+
+		if (col - k < 0 && col + k >= bmapwidth)
+			break;
+
+		for (int dir = -1 ; dir <= 1 ; dir += 2)
+		{
+			int64_t c = col + k * dir;
+
+			if ((k == 0 && dir > 0) || c < 0 || c >= bmapwidth)
+				continue;
+
+			int block = (int)row * bmapwidth + (int)c;
+
+			for (int b = blockoffsets[block] ; b < blockoffsets[block+1] ; b++)
+			{
+				int n = blocklines[b];
+
+				fixed_t ly1 = lines[n].v1->y;
+				fixed_t ly2 = lines[n].v2->y;
+
+				// does the linedef cross the horizontal ray?
+				if ( (y < ly1) && (y < ly2) ) continue;
+				if ( (y > ly1) && (y > ly2) ) continue;
+
+				fixed_t lx1 = lines[n].v1->x;
+				fixed_t lx2 = lines[n].v2->x;
+
+				fixed_t quot = FixedDiv(y - ly1, ly2 - ly1);
+				fixed_t d = lx1 - x + FixedMul(lx2 - lx1, quot);
+
+				if (abs(d) < best_dist || (abs(d) == best_dist && n < best_match))
+				{
+					best_match = n;
+					best_dist  = abs(d);
+					best_side_dist = d;
+				}
+			}
+		}
+	}
+
+	if (side && best_match >= 0)
+	{
+		const line_t *ld = &lines[best_match];
+
+		if (best_dist < FRACUNIT / 8)
+			*side = 0;  // on the line
+		else if ( (ld->v1->y > ld->v2->y) == (best_side_dist > 0))
+			*side = 1;  // right side
+		else
+			*side = -1; // left side
+	}
+
+	if (dist)
+		*dist = best_dist;
+
 	return best_match;
 }
 
 
-sector_t * Context::X_SectorForPoint(fixed_t x, fixed_t y)
+sector_t * LevelData::X_SectorForPoint(fixed_t x, fixed_t y) const
 {
 	/* hack, hack...  I look for the first LineDef crossing
 	   an horizontal half-line drawn from the cursor */
@@ -108,6 +213,224 @@ sector_t * Context::X_SectorForPoint(fixed_t x, fixed_t y)
 }
 
 
+//
+// X_SetupSpot
+//
+// Looks up the sector at a spot and computes the eye height.
+// Returns RESULT_OK when the spot is usable for rendering.
+//
+int RenderState::X_SetupSpot(int x, int y, int dz, fixed_t *rx, fixed_t *ry, fixed_t *rz)
+{
+	if (! level)
+		return RESULT_IN_VOID;
+
+	// the actual spot we will use
+	// (this prevents issues with X_SectorForPoint getting the wrong
+	//  value when the casted ray hits a vertex)
+	*rx = (x << FRACBITS) + (FRACUNIT / 2);
+	*ry = (y << FRACBITS) + (FRACUNIT / 2);
+
+	// check if spot is outside the map
+	if (*rx < level->Map_bbox[BOXLEFT]   ||
+	    *rx > level->Map_bbox[BOXRIGHT]  ||
+	    *ry < level->Map_bbox[BOXBOTTOM] ||
+		*ry > level->Map_bbox[BOXTOP])
+	{
+		return RESULT_IN_VOID;
+	}
+
+	// optimization: we cache the last sector lookup
+	sector_t *sec;
+
+	if (x == last_x && y == last_y)
+		sec = last_sector;
+	else
+	{
+		sec = level->X_SectorForPoint(*rx, *ry);
+
+		last_x = x;
+		last_y = y;
+		last_sector = sec;
+	}
+
+	if (! sec)
+		return RESULT_IN_VOID;
+
+	if (dz < 0)
+		*rz = R_CeilingHeight(sec) + (dz << FRACBITS);
+	else
+		*rz = R_FloorHeight(sec) + (dz << FRACBITS);
+
+	if (*rz <= R_FloorHeight(sec) || *rz >= R_CeilingHeight(sec))
+		return RESULT_BAD_Z;
+
+	return RESULT_OK;
+}
+
+
+//
+// X_ConvertAngle
+//
+// Converts an angle in degrees to the 32-bit BAM representation.
+//
+static angle_t X_ConvertAngle(int angle)
+{
+	if (angle == 360)
+		angle = 0;
+
+	fixed_t ang2 = FixedDiv(angle << FRACBITS, 360 << FRACBITS);
+
+	return (angle_t) (ang2 << 16);
+}
+
+
+//
+// X_RenderSpot
+//
+// Performs a no-draw render from a spot prepared by X_SetupSpot,
+// and updates the maximum counts (visplanes, drawsegs, openings,
+// solidsegs).
+//
+int RenderState::X_RenderSpot(fixed_t rx, fixed_t ry, fixed_t rz, int angle,
+                              int *num_visplanes, int *num_drawsegs,
+                              int *num_openings,  int *num_solidsegs)
+{
+	angle_t r_ang = X_ConvertAngle(angle);
+
+	int result = RESULT_OK;
+
+	// perform a no-draw render and see how many visplanes were needed
+	try
+	{
+		R_RenderView(rx, ry, rz, r_ang);
+	}
+	catch (overflow_exception&)
+	{
+		result = RESULT_OVERFLOW;
+	}
+
+	*num_visplanes = MAX(*num_visplanes, total_visplanes);
+	*num_drawsegs  = MAX(*num_drawsegs, total_drawsegs);
+	*num_openings  = MAX(*num_openings, total_openings);
+	*num_solidsegs = MAX(*num_solidsegs, max_solidsegs);
+
+	return result;
+}
+
+
+//
+// X_TestSpots
+//
+// Tests a batch of spots against a set of angles, see VPO_TestSpotMulti.
+// Each spot is spot_size ints, the first three being x, y and dz.
+//
+void RenderState::X_TestSpots(int num_spots, const int *spots, int spot_size,
+                              int num_angles, const int *angles, int *results)
+{
+	for (int i = 0 ; i < num_spots ; i++, spots += spot_size, results += VPO_SPOT_RESULT_SIZE)
+	{
+		int *out = results;
+
+		out[1] = out[2] = out[3] = out[4] = 0;
+
+		fixed_t rx, ry, rz;
+
+		out[0] = X_SetupSpot(spots[0], spots[1], spots[2], &rx, &ry, &rz);
+
+		if (out[0] != RESULT_OK)
+			continue;
+
+		for (int k = 0 ; k < num_angles ; k++)
+		{
+			if (X_RenderSpot(rx, ry, rz, angles[k],
+			                 &out[1], &out[2], &out[3], &out[4]) == RESULT_OVERFLOW)
+			{
+				out[0] = RESULT_OVERFLOW;
+			}
+		}
+	}
+}
+
+
+//
+// X_SpotsSeeingRegion
+//
+// Flags the spots which can possibly see some part of the given area,
+// see VPO_SpotsSeeingRegion.  Returns the number of flagged spots.
+//
+int RenderState::X_SpotsSeeingRegion(const fixed_t *bbox,
+                                     int num_spots, const int *spots, int spot_size,
+                                     int num_angles, const int *angles, int *flags)
+{
+	int count = 0;
+
+	memcpy(region_bbox, bbox, sizeof(region_bbox));
+
+	for (int i = 0 ; i < num_spots ; i++, spots += spot_size)
+	{
+		fixed_t rx, ry, rz;
+
+		int result = X_SetupSpot(spots[0], spots[1], spots[2], &rx, &ry, &rz);
+
+		flags[i] = 0;
+
+		if (! level)
+			continue;
+
+		// the sector lookup casts a horizontal ray to the closest line,
+		// so a change on that stretch of the row can change the sector
+		// (or make the spot go in or out of the void).
+		if (ry >= bbox[BOXBOTTOM] && ry <= bbox[BOXTOP])
+		{
+			fixed_t dist;
+
+			level->ClosestLine_CastingHoriz(rx, ry, NULL, &dist);
+
+			if ((int64_t)bbox[BOXLEFT]  <= (int64_t)rx + dist &&
+			    (int64_t)bbox[BOXRIGHT] >= (int64_t)rx - dist)
+			{
+				flags[i] = 1;
+				count++;
+				continue;
+			}
+		}
+
+		if (result != RESULT_OK)
+			continue;
+
+		bool seen = false;
+
+		region_query = true;
+
+		for (int k = 0 ; k < num_angles && ! seen ; k++)
+		{
+			R_SetupFrame(rx, ry, rz, X_ConvertAngle(angles[k]));
+			R_ClearClipSegs();
+
+			try
+			{
+				seen = R_RegionBSPNode(level->numnodes - 1, level->Map_bbox);
+			}
+			catch (overflow_exception&)
+			{
+				// the clip ranges overflowed, so assume the worst
+				seen = true;
+			}
+		}
+
+		region_query = false;
+
+		if (seen)
+		{
+			flags[i] = 1;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
 } // namespace vpo
 
 //--- editor settings ---
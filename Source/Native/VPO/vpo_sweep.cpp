@@ -0,0 +1,292 @@
+//------------------------------------------------------------------------
+//  Visplane Overflow Library : multi-threaded sweep engine
+//------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "vpo_local.h"
+#include "vpo_api.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+namespace vpo
+{
+
+// maximum number of spots in a single tile of work
+#define SWEEP_TILE_SPOTS  64
+
+// a tile of spots, VPO_SWEEP_SPOT_SIZE ints per spot
+typedef std::vector<int> sweep_tile_t;
+
+struct SweepWorker
+{
+	// render scratch for this thread
+	std::unique_ptr<RenderState> render;
+
+	// tiles queued for this worker. the owner takes from the back,
+	// other workers steal from the front.
+	std::mutex mutex;
+	std::deque<sweep_tile_t> tiles;
+
+	std::thread thread;
+};
+
+struct Sweep
+{
+	// the level which all workers render
+	std::shared_ptr<LevelData> level;
+
+	std::vector<int> angles;
+	std::vector<std::unique_ptr<SweepWorker>> workers;
+
+	// sleeping workers wait here until tiles are queued
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	int queued_tiles = 0;
+	bool stop = false;
+
+	// next worker to receive a tile
+	unsigned int next_worker = 0;
+
+	std::mutex results_mutex;
+	std::vector<int> results;
+
+	std::atomic<int> pending_spots { 0 };
+
+	bool TakeTile(unsigned int index, sweep_tile_t& tile);
+	void WorkerMain(unsigned int index);
+	void TestTile(SweepWorker* worker, const sweep_tile_t& tile);
+};
+
+
+bool Sweep::TakeTile(unsigned int index, sweep_tile_t& tile)
+{
+	size_t count = workers.size();
+
+	for (size_t i = 0 ; i < count ; i++)
+	{
+		SweepWorker* victim = workers[(index + i) % count].get();
+
+		std::unique_lock<std::mutex> lock(victim->mutex);
+
+		if (victim->tiles.empty())
+			continue;
+
+		if (i == 0)
+		{
+			tile = std::move(victim->tiles.back());
+			victim->tiles.pop_back();
+		}
+		else
+		{
+			tile = std::move(victim->tiles.front());
+			victim->tiles.pop_front();
+		}
+
+		lock.unlock();
+
+		std::unique_lock<std::mutex> wake_lock(wake_mutex);
+		queued_tiles--;
+		return true;
+	}
+
+	return false;
+}
+
+
+void Sweep::TestTile(SweepWorker* worker, const sweep_tile_t& tile)
+{
+	int num_spots = (int)tile.size() / VPO_SWEEP_SPOT_SIZE;
+
+	std::vector<int> spot_results(num_spots * VPO_SPOT_RESULT_SIZE);
+
+	worker->render->X_TestSpots(num_spots, tile.data(), VPO_SWEEP_SPOT_SIZE,
+	                            (int)angles.size(), angles.data(), spot_results.data());
+
+	std::unique_lock<std::mutex> lock(results_mutex);
+
+	for (int i = 0 ; i < num_spots ; i++)
+	{
+		const int *spot = &tile[i * VPO_SWEEP_SPOT_SIZE];
+		const int *res  = &spot_results[i * VPO_SPOT_RESULT_SIZE];
+
+		results.insert(results.end(), spot, spot + VPO_SWEEP_SPOT_SIZE);
+		results.insert(results.end(), res,  res + VPO_SPOT_RESULT_SIZE);
+	}
+
+	pending_spots -= num_spots;
+}
+
+
+void Sweep::WorkerMain(unsigned int index)
+{
+	SweepWorker* worker = workers[index].get();
+	sweep_tile_t tile;
+
+	while (true)
+	{
+		if (TakeTile(index, tile))
+		{
+			TestTile(worker, tile);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(wake_mutex);
+
+		wake.wait(lock, [&] { return stop || queued_tiles > 0; });
+
+		if (stop)
+			return;
+	}
+}
+
+} // namespace vpo
+
+
+//------------------------------------------------------------------------
+
+VPOSweep VPO_NewSweep(VPOContext ctx, int num_threads, int num_angles, const int *angles)
+{
+	vpo::Context* context = (vpo::Context*)ctx;
+
+	context->ClearError();
+
+	if (! context->level)
+	{
+		context->SetError("VPO_NewSweep called without any opened map");
+		return NULL;
+	}
+
+	if (num_angles <= 0 || ! angles)
+	{
+		context->SetError("VPO_NewSweep called without any angles");
+		return NULL;
+	}
+
+	if (num_threads <= 0)
+		num_threads = MAX(1, (int)std::thread::hardware_concurrency());
+
+	vpo::Sweep* sweep = new vpo::Sweep();
+
+	sweep->level = context->level;
+	sweep->angles.assign(angles, angles + num_angles);
+
+	for (int i = 0 ; i < num_threads ; i++)
+	{
+		vpo::SweepWorker* worker = new vpo::SweepWorker();
+
+		// copy the sector heights too, to get the same opened/closed doors
+		worker->render.reset(new vpo::RenderState());
+		worker->render->R_SetLevel(sweep->level.get(), &context->render);
+
+		sweep->workers.push_back(std::unique_ptr<vpo::SweepWorker>(worker));
+	}
+
+	for (int i = 0 ; i < num_threads ; i++)
+	{
+		sweep->workers[i]->thread = std::thread([=]() { sweep->WorkerMain(i); });
+	}
+
+	return sweep;
+}
+
+
+void VPO_DeleteSweep(VPOSweep handle)
+{
+	vpo::Sweep* sweep = (vpo::Sweep*)handle;
+
+	if (! sweep)
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(sweep->wake_mutex);
+		sweep->stop = true;
+	}
+
+	sweep->wake.notify_all();
+
+	for (auto& worker : sweep->workers)
+		worker->thread.join();
+
+	delete sweep;
+}
+
+
+void VPO_SweepAddSpots(VPOSweep handle, int num_spots, const int *spots)
+{
+	vpo::Sweep* sweep = (vpo::Sweep*)handle;
+
+	if (num_spots <= 0)
+		return;
+
+	// count them first, so results never overtake the pending count
+	sweep->pending_spots += num_spots;
+
+	int num_tiles = 0;
+
+	for (int first = 0 ; first < num_spots ; first += SWEEP_TILE_SPOTS)
+	{
+		int count = MIN(SWEEP_TILE_SPOTS, num_spots - first);
+
+		const int *src = spots + first * VPO_SWEEP_SPOT_SIZE;
+
+		vpo::SweepWorker* worker = sweep->workers[sweep->next_worker++ % sweep->workers.size()].get();
+
+		std::unique_lock<std::mutex> lock(worker->mutex);
+		worker->tiles.emplace_back(src, src + count * VPO_SWEEP_SPOT_SIZE);
+
+		num_tiles++;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(sweep->wake_mutex);
+		sweep->queued_tiles += num_tiles;
+	}
+
+	sweep->wake.notify_all();
+}
+
+
+int VPO_SweepGetResults(VPOSweep handle, int max_spots, int *results)
+{
+	vpo::Sweep* sweep = (vpo::Sweep*)handle;
+
+	std::unique_lock<std::mutex> lock(sweep->results_mutex);
+
+	int count = MIN(max_spots, (int)sweep->results.size() / VPO_SWEEP_RESULT_SIZE);
+
+	if (count <= 0)
+		return 0;
+
+	auto end = sweep->results.begin() + count * VPO_SWEEP_RESULT_SIZE;
+
+	std::copy(sweep->results.begin(), end, results);
+	sweep->results.erase(sweep->results.begin(), end);
+
+	return count;
+}
+
+
+int VPO_SweepPending(VPOSweep handle)
+{
+	vpo::Sweep* sweep = (vpo::Sweep*)handle;
+
+	return sweep->pending_spots;
+}
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
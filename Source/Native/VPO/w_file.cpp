@@ -27,11 +27,52 @@
 #include "Precomp.h"
 #include "vpo_local.h"
 
+#ifdef WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+
 namespace vpo
 {
 
 
-wad_file_t *Context::W_OpenFile(const char *path)
+//
+// W_MapFile
+//
+// Try to memory map the whole file.  Failure is not an error, the
+// stdio functions are used for reading instead.
+//
+static void W_MapFile(wad_file_t *wad)
+{
+    if (wad->length == 0)
+        return;
+
+#ifdef WIN32
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(wad->fstream));
+
+    wad->map_handle = CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (wad->map_handle == NULL)
+        return;
+
+    wad->mapping = (const byte *)MapViewOfFile(wad->map_handle, FILE_MAP_READ, 0, 0, 0);
+
+    if (wad->mapping == NULL)
+    {
+        CloseHandle(wad->map_handle);
+        wad->map_handle = NULL;
+    }
+#else
+    void *ptr = mmap(NULL, wad->length, PROT_READ, MAP_PRIVATE, fileno(wad->fstream), 0);
+
+    if (ptr != MAP_FAILED)
+        wad->mapping = (const byte *)ptr;
+#endif
+}
+
+
+wad_file_t *W_OpenFile(const char *path)
 {
     wad_file_t *result;
 
@@ -48,14 +89,36 @@ wad_file_t *Context::W_OpenFile(const char *path)
 
     result->fstream = fstream;
 
-//    result->length = M_FileLength(fstream);
+    fseek(fstream, 0, SEEK_END);
+    long length = ftell(fstream);
+
+    result->length = (length > 0) ? (size_t)length : 0;
+
+    W_MapFile(result);
 
     return result;
 }
 
 
-void Context::W_CloseFile(wad_file_t *wad)
+void W_CloseFile(wad_file_t *wad)
 {
+    // memory supplied by the caller is neither mapped nor opened
+    if (wad->fstream == NULL)
+    {
+        delete wad;
+        return;
+    }
+
+    if (wad->mapping)
+    {
+#ifdef WIN32
+        UnmapViewOfFile(wad->mapping);
+        CloseHandle(wad->map_handle);
+#else
+        munmap((void *)wad->mapping, wad->length);
+#endif
+    }
+
     fclose(wad->fstream);
 
     delete wad;
@@ -65,11 +128,25 @@ void Context::W_CloseFile(wad_file_t *wad)
 // Read data from the specified position in the file into the 
 // provided buffer.  Returns the number of bytes read.
 
-size_t Context::W_Read(wad_file_t *wad, unsigned int offset,
+size_t W_Read(wad_file_t *wad, unsigned int offset,
               void *buffer, size_t buffer_len)
 {
     size_t result;
 
+    if (wad->mapping)
+    {
+        if (offset >= wad->length)
+            return 0;
+
+        result = std::min(buffer_len, wad->length - offset);
+
+        memcpy(buffer, wad->mapping + offset, result);
+
+        return result;
+    }
+
+    std::unique_lock<std::mutex> lock(wad->read_lock);
+
     // Jump to the specified position in the file.
 
     fseek(wad->fstream, offset, SEEK_SET);
@@ -32,11 +32,23 @@
 
 typedef struct _wad_file_s
 {
-    FILE *fstream;
+    FILE *fstream = NULL;
+
+    // The whole file, when it could be memory mapped (NULL otherwise).
+    // fstream is NULL when this is memory owned by the caller.
+    const byte *mapping = NULL;
+    size_t length = 0;
+
+#ifdef WIN32
+    HANDLE map_handle = NULL;
+#endif
+
+    // A file may be shared by several threads, this serializes the
+    // fseek + fread pairs of the stdio fallback.
+    std::mutex read_lock;
 
 } wad_file_t;
 
-/*
 // Open the specified file. Returns a pointer to a new wad_file_t 
 // handle for the WAD file, or NULL if it could not be opened.
 
@@ -52,6 +64,5 @@ void W_CloseFile(wad_file_t *wad);
 
 size_t W_Read(wad_file_t *wad, unsigned int offset,
               void *buffer, size_t buffer_len);
-*/
 
 #endif /* #ifndef __W_FILE__ */
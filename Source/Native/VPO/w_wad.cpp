@@ -26,6 +26,10 @@
 #include "Precomp.h"
 #include "vpo_local.h"
 
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+
 namespace vpo
 {
 
@@ -35,7 +39,7 @@ namespace vpo
 
 // andrewj: added this to find level names
 //          returns 0 if not a level, 1 for DOOM, 2 for HEXEN format
-int Context::CheckMapHeader(filelump_t *lumps, int num_after)
+static int CheckMapHeader(filelump_t *lumps, int num_after)
 {
 	static const char *level_lumps[] =
 	{
@@ -69,42 +73,36 @@ int Context::CheckMapHeader(filelump_t *lumps, int num_after)
 }
 
 
+wad_directory_t::~wad_directory_t()
+{
+	if (file)
+		W_CloseFile(file);
+}
+
+
 //
-// W_AddFile
+// W_ReadDirectory
 //
-// All files are optional, but at least one file must be
-//  found (PWAD, if all required lumps are present).
-// Files with a .wad extension are wadlink files
-//  with multiple lumps.
-// Other files are single lumps with the base filename
-//  for the lump name.
-
-bool Context::W_AddFile (const char *filename)
+// Read the lump directory of an opened file.  The new directory takes
+// ownership of the file, which is closed if it is not a wad.
+//
+static wad_directory_t * W_ReadDirectory (wad_file_t *wad_file)
 {
 	wadinfo_t header;
 	lumpinfo_t *lump_p;
-	wad_file_t *wad_file;
 
 	int i;
 	int length;
-	int startlump;
 
 	filelump_t *fileinfo;
 	filelump_t *filerover;
 
-	// open the file and add to directory
-
-	wad_file = W_OpenFile(filename);
-
-	if (wad_file == NULL)
+	if (W_Read(wad_file, 0, &header, sizeof(header)) < sizeof(header))
 	{
-		return false;
+		W_CloseFile(wad_file);
+		return NULL;
 	}
 
-	startlump = numlumps;
-
-	W_Read(wad_file, 0, &header, sizeof(header));
-
 	if (strncmp(header.identification,"IWAD",4) != 0)
 	{
 		// Homebrew levels?
@@ -115,32 +113,41 @@ bool Context::W_AddFile (const char *filename)
 
 			W_CloseFile(wad_file);
 
-			return false;
+			return NULL;
 		}
 	}
 
 	header.numlumps = LONG(header.numlumps);
 	header.infotableofs = LONG(header.infotableofs);
 
+	if (header.numlumps < 0)
+	{
+		W_CloseFile(wad_file);
+		return NULL;
+	}
+
 	length = header.numlumps * sizeof(filelump_t);
 
 	fileinfo = new filelump_t[header.numlumps];
 
-	W_Read(wad_file, header.infotableofs, fileinfo, length);
-	numlumps += header.numlumps;
-
+	if ((int)W_Read(wad_file, header.infotableofs, fileinfo, length) < length)
+	{
+		delete[] fileinfo;
+		W_CloseFile(wad_file);
+		return NULL;
+	}
 
-	// Fill in lumpinfo
-	lumpinfo = (lumpinfo_t *)realloc(lumpinfo, numlumps * sizeof(lumpinfo_t));
+	wad_directory_t *dir = new wad_directory_t;
 
-	if (! lumpinfo)
-		I_Error ("Out of memory -- could not realloc lumpinfo");
+	dir->file = wad_file;
+	dir->lumps.resize(header.numlumps);
 
-	lump_p = &lumpinfo[startlump];
+	// Fill in lumpinfo
+	lump_p = dir->lumps.data();
 
 	filerover = fileinfo;
 
-	for (i=startlump; i < numlumps; ++i)
+	for (i=0; i < header.numlumps; ++i)
 	{
 		int map_header;
 
@@ -149,7 +156,7 @@ bool Context::W_AddFile (const char *filename)
 
 		strncpy(lump_p->name, filerover->name, 8);
 
-		map_header = CheckMapHeader(filerover, numlumps - i - 1);
+		map_header = CheckMapHeader(filerover, header.numlumps - i - 1);
 
 		lump_p->is_map_header = (map_header >= 1);
 		lump_p->is_hexen      = (map_header == 2);
@@ -160,31 +167,177 @@ bool Context::W_AddFile (const char *filename)
 
 	delete[] fileinfo;
 
-	// close the file now, we re-open it later to load the map
-	W_CloseFile(wad_file);
+	return dir;
+}
+
+
+//
+// W_StampFile
+//
+// Gets the size, modification time and identity of a file.
+// Returns false when the file cannot be found.
+//
+static bool W_StampFile (const char *filename, wad_stamp_t *stamp)
+{
+#ifdef WIN32
+	// stat() only has whole seconds here and no file identity
+	HANDLE handle = CreateFileA(filename, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	BY_HANDLE_FILE_INFORMATION info;
+
+	BOOL ok = GetFileInformationByHandle(handle, &info);
+
+	CloseHandle(handle);
+
+	if (! ok)
+		return false;
+
+	stamp->size   = ((long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	stamp->time   = ((long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	stamp->inode  = ((long long)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	stamp->device = info.dwVolumeSerialNumber;
+#else
+	struct stat info;
 
-	wad_filename = strdup(filename);
+	if (stat(filename, &info) != 0)
+		return false;
 
-	if (! wad_filename)
-		I_Error ("Out of memory -- could not strdup filename");
+#ifdef __APPLE__
+	const struct timespec& mtime = info.st_mtimespec;
+#else
+	const struct timespec& mtime = info.st_mtim;
+#endif
+
+	stamp->size   = (long long)info.st_size;
+	stamp->time   = (long long)mtime.tv_sec * 1000000000LL + mtime.tv_nsec;
+	stamp->inode  = (long long)info.st_ino;
+	stamp->device = (long long)info.st_dev;
+#endif
 
 	return true;
 }
 
 
-void Context::W_RemoveFile(void)
+//
+// W_OpenDirectory
+//
+// Returns the directory of the given wad file, reusing the one
+// already loaded by another context when the file is unchanged.
+// The file is closed again once the directory has been read.
+//
+static std::shared_ptr<wad_directory_t> W_OpenDirectory (const char *filename)
 {
-	if (wad_filename)
+	static std::mutex cache_mutex;
+	static std::map<std::string, std::weak_ptr<wad_directory_t>> cache;
+
+	wad_stamp_t stamp;
+
+	if (! W_StampFile(filename, &stamp))
+		return NULL;
+
+	std::unique_lock<std::mutex> lock(cache_mutex);
+
+	std::shared_ptr<wad_directory_t> dir = cache[filename].lock();
+
+	if (dir && dir->stamp == stamp)
 	{
-		free(wad_filename);
+		return dir;
+	}
 
-		wad_filename = NULL;
+	wad_file_t *wad_file = W_OpenFile(filename);
 
-		free(lumpinfo);
+	if (wad_file)
+		dir.reset(W_ReadDirectory(wad_file));
 
-		lumpinfo = NULL;
-		numlumps = 0;
+	// stamped again now that it has been read, in case it was
+	// being written to just before
+	if (! wad_file || ! dir || ! W_StampFile(filename, &stamp))
+	{
+		cache.erase(filename);
+		return NULL;
 	}
+
+	W_CloseFile(dir->file);
+	dir->file = NULL;
+
+	dir->filename = filename;
+	dir->stamp = stamp;
+
+	cache[filename] = dir;
+
+	// forget about files which nobody is using anymore
+	for (auto it = cache.begin(); it != cache.end(); )
+	{
+		if (it->second.expired())
+			it = cache.erase(it);
+		else
+			++it;
+	}
+
+	return dir;
+}
+
+
+//
+// W_AddFile
+//
+// andrewj: only a single file can be added now.
+// The directory and the open file are shared between all the
+// contexts which load the same wad.
+//
+bool Context::W_AddFile (const char *filename)
+{
+	wad_dir = W_OpenDirectory(filename);
+
+	if (! wad_dir)
+	{
+		return false;
+	}
+
+	lumpinfo = wad_dir->lumps.data();
+	numlumps = (int)wad_dir->lumps.size();
+
+	return true;
+}
+
+
+//
+// W_AddMemory
+//
+// Like W_AddFile, but for a wad which the caller has in memory.
+// The data is used in place and is never shared with other contexts.
+//
+bool Context::W_AddMemory (const void *data, size_t size)
+{
+	wad_file_t *wad_file = new wad_file_t;
+
+	wad_file->mapping = (const byte *)data;
+	wad_file->length  = size;
+
+	wad_dir.reset(W_ReadDirectory(wad_file));
+
+	if (! wad_dir)
+	{
+		return false;
+	}
+
+	lumpinfo = wad_dir->lumps.data();
+	numlumps = (int)wad_dir->lumps.size();
+
+	return true;
+}
+
+
+void Context::W_RemoveFile(void)
+{
+	wad_dir.reset();
+
+	lumpinfo = NULL;
+	numlumps = 0;
 }
 
 
@@ -227,12 +380,15 @@ int Context::W_CheckNumForName (const char* name)
 //
 int Context::W_LumpLength (int lumpnum)
 {
-	if (lumpnum >= numlumps)
+	if (! current_dir)
+		I_Error ("W_LumpLength: no current file (W_BeginRead not called)");
+
+	if (lumpnum >= (int)current_dir->lumps.size())
 	{
 		I_Error ("W_LumpLength: %i >= numlumps", lumpnum);
 	}
 
-	return lumpinfo[lumpnum].size;
+	return current_dir->lumps[lumpnum].size;
 }
 
 
@@ -244,16 +400,16 @@ int Context::W_LumpLength (int lumpnum)
 void Context::W_ReadLump(int lump, void *dest)
 {
 	int c;
-	lumpinfo_t *l;
+	const lumpinfo_t *l;
 
-	if (lump >= numlumps)
+	if (lump >= (int)current_dir->lumps.size())
 	{
 		I_Error ("W_ReadLump: %i >= numlumps", lump);
 	}
 
-	l = lumpinfo+lump;
+	l = &current_dir->lumps[lump];
 
-	c = W_Read(current_file, l->position, dest, l->size);
+	c = (int)W_Read(current_file, l->position, dest, l->size);
 
 	if (c < l->size)
 	{
@@ -266,19 +422,44 @@ void Context::W_ReadLump(int lump, void *dest)
 // W_LoadLump
 //
 // Load a lump into memory and return a pointer to a buffer containing
-// the lump data.
+// the lump data.  When the lump is in memory (or the wad is memory
+// mapped) this points straight at it, the loaders never modify lumps.
 //
-byte * Context::W_LoadLump(int lumpnum)
+const byte * Context::W_LoadLump(int lumpnum)
 {
 	byte *result;
 
-	if (lumpnum < 0 || lumpnum >= numlumps)
+	if (! current_dir)
+		I_Error ("W_LoadLump: no current file (W_BeginRead not called)");
+
+	if (lumpnum < 0 || lumpnum >= (int)current_dir->lumps.size())
 	{
 		I_Error ("W_LoadLump: %i >= numlumps", lumpnum);
 	}
 
+	const lumpinfo_t *l = &current_dir->lumps[lumpnum];
+
+	if (l->data)
+		return l->data;
+
+	// an empty lump given by VPO_OpenMapFromLumps has no data and
+	// no file behind it (W_FreeLump leaves this alone too)
 	if (! current_file)
-		I_Error ("W_LoadLump: no current file (W_BeginRead not called)");
+	{
+		static const byte empty_lump[1] = { 0 };
+		return empty_lump;
+	}
+
+	if (current_file->mapping)
+	{
+		if (l->position < 0 || l->size < 0 ||
+			(size_t)l->position + (size_t)l->size > current_file->length)
+		{
+			I_Error ("W_LoadLump: lump %i is past the end of the file", lumpnum);
+		}
+
+		return current_file->mapping + l->position;
+	}
 
 	// load it now
 
@@ -290,37 +471,95 @@ byte * Context::W_LoadLump(int lumpnum)
 }
 
 
-void Context::W_FreeLump(byte * data)
+void Context::W_FreeLump(const byte * data)
 {
+	// lumps which are in memory are never copied
+	if (! current_file)
+		return;
+
+	if (current_file->mapping &&
+		data >= current_file->mapping &&
+		data <= current_file->mapping + current_file->length)
+	{
+		return;
+	}
+
 	delete[] data;
 }
 
 
-void Context::W_BeginRead()
+//
+// W_BeginRead
+//
+// Opens the file of a directory for loading lumps, unless another
+// context has it open already.  Returns false when the file cannot be
+// opened, or it is not the version which the directory was read from.
+//
+bool Context::W_BeginRead(wad_directory_t *dir)
 {
 	// check API usage
-	if (! wad_filename)
+	if (! dir)
 		I_Error("W_BeginRead called without any wad file!");
 
-	if (current_file)
+	if (current_dir)
 		I_Error("W_BeginRead called twice without W_EndRead.");
 
-	current_file = W_OpenFile(wad_filename);
+	if (! dir->filename.empty())
+	{
+		std::unique_lock<std::mutex> lock(dir->file_mutex);
+
+		if (! dir->file)
+		{
+			wad_file_t *wad_file = W_OpenFile(dir->filename.c_str());
+
+			if (! wad_file)
+				return false;
 
-	// it should normally succeed, as it is unlikely the file suddenly
-	// disappears between reading the directory and loading a map.
-	if (! current_file)
-		I_Error("Could not re-open the wad file -- deleted?");
+			// stamped after opening, so a later change cannot slip
+			// in before the file is mapped
+			wad_stamp_t stamp;
+
+			if (! W_StampFile(dir->filename.c_str(), &stamp) || ! (stamp == dir->stamp))
+			{
+				W_CloseFile(wad_file);
+				return false;
+			}
+
+			dir->file = wad_file;
+		}
+
+		dir->readers++;
+	}
+
+	current_dir  = dir;
+	current_file = dir->file;
+
+	return true;
 }
 
 
+//
+// W_EndRead
+//
+// The last context to finish reading from a file closes it.
+//
 void Context::W_EndRead()
 {
-	if (! current_file)
+	if (! current_dir)
 		I_Error("W_EndRead called without a previous W_BeginRead.");
 
-	W_CloseFile(current_file);
+	if (! current_dir->filename.empty())
+	{
+		std::unique_lock<std::mutex> lock(current_dir->file_mutex);
+
+		if (--current_dir->readers == 0)
+		{
+			W_CloseFile(current_dir->file);
+			current_dir->file = NULL;
+		}
+	}
 
+	current_dir  = NULL;
 	current_file = NULL;
 }
 
@@ -51,6 +51,58 @@ struct lumpinfo_s
 
 	bool  is_map_header;  // e.g. MAP01 or E1M1 
 	bool  is_hexen;
+
+	// contents of a lump supplied in memory (NULL when in the file)
+	const byte *data;
+};
+
+//
+// What identifies one version of a file on disk: a rewrite changes the
+// time (or the size), a replacement changes the inode too.  The time
+// is in nanoseconds, or whatever finer unit the platform has.
+//
+struct wad_stamp_t
+{
+	long long  size   = 0;
+	long long  time   = 0;
+	long long  inode  = 0;
+	long long  device = 0;
+
+	bool operator== (const wad_stamp_t& other) const
+	{
+		return size == other.size && time == other.time &&
+		       inode == other.inode && device == other.device;
+	}
+};
+
+//
+// The directory of a wad file.  This is shared by every Context which
+// loads the same file, and the lumps are never modified once they have
+// been read.
+//
+// The file itself is only open while maps are being loaded from it
+// (between W_BeginRead and W_EndRead), the loaded maps do not need it,
+// so it is not kept open (and locked, on Windows) while they are used.
+//
+// A directory without a filename holds lumps supplied in memory, any
+// file it has is the caller's memory and stays open.
+//
+struct wad_directory_t
+{
+	std::string  filename;
+
+	// the version of the file which the lumps were read from
+	wad_stamp_t  stamp;
+
+	// guards 'file' and 'readers'
+	std::mutex  file_mutex;
+
+	wad_file_t *file = NULL;
+	int  readers = 0;
+
+	std::vector<lumpinfo_t> lumps;
+
+	~wad_directory_t();
 };
 
 /*
@@ -17,8 +17,6 @@
 #region ================== Namespaces
 
 using System;
-using System.Globalization;
-using System.IO;
 using CodeImp.DoomBuilder.Plugins.VisplaneExplorer.Properties;
 using CodeImp.DoomBuilder.Windows;
 
@@ -138,23 +136,6 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 			foreach(Palette p in palettes) p.SetColor(Tile.POINT_VOID_B, General.Colors.Background.WithAlpha(0).ToInt());
 		}
 
-		// This returns a unique temp filename
-		public static string MakeTempFilename(string extension)
-		{
-			string filename;
-
-			do
-			{
-				//mxd. Generate a filename
-				filename = Path.Combine(General.TempPath, MurmurHash2.Hash(DateTime.Now.Ticks.ToString(CultureInfo.InvariantCulture)) + extension);
-			}
-			// Continue while file is not unique
-			while(File.Exists(filename) || Directory.Exists(filename));
-
-			// Return the filename
-			return filename;
-		}
-
 		#endregion
 	}
 }
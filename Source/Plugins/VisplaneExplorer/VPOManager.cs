@@ -17,7 +17,10 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 		#region ================== Constants
 
 		public const int POINTS_PER_ITERATION = 100;
-		private const int EXPECTED_RESULTS_BUFFER = 200000;
+
+		// Must match VPO_SWEEP_SPOT_SIZE and VPO_SWEEP_RESULT_SIZE in vpo_api.h
+		private const int SWEEP_SPOT_SIZE = 4;
+		private const int SWEEP_RESULT_SIZE = 9;
 
 		private readonly int[] TEST_ANGLES = new[] { 0, 90, 180, 270, 45, 135, 225, 315 /*, 22, 67, 112, 157, 202, 247, 292, 337 */ };
 		
@@ -34,14 +37,11 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
 		private static extern string VPO_GetError(IntPtr handle);
 
-		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
-		private static extern int VPO_LoadWAD(IntPtr handle, string filename);
-
-		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
-		private static extern int VPO_OpenMap(IntPtr handle, string mapname, ref bool isHexen);
-
 		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
-		private static extern void VPO_FreeWAD(IntPtr handle);
+		private static extern int VPO_OpenMapFromLumps(IntPtr handle, [MarshalAs(UnmanagedType.I1)] bool isHexen,
+			byte[] linedefs, int linedefslen, byte[] sidedefs, int sidedefslen, byte[] vertexes, int vertexeslen,
+			byte[] segs, int segslen, byte[] ssectors, int ssectorslen, byte[] nodes, int nodeslen,
+			byte[] sectors, int sectorslen);
 
 		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
 		private static extern void VPO_CloseMap(IntPtr handle);
@@ -50,23 +50,30 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 		private static extern void VPO_OpenDoorSectors(IntPtr handle, int dir);
 
 		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
-		private static extern int VPO_TestSpot(IntPtr handle, int x, int y, int dz, int angle, ref int visplanes, ref int drawsegs, ref int openings, ref int solidsegs);
+		private static extern IntPtr VPO_NewSweep(IntPtr handle, int numthreads, int numangles, int[] angles);
+
+		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+		private static extern void VPO_DeleteSweep(IntPtr sweep);
+
+		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+		private static extern void VPO_SweepAddSpots(IntPtr sweep, int numspots, int[] spots);
+
+		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+		private static extern int VPO_SweepGetResults(IntPtr sweep, int maxspots, int[] results);
+
+		[DllImport("BuilderNative", CallingConvention = CallingConvention.Cdecl)]
+		private static extern int VPO_SweepPending(IntPtr sweep);
 
 		#endregion
 
 		#region ================== Variables
 
-		// Main objects
-		private List<Thread> threads = new List<Thread>();
-
-		// Map to load
-		private string filename;
-		private string mapname;
+		// Native objects (the map is loaded once and shared by all sweep threads)
+		private IntPtr context;
+		private IntPtr sweep;
 
-		// Input and output queue and stop flag (all require a lock on 'points' !)
-		private readonly Queue<TilePoint> points = new Queue<TilePoint>(EXPECTED_RESULTS_BUFFER);
-		private readonly Queue<PointData> results = new Queue<PointData>(EXPECTED_RESULTS_BUFFER);
-		private bool stopflag;
+		// Buffer for fetching results from the sweep
+		private readonly int[] resultsbuffer = new int[POINTS_PER_ITERATION * SWEEP_RESULT_SIZE];
 		
 		#endregion
 
@@ -92,145 +99,118 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 		
 		#endregion
 
-		#region ================== Processing
-
-		// The thread!
-		private void ProcessingThread()
-		{
-			IntPtr context = VPO_NewContext();
-
-			// Load the map
-			bool isHexen = General.Map.HEXEN;
-			if(VPO_LoadWAD(context, filename) != 0) throw new Exception("VPO is unable to read this file:" + (VPO_GetError(context) ?? "<unknown error>"));
-			if(VPO_OpenMap(context, mapname, ref isHexen) != 0) throw new Exception("VPO is unable to open this map:" + (VPO_GetError(context) ?? "<unknown error>"));
-			VPO_OpenDoorSectors(context, BuilderPlug.InterfaceForm.OpenDoors ? 1 : -1); //mxd
-
-			// Processing
-			Queue<TilePoint> todo = new Queue<TilePoint>(POINTS_PER_ITERATION);
-			Queue<PointData> done = new Queue<PointData>(POINTS_PER_ITERATION);
-			while(true)
-			{
-				lock(points)
-				{
-					// Wait for work
-					if (points.Count == 0 && !stopflag)
-						Monitor.Wait(points);
-
-					// Flush done points to the results
-					int numdone = done.Count;
-					for(int i = 0; i < numdone; i++)
-						results.Enqueue(done.Dequeue());
-
-					if (stopflag)
-						break;
-
-					// Get points from the waiting queue into my todo queue for processing
-					int numtodo = Math.Min(POINTS_PER_ITERATION, points.Count);
-					for(int i = 0; i < numtodo; i++)
-						todo.Enqueue(points.Dequeue());
-				}
-					
-				// Process the points
-				while(todo.Count > 0)
-				{
-					TilePoint p = todo.Dequeue();
-					PointData pd = new PointData();
-					pd.point = p;
-
-					for(int i = 0; i < TEST_ANGLES.Length; i++)
-					{
-						pd.result = (PointResult)VPO_TestSpot(context, p.x, p.y, BuilderPlug.InterfaceForm.ViewHeight, TEST_ANGLES[i],
-							ref pd.visplanes, ref pd.drawsegs, ref pd.openings, ref pd.solidsegs);
-					}
-
-					done.Enqueue(pd);
-				}
-			}
-
-			VPO_CloseMap(context);
-			VPO_FreeWAD(context);
-			VPO_DeleteContext(context);
-		}
-
-		#endregion
-
 		#region ================== Public Methods
 
-		// This loads a map
-		public void Start(string filename, string mapname)
+		// This loads a map from its lumps (keyed by lump name, a missing lump is passed as empty)
+		public void Start(Dictionary<string, byte[]> lumps)
 		{
 			Stop();
 
-			this.filename = filename;
-			this.mapname = mapname;
+			context = VPO_NewContext();
+
+			// Load the map
+			byte[] linedefs = GetLump(lumps, "LINEDEFS");
+			byte[] sidedefs = GetLump(lumps, "SIDEDEFS");
+			byte[] vertexes = GetLump(lumps, "VERTEXES");
+			byte[] segs = GetLump(lumps, "SEGS");
+			byte[] ssectors = GetLump(lumps, "SSECTORS");
+			byte[] nodes = GetLump(lumps, "NODES");
+			byte[] sectors = GetLump(lumps, "SECTORS");
+			if(VPO_OpenMapFromLumps(context, General.Map.HEXEN, linedefs, linedefs.Length, sidedefs, sidedefs.Length,
+				vertexes, vertexes.Length, segs, segs.Length, ssectors, ssectors.Length, nodes, nodes.Length,
+				sectors, sectors.Length) != 0)
+				throw new Exception("VPO is unable to open this map:" + (VPO_GetError(context) ?? "<unknown error>"));
+			VPO_OpenDoorSectors(context, BuilderPlug.InterfaceForm.OpenDoors ? 1 : -1); //mxd
 
 			// Start a thread on each core
-			for(int i = 0; i < NumThreads; i++)
-			{
-				var thread = new Thread(ProcessingThread);
-				thread.Name = "Visplane Explorer " + i;
-				thread.Start();
-				threads.Add(thread);
-			}
+			sweep = VPO_NewSweep(context, NumThreads, TEST_ANGLES.Length, TEST_ANGLES);
+			if(sweep == IntPtr.Zero) throw new Exception("VPO is unable to start processing:" + (VPO_GetError(context) ?? "<unknown error>"));
 		}
 
 		// This frees the map
 		public void Stop()
 		{
-			lock (points)
+			if(sweep != IntPtr.Zero)
 			{
-				stopflag = true;
-				Monitor.PulseAll(points);
+				VPO_DeleteSweep(sweep);
+				sweep = IntPtr.Zero;
 			}
 
-			foreach (Thread thread in threads)
+			if(context != IntPtr.Zero)
 			{
-				thread.Join();
-			}
-			threads.Clear();
-
-			lock (points)
-			{
-				results.Clear();
-				points.Clear();
-				stopflag = false;
+				VPO_CloseMap(context);
+				VPO_DeleteContext(context);
+				context = IntPtr.Zero;
 			}
 		}
 
 		// This gives points to process and returns the total points left in the buffer
 		public int EnqueuePoints(IEnumerable<TilePoint> newpoints)
 		{
-			lock(points)
+			if(sweep == IntPtr.Zero) return 0;
+
+			List<int> spots = new List<int>();
+			int viewheight = BuilderPlug.InterfaceForm.ViewHeight;
+			int numspots = 0;
+			foreach(TilePoint p in newpoints)
 			{
-				foreach(TilePoint p in newpoints)
-					points.Enqueue(p);
-				Monitor.PulseAll(points);
-				return points.Count;
+				spots.Add(p.x);
+				spots.Add(p.y);
+				spots.Add(viewheight);
+				spots.Add(p.granularity);
+				numspots++;
 			}
+
+			VPO_SweepAddSpots(sweep, numspots, spots.ToArray());
+			return VPO_SweepPending(sweep);
 		}
 
 		// This fetches results (in 'data') and returns the number of points
 		// remaining to be processed.
 		public int DequeueResults(List<PointData> data)
 		{
-			lock(points)
+			if(sweep == IntPtr.Zero) return 0;
+
+			while(true)
 			{
-				int numresults = results.Count;
-				if(data.Capacity - data.Count < numresults)
-					data.Capacity = data.Count + numresults;
+				int numresults = VPO_SweepGetResults(sweep, POINTS_PER_ITERATION, resultsbuffer);
+				if(numresults == 0) break;
+
 				for(int i = 0; i < numresults; i++)
-					data.Add(results.Dequeue());
-				return points.Count;
+				{
+					int r = i * SWEEP_RESULT_SIZE;
+					PointData pd = new PointData();
+					pd.point.x = resultsbuffer[r];
+					pd.point.y = resultsbuffer[r + 1];
+					pd.point.granularity = (byte)resultsbuffer[r + 3];
+					pd.result = (PointResult)resultsbuffer[r + SWEEP_SPOT_SIZE];
+					pd.visplanes = resultsbuffer[r + SWEEP_SPOT_SIZE + 1];
+					pd.drawsegs = resultsbuffer[r + SWEEP_SPOT_SIZE + 2];
+					pd.openings = resultsbuffer[r + SWEEP_SPOT_SIZE + 3];
+					pd.solidsegs = resultsbuffer[r + SWEEP_SPOT_SIZE + 4];
+					data.Add(pd);
+				}
 			}
+
+			return VPO_SweepPending(sweep);
 		}
 
 		// This returns the number of points left in the buffer
 		public int GetRemainingPoints()
 		{
-			lock(points)
-			{
-				return points.Count;
-			}
+			if(sweep == IntPtr.Zero) return 0;
+			return VPO_SweepPending(sweep);
+		}
+
+		#endregion
+
+		#region ================== Private Methods
+
+		// This returns the lump with the given name, or an empty one when it doesn't exist
+		private static byte[] GetLump(Dictionary<string, byte[]> lumps, string name)
+		{
+			byte[] data;
+			return lumps.TryGetValue(name, out data) ? data : new byte[0];
 		}
 
 		#endregion
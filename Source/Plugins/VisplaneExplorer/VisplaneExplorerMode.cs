@@ -40,8 +40,8 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 		private Bitmap canvas;
 		private ViewStats lastviewstats;
 		
-		// Temporary WAD file written for the vpo.dll library
-		private string tempfile;
+		// Lumps of the map with freshly built nodes, as loaded by the VPO library
+		private Dictionary<string, byte[]> maplumps;
 
 		// Rectangle around the map
 		private Rectangle mapbounds;
@@ -70,11 +70,7 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 				processingenabled = false;
 			}
 			
-			if(!string.IsNullOrEmpty(tempfile))
-			{
-				File.Delete(tempfile);
-				tempfile = null;
-			}
+			maplumps = null;
 
 			if(image != null)
 			{
@@ -230,47 +226,47 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 		}
 
 		/// <summary>
-		/// Checks if the given map is valid for the Visplane Explorer Mode. Specifically it may not have
-		/// ZDBSP nodes. See https://github.com/jewalky/UltimateDoomBuilder/issues/736
+		/// Copies the lumps which the VPO library needs from the map's temporary file, after the nodes were built.
 		/// </summary>
-		/// <param name="file">Full path and file name of the WAD to check. Only the first map is checked</param>
-		/// <returns>true if the check was successful, false if there was a problem. Also returns a message in case something is wrong</returns>
-		private (bool, string) CheckMapValidity(string file)
+		/// <returns>The lumps by name. Lumps which don't exist are left out</returns>
+		private static Dictionary<string, byte[]> GetMapLumps()
 		{
-			WAD wad = new WAD(file, true);
+			Dictionary<string, byte[]> lumps = new Dictionary<string, byte[]>();
 
-			try
+			foreach(string name in new[] { "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS", "NODES", "SECTORS" })
 			{
-				Lump nodes = wad.FindLump("NODES");
-				if (nodes == null)
-					throw new Exception("NODES lump not found");
-
-				Stream stream = nodes.GetSafeStream();
-				if (stream.Length == 0)
-					throw new Exception("NODES lump is empty");
-
-				using (BinaryReader reader = new BinaryReader(stream))
+				using(MemoryStream stream = General.Map.GetLumpData(name))
 				{
-					List<byte[]> formats = new List<byte[]> { Encoding.ASCII.GetBytes("ZNOD"), Encoding.ASCII.GetBytes("XNOD") };
-
-					byte[] format = reader.ReadBytes(4);
-
-					if(formats.Any(f => f.SequenceEqual(format)))
-						throw new Exception("ZDBSP nodes detected. This format is not supporeted by the Visplane Explorer Mode");
+					if(stream != null) lumps[name] = stream.ToArray();
 				}
 			}
-			catch(Exception e)
-			{
-				return (false, e.Message);
-			}
-			finally
+
+			return lumps;
+		}
+
+		/// <summary>
+		/// Checks if the given map is valid for the Visplane Explorer Mode. Specifically it must have nodes, either
+		/// in the NODES lump (vanilla or XNOD/ZNOD) or as ZDoom GL nodes in the SSECTORS lump (with NODES left empty).
+		/// See https://github.com/jewalky/UltimateDoomBuilder/issues/736
+		/// </summary>
+		/// <param name="lumps">The map lumps, as returned by GetMapLumps</param>
+		/// <returns>true if the check was successful, false if there was a problem. Also returns a message in case something is wrong</returns>
+		private static (bool, string) CheckMapValidity(Dictionary<string, byte[]> lumps)
+		{
+			byte[] nodes;
+			if(lumps.TryGetValue("NODES", out nodes) && nodes.Length > 0)
+				return (true, string.Empty);
+
+			byte[] ssectors;
+			if(lumps.TryGetValue("SSECTORS", out ssectors) && ssectors.Length >= 4)
 			{
-				// Get rid of the WAD ASAP. If something failed and we don't do this the WAD can't be deleted by the
-				// cleanup method
-				wad.Dispose();
+				string signature = Encoding.ASCII.GetString(ssectors, 0, 4);
+				if(signature == "XGLN" || signature == "XGL2" || signature == "XGL3" ||
+				   signature == "ZGLN" || signature == "ZGL2" || signature == "ZGL3")
+					return (true, string.Empty);
 			}
 
-			return (true, string.Empty);
+			return (false, (nodes == null) ? "NODES lump not found" : "NODES lump is empty");
 		}
 
 		#endregion
@@ -292,18 +288,18 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 			BuilderPlug.InterfaceForm.OnVisplaneSettingsChanged += OnVisplaneSettingsChanged; //mxd
 			lastviewstats = BuilderPlug.InterfaceForm.ViewStats;
 
-			// Export the current map to a temporary WAD file
-			tempfile = BuilderPlug.MakeTempFilename(".wad");
-			if(!General.Map.ExportToFile(tempfile))
+			// Build the nodes in the map's temporary file and take the lumps from there
+			if(!General.Map.RebuildNodes(General.Map.ConfigSettings.NodebuilderTest, true))
 			{
-				//mxd. Abort on export fail
+				//mxd. Abort when the map or its nodes could not be built
 				Cursor.Current = Cursors.Default;
 				General.Interface.DisplayStatus(StatusType.Warning, "Unable to set test environment...");
 				OnCancel();
 				return;
 			}
 
-			(bool mapvalid, string message) = CheckMapValidity(tempfile);
+			maplumps = GetMapLumps();
+			(bool mapvalid, string message) = CheckMapValidity(maplumps);
 			if(!mapvalid)
 			{
 				MessageBox.Show($"Error: {message}.", "Error", MessageBoxButtons.OK, MessageBoxIcon.Error);
@@ -312,7 +308,7 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 			}
 
 			// Load the map in VPO_DLL
-			BuilderPlug.VPO.Start(tempfile, General.Map.Options.LevelName);
+			BuilderPlug.VPO.Start(maplumps);
 
 			// Determine map boundary
 			mapbounds = Rectangle.Round(MapSet.CreateArea(General.Map.Map.Vertices));
@@ -542,7 +538,7 @@ namespace CodeImp.DoomBuilder.Plugins.VisplaneExplorer
 			BuilderPlug.VPO.Stop();
 			tiles.Clear();
 			CreateTiles();
-			BuilderPlug.VPO.Start(tempfile, General.Map.Options.LevelName);
+			BuilderPlug.VPO.Start(maplumps);
 			General.Interface.RedrawDisplay();
 		}
 